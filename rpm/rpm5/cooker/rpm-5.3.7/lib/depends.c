@@ -13,8 +13,9 @@
 #include <ugid.h>		/* XXX user()/group() probes */
 
 #include <rpmtag.h>
-#define	_RPMDB_INTERNAL		/* XXX response cache needs dbiOpen et al. */
+#define	_RPMDB_INTERNAL		/* XXX response cache needs db->db_depcache */
 #include <rpmdb.h>
+#include "depcache.h"
 
 #define	_RPMEVR_INTERNAL
 #include <rpmds.h>
@@ -845,8 +846,30 @@ void rpmnsClean(void)
     sysinfo_path = _free(sysinfo_path);
 }
 
+#if defined(CACHE_DEPENDENCY_RESULT)
+/**
+ * Is an rpmdb instance being removed by a transaction set?
+ * @param ts		transaction set
+ * @param instance	rpmdb header instance
+ * @return		1 if removed, 0 if not
+ */
+static int isRemovedInstance(rpmts ts, uint32_t instance)
+	/*@*/
+{
+    return (ts->numRemovedPackages > 0 && ts->removedPackages != NULL
+	&& bsearch(&instance, ts->removedPackages, ts->numRemovedPackages,
+			sizeof(*ts->removedPackages), uintcmp) != NULL);
+}
+#endif
+
 /**
  * Check dep for an unsatisfied dependency.
+ *
+ * Results from the rpmdb are memoized (in db->db_depcache) by dependency
+ * (N, Flags, EVR). A cached provider is used only if it is not being
+ * removed, and a cached failure is saved only if nothing was removed.
+ * The cached results for a name are discarded by rpmdbAdd/rpmdbRemove.
+ *
  * @param ts		transaction set
  * @param dep		dependency
  * @param adding	dependency is from added package set?
@@ -858,15 +881,15 @@ static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
 	/*@modifies ts, dep, _cacheDependsRC, rpmGlobalMacroContext,
 		sysinfo_path, fileSystem, internalState @*/
 {
-    DBT * key = alloca(sizeof(*key));
-    DBT * data = alloca(sizeof(*data));
     rpmmi mi;
     nsType NSType;
     const char * Name;
     rpmuint32_t Flags;
     Header h;
 #if defined(CACHE_DEPENDENCY_RESULT)
-    int _cacheThisRC = 1;
+    depCache dc = NULL;
+    rpmop op = NULL;
+    uint32_t instance = 0;
 #endif
     int rc;
     int xx;
@@ -877,54 +900,6 @@ static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
     Flags = rpmdsFlags(dep);
     NSType = rpmdsNSType(dep);
 
-#if defined(CACHE_DEPENDENCY_RESULT)
-    /*
-     * Check if dbiOpen/dbiPut failed (e.g. permissions), we can't cache.
-     */
-    if (_cacheDependsRC) {
-	dbiIndex dbi;
-	dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPENDS, 0);
-	if (dbi == NULL)
-	    _cacheDependsRC = 0;
-	else {
-	    const char * DNEVR;
-
-	    rc = -1;
-	    if ((DNEVR = rpmdsDNEVR(dep)) != NULL) {
-		DBC * dbcursor = NULL;
-		void * datap = NULL;
-		size_t datalen = 0;
-		size_t DNEVRlen = strlen(DNEVR);
-
-		xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, 0);
-
-		memset(key, 0, sizeof(*key));
-/*@i@*/		key->data = (void *) DNEVR;
-		key->size = DNEVRlen;
-		memset(data, 0, sizeof(*data));
-		data->data = datap;
-		data->size = datalen;
-/*@-nullstate@*/ /* FIX: data->data may be NULL */
-		xx = dbiGet(dbi, dbcursor, key, data, DB_SET);
-/*@=nullstate@*/
-		DNEVR = key->data;
-		DNEVRlen = key->size;
-		datap = data->data;
-		datalen = data->size;
-
-		if (xx == 0 && datap && datalen == 4)
-		    memcpy(&rc, datap, datalen);
-		xx = dbiCclose(dbi, dbcursor, 0);
-	    }
-
-	    if (rc >= 0) {
-		rpmdsNotify(dep, _("(cached)"), rc);
-		return rpmdsNegateRC(dep, rc);
-	    }
-	}
-    }
-#endif
-
 retry:
     rc = 0;	/* assume dependency is satisfied */
 
@@ -1412,17 +1387,8 @@ retry:
     }
 
     /* Search added packages for the dependency. */
-    if (rpmalSatisfiesDepend(ts->addedPackages, dep, NULL) != NULL) {
-#if defined(CACHE_DEPENDENCY_RESULT)
-	/*
-	 * XXX Ick, context sensitive answers from dependency cache.
-	 * XXX Always resolve added dependencies within context to disambiguate.
-	 */
-	if (_rpmds_nopromote)
-	    _cacheThisRC = 0;
-#endif
+    if (rpmalSatisfiesDepend(ts->addedPackages, dep, NULL) != NULL)
 	goto exit;
-    }
 
     /* XXX only the installer does not have the database open here. */
     if (rpmtsGetRdb(ts) != NULL) {
@@ -1431,6 +1397,34 @@ retry:
 	    rpmdsNotify(dep, _("(root files)"), rc);
 	    goto exit;
 	}
+
+#if defined(CACHE_DEPENDENCY_RESULT)
+	if (_cacheDependsRC) {
+	    rpmdb db = rpmtsGetRdb(ts);
+	    if (db->db_depcache == NULL)
+		db->db_depcache = depCacheCreate(0);
+	    dc = db->db_depcache;
+	    if (depCacheGet(dc, Name, rpmdsEVR(dep), (Flags & RPMSENSE_SENSEMASK),
+			&rc, &instance)
+	     && !(rc == 0 && isRemovedInstance(ts, instance)))
+	    {
+		op = rpmtsOp(ts, RPMTS_OP_DEPHIT);
+		(void) rpmswEnter(op, 0);
+		(void) rpmswExit(op, 0);
+		dc = NULL;
+		if (rc == 0) {
+		    rpmdsNotify(dep, _("(cached)"), rc);
+		    goto exit;
+		}
+		rc = 0;
+		goto notindb;
+	    }
+	    rc = 0;
+	    op = rpmtsOp(ts, RPMTS_OP_DEPMISS);
+	    (void) rpmswEnter(op, 0);
+	}
+#endif
+
 	if (Name[0] == '/') {
 	    /* depFlags better be 0! */
 
@@ -1438,6 +1432,9 @@ retry:
 	    (void) rpmmiPrune(mi,
 			ts->removedPackages, ts->numRemovedPackages, 1);
 	    while ((h = rpmmiNext(mi)) != NULL) {
+#if defined(CACHE_DEPENDENCY_RESULT)
+		instance = rpmmiInstance(mi);
+#endif
 		rpmdsNotify(dep, _("(db files)"), rc);
 		mi = rpmmiFree(mi);
 		goto exit;
@@ -1450,14 +1447,31 @@ retry:
 			ts->removedPackages, ts->numRemovedPackages, 1);
 	while ((h = rpmmiNext(mi)) != NULL) {
 	    if (rpmdsAnyMatchesDep(h, dep, _rpmds_nopromote)) {
+#if defined(CACHE_DEPENDENCY_RESULT)
+		instance = rpmmiInstance(mi);
+#endif
 		rpmdsNotify(dep, _("(db provides)"), rc);
 		mi = rpmmiFree(mi);
 		goto exit;
 	    }
 	}
 	mi = rpmmiFree(mi);
+
+#if defined(CACHE_DEPENDENCY_RESULT)
+	/* XXX a removed package may have been the (only) provider. */
+	if (dc != NULL) {
+	    if (ts->numRemovedPackages == 0)
+		depCachePut(dc, Name, rpmdsEVR(dep),
+			(Flags & RPMSENSE_SENSEMASK), 1, 0);
+	    (void) rpmswExit(op, 0);
+	    dc = NULL;
+	}
+#endif
     }
 
+#if defined(CACHE_DEPENDENCY_RESULT)
+notindb:
+#endif
     /*
      * Search for an unsatisfied dependency.
      */
@@ -1477,9 +1491,6 @@ retry:
 unsatisfied:
     if (Flags & RPMSENSE_MISSINGOK) {
 	rc = 0;	/* dependency is unsatisfied, but just a hint. */
-#if defined(CACHE_DEPENDENCY_RESULT)
-	_cacheThisRC = 0;
-#endif
 	rpmdsNotify(dep, _("(hint skipped)"), rc);
     } else {
 	rc = 1;	/* dependency is unsatisfied */
@@ -1487,39 +1498,12 @@ unsatisfied:
     }
 
 exit:
-    /*
-     * If dbiOpen/dbiPut fails (e.g. permissions), we can't cache.
-     */
 #if defined(CACHE_DEPENDENCY_RESULT)
-    if (_cacheDependsRC && _cacheThisRC) {
-	dbiIndex dbi;
-	dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPENDS, 0);
-	if (dbi == NULL) {
-	    _cacheDependsRC = 0;
-	} else {
-	    const char * DNEVR;
-	    xx = 0;
-	    if ((DNEVR = rpmdsDNEVR(dep)) != NULL) {
-		DBC * dbcursor = NULL;
-		size_t DNEVRlen = strlen(DNEVR);
-
-		xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, DB_WRITECURSOR);
-
-		memset(key, 0, sizeof(*key));
-/*@i@*/		key->data = (void *) DNEVR;
-		key->size = DNEVRlen;
-		memset(data, 0, sizeof(*data));
-		data->data = &rc;
-		data->size = sizeof(rc);
-
-		/*@-compmempass@*/
-		xx = dbiPut(dbi, dbcursor, key, data, 0);
-		/*@=compmempass@*/
-		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
-	    }
-	    if (xx)
-		_cacheDependsRC = 0;
-	}
+    /* Save the provider found in the rpmdb. */
+    if (dc != NULL) {
+	depCachePut(dc, Name, rpmdsEVR(dep), (Flags & RPMSENSE_SENSEMASK),
+		rc, instance);
+	(void) rpmswExit(op, 0);
     }
 #endif
 
@@ -2028,10 +2012,6 @@ exit:
 
     if (closeatexit)
 	xx = rpmtsCloseDB(ts);
-#if defined(CACHE_DEPENDENCY_RESULT)
-    else if (_cacheDependsRC)
-	xx = rpmdbCloseDBI(rpmtsGetRdb(ts), RPMDBI_DEPENDS);
-#endif
 
 #ifdef	NOTYET
      /* On failed dependencies, perform the autorollback goal (if any). */
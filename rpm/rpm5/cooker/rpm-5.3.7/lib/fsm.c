@@ -9,6 +9,9 @@
 #include <rpmcb.h>		/* XXX fnpyKey */
 #include "rpmsq.h"
 #include <rpmsx.h>
+#include <rpmmacro.h>
+#include <argv.h>
+#include <yarn.h>
 #if defined(SUPPORT_AR_PAYLOADS)
 #include "ar.h"
 #endif
@@ -56,8 +59,20 @@ int _fsm_debug = _FSM_DEBUG;
 /*@-exportheadervar@*/
 /*@unchecked@*/
 int _fsm_threads = 0;
+
+/*@unchecked@*/
+int _fsm_writers = 0;
 /*@=exportheadervar@*/
 
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmtpool _fsmTPool;
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmtpool _fsmWPool;
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmtpool _fsmSPool;
+
 /**
  * Retrieve transaction set from file state machine iterator.
  * @param fsm		file state machine
@@ -415,7 +430,6 @@ const char * dnlNextIterator(/*@null@*/ DNLI_t dnli)
     return dn;
 }
 
-#if defined(WITH_PTHREADS)
 static void * fsmThread(void * arg)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies arg, fileSystem, internalState @*/
@@ -425,17 +439,14 @@ static void * fsmThread(void * arg)
     return ((void *) ((long)fsmStage(fsm, fsm->nstage)));
 /*@=unqualifiedtrans@*/
 }
-#endif
 
 int fsmNext(IOSM_t fsm, iosmFileStage nstage)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies fsm, fileSystem, internalState @*/
 {
     fsm->nstage = nstage;
-#if defined(WITH_PTHREADS)
-    if (fsm->multithreaded)
-	return rpmsqJoin( rpmsqThread(fsmThread, fsm) );
-#endif
+    if (fsm->multithreaded && fsm->tpool != NULL)
+	return (int)(long) rpmtpoolCall(fsm->tpool, fsmThread, fsm);
     return fsmStage(fsm, fsm->nstage);
 }
 
@@ -558,6 +569,7 @@ IOSM_t freeFSM(IOSM_t fsm)
 	fsm->dnlx = _free(fsm->dnlx);
 	fsm->ldn = _free(fsm->ldn);
 	fsm->iter = mapFreeIterator(fsm->iter);
+	(void) fsmSyncWait(fsm, NULL);
     }
     return _free(fsm);
 }
@@ -616,6 +628,609 @@ static int arSetup(IOSM_t fsm, rpmfi fi)
 }
 #endif
 
+/** \ingroup payload
+ * Verify digest of a file just written.
+ * @param fsm		file state machine data
+ * @return		0 on success
+ */
+static int fsmCheckDigest(/*@special@*/ IOSM_t fsm)
+	/*@uses fsm->fdigest, fsm->digest, fsm->wfd @*/
+	/*@globals internalState @*/
+	/*@modifies fsm, internalState @*/
+{
+    void * digest = NULL;
+    int asAscii = (fsm->digest == NULL ? 1 : 0);
+    int rc = 0;
+
+    (void) Fflush(fsm->wfd);
+    fdFiniDigest(fsm->wfd, fsm->fdigestalgo, &digest, NULL, asAscii);
+
+    if (digest == NULL)
+	return IOSMERR_DIGEST_MISMATCH;
+
+    if (fsm->digest != NULL) {
+	if (memcmp(digest, fsm->digest, fsm->digestlen))
+	    rc = IOSMERR_DIGEST_MISMATCH;
+    } else {
+	if (strcmp(digest, fsm->fdigest))
+	    rc = IOSMERR_DIGEST_MISMATCH;
+    }
+    digest = _free(digest);
+    return rc;
+}
+
+/**
+ * A regular file, read from the payload, queued for a writer thread.
+ */
+typedef struct fsmWrite_s * fsmWrite;
+struct fsmWrite_s {
+/*@null@*/
+    fsmWrite next;		/*!< next file (in payload order) */
+/*@only@*/
+    IOSM_t fsm;			/*!< file state (a copy) */
+/*@only@*/
+    char * b;			/*!< file contents */
+    size_t nb;			/*!< no. of bytes */
+    size_t charge;		/*!< no. of bytes charged to memory budget */
+    int rc;			/*!< writer return code */
+    yarnLock done;		/*!< 1 when written */
+    struct rpmop_s op;		/*!< writer time */
+};
+
+/**
+ * Regular files queued for writer threads.
+ */
+struct fsmWriters_s {
+/*@dependent@*/
+    rpmtpool tp;		/*!< writer threads */
+/*@null@*/
+    fsmWrite head;		/*!< queued files */
+/*@dependent@*/
+    fsmWrite * tail;		/*!< end of queue */
+    size_t nb;			/*!< no. of bytes queued */
+    size_t max;			/*!< max. no. of bytes queued */
+    struct rpmop_s op_read;	/*!< reading file contents */
+    struct rpmop_s op_write;	/*!< writing files (all writers) */
+    struct rpmop_s op_wait;	/*!< waiting for writers */
+};
+
+/**
+ * Write a regular file on a writer thread.
+ *
+ * Only the (copied) file state is used, so this is the same as
+ * extractRegular() w/o reading the payload.
+ * @param _w		queued file
+ */
+static void fsmWriteThread(void * _w)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies _w, fileSystem, internalState @*/
+{
+    fsmWrite w = _w;
+    IOSM_t fsm = w->fsm;
+    size_t left = w->nb;
+    int rc;
+    int xx;
+
+    xx = rpmswEnter(&w->op, 0);
+
+    rc = fsmNext(fsm, IOSM_WOPEN);
+    if (rc)
+	goto exit;
+
+    if (w->nb > 0 && (fsm->fdigest != NULL || fsm->digest != NULL))
+	fdInitDigest(fsm->wfd, fsm->fdigestalgo, 0);
+
+    fsm->wrbuf = w->b;
+    while (left) {
+	fsm->rdnb = (left > fsm->wrsize ? fsm->wrsize : left);
+	rc = fsmNext(fsm, IOSM_WRITE);
+	if (rc)
+	    goto exit;
+	fsm->wrbuf += fsm->wrnb;
+	left -= fsm->wrnb;
+    }
+
+    if (fsm->sync == NULL)
+	xx = fsync(Fileno(fsm->wfd));
+
+    if (w->nb > 0 && (fsm->fdigest || fsm->digest))
+	rc = fsmCheckDigest(fsm);
+
+exit:
+    (void) fsmNext(fsm, IOSM_WCLOSE);
+    fsm->wrbuf = NULL;
+    xx = rpmswExit(&w->op, w->nb);
+
+    w->rc = rc;
+    yarnPossess(w->done);
+    yarnTwist(w->done, TO, 1);
+}
+
+/**
+ * Create queue of regular files for writer threads.
+ * @param nwriters	no. of writer threads
+ * @return		file queue (NULL if not threaded)
+ */
+/*@null@*/
+static struct fsmWriters_s * fsmWritersNew(int nwriters)
+	/*@globals _fsmWPool, rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies _fsmWPool, rpmGlobalMacroContext, internalState @*/
+{
+    struct fsmWriters_s * wr;
+
+    /* The pool lasts for the transaction (see fsmFreeThreadPools). */
+    /* A changed %{_fsm_writers} (e.g. --define) resizes the pool. */
+    if (_fsmWPool != NULL && rpmtpoolThreads(_fsmWPool) > 0
+     && rpmtpoolThreads(_fsmWPool) != nwriters)
+	_fsmWPool = rpmtpoolFree(_fsmWPool);
+    if (_fsmWPool == NULL)
+	_fsmWPool = rpmtpoolNew(nwriters);
+    if (rpmtpoolThreads(_fsmWPool) == 0)
+	return NULL;
+
+    wr = xcalloc(1, sizeof(*wr));
+    wr->tp = _fsmWPool;
+    wr->head = NULL;
+    wr->tail = &wr->head;
+    wr->max = (size_t) rpmExpandNumeric("%{?_fsm_writers_memory}");
+    if (wr->max == 0)
+	wr->max = 16 * 1024 * 1024;
+    return wr;
+}
+
+/**
+ * Wait for the oldest queued file to be written, and dequeue it.
+ * @param wr		queued files
+ * @return		oldest queued file
+ */
+static fsmWrite fsmWritersPop(struct fsmWriters_s * wr)
+	/*@globals internalState @*/
+	/*@modifies wr, internalState @*/
+{
+    fsmWrite w = wr->head;
+    int xx;
+
+    xx = rpmswEnter(&wr->op_wait, 0);
+    yarnPossess(w->done);
+    yarnWaitFor(w->done, TO_BE, 1);
+    yarnRelease(w->done);
+    xx = rpmswExit(&wr->op_wait, 0);
+
+    if ((wr->head = w->next) == NULL)
+	wr->tail = &wr->head;
+    w->next = NULL;
+    wr->nb -= w->charge;
+    (void) rpmswAdd(&wr->op_write, &w->op);
+    return w;
+}
+
+/**
+ * Free a written file, and its (copied) file state.
+ * @param fsm		file state machine data
+ * @param w		written file
+ * @return		NULL always
+ */
+/*@null@*/
+static fsmWrite fsmWriteFree(IOSM_t fsm, /*@only@*/ fsmWrite w)
+	/*@modifies fsm, w @*/
+{
+    (void) rpmswAdd(&fsm->op_digest, &w->fsm->op_digest);
+    w->fsm->path = _free(w->fsm->path);
+    w->fsm->lpath = _free(w->fsm->lpath);
+    w->fsm->opath = _free(w->fsm->opath);
+    w->fsm = _free(w->fsm);
+    w->b = _free(w->b);
+    w->done = yarnFreeLock(w->done);
+    w = _free(w);
+    return NULL;
+}
+
+/**
+ * Commit written files, oldest first, until few enough bytes are queued.
+ * @param fsm		file state machine data
+ * @param all		commit all queued files?
+ * @param keep		max. no. of bytes to leave queued (if not all)
+ * @return		0 on success
+ */
+static int fsmWritersCommit(IOSM_t fsm, int all, size_t keep)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    struct fsmWriters_s * wr = fsm->writers;
+    int rc = 0;
+
+    while (rc == 0 && wr != NULL && wr->head != NULL
+	&& (all || wr->nb > keep))
+    {
+	fsmWrite w = fsmWritersPop(wr);
+
+	/* The same stages as the IOSM_PKGINSTALL loop, on the copied state. */
+	if ((rc = w->rc) != 0) {
+	    w->fsm->rc = rc;
+	    (void) fsmNext(w->fsm, IOSM_UNDO);
+	} else {
+	    (void) fsmNext(w->fsm, IOSM_NOTIFY);
+	    rc = fsmNext(w->fsm, IOSM_FINI);
+	}
+	w = fsmWriteFree(fsm, w);
+    }
+    return rc;
+}
+
+/**
+ * Discard (unlinking temporary files) all queued files.
+ * @param fsm		file state machine data
+ */
+static void fsmWritersAbort(IOSM_t fsm)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    struct fsmWriters_s * wr = fsm->writers;
+
+    while (wr != NULL && wr->head != NULL) {
+	fsmWrite w = fsmWritersPop(wr);
+	(void) fsmNext(w->fsm, IOSM_UNDO);
+	w = fsmWriteFree(fsm, w);
+    }
+}
+
+/**
+ * Destroy queue of regular files for writer threads.
+ * @param fsm		file state machine data
+ * @return		NULL always
+ */
+/*@null@*/
+static struct fsmWriters_s * fsmWritersFree(IOSM_t fsm)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    struct fsmWriters_s * wr = fsm->writers;
+    rpmts ts = fsmGetTs(fsm);
+
+    if (wr == NULL)
+	return NULL;
+
+    fsmWritersAbort(fsm);
+
+    (void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSMREAD), &wr->op_read);
+    (void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSMWRITE), &wr->op_write);
+    (void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSMWAIT), &wr->op_wait);
+
+    wr = _free(wr);
+    return NULL;
+}
+
+/** \ingroup payload
+ * Read a regular file from payload stream, queue it for a writer thread.
+ *
+ * The file is committed (renamed, chown'ed, etc) later, in payload order,
+ * by fsmWritersCommit(), so the IOSM_FINI of the current file is skipped.
+ * @param fsm		file state machine data
+ * @return		0 on success
+ */
+static int extractQueued(/*@special@*/ IOSM_t fsm)
+	/*@uses fsm->sb @*/
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    struct fsmWriters_s * wr = fsm->writers;
+    const struct stat * st = &fsm->sb;
+    size_t left = (size_t) st->st_size;
+    fsmWrite w;
+    IOSM_t wfsm;
+    int rc;
+    int xx;
+
+    w = xcalloc(1, sizeof(*w));
+    w->nb = left;
+    w->charge = w->nb + sizeof(*w) + sizeof(*fsm);
+
+    /* Make room within the memory budget. */
+    rc = fsmWritersCommit(fsm, 0,
+		(w->charge < wr->max ? wr->max - w->charge : 0));
+    if (rc) {
+	w = _free(w);
+	return rc;
+    }
+
+    {	const char * fn = fsm->path;
+	mode_t mode = st->st_mode;
+	uint8_t * b = (uint8_t *)"";
+	size_t blen = 1;
+	const uint8_t * d = fsm->digest;
+	size_t dlen = fsm->digestlen;
+	uint32_t dalgo = fsm->fdigestalgo;
+
+	xx = rpmlioCreat(rpmtsGetRdb(fsmGetTs(fsm)), fn, mode, b, blen, d, dlen, dalgo);
+    }
+
+    /* Read the file contents, notifying progress as extractRegular does. */
+    xx = rpmswEnter(&wr->op_read, 0);
+    w->b = xmalloc(w->nb > 0 ? w->nb : 1);
+    fsm->wrbuf = w->b;
+    while (left) {
+	fsm->wrlen = (left > fsm->wrsize ? fsm->wrsize : left);
+	rc = fsmNext(fsm, IOSM_DREAD);
+	if (rc)
+	    break;
+	fsm->wrbuf += fsm->rdnb;
+	left -= fsm->rdnb;
+	if (left)
+	    (void) fsmNext(fsm, IOSM_NOTIFY);
+    }
+    fsm->wrbuf = fsm->wrb;
+    xx = rpmswExit(&wr->op_read, w->nb - left);
+    if (rc) {
+	w->b = _free(w->b);
+	w = _free(w);
+	return rc;
+    }
+
+    /* Copy the file state, moving the file names to the copy. */
+    wfsm = memcpy(xmalloc(sizeof(*wfsm)), fsm, sizeof(*wfsm));
+    if (wfsm->suffix == fsm->sufbuf)
+	wfsm->suffix = wfsm->sufbuf;
+    wfsm->multithreaded = 0;
+    wfsm->tpool = NULL;
+    wfsm->ra = NULL;
+    wfsm->writers = NULL;
+    wfsm->wfd = NULL;
+    wfsm->rc = 0;
+    memset(&wfsm->op_digest, 0, sizeof(wfsm->op_digest));
+    fsm->path = NULL;
+    fsm->lpath = NULL;
+    fsm->opath = NULL;
+    fsm->postpone = 1;		/* XXX committed by fsmWritersCommit() */
+
+    w->fsm = wfsm;
+    w->done = yarnNewLock(0);
+    *wr->tail = w;
+    wr->tail = &w->next;
+    wr->nb += w->charge;
+
+    return rpmtpoolSubmit(wr->tp, fsmWriteThread, w);
+}
+
+/**
+ * Files (and directories) installed, but not yet synced to disk.
+ */
+struct fsmSync_s {
+    fsmSyncPolicy policy;	/*!< %_transaction_fsync_policy */
+/*@only@*/ /*@null@*/
+    ARGV_t files;		/*!< installed files */
+/*@only@*/ /*@null@*/
+    ARGV_t dirs;		/*!< installed (or changed) directories */
+/*@only@*/ /*@null@*/
+    yarnLock done;		/*!< 1 when synced (NULL if not started) */
+    int rc;			/*!< errno of first failure (0 on success) */
+    struct rpmop_s op;		/*!< sync time */
+};
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static fsmSync _fsmTSync;	/*!< Files installed by the transaction. */
+
+/**
+ * Return %_transaction_fsync_policy.
+ * @return		fsync(2) policy
+ */
+static fsmSyncPolicy fsmGetSyncPolicy(void)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    const char * s = rpmExpand("%{?_transaction_fsync_policy}", NULL);
+    fsmSyncPolicy policy = FSM_FSYNC_FILE;
+
+    if (!strcmp(s, "package"))
+	policy = FSM_FSYNC_PACKAGE;
+    else if (!strcmp(s, "transaction"))
+	policy = FSM_FSYNC_TRANSACTION;
+    s = _free(s);
+    return policy;
+}
+
+static fsmSync fsmSyncNew(fsmSyncPolicy policy)
+	/*@*/
+{
+    fsmSync sync = xcalloc(1, sizeof(*sync));
+    sync->policy = policy;
+    return sync;
+}
+
+/*@null@*/
+static fsmSync fsmSyncFree(/*@only@*/ /*@null@*/ fsmSync sync)
+	/*@modifies sync @*/
+{
+    if (sync != NULL) {
+	sync->files = argvFree(sync->files);
+	sync->dirs = argvFree(sync->dirs);
+	sync->done = yarnFreeLock(sync->done);
+	sync = _free(sync);
+    }
+    return NULL;
+}
+
+/**
+ * Add a directory to be synced, unless just added.
+ * @param sync		files to sync
+ * @param dn		directory
+ * @param dnlen		length of directory
+ */
+static void fsmSyncAddDir(fsmSync sync, const char * dn, size_t dnlen)
+	/*@modifies sync @*/
+{
+    int ac = argvCount(sync->dirs);
+    char * t;
+
+    if (dnlen == 0)
+	return;
+    if (ac > 0 && strlen(sync->dirs[ac-1]) == dnlen
+     && !strncmp(sync->dirs[ac-1], dn, dnlen))
+	return;
+    t = strncpy(alloca(dnlen + 1), dn, dnlen);
+    t[dnlen] = '\0';
+    (void) argvAdd(&sync->dirs, t);
+}
+
+/**
+ * Add an installed file to be synced.
+ * @param sync		files to sync
+ * @param fn		file name
+ * @param mode		file type
+ */
+static void fsmSyncAdd(fsmSync sync, const char * fn, mode_t mode)
+	/*@modifies sync @*/
+{
+    const char * bn = strrchr(fn, '/');
+
+    if (S_ISREG(mode))
+	(void) argvAdd(&sync->files, fn);
+    else if (S_ISDIR(mode))
+	fsmSyncAddDir(sync, fn, strlen(fn));
+    /* The directory entry is changed for every file type. */
+    if (bn != NULL)
+	fsmSyncAddDir(sync, fn, (bn > fn ? (size_t)(bn - fn) : 1));
+}
+
+/**
+ * Sync installed files to disk, on a background thread.
+ * @param _sync		files to sync
+ */
+static void fsmSyncThread(void * _sync)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _sync, fileSystem, internalState @*/
+{
+    fsmSync sync = _sync;
+    int ndirs = argvCount(sync->dirs);
+    int nfiles = argvCount(sync->files);
+    int fdno;
+    int xx;
+    int i;
+
+    xx = rpmswEnter(&sync->op, 0);
+
+#if defined(HAVE_SYNCFS)
+    /* One syncfs(2) for each file system. */
+    {	dev_t * devs = xcalloc(ndirs + 1, sizeof(*devs));
+	int ndevs = 0;
+	for (i = 0; i < ndirs; i++) {
+	    struct stat sb;
+	    int j;
+	    if (stat(sync->dirs[i], &sb) < 0)
+		continue;
+	    for (j = 0; j < ndevs; j++) {
+		if (devs[j] == sb.st_dev)
+		    /*@innerbreak@*/ break;
+	    }
+	    if (j < ndevs)
+		continue;
+	    devs[ndevs++] = sb.st_dev;
+	    if ((fdno = open(sync->dirs[i], O_RDONLY)) < 0
+	     || syncfs(fdno) < 0)
+	    {
+		if (sync->rc == 0)
+		    sync->rc = errno;
+	    }
+	    if (fdno >= 0)
+		xx = close(fdno);
+	}
+	devs = _free(devs);
+    }
+#else
+    /* Sync file data, then the directory entries. */
+    for (i = 0; i < nfiles; i++) {
+	if ((fdno = open(sync->files[i], O_RDONLY)) < 0
+	 || fdatasync(fdno) < 0)
+	{
+	    if (sync->rc == 0)
+		sync->rc = errno;
+	}
+	if (fdno >= 0)
+	    xx = close(fdno);
+    }
+    for (i = 0; i < ndirs; i++) {
+	if ((fdno = open(sync->dirs[i], O_RDONLY)) < 0
+	 || fsync(fdno) < 0)
+	{
+	    if (sync->rc == 0)
+		sync->rc = errno;
+	}
+	if (fdno >= 0)
+	    xx = close(fdno);
+    }
+#endif
+
+    xx = rpmswExit(&sync->op, nfiles);
+
+    yarnPossess(sync->done);
+    yarnTwist(sync->done, TO, 1);
+}
+
+/**
+ * Start syncing installed files to disk.
+ * @param sync		files to sync
+ */
+static void fsmSyncStart(fsmSync sync)
+	/*@globals _fsmSPool, fileSystem, internalState @*/
+	/*@modifies sync, _fsmSPool, fileSystem, internalState @*/
+{
+    if (sync->done != NULL)
+	return;
+    sync->done = yarnNewLock(0);
+    if (_fsmSPool == NULL)
+	_fsmSPool = rpmtpoolNew(1);
+    (void) rpmtpoolSubmit(_fsmSPool, fsmSyncThread, sync);
+}
+
+/**
+ * Wait for installed files to be synced to disk.
+ * @param sync		files to sync
+ * @param ts		transaction set (for sync timing)
+ * @return		0 on success, otherwise errno of first failure
+ */
+static int fsmSyncFinish(fsmSync sync, /*@null@*/ rpmts ts)
+	/*@globals _fsmSPool, fileSystem, internalState @*/
+	/*@modifies sync, _fsmSPool, ts, fileSystem, internalState @*/
+{
+    fsmSyncStart(sync);
+    yarnPossess(sync->done);
+    yarnWaitFor(sync->done, TO_BE, 1);
+    yarnRelease(sync->done);
+    if (ts != NULL)
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_FSYNC), &sync->op);
+    return sync->rc;
+}
+
+int fsmSyncWait(IOSM_t fsm, const void * _ts)
+{
+    rpmts ts = (rpmts) _ts;
+    int rc = 0;
+
+    if (fsm != NULL && fsm->sync != NULL) {
+	rc = fsmSyncFinish(fsm->sync, ts);
+	fsm->sync = fsmSyncFree(fsm->sync);
+    }
+    return rc;
+}
+
+int fsmSyncTransaction(const void * _ts)
+{
+    rpmts ts = (rpmts) _ts;
+    int rc = 0;
+
+    if (_fsmTSync != NULL) {
+	rc = fsmSyncFinish(_fsmTSync, ts);
+	_fsmTSync = fsmSyncFree(_fsmTSync);
+    }
+    return rc;
+}
+
+void fsmFreeThreadPools(void)
+{
+    _fsmTPool = rpmtpoolFree(_fsmTPool);
+    _fsmWPool = rpmtpoolFree(_fsmWPool);
+    _fsmSPool = rpmtpoolFree(_fsmSPool);
+}
+
 int fsmSetup(void * _fsm, iosmFileStage goal, const char * afmt,
 		const void * _ts, const void * _fi, FD_t cfd,
 		unsigned int * archiveSize, const char ** failedFile)
@@ -638,6 +1253,22 @@ int fsmSetup(void * _fsm, iosmFileStage goal, const char * afmt,
     fsm->debug = _fsm_debug;
     fsm->multithreaded = _fsm_threads;
     fsm->adding = adding;
+    if (fsm->multithreaded) {
+	if (_fsmTPool == NULL)
+	    _fsmTPool = rpmtpoolNew(2);
+	fsm->tpool = _fsmTPool;
+    }
+    if (goal == IOSM_PKGINSTALL) {
+	int nwriters = (_fsm_writers > 0
+		? _fsm_writers : rpmExpandNumeric("%{?_fsm_writers}"));
+	fsmSyncPolicy policy = fsmGetSyncPolicy();
+	if (nwriters > 0)
+	    fsm->writers = fsmWritersNew(nwriters);
+	/* XXX the previous package should already have been synced. */
+	(void) fsmSyncWait(fsm, NULL);
+	if (policy != FSM_FSYNC_FILE)
+	    fsm->sync = fsmSyncNew(policy);
+    }
 
 /*@+voidabstract -nullpass@*/
 if (fsm->debug < 0)
@@ -683,6 +1314,8 @@ fprintf(stderr, "\tcpio vectors set\n");
 /*@=assignexpose =castexpose @*/
 	pos = fdGetCpioPos(fsm->cfd);
 	fdSetCpioPos(fsm->cfd, 0);
+	if (fsm->multithreaded && goal == IOSM_PKGINSTALL)
+	    (void) iosmReadAheadStart(fsm, fsm->tpool);
     }
 /*@-mods@*/	/* LCL: avoid void * _ts/_fi annotations for now. */
     fsm->iter = mapInitIterator(fi, reverse);
@@ -747,22 +1380,37 @@ int fsmTeardown(void * _fsm)
 
 if (fsm->debug < 0)
 fprintf(stderr, "--> fsmTeardown(%p)\n", fsm);
+    fsm->writers = fsmWritersFree(fsm);
     if (!rc)
 	rc = fsmUNSAFE(fsm, IOSM_DESTROY);
 
 	(void) rpmswAdd(rpmtsOp(fsmGetTs(fsm), RPMTS_OP_DIGEST),
 			&fsm->op_digest);
 
+    /* Start syncing the package, or save the files for the transaction. */
+    if (fsm->sync != NULL) {
+	if (fsm->sync->policy == FSM_FSYNC_TRANSACTION) {
+	    if (_fsmTSync == NULL)
+		_fsmTSync = fsmSyncNew(FSM_FSYNC_TRANSACTION);
+	    (void) argvAppend(&_fsmTSync->files, fsm->sync->files);
+	    (void) argvAppend(&_fsmTSync->dirs, fsm->sync->dirs);
+	    fsm->sync = fsmSyncFree(fsm->sync);
+	} else
+	    fsmSyncStart(fsm->sync);
+    }
+
     fsm->lmtab = _free(fsm->lmtab);
     (void)rpmtsFree(fsm->iter->ts); 
     fsm->iter->ts = NULL;
     fsm->iter = mapFreeIterator(fsm->iter);
+    iosmReadAheadStop(fsm);
     if (fsm->cfd != NULL) {
 /*@-refcounttrans@*/	/* FIX: XfdFree annotation */
 	fsm->cfd = fdFree(fsm->cfd, "persist (fsm)");
 /*@=refcounttrans@*/
 	fsm->cfd = NULL;
     }
+    fsm->tpool = NULL;
     fsm->failedFile = NULL;
     return rc;
 }
@@ -1017,29 +1665,11 @@ static int extractRegular(/*@special@*/ IOSM_t fsm)
 	    (void) fsmNext(fsm, IOSM_NOTIFY);
     }
 
-    xx = fsync(Fileno(fsm->wfd));
-
-    if (st->st_size > 0 && (fsm->fdigest || fsm->digest)) {
-	void * digest = NULL;
-	int asAscii = (fsm->digest == NULL ? 1 : 0);
-
-	(void) Fflush(fsm->wfd);
-	fdFiniDigest(fsm->wfd, fsm->fdigestalgo, &digest, NULL, asAscii);
-
-	if (digest == NULL) {
-	    rc = IOSMERR_DIGEST_MISMATCH;
-	    goto exit;
-	}
+    if (fsm->sync == NULL)
+	xx = fsync(Fileno(fsm->wfd));
 
-	if (fsm->digest != NULL) {
-	    if (memcmp(digest, fsm->digest, fsm->digestlen))
-		rc = IOSMERR_DIGEST_MISMATCH;
-	} else {
-	    if (strcmp(digest, fsm->fdigest))
-		rc = IOSMERR_DIGEST_MISMATCH;
-	}
-	digest = _free(digest);
-    }
+    if (st->st_size > 0 && (fsm->fdigest || fsm->digest))
+	rc = fsmCheckDigest(fsm);
 
 exit:
     (void) fsmNext(fsm, IOSM_WCLOSE);
@@ -1633,9 +2263,9 @@ int fsmStage(IOSM_t fsm, iosmFileStage stage)
 	    /* Clean fsm, free'ing memory. Read next archive header. */
 	    rc = fsmUNSAFE(fsm, IOSM_INIT);
 
-	    /* Exit on end-of-payload. */
+	    /* Exit on end-of-payload, after committing queued files. */
 	    if (rc == IOSMERR_HDR_TRAILER) {
-		rc = 0;
+		rc = fsmWritersCommit(fsm, 1, 0);
 		/*@loopbreak@*/ break;
 	    }
 
@@ -1661,6 +2291,9 @@ int fsmStage(IOSM_t fsm, iosmFileStage stage)
 		/*@loopbreak@*/ break;
 	    }
 	}
+	/* Discard queued files on error. */
+	if (rc)
+	    fsmWritersAbort(fsm);
 	break;
     case IOSM_PKGERASE:
     case IOSM_PKGCOMMIT:
@@ -1925,7 +2558,11 @@ if (!(fsm->mapFlags & IOSM_ALL_HARDLINKS)) break;
 
 	if (S_ISREG(st->st_mode) && fsm->lpath != NULL) {
 	    const char * opath = fsm->opath;
-	    char * t = xmalloc(strlen(fsm->lpath+1) + strlen(fsm->suffix) + 1);
+	    char * t;
+	    /* XXX the link target may be queued. */
+	    rc = fsmWritersCommit(fsm, 1, 0);
+	    if (rc) break;
+	    t = xmalloc(strlen(fsm->lpath+1) + strlen(fsm->suffix) + 1);
 	    (void) stpcpy(t, fsm->lpath+1);
 	     fsm->opath = t;
 	    /* XXX link(fsm->opath, fsm->path) */
@@ -1961,7 +2598,12 @@ if (!(fsm->mapFlags & IOSM_ALL_HARDLINKS)) break;
 	    fsm->path = path;
 	    /*@=dependenttrans@*/
 	    if (!(rc == IOSMERR_ENOENT)) return rc;
-	    rc = extractRegular(fsm);
+	    /* Queue (small, not hard linked) files for writer threads. */
+	    if (fsm->writers != NULL && st->st_nlink <= 1
+	     && (size_t)st->st_size <= fsm->writers->max / 4)
+		rc = extractQueued(fsm);
+	    else
+		rc = extractRegular(fsm);
 	} else if (S_ISDIR(st->st_mode)) {
 	    mode_t st_mode = st->st_mode;
 	    rc = fsmUNSAFE(fsm, IOSM_VERIFY);
@@ -2181,6 +2823,10 @@ if (!(fsmGetFi(fsm)->mapflags & IOSM_PAYLOAD_EXTRACT)) {
 	}
 }
 
+	/* Remember what to sync (if not synced when written). */
+	if (!rc && fsm->sync != NULL && fsm->path != NULL)
+	    fsmSyncAdd(fsm->sync, fsm->path, st->st_mode);
+
 	/* Notify on success. */
 	if (!rc)		rc = fsmNext(fsm, IOSM_NOTIFY);
 	else if (fsm->failedFile && *fsm->failedFile == NULL) {
@@ -23,6 +23,20 @@ extern int _fsm_debug;
  */
 typedef /*@abstract@*/ struct iosmIterator_s * FSMI_t;
 
+/** \ingroup payload
+ * When are installed files synced to disk (%_transaction_fsync_policy)?
+ */
+typedef enum fsmSyncPolicy_e {
+    FSM_FSYNC_FILE		= 0,	/*!< fsync(2) each file when written */
+    FSM_FSYNC_PACKAGE		= 1,	/*!< sync before rpmdbAdd() */
+    FSM_FSYNC_TRANSACTION	= 2	/*!< sync after last package */
+} fsmSyncPolicy;
+
+/** \ingroup payload
+ * Installed files that have not been synced to disk.
+ */
+typedef /*@abstract@*/ struct fsmSync_s * fsmSync;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -74,6 +88,36 @@ int fsmTeardown(void * _fsm)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies _fsm, fileSystem, internalState @*/;
 
+/**
+ * Wait for the files installed by a package to be synced to disk.
+ * With %_transaction_fsync_policy "package", the sync is started on a
+ * background thread by fsmTeardown(), and must finish before rpmdbAdd().
+ * @param fsm		file state machine
+ * @param _ts		transaction set (for sync timing, NULL to skip)
+ * @return		0 on success, otherwise errno of first failure
+ */
+int fsmSyncWait(/*@null@*/ IOSM_t fsm, /*@null@*/ const void * _ts)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/;
+
+/**
+ * Sync the files installed by a transaction to disk.
+ * With %_transaction_fsync_policy "transaction", this is done once, after
+ * the last package has been installed.
+ * @param _ts		transaction set (for sync timing, NULL to skip)
+ * @return		0 on success, otherwise errno of first failure
+ */
+int fsmSyncTransaction(/*@null@*/ const void * _ts)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/;
+
+/**
+ * Free the file state machine thread pools (at transaction end).
+ */
+void fsmFreeThreadPools(void)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/;
+
 /**
  * Map next file path and action.
  * @param fsm		file state machine
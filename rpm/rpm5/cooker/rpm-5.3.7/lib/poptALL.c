@@ -34,6 +34,8 @@ const char *__localedir = LOCALEDIR;
 
 #include <fs.h>			/* XXX rpmFreeFilesystems() */
 
+#include "legacy.h"		/* XXX dodigestCacheSync() */
+
 #include "debug.h"
 
 /*@unchecked@*/ /*@only@*/ /*@null@*/
@@ -64,6 +66,9 @@ extern int _fsm_debug;
 /*@unchecked@*/
 extern int _fsm_threads;
 
+/*@unchecked@*/
+extern int _fsm_writers;
+
 /*@unchecked@*/
 extern int _hdr_debug;
 /*@unchecked@*/
@@ -438,6 +443,8 @@ struct poptOption rpmcliAllPoptTable[] = {
 	N_("Debug payload File State Machine"), NULL},
  { "fsmthreads", '\0', POPT_ARG_VAL|POPT_ARGFLAG_DOC_HIDDEN, &_fsm_threads, -1,
 	N_("Use threads for File State Machine"), NULL},
+ { "fsmwriters", '\0', POPT_ARG_INT|POPT_ARGFLAG_DOC_HIDDEN, &_fsm_writers, 0,
+	N_("Use N threads to write files for File State Machine"), N_("N")},
  { "hdrdebug", '\0', POPT_ARG_VAL|POPT_ARGFLAG_DOC_HIDDEN, &_hdr_debug, -1,
 	NULL, NULL},
  { "hdrqfdebug", '\0', POPT_ARG_VAL|POPT_ARGFLAG_DOC_HIDDEN, &_hdrqf_debug, -1,
@@ -502,6 +509,9 @@ rpmcliFini(poptContext optCon)
 /*@=nestedextern@*/
 
 /*@-mods@*/
+    /* Save file digests computed by this run (if %_dodigest_cache is set). */
+    (void) dodigestCacheSync();
+
     evr_tuple_order = _free(evr_tuple_order);
     evr_tuple_match = _free(evr_tuple_match);
     evr_tuple_mire = mireFree(evr_tuple_mire);
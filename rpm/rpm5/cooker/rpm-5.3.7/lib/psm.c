@@ -71,6 +71,9 @@ int _psm_debug = _PSM_DEBUG;
 /*@unchecked@*/
 int _psm_threads = 0;
 
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmtpool _psmTPool;
+
 /*@access FD_t @*/		/* XXX void * arg */
 /*@access Header @*/		/* XXX void * arg */
 /*@access miRE @*/
@@ -1735,6 +1738,11 @@ void rpmpsmSetAsync(rpmpsm psm, int async)
 #endif
 }
 
+void rpmpsmFreeThreadPools(void)
+{
+    _psmTPool = rpmtpoolFree(_psmTPool);
+}
+
 rpmRC rpmpsmScriptStage(rpmpsm psm, rpmTag scriptTag, rpmTag progTag)
 {
 assert(psm != NULL);
@@ -2140,7 +2148,6 @@ static int postPopulateInstallHeader(/*@unused@*/ const rpmts ts,
     return 0;
 }
 
-#if defined(WITH_PTHREADS)
 static void * rpmpsmThread(void * arg)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies arg, rpmGlobalMacroContext, fileSystem, internalState @*/
@@ -2150,17 +2157,18 @@ static void * rpmpsmThread(void * arg)
     return ((void *) rpmpsmStage(psm, psm->nstage));
 /*@=unqualifiedtrans@*/
 }
-#endif
 
 static int rpmpsmNext(rpmpsm psm, pkgStage nstage)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies psm, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
     psm->nstage = nstage;
-#if defined(WITH_PTHREADS)
-    if (_psm_threads)
-	return rpmsqJoin( rpmsqThread(rpmpsmThread, psm) );
-#endif
+    /* XXX psm stages call fsm stages, which run on a different pool. */
+    if (_psm_threads) {
+	if (_psmTPool == NULL)
+	    _psmTPool = rpmtpoolNew(1);
+	return (int)(long) rpmtpoolCall(_psmTPool, rpmpsmThread, psm);
+    }
     return rpmpsmStage(psm, psm->nstage);
 }
 
@@ -2767,6 +2775,12 @@ assert(psm->te != NULL);
 	    /* Add scriptlet/file states to install header. */
 	    xx = postPopulateInstallHeader(ts, psm, fi);
 
+	    /* Installed files must be on disk before the rpmdb says so. */
+	    xx = fsmSyncWait(fi->fsm, ts);
+	    if (xx)
+		rpmlog(RPMLOG_WARNING, _("%s: sync of installed files failed: %s\n"),
+			rpmteNEVR(psm->te), strerror(xx));
+
 	    rc = rpmpsmNext(psm, PSM_RPMDB_ADD);
 	    if (rc) break;
 
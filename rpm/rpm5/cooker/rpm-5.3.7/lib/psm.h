@@ -223,6 +223,13 @@ rpmRC rpmpsmScriptStage(rpmpsm psm, rpmTag scriptTag, rpmTag progTag)
 void rpmpsmSetAsync(rpmpsm psm, int async)
 	/*@modifies psm @*/;
 
+/**
+ * Free the package state machine thread pool (at transaction end).
+ */
+void rpmpsmFreeThreadPools(void)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/;
+
 #ifdef __cplusplus
 }
 #endif
@@ -135,16 +135,23 @@ static void printFileInfo(char * te, const char * name,
 
 /**
  */
-static inline /*@null@*/ const char * queryHeader(Header h, const char * qfmt)
+static inline /*@null@*/ /*@observer@*/
+const char * queryHeader(QVA_t qva, Header h)
 	/*@globals internalState @*/
-	/*@modifies h, internalState @*/
+	/*@modifies qva, h, internalState @*/
 {
     const char * errstr = "(unkown error)";
-    const char * str;
+    const char * str = NULL;
 
+    /* The format is compiled once, and reused for every header queried. */
+    if (qva->qva_hdrfmt == NULL) {
 /*@-modobserver@*/
-    str = headerSprintf(h, qfmt, NULL, rpmHeaderFormats, &errstr);
+	qva->qva_hdrfmt = headerCompileFormat(qva->qva_queryFormat, NULL,
+		rpmHeaderFormats, &errstr);
 /*@=modobserver@*/
+    }
+    if (qva->qva_hdrfmt != NULL)
+	str = headerFormatRun(h, qva->qva_hdrfmt, &errstr);
     if (str == NULL)
 	rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), errstr);
     return str;
@@ -191,7 +198,7 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
 /*@-type@*/	/* FIX rpmtsGetRDB()? */
 	(void) headerSetRpmdb(h, ts->rdb);
 /*@=type@*/
-	str = queryHeader(h, qva->qva_queryFormat);
+	str = queryHeader(qva, h);
 	(void) headerSetRpmdb(h, NULL);
 	if (str) {
 	    size_t tx = (te - t);
@@ -205,7 +212,6 @@ int showQueryPackage(QVA_t qva, rpmts ts, Header h)
 	    /*@-usereleased@*/
 	    te = stpcpy(te, str);
 	    /*@=usereleased@*/
-	    str = _free(str);
 	    flushBuffer(&t, &te, 1);
 	}
     }
@@ -414,6 +420,102 @@ static int rpmgiShowMatches(QVA_t qva, rpmts ts)
     return ec;
 }
 
+/**
+ * Shared state of rpmcliShowMatches() on rpmmiParallel() worker threads.
+ */
+struct showMatches_s {
+/*@dependent@*/
+    QVA_t qva;			/*!< parsed query/verify options */
+/*@dependent@*/
+    rpmts ts;			/*!< transaction set */
+/*@only@*/ /*@null@*/
+    hdrfmt_t * hfmts;		/*!< per-thread compiled query formats */
+    int ec;			/*!< result of last showPackage() */
+};
+
+/**
+ * Can the query format be run on worker threads?
+ * Only --qf queries without file lists are formatted in parallel, and the
+ * formats that look up other headers in the rpmdb are not. Nor are i18n
+ * lookups through %{_i18ndomains}, which change $LANGUAGE while running.
+ * @param qva		parsed query/verify options
+ * @return		1 if the query format can be run in parallel
+ */
+static int queryFormatParallel(QVA_t qva)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    static const char * rpmdbtags[] = { "whatneeds", "needswhat", NULL };
+    const char * s;
+    int i;
+
+    if (qva->qva_showPackage != showQueryPackage
+     || qva->qva_queryFormat == NULL || (qva->qva_flags & QUERY_FOR_LIST))
+	return 0;
+    s = rpmExpand("%{?_i18ndomains}", NULL);
+    i = (*s != '\0');
+    s = _free(s);
+    if (i)
+	return 0;
+    for (s = qva->qva_queryFormat; *s != '\0'; s++) {
+	for (i = 0; rpmdbtags[i] != NULL; i++) {
+	    if (!xstrncasecmp(s, rpmdbtags[i], strlen(rpmdbtags[i])))
+		return 0;
+	}
+    }
+    return 1;
+}
+
+/**
+ * Format a header on a worker thread.
+ * @param _sm		shared state
+ * @param h		header
+ * @param tid		worker thread no.
+ * @return		formatted string (NULL on error)
+ */
+/*@null@*/
+static void * showMatchesWork(void * _sm, Header h, int tid)
+	/*@modifies h @*/
+{
+    struct showMatches_s * sm = _sm;
+    errmsg_t errstr = NULL;
+    const char * str;
+
+    if (sm->hfmts == NULL || sm->hfmts[tid] == NULL)
+	return NULL;
+    str = headerFormatRun(h, sm->hfmts[tid], &errstr);
+    return (str != NULL ? xstrdup(str) : NULL);
+}
+
+/**
+ * Display a header (in iterator order) on the calling thread.
+ * @param _sm		shared state
+ * @param h		header
+ * @param result	formatted string (NULL displays with showPackage())
+ */
+static void showMatchesDone(void * _sm, Header h, void * result)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies _sm, h, result, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    struct showMatches_s * sm = _sm;
+    QVA_t qva = sm->qva;
+    char * str = result;
+    int rc = 0;
+
+    if (str != NULL) {
+	if (*str != '\0')
+	    rpmlog(RPMLOG_NOTICE, "%s", str);
+	str = _free(str);
+    } else
+	rc = qva->qva_showPackage(qva, sm->ts, h);
+
+    sm->ec = rc;
+    if (rc)
+	qva->qva_showFAIL++;
+    else
+	qva->qva_showOK++;
+}
+
 /** \ingroup rpmcli
  * Display query/verify information for each header in iterator.
  *
@@ -429,10 +531,49 @@ static int rpmcliShowMatches(QVA_t qva, rpmts ts)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies qva, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
+    int nthreads = rpmExpandNumeric("%{?_query_threads}%{!?_query_threads:1}");
     Header h;
     int ec = 1;
 
     qva->qva_showFAIL = qva->qva_showOK = 0;
+
+    /* Load (and format) headers on worker threads, display them in order. */
+    if (nthreads != 1 && qva->qva_source != RPMQV_DBOFFSET) {
+	struct showMatches_s sm;
+	int i;
+
+	if (nthreads <= 0) {
+	    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	    nthreads = (cpus > 0 ? (int) cpus : 1);
+	}
+	memset(&sm, 0, sizeof(sm));
+	sm.qva = qva;
+	sm.ts = ts;
+	sm.ec = 0;
+	/* XXX compiled formats aren't reentrant, compile one per thread. */
+	if (queryFormatParallel(qva)) {
+	    sm.hfmts = xcalloc(nthreads, sizeof(*sm.hfmts));
+	    for (i = 0; i < nthreads; i++) {
+		errmsg_t errstr = NULL;
+		sm.hfmts[i] = headerCompileFormat(qva->qva_queryFormat, NULL,
+			rpmHeaderFormats, &errstr);
+	    }
+	}
+
+	if (rpmmiParallel(qva->qva_mi, nthreads, RPMMI_ORDERED,
+		(sm.hfmts != NULL ? showMatchesWork : NULL),
+		showMatchesDone, &sm) > 0)
+	    ec = sm.ec;
+
+	if (sm.hfmts != NULL) {
+	    for (i = 0; i < nthreads; i++)
+		sm.hfmts[i] = headerFormatFree(sm.hfmts[i]);
+	    sm.hfmts = _free(sm.hfmts);
+	}
+	qva->qva_mi = rpmmiFree(qva->qva_mi);
+	return ec;
+    }
+
     while ((h = rpmmiNext(qva->qva_mi)) != NULL) {
 	ec = qva->qva_showPackage(qva, ts, h);
 	if (ec)
@@ -902,6 +1043,8 @@ int rpmcliQuery(rpmts ts, QVA_t qva, const char ** argv)
     transFlags = rpmtsSetFlags(ts, otransFlags);
     depFlags = rpmtsSetDFlags(ts, odepFlags);
 
+    qva->qva_hdrfmt = headerFormatFree(qva->qva_hdrfmt);
+
     if (qva->qva_showPackage == showQueryPackage)
 	qva->qva_showPackage = NULL;
 
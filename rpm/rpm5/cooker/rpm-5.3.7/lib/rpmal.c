@@ -6,6 +6,7 @@
 
 #include <rpmio.h>
 #include <rpmiotypes.h>		/* XXX fnpyKey */
+#include <rpmhash.h>		/* XXX hashFunctionString */
 
 #include <rpmtag.h>
 #include <rpmtypes.h>
@@ -26,6 +27,40 @@ typedef /*@abstract@*/ struct availablePackage_s * availablePackage;
 
 /*@access fnpyKey @*/	/* XXX suggestedKeys array */
 
+typedef /*@abstract@*/ struct alHashLink_s *		alHashLink;
+/*@access alHashLink@*/
+
+/** \ingroup rpmdep
+ * A hash chain link, the first member of every indexed item.
+ */
+struct alHashLink_s {
+/*@dependent@*/ /*@null@*/
+    alHashLink next;		/*!< Next item in bucket. */
+    rpmuint32_t hash;		/*!< Item key hash. */
+};
+
+typedef /*@abstract@*/ struct alHash_s *		alHash;
+/*@access alHash@*/
+
+/** \ingroup rpmdep
+ * A chained hash table of indexed items.
+ */
+struct alHash_s {
+/*@owned@*/ /*@null@*/
+    alHashLink * buckets;	/*!< Bucket chains. */
+    size_t nbuckets;		/*!< No. of buckets (a power of 2). */
+    size_t nitems;		/*!< No. of indexed items. */
+};
+
+typedef /*@abstract@*/ struct availableIndexEntry_s *	availableIndexEntry;
+/*@access availableIndexEntry@*/
+
+typedef /*@abstract@*/ struct fileIndexEntry_s *	fileIndexEntry;
+/*@access fileIndexEntry@*/
+
+typedef /*@abstract@*/ struct dirInfo_s *		dirInfo;
+/*@access dirInfo@*/
+
 /** \ingroup rpmdep
  * Info about a single package to be installed.
  */
@@ -40,15 +75,19 @@ struct availablePackage_s {
 /*@exposed@*/ /*@dependent@*/ /*@null@*/
     fnpyKey key;		/*!< Associated file name/python object */
 
+/*@owned@*/ /*@null@*/
+    availableIndexEntry provideIx;	/*!< Indexed Provides: dependencies. */
+    int nprovideIx;		/*!< No. of indexed provides. */
+/*@owned@*/ /*@null@*/
+    fileIndexEntry fileIx;	/*!< Indexed files. */
+    int nfileIx;		/*!< No. of indexed files. */
 };
 
-typedef /*@abstract@*/ struct availableIndexEntry_s *	availableIndexEntry;
-/*@access availableIndexEntry@*/
-
 /** \ingroup rpmdep
  * A single available item (e.g. a Provides: dependency).
  */
 struct availableIndexEntry_s {
+    struct alHashLink_s link;	/*!< Hash chain (keyed by name). */
 /*@exposed@*/ /*@dependent@*/ /*@null@*/
     alKey pkgKey;		/*!< Containing package. */
 /*@observer@*/
@@ -60,26 +99,13 @@ struct availableIndexEntry_s {
     } type;			/*!< Type of available item. */
 };
 
-typedef /*@abstract@*/ struct availableIndex_s *	availableIndex;
-/*@access availableIndex@*/
-
-/** \ingroup rpmdep
- * Index of all available items.
- */
-struct availableIndex_s {
-/*@null@*/
-    availableIndexEntry index;	/*!< Array of available items. */
-    int size;			/*!< No. of available items. */
-    int k;			/*!< Current index. */
-};
-
-typedef /*@abstract@*/ struct fileIndexEntry_s *	fileIndexEntry;
-/*@access fileIndexEntry@*/
-
 /** \ingroup rpmdep
  * A file to be installed/removed.
  */
 struct fileIndexEntry_s {
+    struct alHashLink_s link;	/*!< Hash chain (keyed by dirName+baseName). */
+/*@dependent@*/
+    dirInfo die;		/*!< Containing directory. */
 /*@dependent@*/ /*@relnull@*/
     const char * baseName;	/*!< File basename. */
     size_t baseNameLen;
@@ -87,19 +113,15 @@ struct fileIndexEntry_s {
     rpmuint32_t ficolor;
 };
 
-typedef /*@abstract@*/ struct dirInfo_s *		dirInfo;
-/*@access dirInfo@*/
-
 /** \ingroup rpmdep
  * A directory to be installed/removed.
  */
 struct dirInfo_s {
+    struct alHashLink_s link;	/*!< Hash chain (keyed by dirName). */
 /*@owned@*/ /*@relnull@*/
     const char * dirName;	/*!< Directory path (+ trailing '/'). */
     size_t dirNameLen;		/*!< No. bytes in directory path. */
-/*@owned@*/
-    fileIndexEntry files;	/*!< Array of files in directory. */
-    int numFiles;		/*!< No. files in directory. */
+    int numFiles;		/*!< No. of indexed files in directory. */
 };
 
 /** \ingroup rpmdep
@@ -108,28 +130,120 @@ struct dirInfo_s {
 struct rpmal_s {
 /*@owned@*/ /*@null@*/
     availablePackage list;	/*!< Set of packages. */
-    struct availableIndex_s index;	/*!< Set of available items. */
     int delta;			/*!< Delta for pkg list reallocation. */
     int size;			/*!< No. of pkgs in list. */
     int alloced;		/*!< No. of pkgs allocated for list. */
     rpmuint32_t tscolor;	/*!< Transaction color. */
-    int numDirs;		/*!< No. of directories. */
-/*@owned@*/ /*@null@*/
-    dirInfo dirs;		/*!< Set of directories. */
+    struct alHash_s provides;	/*!< Provides: index, by name. */
+    struct alHash_s dirs;	/*!< Directory index, by dirName. */
+    struct alHash_s files;	/*!< File index, by dirName+baseName. */
 };
 
 /**
- * Destroy available item index.
- * @param al		available list
+ * Initialize a hash table.
+ * @param ht		hash table
  */
-static void rpmalFreeIndex(rpmal al)
-	/*@modifies al @*/
+static void alHashInit(alHash ht)
+	/*@modifies ht @*/
+{
+    ht->nbuckets = 64;
+    ht->buckets = xcalloc(ht->nbuckets, sizeof(*ht->buckets));
+    ht->nitems = 0;
+}
+
+/**
+ * Destroy a hash table (the items are owned elsewhere).
+ * @param ht		hash table
+ */
+static void alHashFini(alHash ht)
+	/*@modifies ht @*/
 {
-    availableIndex ai = &al->index;
-    if (ai->size > 0) {
-	ai->index = _free(ai->index);
-	ai->size = 0;
+    ht->buckets = _free(ht->buckets);
+    ht->nbuckets = 0;
+    ht->nitems = 0;
+}
+
+/**
+ * Return the chain of items that may have a key hash.
+ * @param ht		hash table
+ * @param hash		key hash
+ * @return		1st item in the bucket (or NULL)
+ */
+/*@null@*/
+static inline alHashLink alHashFirst(alHash ht, rpmuint32_t hash)
+	/*@*/
+{
+    return (ht->nitems > 0 ? ht->buckets[hash & (ht->nbuckets - 1)] : NULL);
+}
+
+/**
+ * Double the no. of buckets in a hash table.
+ * Chains keep their order, so items with equal keys stay in insertion order.
+ * @param ht		hash table
+ */
+static void alHashGrow(alHash ht)
+	/*@modifies ht @*/
+{
+    size_t nbuckets = 2 * ht->nbuckets;
+    alHashLink * buckets = xcalloc(nbuckets, sizeof(*buckets));
+    alHashLink ** tails = xcalloc(nbuckets, sizeof(*tails));
+    size_t i;
+
+    for (i = 0; i < nbuckets; i++)
+	tails[i] = buckets + i;
+    for (i = 0; i < ht->nbuckets; i++) {
+	alHashLink l;
+	while ((l = ht->buckets[i]) != NULL) {
+	    size_t bx = l->hash & (nbuckets - 1);
+	    ht->buckets[i] = l->next;
+	    l->next = NULL;
+	    *tails[bx] = l;
+	    tails[bx] = &l->next;
+	}
     }
+    tails = _free(tails);
+    ht->buckets = _free(ht->buckets);
+    ht->buckets = buckets;
+    ht->nbuckets = nbuckets;
+}
+
+/**
+ * Append an item to a hash table.
+ * @param ht		hash table
+ * @param l		item hash link
+ * @param hash		item key hash
+ */
+static void alHashAdd(alHash ht, alHashLink l, rpmuint32_t hash)
+	/*@modifies ht, l @*/
+{
+    alHashLink * link = ht->buckets + (hash & (ht->nbuckets - 1));
+
+    while (*link != NULL)
+	link = &(*link)->next;
+    l->next = NULL;
+    l->hash = hash;
+    *link = l;
+    if (++ht->nitems > 2 * ht->nbuckets)
+	alHashGrow(ht);
+}
+
+/**
+ * Remove an item from a hash table.
+ * @param ht		hash table
+ * @param l		item hash link
+ */
+static void alHashDel(alHash ht, alHashLink l)
+	/*@modifies ht, l @*/
+{
+    alHashLink * link = ht->buckets + (l->hash & (ht->nbuckets - 1));
+
+    while (*link != NULL && *link != l)
+	link = &(*link)->next;
+    if (*link == NULL)
+	return;		/* XXX can't happen */
+    *link = l->next;
+    l->next = NULL;
+    ht->nitems--;
 }
 
 static inline alNum alKey2Num(/*@unused@*/ /*@null@*/ const rpmal al,
@@ -159,25 +273,22 @@ static inline alKey alNum2Key(/*@unused@*/ /*@null@*/ const rpmal al,
 rpmal rpmalCreate(int delta)
 {
     rpmal al = xcalloc(1, sizeof(*al));
-    availableIndex ai = &al->index;
 
     al->delta = delta;
     al->size = 0;
     al->list = xcalloc(al->delta, sizeof(*al->list));
     al->alloced = al->delta;
 
-    ai->index = NULL;
-    ai->size = 0;
-
-    al->numDirs = 0;
-    al->dirs = NULL;
+    alHashInit(&al->provides);
+    alHashInit(&al->dirs);
+    alHashInit(&al->files);
     return al;
 }
 
 rpmal rpmalFree(rpmal al)
 {
     availablePackage alp;
-    dirInfo die;
+    size_t j;
     int i;
 
     if (al == NULL)
@@ -189,147 +300,178 @@ rpmal rpmalFree(rpmal al)
 	alp->provides = NULL;
 	(void)rpmfiFree(alp->fi);
 	alp->fi = NULL;
+	alp->provideIx = _free(alp->provideIx);
+	alp->fileIx = _free(alp->fileIx);
     }
 
-    if ((die = al->dirs) != NULL)
-    for (i = 0; i < al->numDirs; i++, die++) {
-	die->dirName = _free(die->dirName);
-	die->files = _free(die->files);
+    for (j = 0; j < al->dirs.nbuckets; j++) {
+	alHashLink l;
+	while ((l = al->dirs.buckets[j]) != NULL) {
+	    dirInfo die = (dirInfo) l;
+	    al->dirs.buckets[j] = l->next;
+	    die->dirName = _free(die->dirName);
+	    die = _free(die);
+	}
     }
-    al->dirs = _free(al->dirs);
-    al->numDirs = 0;
+    alHashFini(&al->dirs);
+    alHashFini(&al->files);
+    alHashFini(&al->provides);
 
     al->list = _free(al->list);
     al->alloced = 0;
-    rpmalFreeIndex(al);
     al = _free(al);
     return NULL;
 }
 
 /**
- * Compare two directory info entries by name (qsort/bsearch).
- * @param one		1st directory info
- * @param two		2nd directory info
- * @return		result of comparison
+ * Find (or add) a directory in the directory index.
+ * @param al		available list
+ * @param dirName	directory path (+ trailing '/')
+ * @param dirNameLen	no. bytes in directory path
+ * @param create	add a new directory if not found?
+ * @return		directory info (or NULL if not found)
  */
-static int dieCompare(const void * one, const void * two)
-	/*@*/
+/*@dependent@*/ /*@null@*/
+static dirInfo rpmalDirInfo(rpmal al, const char * dirName, size_t dirNameLen,
+		int create)
+	/*@modifies al @*/
 {
-    /*@-castexpose@*/
-    const dirInfo a = (const dirInfo) one;
-    const dirInfo b = (const dirInfo) two;
-    /*@=castexpose@*/
-    int lenchk = (int)a->dirNameLen - (int)b->dirNameLen;
-
-    if (lenchk || a->dirNameLen == 0)
-	return lenchk;
+    rpmuint32_t hash = hashFunctionString(0, dirName, dirNameLen);
+    alHashLink l;
+    dirInfo die;
 
-    if (a->dirName == NULL || b->dirName == NULL)
-	return lenchk;
+    for (l = alHashFirst(&al->dirs, hash); l != NULL; l = l->next) {
+	if (l->hash != hash)
+	    continue;
+	die = (dirInfo) l;
+	if (die->dirNameLen == dirNameLen
+	 && !strncmp(die->dirName, dirName, dirNameLen))
+	    return die;
+    }
+    if (!create)
+	return NULL;
 
-    /* XXX FIXME: this might do "backward" strcmp for speed */
-    return strcmp(a->dirName, b->dirName);
+    die = xcalloc(1, sizeof(*die));
+    {	char * t = xmalloc(dirNameLen + 1);
+	memcpy(t, dirName, dirNameLen);
+	t[dirNameLen] = '\0';
+	die->dirName = t;
+    }
+    die->dirNameLen = dirNameLen;
+    die->numFiles = 0;
+    alHashAdd(&al->dirs, &die->link, hash);
+    return die;
 }
 
 /**
- * Compare two file info entries by name (qsort/bsearch).
- * @param one		1st directory info
- * @param two		2nd directory info
- * @return		result of comparison
+ * Remove a package's files from the file/directory index.
+ * @param al		available list
+ * @param alp		available package
  */
-static int fieCompare(const void * one, const void * two)
-	/*@*/
+static void rpmalDelFiles(rpmal al, availablePackage alp)
+	/*@modifies al, alp @*/
 {
-    /*@-castexpose@*/
-    const fileIndexEntry a = (const fileIndexEntry) one;
-    const fileIndexEntry b = (const fileIndexEntry) two;
-    /*@=castexpose@*/
-    int lenchk = (int)a->baseNameLen - (int)b->baseNameLen;
-
-    if (lenchk)
-	return lenchk;
+    int i;
 
-    if (a->baseName == NULL || b->baseName == NULL)
-	return lenchk;
+    for (i = 0; i < alp->nfileIx; i++) {
+	fileIndexEntry fie = alp->fileIx + i;
+	dirInfo die = fie->die;
 
-    return strcmp(a->baseName, b->baseName);
+	alHashDel(&al->files, &fie->link);
+	if (--die->numFiles > 0)
+	    continue;
+	alHashDel(&al->dirs, &die->link);
+	die->dirName = _free(die->dirName);
+	die = _free(die);
+    }
+    alp->fileIx = _free(alp->fileIx);
+    alp->nfileIx = 0;
 }
 
-void rpmalDel(rpmal al, alKey pkgKey)
+/**
+ * Add a package's files to the file/directory index.
+ * @param al		available list
+ * @param pkgNum	package index
+ */
+static void rpmalAddFiles(rpmal al, alNum pkgNum)
+	/*@modifies al @*/
 {
-    alNum pkgNum = alKey2Num(al, pkgKey);
-    availablePackage alp;
+    availablePackage alp = al->list + pkgNum;
     rpmfi fi;
 
-    if (al == NULL || al->list == NULL)
-	return;		/* XXX can't happen */
-
-    alp = al->list + pkgNum;
-
-    /* Delete directory/file info entries from added package list. */
-    if ((fi = alp->fi) != NULL)
+/*@-castexpose@*/
+    fi = rpmfiLink(alp->fi, "Files index (rpmalAdd)");
+/*@=castexpose@*/
+    fi = rpmfiInit(fi, 0);
     if (rpmfiFC(fi) > 0) {
-	int origNumDirs = al->numDirs;
-	int dx;
-	dirInfo dieNeedle =
-		memset(alloca(sizeof(*dieNeedle)), 0, sizeof(*dieNeedle));
-	dirInfo die;
-	int last;
-	int i;
+	int dc = rpmfiDC(fi);
+	dirInfo * dirMapping = memset(alloca(sizeof(*dirMapping) * dc),
+			0, sizeof(*dirMapping) * dc);
 
 	/* XXX FIXME: We ought to relocate the directory list here */
 
-	if (al->dirs != NULL)
-	for (dx = rpmfiDC(fi) - 1; dx >= 0; dx--)
-	{
-	    fileIndexEntry fie;
-
-	    (void) rpmfiSetDX(fi, dx);
-
-	    /*@-assignexpose -dependenttrans -observertrans@*/
-	    dieNeedle->dirName = (char *) rpmfiDN(fi);
-	    /*@=assignexpose =dependenttrans =observertrans@*/
-	    dieNeedle->dirNameLen = (dieNeedle->dirName != NULL
-			? strlen(dieNeedle->dirName) : 0);
-	    die = bsearch(dieNeedle, al->dirs, al->numDirs,
-			       sizeof(*dieNeedle), dieCompare);
-	    if (die == NULL)
-		continue;
-
-	    last = die->numFiles;
-	    fie = die->files + last - 1;
-	    for (i = last - 1; i >= 0; i--, fie--) {
-		if (fie->pkgNum != pkgNum)
-		    /*@innercontinue@*/ continue;
-		die->numFiles--;
-
-		if (i < die->numFiles)
-		    memmove(fie, fie+1, (die->numFiles - i) * sizeof(*fie));
-		memset(die->files + die->numFiles, 0, sizeof(*fie)); /* overkill */
+	alp->fileIx = xcalloc(rpmfiFC(fi), sizeof(*alp->fileIx));
+	alp->nfileIx = 0;
 
-	    }
-	    if (die->numFiles > 0) {
-		if (last > i)
-		    die->files = xrealloc(die->files,
-					die->numFiles * sizeof(*die->files));
-		continue;
-	    }
-	    die->files = _free(die->files);
-	    die->dirName = _free(die->dirName);
-	    al->numDirs--;
-	    if ((die - al->dirs) < al->numDirs)
-		memmove(die, die+1, (al->numDirs - (die - al->dirs)) * sizeof(*die));
+	while (rpmfiNext(fi) >= 0) {
+	    fileIndexEntry fie = alp->fileIx + alp->nfileIx;
+	    int dx = rpmfiDX(fi);
+	    dirInfo die;
 
-	    memset(al->dirs + al->numDirs, 0, sizeof(*al->dirs)); /* overkill */
-	}
+	    /* Map package dirs into the transaction dirInfo index on 1st use. */
+	    if ((die = dirMapping[dx]) == NULL) {
+		const char * DN = rpmfiDN(fi);
+		if (DN == NULL) DN = "";
+		die = dirMapping[dx] = rpmalDirInfo(al, DN, strlen(DN), 1);
+	    }
 
-	if (origNumDirs > al->numDirs) {
-	    if (al->numDirs > 0)
-		al->dirs = xrealloc(al->dirs, al->numDirs * sizeof(*al->dirs));
-	    else
-		al->dirs = _free(al->dirs);
+	    fie->die = die;
+	    /*@-assignexpose -dependenttrans -observertrans @*/
+	    fie->baseName = rpmfiBN(fi);
+	    /*@=assignexpose =dependenttrans =observertrans @*/
+	    if (fie->baseName == NULL) fie->baseName = "";
+	    fie->baseNameLen = strlen(fie->baseName);
+	    fie->pkgNum = pkgNum;
+	    fie->ficolor = rpmfiFColor(fi);
+
+	    die->numFiles++;
+	    alHashAdd(&al->files, &fie->link,
+		hashFunctionString(die->link.hash, fie->baseName, fie->baseNameLen));
+	    alp->nfileIx++;
 	}
     }
+    fi = rpmfiUnlink(fi, "Files index (rpmalAdd)");
+}
+
+/**
+ * Remove a package's provides from the provides index.
+ * @param al		available list
+ * @param alp		available package
+ */
+static void rpmalDelProvides(rpmal al, availablePackage alp)
+	/*@modifies al, alp @*/
+{
+    int i;
+
+    for (i = 0; i < alp->nprovideIx; i++)
+	alHashDel(&al->provides, &alp->provideIx[i].link);
+    alp->provideIx = _free(alp->provideIx);
+    alp->nprovideIx = 0;
+}
+
+void rpmalDel(rpmal al, alKey pkgKey)
+{
+    alNum pkgNum = alKey2Num(al, pkgKey);
+    availablePackage alp;
+
+    if (al == NULL || al->list == NULL)
+	return;		/* XXX can't happen */
+
+    alp = al->list + pkgNum;
+
+    /* Delete directory/file info and provides entries from the index. */
+    rpmalDelFiles(al, alp);
+    rpmalDelProvides(al, alp);
 
     (void)rpmdsFree(alp->provides);
     alp->provides = NULL;
@@ -361,6 +503,7 @@ alKey rpmalAdd(rpmal * alistp, alKey pkgKey, fnpyKey key,
 	    al->list = xrealloc(al->list, sizeof(*al->list) * al->alloced);
 	}
 	pkgNum = al->size++;
+	memset(al->list + pkgNum, 0, sizeof(*al->list));
     }
 
     if (al->list == NULL)
@@ -376,163 +519,34 @@ alKey rpmalAdd(rpmal * alistp, alKey pkgKey, fnpyKey key,
     alp->fi = rpmfiLink(fi, "Files (rpmalAdd)");
 /*@=assignexpose =castexpose @*/
 
-/*@-castexpose@*/
-    fi = rpmfiLink(alp->fi, "Files index (rpmalAdd)");
-/*@=castexpose@*/
-    fi = rpmfiInit(fi, 0);
-    if (rpmfiFC(fi) > 0) {
-	dirInfo dieNeedle =
-		memset(alloca(sizeof(*dieNeedle)), 0, sizeof(*dieNeedle));
-	dirInfo die;
-	int dc = rpmfiDC(fi);
-	int dx;
-	int * dirMapping = alloca(sizeof(*dirMapping) * dc);
-	int * dirUnique = alloca(sizeof(*dirUnique) * dc);
-	const char * DN;
-	int origNumDirs;
-	int first;
-
-	/* XXX FIXME: We ought to relocate the directory list here */
-
-	/* XXX enough space for all directories, late realloc to truncate. */
-	al->dirs = xrealloc(al->dirs, (al->numDirs + dc) * sizeof(*al->dirs));
-
-	/* Only previously allocated dirInfo is sorted and bsearch'able. */
-	origNumDirs = al->numDirs;
-
-	/* Package dirnames are not currently unique. Create unique mapping. */
-	for (dx = 0; dx < dc; dx++) {
-	    int i = 0;
-	    (void) rpmfiSetDX(fi, dx);
-	    DN = rpmfiDN(fi);
-	    if (DN != NULL)
-	    for (i = 0; i < dx; i++) {
-		const char * iDN;
-		(void) rpmfiSetDX(fi, i);
-		iDN = rpmfiDN(fi);
-		if (iDN != NULL && !strcmp(DN, iDN))
-		    /*@innerbreak@*/ break;
-	    }
-	    dirUnique[dx] = i;
-	}
-
-	/* Map package dirs into transaction dirInfo index. */
-	for (dx = 0; dx < dc; dx++) {
-
-	    /* Non-unique package dirs use the 1st entry mapping. */
-	    if (dirUnique[dx] < dx) {
-		dirMapping[dx] = dirMapping[dirUnique[dx]];
-		continue;
-	    }
-
-	    /* Find global dirInfo mapping for first encounter. */
-	    (void) rpmfiSetDX(fi, dx);
-
-	    /*@-assignexpose -dependenttrans -observertrans@*/
-	    dieNeedle->dirName = rpmfiDN(fi);
-	    /*@=assignexpose =dependenttrans =observertrans@*/
-
-	    dieNeedle->dirNameLen = (dieNeedle->dirName != NULL
-			? strlen(dieNeedle->dirName) : 0);
-	    die = bsearch(dieNeedle, al->dirs, origNumDirs,
-			       sizeof(*dieNeedle), dieCompare);
-	    if (die) {
-		dirMapping[dx] = die - al->dirs;
-	    } else {
-		dirMapping[dx] = al->numDirs;
-		die = al->dirs + al->numDirs;
-		if (dieNeedle->dirName != NULL)
-		    die->dirName = xstrdup(dieNeedle->dirName);
-		die->dirNameLen = dieNeedle->dirNameLen;
-		die->files = NULL;
-		die->numFiles = 0;
-
-		al->numDirs++;
-	    }
-	}
-
-	for (first = rpmfiNext(fi); first >= 0;) {
-	    fileIndexEntry fie;
-	    int next;
-
-	    /* Find the first file of the next directory. */
-	    dx = rpmfiDX(fi);
-	    while ((next = rpmfiNext(fi)) >= 0) {
-		if (dx != rpmfiDX(fi))
-		    /*@innerbreak@*/ break;
-	    }
-	    if (next < 0) next = rpmfiFC(fi);	/* XXX reset end-of-list */
-
-	    die = al->dirs + dirMapping[dx];
-	    die->files = xrealloc(die->files,
-			(die->numFiles + next - first) * sizeof(*die->files));
-
-	    fie = die->files + die->numFiles;
-
-	    /* Rewind to first file, generate file index entry for each file. */
-	    fi = rpmfiInit(fi, first);
-	    while ((first = rpmfiNext(fi)) >= 0 && first < next) {
-		/*@-assignexpose -dependenttrans -observertrans @*/
-		fie->baseName = rpmfiBN(fi);
-		/*@=assignexpose =dependenttrans =observertrans @*/
-		fie->baseNameLen = (fie->baseName ? strlen(fie->baseName) : 0);
-		fie->pkgNum = pkgNum;
-		fie->ficolor = rpmfiFColor(fi);
-
-		die->numFiles++;
-		fie++;
-	    }
-	    qsort(die->files, die->numFiles, sizeof(*die->files), fieCompare);
-	}
-
-	/* Resize the directory list. If any directories were added, resort. */
-	al->dirs = xrealloc(al->dirs, al->numDirs * sizeof(*al->dirs));
-	if (origNumDirs != al->numDirs)
-	    qsort(al->dirs, al->numDirs, sizeof(*al->dirs), dieCompare);
-    }
-    fi = rpmfiUnlink(fi, "Files index (rpmalAdd)");
-
-    rpmalFreeIndex(al);
+    /* The index is maintained incrementally, no re-sort is needed. */
+    rpmalAddFiles(al, pkgNum);
+    rpmalAddProvides(al, alNum2Key(al, pkgNum), alp->provides, tscolor);
 
 assert(((alNum)(alp - al->list)) == pkgNum);
     return ((alKey)(alp - al->list));
 }
 
-/**
- * Compare two available index entries by name (qsort/bsearch).
- * @param one		1st available index entry
- * @param two		2nd available index entry
- * @return		result of comparison
- */
-static int indexcmp(const void * one, const void * two)
-	/*@*/
-{
-    /*@-castexpose@*/
-    const availableIndexEntry a = (const availableIndexEntry) one;
-    const availableIndexEntry b = (const availableIndexEntry) two;
-    /*@=castexpose@*/
-    int lenchk;
-
-    lenchk = a->entryLen - b->entryLen;
-    if (lenchk)
-	return lenchk;
-
-    return strcmp(a->entry, b->entry);
-}
-
 void rpmalAddProvides(rpmal al, alKey pkgKey, rpmds provides, rpmuint32_t tscolor)
 {
     rpmuint32_t dscolor;
     const char * Name;
     alNum pkgNum = alKey2Num(al, pkgKey);
-    availableIndex ai = &al->index;
+    availablePackage alp;
     availableIndexEntry aie;
     int ix;
 
-    if (provides == NULL || pkgNum < 0 || pkgNum >= al->size)
+    if (al == NULL || pkgNum < 0 || pkgNum >= al->size)
 	return;
-    if (ai->index == NULL || ai->k < 0 || ai->k >= ai->size)
+    alp = al->list + pkgNum;
+
+    /* Re-adding replaces any provides already indexed for the package. */
+    rpmalDelProvides(al, alp);
+
+    if (provides == NULL || rpmdsCount(provides) <= 0)
 	return;
+    alp->provideIx = xcalloc(rpmdsCount(provides), sizeof(*alp->provideIx));
+    alp->nprovideIx = 0;
 
     if (rpmdsInit(provides) != NULL)
     while (rpmdsNext(provides) >= 0) {
@@ -545,8 +559,8 @@ void rpmalAddProvides(rpmal al, alKey pkgKey, rpmds provides, rpmuint32_t tscolo
 	if (tscolor && dscolor && !(tscolor & dscolor))
 	    continue;
 
-	aie = ai->index + ai->k;
-	ai->k++;
+	aie = alp->provideIx + alp->nprovideIx;
+	alp->nprovideIx++;
 
 	aie->pkgKey = pkgKey;
 /*@-assignexpose@*/
@@ -560,36 +574,24 @@ assert(ix < 0x10000);
 
 	aie->entryIx = ix;
 	aie->type = IET_PROVIDES;
+	alHashAdd(&al->provides, &aie->link,
+		hashFunctionString(0, Name, aie->entryLen));
     }
 }
 
 void rpmalMakeIndex(rpmal al)
 {
-    availableIndex ai;
     availablePackage alp;
     int i;
 
     if (al == NULL || al->list == NULL) return;
-    ai = &al->index;
-
-    ai->size = 0;
-    for (i = 0; i < al->size; i++) {
-	alp = al->list + i;
-	if (alp->provides != NULL)
-	    ai->size += rpmdsCount(alp->provides);
-    }
-    if (ai->size == 0) return;
 
-    ai->index = xrealloc(ai->index, ai->size * sizeof(*ai->index));
-    ai->k = 0;
+    /* The index is maintained by rpmalAdd/rpmalDel: only fill in gaps. */
     for (i = 0; i < al->size; i++) {
 	alp = al->list + i;
-	rpmalAddProvides(al, alNum2Key(NULL, (alNum)i), alp->provides, alp->tscolor);
+	if (alp->provides != NULL && alp->provideIx == NULL)
+	    rpmalAddProvides(al, alNum2Key(NULL, (alNum)i), alp->provides, alp->tscolor);
     }
-
-    /* Reset size to the no. of provides added. */
-    ai->size = ai->k;
-    qsort(ai->index, ai->size, sizeof(*ai->index), indexcmp);
 }
 
 fnpyKey *
@@ -598,63 +600,40 @@ rpmalAllFileSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
     rpmuint32_t tscolor;
     rpmuint32_t ficolor;
     int found = 0;
-    const char * dirName;
     const char * baseName;
-    dirInfo dieNeedle =
-		memset(alloca(sizeof(*dieNeedle)), 0, sizeof(*dieNeedle));
+    size_t baseNameLen;
     dirInfo die;
-    fileIndexEntry fieNeedle =
-		memset(alloca(sizeof(*fieNeedle)), 0, sizeof(*fieNeedle));
     fileIndexEntry fie;
     availablePackage alp;
     fnpyKey * ret = NULL;
     const char * fileName;
+    rpmuint32_t hash;
+    alHashLink l;
 
     if (keyp) *keyp = RPMAL_NOMATCH;
 
     if (al == NULL || (fileName = rpmdsN(ds)) == NULL || *fileName != '/')
 	return NULL;
 
-    /* Solaris 2.6 bsearch sucks down on this. */
-    if (al->numDirs == 0 || al->dirs == NULL || al->list == NULL)
+    if (al->files.nitems == 0 || al->list == NULL)
 	return NULL;
 
-    {	char * t;
-	dirName = t = xstrdup(fileName);
-	if ((t = strrchr(t, '/')) != NULL) {
-	    t++;		/* leave the trailing '/' */
-	    *t = '\0';
-	}
-    }
+    /* Split the path, leaving the trailing '/' on the dirName. */
+    baseName = strrchr(fileName, '/') + 1;
+    baseNameLen = strlen(baseName);
 
-    dieNeedle->dirName = (char *) dirName;
-    dieNeedle->dirNameLen = strlen(dirName);
-    die = bsearch(dieNeedle, al->dirs, al->numDirs,
-		       sizeof(*dieNeedle), dieCompare);
+    die = rpmalDirInfo(al, fileName, (size_t)(baseName - fileName), 0);
     if (die == NULL)
 	goto exit;
 
-    /* rewind to the first match */
-    while (die > al->dirs && dieCompare(die-1, dieNeedle) == 0)
-	die--;
-
-    if ((baseName = strrchr(fileName, '/')) == NULL)
-	goto exit;
-    baseName++;
-
-    for (found = 0, ret = NULL;
-	 die < al->dirs + al->numDirs && dieCompare(die, dieNeedle) == 0;
-	 die++)
-    {
-
-/*@-observertrans@*/
-	fieNeedle->baseName = baseName;
-/*@=observertrans@*/
-	fieNeedle->baseNameLen = strlen(fieNeedle->baseName);
-	fie = bsearch(fieNeedle, die->files, die->numFiles,
-		       sizeof(*fieNeedle), fieCompare);
-	if (fie == NULL)
-	    continue;	/* XXX shouldn't happen */
+    hash = hashFunctionString(die->link.hash, baseName, baseNameLen);
+    for (l = alHashFirst(&al->files, hash); l != NULL; l = l->next) {
+	if (l->hash != hash)
+	    continue;
+	fie = (fileIndexEntry) l;
+	if (fie->die != die || fie->baseNameLen != baseNameLen
+	 || strcmp(fie->baseName, baseName))
+	    continue;
 
 	alp = al->list + fie->pkgNum;
 
@@ -675,7 +654,6 @@ rpmalAllFileSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
     }
 
 exit:
-    dirName = _free(dirName);
     if (ret)
 	ret[found] = NULL;
     return ret;
@@ -684,13 +662,14 @@ exit:
 fnpyKey *
 rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
 {
-    availableIndex ai;
-    availableIndexEntry needle;
     availableIndexEntry match;
     fnpyKey * ret = NULL;
     int found = 0;
     const char * KName;
+    size_t KNameLen;
     availablePackage alp;
+    rpmuint32_t hash;
+    alHashLink l;
     int rc;
 
     if (keyp) *keyp = RPMAL_NOMATCH;
@@ -707,29 +686,21 @@ rpmalAllSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
 	/* ... then, look for files "provided" by package. */
     }
 
-    ai = &al->index;
-    if (ai->index == NULL || ai->size <= 0)
+    if (al->provides.nitems == 0)
 	return NULL;
 
-    needle = memset(alloca(sizeof(*needle)), 0, sizeof(*needle));
-    /*@-assignexpose -temptrans@*/
-    needle->entry = KName;
-    /*@=assignexpose =temptrans@*/
-    needle->entryLen = (unsigned short)strlen(needle->entry);
-
-    match = bsearch(needle, ai->index, ai->size, sizeof(*ai->index), indexcmp);
-    if (match == NULL)
-	return NULL;
-
-    /* rewind to the first match */
-    while (match > ai->index && indexcmp(match-1, needle) == 0)
-	match--;
+    KNameLen = strlen(KName);
+    hash = hashFunctionString(0, KName, KNameLen);
 
     if (al->list != NULL)	/* XXX always true */
-    for (ret = NULL, found = 0;
-	 match < ai->index + ai->size && indexcmp(match, needle) == 0;
-	 match++)
-    {
+    for (l = alHashFirst(&al->provides, hash); l != NULL; l = l->next) {
+	if (l->hash != hash)
+	    continue;
+	match = (availableIndexEntry) l;
+	if (match->entryLen != (unsigned short)KNameLen
+	 || strcmp(match->entry, KName))
+	    continue;
+
 	alp = al->list + alKey2Num(al, match->pkgKey);
 
 	rc = 0;
@@ -8,6 +8,8 @@
 #include <rpmio_internal.h>
 #include <poptIO.h>
 #include <rpmbc.h>		/* XXX beecrypt base64 */
+#include <rpmtpool.h>
+#include <yarn.h>
 
 #define	_RPMHKP_INTERNAL	/* XXX internal prototypes. */
 #include <rpmhkp.h>
@@ -910,11 +912,98 @@ rpmtsClean(ts);
 }
 
 /**
+ * A message from checking a package, displayed later in argument order.
+ */
+typedef struct rpmckMsg_s * rpmckMsg;
+struct rpmckMsg_s {
+/*@null@*/
+    rpmckMsg next;		/*!< next message */
+    int code;			/*!< rpmlog code */
+    char text[1];		/*!< message text */
+};
+
+/**
+ * Shared state of package files checked by worker threads.
+ */
+typedef struct rpmck_s * rpmck;
+struct rpmck_s {
+/*@dependent@*/
+    rpmts ts;			/*!< keyring (and pubkey cache) owner */
+    QVA_t qva;			/*!< check flags */
+    yarnLock keylock;		/*!< serializes pubkey lookups through ts */
+    yarnLock idle;		/*!< protects the idle worker ts stack */
+/*@only@*/
+    rpmts * tss;		/*!< idle worker transaction sets */
+    int ntss;			/*!< no. of idle worker transaction sets */
+};
+
+/**
+ * A package file checked by a worker thread.
+ */
+typedef struct rpmckJob_s * rpmckJob;
+struct rpmckJob_s {
+/*@dependent@*/
+    rpmck ck;			/*!< shared state */
+/*@observer@*/
+    const char * fn;		/*!< package file name */
+/*@only@*/ /*@null@*/
+    rpmckMsg msgs;		/*!< messages (in order) */
+    rpmckMsg * tail;		/*!< end of messages */
+    yarnLock done;		/*!< becomes 1 when checked */
+    int res;			/*!< 1 on failure */
+};
+
+/**
+ * Log a message now, or save it with a worker thread job.
+ * @param job		worker thread job (NULL logs immediately)
+ * @param code		rpmlog code
+ * @param fmt		format
+ */
+/*@printflike@*/
+static void ckLog(/*@null@*/ rpmckJob job, int code, const char * fmt, ...)
+	/*@modifies job @*/
+{
+    va_list ap;
+
+    if (job == NULL) {
+	if (RPMLOG_MASK(RPMLOG_PRI(code)) & rpmlogSetMask(0)) {
+	    va_start(ap, fmt);
+	    vrpmlog(code, fmt, ap);
+	    va_end(ap);
+	}
+    } else {
+	rpmckMsg m;
+	int nb;
+
+	va_start(ap, fmt);
+	nb = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (nb < 0)
+	    return;
+	m = xmalloc(sizeof(*m) + nb);
+	m->next = NULL;
+	m->code = code;
+	va_start(ap, fmt);
+	(void) vsnprintf(m->text, nb + 1, fmt, ap);
+	va_end(ap);
+	*job->tail = m;
+	job->tail = &m->next;
+    }
+}
+
+/**
+ * Read the header and (if needed) the payload, digesting on the fly.
  * @todo If the GPG key was known available, the md5 digest could be skipped.
+ * @param fd		package file handle (at the header)
+ * @param fn		package file name
+ * @param job		worker thread job (NULL logs immediately)
+ * @param payload	read the payload too?
+ * @return		RPMRC_OK on success
  */
-static rpmRC readFile(FD_t fd, const char * fn)
+static rpmRC readFile(FD_t fd, const char * fn, /*@null@*/ rpmckJob job,
+		int payload)
 	/*@globals fileSystem, internalState @*/
-	/*@modifies fd, fileSystem, internalState @*/
+	/*@modifies fd, job, fileSystem, internalState @*/
 {
 rpmxar xar = fdGetXAR(fd);
 pgpDig dig = fdGetDig(fd);
@@ -933,7 +1022,7 @@ pgpDig dig = fdGetDig(fd);
 	const char * msg = NULL;
 	rc = rpmpkgRead(item, fd, &h, &msg);
 	if (rc != RPMRC_OK) {
-	    rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, item, msg);
+	    ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, item, msg);
 	    msg = _free(msg);
 	    goto exit;
 	}
@@ -974,7 +1063,7 @@ pgpDig dig = fdGetDig(fd);
 	    if (!xx || he->p.ptr == NULL) {
 		(void)headerFree(h);
 		h = NULL;
-		rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, _("headerGet failed"),
+		ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, _("headerGet failed"),
 			_("failed to retrieve original header\n"));
 		rc = RPMRC_FAIL;
 		goto exit;
@@ -994,10 +1083,16 @@ pgpDig dig = fdGetDig(fd);
 	h = NULL;
     }
 
+    /* Header-only signatures don't need the payload. */
+    if (!payload) {
+	rc = RPMRC_OK;
+	goto exit;
+    }
+
     if (xar != NULL) {
 	const char item[] = "Payload";
 	if ((xx = rpmxarNext(xar)) != 0 || (xx = rpmxarPull(xar, item)) != 0) {
-	    rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, item,
+	    ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, item,
 		_("XAR file not found (or no XAR support)"));
 	    rc = RPMRC_NOTFOUND;
 	    goto exit;
@@ -1008,7 +1103,7 @@ pgpDig dig = fdGetDig(fd);
     while ((count = Fread(buf, sizeof(buf[0]), sizeof(buf), fd)) > 0)
 	dig->nbytes += count;
     if (count < 0 || Ferror(fd)) {
-	rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, _("Fread failed"), Fstrerror(fd));
+	ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, _("Fread failed"), Fstrerror(fd));
 	rc = RPMRC_FAIL;
 	goto exit;
     }
@@ -1022,13 +1117,23 @@ exit:
     return rc;
 }
 
-int rpmVerifySignatures(QVA_t qva, rpmts ts, void * _fd, const char * fn)
+/**
+ * Check the signature(s) and digest(s) of a package file.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param fd		package file handle
+ * @param fn		package file name
+ * @param job		worker thread job (NULL logs immediately)
+ * @return		0 on success
+ */
+static int rpmckVerify(QVA_t qva, rpmts ts, FD_t fd, const char * fn,
+		/*@null@*/ rpmckJob job)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ts, fd, job, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
 {
     HE_t he = memset(alloca(sizeof(*he)), 0, sizeof(*he));
     HE_t she = memset(alloca(sizeof(*she)), 0, sizeof(*she));
-/*@-castexpose@*/
-    FD_t fd = (FD_t)_fd;
-/*@=castexpose@*/
     char result[1024];
     char buf[8192], * b;
     char missingKeys[7164], * m;
@@ -1044,6 +1149,7 @@ int rpmVerifySignatures(QVA_t qva, rpmts ts, void * _fd, const char * fn)
     int failed;
     int nodigests = !(qva->qva_flags & VERIFY_DIGEST);
     int nosignatures = !(qva->qva_flags & VERIFY_SIGNATURE);
+    int payload;
 pgpPkt pp = alloca(sizeof(*pp));
 
     {
@@ -1053,7 +1159,7 @@ pgpPkt pp = alloca(sizeof(*pp));
 	    rc = rpmpkgRead(item, fd, NULL, &msg);
 /*@=mods@*/
 	    if (rc != RPMRC_OK) {
-		rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, item, msg);
+		ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, item, msg);
 		msg = _free(msg);
 		res++;
 		goto exit;
@@ -1068,7 +1174,7 @@ pgpPkt pp = alloca(sizeof(*pp));
 /*@=mods@*/
 	    switch (rc) {
 	    default:
-		rpmlog(RPMLOG_ERR, "%s: %s: %s\n", fn, item,
+		ckLog(job, RPMLOG_ERR, "%s: %s: %s\n", fn, item,
 			(msg && *msg ? msg : ""));
 		msg = _free(msg);
 		res++;
@@ -1076,7 +1182,7 @@ pgpPkt pp = alloca(sizeof(*pp));
 		/*@notreached@*/ /*@switchbreak@*/ break;
 	    case RPMRC_OK:
 		if (sigh == NULL) {
-		    rpmlog(RPMLOG_ERR, _("%s: No signature available\n"), fn);
+		    ckLog(job, RPMLOG_ERR, _("%s: No signature available\n"), fn);
 		    res++;
 		    goto exit;
 		}
@@ -1115,15 +1221,17 @@ pgpPkt pp = alloca(sizeof(*pp));
 	    he->p.ptr = _free(he->p.ptr);
 	}
 
+	/* Only the MD5 digest covers the payload. */
+	payload = (!nodigests && headerIsEntry(sigh, (rpmTag)RPMSIGTAG_MD5));
 /*@-mods@*/	/* LCL: avoid void * _fd annotation for now. */
-	if (headerIsEntry(sigh, (rpmTag)RPMSIGTAG_MD5))
+	if (payload)
 	    fdInitDigest(fd, PGPHASHALGO_MD5, 0);
 /*@=mods@*/
 
-	/* Read the file, generating digest(s) on the fly. */
+	/* Read the file once, generating all digest(s) on the fly. */
 /*@-mods@*/	/* LCL: avoid void * _fd annotation for now. */
 	if (dig == NULL || sigp == NULL
-	 || readFile(fd, fn) != RPMRC_OK)
+	 || readFile(fd, fn, job, payload) != RPMRC_OK)
 	{
 	    res++;
 	    goto exit;
@@ -1161,7 +1269,7 @@ assert(she->p.ptr != NULL);
 		xx = pgpPktLen(she->p.ptr, she->c, pp);
 		xx = rpmhkpLoadSignature(NULL, dig, pp);
 		if (sigp->version != 3 && sigp->version != 4) {
-		    rpmlog(RPMLOG_ERR,
+		    ckLog(job, RPMLOG_ERR,
 		_("skipping package %s with unverifiable V%u signature\n"),
 			fn, sigp->version);
 		    res++;
@@ -1247,9 +1355,9 @@ assert(she->p.ptr != NULL);
 
 	if (failed) {
 	    if (rpmIsVerbose()) {
-		rpmlog(RPMLOG_NOTICE, "%s", buf);
+		ckLog(job, RPMLOG_NOTICE, "%s", buf);
 	    } else {
-		rpmlog(RPMLOG_NOTICE, "%s%s%s%s%s%s%s%s\n", buf,
+		ckLog(job, RPMLOG_NOTICE, "%s%s%s%s%s%s%s%s\n", buf,
 			_("NOT_OK"),
 			(missingKeys[0] != '\0') ? _(" (MISSING KEYS:") : "",
 			missingKeys,
@@ -1261,9 +1369,9 @@ assert(she->p.ptr != NULL);
 	    }
 	} else {
 	    if (rpmIsVerbose()) {
-		rpmlog(RPMLOG_NOTICE, "%s", buf);
+		ckLog(job, RPMLOG_NOTICE, "%s", buf);
 	    } else {
-		rpmlog(RPMLOG_NOTICE, "%s%s%s%s%s%s%s%s\n", buf,
+		ckLog(job, RPMLOG_NOTICE, "%s%s%s%s%s%s%s%s\n", buf,
 			_("OK"),
 			(missingKeys[0] != '\0') ? _(" (MISSING KEYS:") : "",
 			missingKeys,
@@ -1283,6 +1391,225 @@ exit:
     return res;
 }
 
+int rpmVerifySignatures(QVA_t qva, rpmts ts, void * _fd, const char * fn)
+{
+/*@-castexpose@*/
+    FD_t fd = (FD_t)_fd;
+/*@=castexpose@*/
+
+    return rpmckVerify(qva, ts, fd, fn, NULL);
+}
+
+/**
+ * Check a package file.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param fn		package file name
+ * @param job		worker thread job (NULL logs immediately)
+ * @return		0 on success
+ */
+static int rpmckFile(QVA_t qva, rpmts ts, const char * fn,
+		/*@null@*/ rpmckJob job)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ts, job, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+{
+    FD_t fd;
+    int res = 0;
+    int xx;
+
+    fd = Fopen(fn, "r.fdio");
+    if (fd == NULL || Ferror(fd)) {
+	ckLog(job, RPMLOG_ERR, _("%s: open failed: %s\n"),
+		 fn, Fstrerror(fd));
+	res++;
+    } else {
+#if defined(POSIX_FADV_SEQUENTIAL)
+	xx = Fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	if (rpmckVerify(qva, ts, fd, fn, job))
+	    res++;
+    }
+
+    if (fd != NULL) {
+	xx = Fclose(fd);
+    }
+    return res;
+}
+
+/**
+ * Find a pubkey for a worker thread, using the keyring of the shared ts.
+ * @param _ck		shared state
+ * @param _dig		worker thread signature parameters
+ * @return		RPMRC_OK on success
+ */
+static int ckFindPubkey(void * _ck, /*@null@*/ void * _dig)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies _ck, _dig, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+{
+    rpmck ck = _ck;
+    rpmts ts = ck->ts;
+    pgpDig odig;
+    rpmRC rc;
+
+    /* XXX rpmtsFindPubkey() expects the dig to be attached to the ts. */
+    yarnPossess(ck->keylock);
+    odig = ts->dig;
+    ts->dig = _dig;
+    rc = rpmtsFindPubkey(ts, _dig);
+    ts->dig = odig;
+    yarnRelease(ck->keylock);
+    return (int) rc;
+}
+
+/**
+ * Check a package file on a worker thread.
+ * @param _job		worker thread job
+ */
+static void rpmckJobRun(void * _job)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies _job, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+{
+    rpmckJob job = _job;
+    rpmck ck = job->ck;
+    rpmts ts;
+    int xx;
+
+    /* There are never more jobs running than worker transaction sets. */
+    yarnPossess(ck->idle);
+assert(ck->ntss > 0);
+    ts = ck->tss[--ck->ntss];
+    yarnRelease(ck->idle);
+
+/*@-refcounttrans@*/
+    xx = pgpSetFindPubkey(rpmtsDig(ts), ckFindPubkey, ck);
+/*@=refcounttrans@*/
+    job->res = rpmckFile(ck->qva, ts, job->fn, job);
+    rpmtsCleanDig(ts);
+
+    yarnPossess(ck->idle);
+    ck->tss[ck->ntss++] = ts;
+    yarnRelease(ck->idle);
+
+    yarnPossess(job->done);
+    yarnTwist(job->done, TO, 1);
+}
+
+/**
+ * Wait for a worker thread job, then display its messages.
+ * @param job		worker thread job
+ * @return		0 on success
+ */
+static int rpmckJobDone(rpmckJob job)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies job, fileSystem, internalState @*/
+{
+    rpmckMsg m;
+
+    yarnPossess(job->done);
+    yarnWaitFor(job->done, TO_BE, 1);
+    yarnRelease(job->done);
+    job->done = yarnFreeLock(job->done);
+
+    while ((m = job->msgs) != NULL) {
+	job->msgs = m->next;
+	rpmlog(m->code, "%s", m->text);
+	m = _free(m);
+    }
+    return job->res;
+}
+
+/**
+ * Check package files on worker threads, displaying results in order.
+ * Each worker thread has its own transaction set (and pgpDig); pubkeys
+ * are found (one at a time) in the keyring of ts.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param av		package file names
+ * @param nthreads	no. of worker threads (<= 0 uses no. of cpus)
+ * @return		no. of failed packages
+ */
+static int rpmckParallel(QVA_t qva, rpmts ts, ARGV_t av, int nthreads)
+	/*@globals _rpmts_stats, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+	/*@modifies ts, _rpmts_stats, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+{
+    int nfiles = argvCount(av);
+    rpmtpool tp = NULL;
+    struct rpmck_s _ck;
+    rpmck ck = &_ck;
+    rpmckJob jobs;
+    int window;
+    int stats;
+    int res = 0;
+    int i, j;
+    int xx;
+
+    if (nfiles > 1) {
+	tp = rpmtpoolNew(nthreads);
+	if (rpmtpoolThreads(tp) < 2)
+	    tp = rpmtpoolFree(tp);
+    }
+    if (tp == NULL) {
+	for (i = 0; i < nfiles; i++)
+	    res += rpmckFile(qva, ts, av[i], NULL);
+	return res;
+    }
+    nthreads = rpmtpoolThreads(tp);
+    window = 4 * nthreads;
+
+    memset(ck, 0, sizeof(*ck));
+    ck->ts = ts;
+    ck->qva = qva;
+    ck->keylock = yarnNewLock(0);
+    ck->idle = yarnNewLock(0);
+    ck->tss = xcalloc(nthreads, sizeof(*ck->tss));
+    for (i = 0; i < nthreads; i++)
+	ck->tss[ck->ntss++] = rpmtsCreate();
+
+    jobs = xcalloc(nfiles, sizeof(*jobs));
+    for (i = 0, j = 0; i < nfiles; i++) {
+	rpmckJob job = jobs + i;
+
+	/* Keep at most window files in flight, displaying the oldest. */
+	if (i - j >= window)
+	    res += rpmckJobDone(jobs + j++);
+
+	job->ck = ck;
+	job->fn = av[i];
+	job->msgs = NULL;
+	job->tail = &job->msgs;
+	job->done = yarnNewLock(0);
+	job->res = 0;
+	xx = rpmtpoolSubmit(tp, rpmckJobRun, job);
+    }
+    while (j < nfiles)
+	res += rpmckJobDone(jobs + j++);
+    tp = rpmtpoolFree(tp);
+    jobs = _free(jobs);
+
+    /* Add the worker statistics to ts (and display them with it). */
+    stats = _rpmts_stats;
+    _rpmts_stats = 0;
+    for (i = 0; i < ck->ntss; i++) {
+	rpmts wts = ck->tss[i];
+	xx = rpmswAdd(rpmtsOp(ts, RPMTS_OP_DIGEST),
+		rpmtsOp(wts, RPMTS_OP_DIGEST));
+	xx = rpmswAdd(rpmtsOp(ts, RPMTS_OP_SIGNATURE),
+		rpmtsOp(wts, RPMTS_OP_SIGNATURE));
+	(void) rpmtsFree(wts);
+    }
+    _rpmts_stats = stats;
+    ck->tss = _free(ck->tss);
+    ck->keylock = yarnFreeLock(ck->keylock);
+    ck->idle = yarnFreeLock(ck->idle);
+
+    return res;
+}
+
 int rpmcliSign(rpmts ts, QVA_t qva, const char ** argv)
 	/*@globals rpmioFtsOpts @*/
 	/*@modifies rpmioFtsOpts @*/
@@ -1312,31 +1639,27 @@ int rpmcliSign(rpmts ts, QVA_t qva, const char ** argv)
 
     int tag = (qva->qva_source == RPMQV_FTSWALK)
 	? RPMDBI_FTSWALK : RPMDBI_ARGLIST;
+    int nthreads =
+	rpmExpandNumeric("%{?_checksig_threads}%{!?_checksig_threads:1}");
     rpmgi gi = rpmgiNew(ts, tag, NULL, 0);
     rpmgiFlags _giFlags = RPMGI_NONE;
     rpmRC rc;
+    int xx;
 
     if (rpmioFtsOpts == 0)
 	rpmioFtsOpts = (FTS_COMFOLLOW | FTS_LOGICAL | FTS_NOSTAT);
     rc = rpmgiSetArgs(gi, argv, rpmioFtsOpts, (_giFlags|RPMGI_NOHEADER));
-    while (rpmgiNext(gi) == RPMRC_OK) {
-	const char * fn = rpmgiHdrPath(gi);
-	FD_t fd;
-	int xx;
-
-	fd = Fopen(fn, "r.fdio");
-	if (fd == NULL || Ferror(fd)) {
-	    rpmlog(RPMLOG_ERR, _("%s: open failed: %s\n"), 
-		     fn, Fstrerror(fd));
-	    res++;
-	} else if (rpmVerifySignatures(qva, ts, fd, fn)) {
-	    res++;
-	}
-
-	if (fd != NULL) {
-	    xx = Fclose(fd);
-	}
-    }
+    if (nthreads != 1) {
+	ARGV_t av = NULL;
+
+	/* Collect the file names, then check them on worker threads. */
+	while (rpmgiNext(gi) == RPMRC_OK)
+	    xx = argvAdd(&av, rpmgiHdrPath(gi));
+	res += rpmckParallel(qva, ts, av, nthreads);
+	av = argvFree(av);
+    } else
+    while (rpmgiNext(gi) == RPMRC_OK)
+	res += rpmckFile(qva, ts, rpmgiHdrPath(gi), NULL);
 
     gi = rpmgiFree(gi);
 
@@ -647,6 +647,8 @@ struct rpmQVKArguments_s {
     int qva_verbose;		/*!< (unused) */
 /*@only@*/ /*@null@*/
     const char * qva_queryFormat;/*!< Format for headerSprintf(). */
+/*@only@*/ /*@null@*/
+    hdrfmt_t qva_hdrfmt;	/*!< Compiled qva_queryFormat. */
     int sign;			/*!< Is a passphrase needed? */
     int nopassword;
     int trust;			/*!< Trust metric when importing pubkeys. */
@@ -156,10 +156,47 @@ const char * rpmdsType(const rpmds ds)
     return rpmdsTagName(rpmdsTagN(ds));
 }
 
+/**
+ * Free parsed EVR comparison keys.
+ * @param ds		dependency set
+ */
+static void rpmdsEVRkeysFree(rpmds ds)
+	/*@modifies ds @*/
+{
+    if (ds->EVRk != NULL) {
+	int i;
+	for (i = 0; i < (int)ds->Count; i++)
+	    ds->EVRk[i] = rpmEVRfree(ds->EVRk[i]);
+	ds->EVRk = _free(ds->EVRk);
+    }
+}
+
+/**
+ * Return parsed EVR comparison key of current element, parsing once.
+ * @param ds		dependency set
+ * @return		parsed EVR
+ */
+static EVR_t rpmdsEVRkey(rpmds ds)
+	/*@modifies ds @*/
+{
+    EVR_t evr;
+    int xx;
+
+assert(ds->i >= 0 && ds->i < (int)ds->Count);
+    if (ds->EVRk == NULL)
+	ds->EVRk = xcalloc(ds->Count, sizeof(*ds->EVRk));
+    if ((evr = ds->EVRk[ds->i]) == NULL) {
+	evr = ds->EVRk[ds->i] = rpmEVRnew(0, 0);
+	xx = (ds->EVRparse ? ds->EVRparse : rpmEVRparse) (ds->EVR[ds->i], evr);
+    }
+    return evr;
+}
+
 static void rpmdsFini(void * _ds)
 {
     rpmds ds = _ds;
 
+    rpmdsEVRkeysFree(ds);
     if (ds->Count > 0) {
 	ds->N = _free(ds->N);
 	ds->EVR = _free(ds->EVR);
@@ -764,6 +801,7 @@ void * rpmdsSetEVRparse(rpmds ds,
     if (ds != NULL) {
 /*@i@*/	oEVRparse = ds->EVRparse;
 /*@i@*/	ds->EVRparse = EVRparse;
+	rpmdsEVRkeysFree(ds);
     }
     return oEVRparse;
 }
@@ -1088,6 +1126,7 @@ assert(ods->Flags != NULL);
 	ds->Flags = Flags;
 /*@=nullderef =nullpass =nullptrarith @*/
 
+	rpmdsEVRkeysFree(ds);
 	ds->i = -1;
 	ds->Count++;
 
@@ -3782,15 +3821,14 @@ int rpmdsCompare(const rpmds A, const rpmds B)
 {
     const char *aDepend = (A->DNEVR != NULL ? xstrdup(A->DNEVR+2) : "");
     const char *bDepend = (B->DNEVR != NULL ? xstrdup(B->DNEVR+2) : "");
-    EVR_t a = memset(alloca(sizeof(*a)), 0, sizeof(*a));
-    EVR_t b = memset(alloca(sizeof(*a)), 0, sizeof(*a));
+    EVR_t a;
+    EVR_t b;
     evrFlags aFlags = A->ns.Flags;
     evrFlags bFlags = B->ns.Flags;
     int (*EVRcmp) (const char *a, const char *b);
     int result = 1;
     const char * s;
     int sense;
-    int xx;
 
 assert((rpmdsFlags(A) & RPMSENSE_SENSEMASK) == A->ns.Flags);
 assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
@@ -3813,9 +3851,9 @@ assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
     if (!(A->EVR[A->i] && *A->EVR[A->i] && B->EVR[B->i] && *B->EVR[B->i]))
 	goto exit;
 
-    /* Both AEVR and BEVR exist. */
-    xx = (A->EVRparse ? A->EVRparse : rpmEVRparse) (A->EVR[A->i], a);
-    xx = (B->EVRparse ? B->EVRparse : rpmEVRparse) (B->EVR[B->i], b);
+    /* Both AEVR and BEVR exist, parsed once per element. */
+    a = rpmdsEVRkey(A);
+    b = rpmdsEVRkey(B);
 
     /* If EVRcmp is identical, use that, otherwise use default. */
     EVRcmp = (A->EVRcmp && B->EVRcmp && A->EVRcmp == B->EVRcmp)
@@ -3855,9 +3893,6 @@ assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
 	    break;
     }
 
-    a->str = _free(a->str);
-    b->str = _free(b->str);
-
     /* Detect overlap of {A,B} range. */
     if (aFlags == RPMSENSE_NOTEQUAL || bFlags == RPMSENSE_NOTEQUAL) {
 	result = (sense != 0);
@@ -59,6 +59,8 @@ struct rpmds_s {
 /*@null@*/
     int (*EVRparse) (const char *evrstr, EVR_t evr);	 /* EVR parsing. */
     int (*EVRcmp) (const char *a, const char *b);	 /* EVR comparison. */
+/*@only@*/ /*@null@*/
+    EVR_t * EVRk;		/*!< Parsed EVR comparison keys (lazy). */
     struct rpmns_s ns;		/*!< Name (split). */
 /*@only@*/ /*@null@*/
     miRE exclude;		/*!< Iterator exclude patterns. */
@@ -692,6 +692,17 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("readhdr:     ", rpmtsOp(ts, RPMTS_OP_READHDR));
     rpmtsPrintStat("hdrload:     ", rpmtsOp(ts, RPMTS_OP_HDRLOAD));
     rpmtsPrintStat("hdrget:      ", rpmtsOp(ts, RPMTS_OP_HDRGET));
+    rpmtsPrintStat("fsmread:     ", rpmtsOp(ts, RPMTS_OP_FSMREAD));
+    rpmtsPrintStat("fsmwrite:    ", rpmtsOp(ts, RPMTS_OP_FSMWRITE));
+    rpmtsPrintStat("fsmwait:     ", rpmtsOp(ts, RPMTS_OP_FSMWAIT));
+    rpmtsPrintStat("fsync:       ", rpmtsOp(ts, RPMTS_OP_FSYNC));
+    rpmtsPrintStat("dephit:      ", rpmtsOp(ts, RPMTS_OP_DEPHIT));
+    rpmtsPrintStat("depmiss:     ", rpmtsOp(ts, RPMTS_OP_DEPMISS));
+    rpmtsPrintStat("vfystat:     ", rpmtsOp(ts, RPMTS_OP_VFYSTAT));
+    rpmtsPrintStat("vfydigest:   ", rpmtsOp(ts, RPMTS_OP_VFYDIGEST));
+    rpmtsPrintStat("prelink:     ", rpmtsOp(ts, RPMTS_OP_PRELINK));
+    rpmtsPrintStat("pkhit:       ", rpmtsOp(ts, RPMTS_OP_PKHIT));
+    rpmtsPrintStat("pkmiss:      ", rpmtsOp(ts, RPMTS_OP_PKMISS));
 /*@-globstate@*/
     return;
 /*@=globstate@*/
@@ -703,14 +714,7 @@ static void rpmtsFini(void * _ts)
     rpmts ts = _ts;
 
 /*@-nullstate@*/	/* FIX: partial annotations */
-    /* XXX there's a recursion here ... release and reacquire the lock */
-#ifndef	BUGGY
-    yarnRelease(ts->_item.use);	/* XXX hack-o-round */
-#endif
     rpmtsEmpty(ts);
-#ifndef	BUGGY
-    yarnPossess(ts->_item.use);	/* XXX hack-o-round */
-#endif
 /*@=nullstate@*/
 
     ts->PRCO = rpmdsFreePRCO(ts->PRCO);
@@ -747,6 +751,7 @@ assert(ts->txn == NULL);	/* XXX FIXME */
     ts->keyring = rpmKeyringFree(ts->keyring);
     (void) rpmhkpFree(ts->hkp);
     ts->hkp = NULL;
+    rpmtsCleanPubkeys(ts);
 
     if (_rpmts_stats)
 	rpmtsPrintStats(ts);
@@ -1524,6 +1529,7 @@ rpmts rpmtsCreate(void)
 
     ts->keyring = NULL;
     ts->hkp = NULL;
+    ts->pkc = NULL;
     ts->dig = NULL;
 
     /* Set autorollback goal to the end of time. */
@@ -135,8 +135,19 @@ typedef	enum rpmtsOpX_e {
     RPMTS_OP_READHDR		= 17,
     RPMTS_OP_HDRLOAD		= 18,
     RPMTS_OP_HDRGET		= 19,
-    RPMTS_OP_DEBUG		= 20,
-    RPMTS_OP_MAX		= 20
+    RPMTS_OP_FSMREAD		= 20,
+    RPMTS_OP_FSMWRITE		= 21,
+    RPMTS_OP_FSMWAIT		= 22,
+    RPMTS_OP_FSYNC		= 23,
+    RPMTS_OP_DEPHIT		= 24,
+    RPMTS_OP_DEPMISS		= 25,
+    RPMTS_OP_VFYSTAT		= 26,
+    RPMTS_OP_VFYDIGEST		= 27,
+    RPMTS_OP_PRELINK		= 28,
+    RPMTS_OP_PKHIT		= 29,
+    RPMTS_OP_PKMISS		= 30,
+    RPMTS_OP_DEBUG		= 31,
+    RPMTS_OP_MAX		= 31
 } rpmtsOpX;
 
 /** \ingroup rpmts
@@ -311,6 +322,8 @@ struct rpmts_s {
     rpmKeyring keyring;		/*!< Keyring in use. */
 /*@relnull@*/
     void * hkp;			/*!< Pubkey validation container. */
+/*@relnull@*/
+    void * pkc;			/*!< Pubkey cache (by signer key id). */
 
     struct rpmop_s ops[RPMTS_OP_MAX];
 
@@ -633,6 +646,13 @@ void rpmtsCleanDig(rpmts ts)
 	/*@globals fileSystem @*/
 	/*@modifies ts, fileSystem @*/;
 
+/** \ingroup rpmts
+ * Free (or release the process-wide) pubkey cache.
+ * @param ts		transaction set
+ */
+void rpmtsCleanPubkeys(rpmts ts)
+	/*@modifies ts @*/;
+
 /** \ingroup rpmts
  * Free memory needed only for dependency checks and ordering.
  * @param ts		transaction set
@@ -0,0 +1,179 @@
+/** \ingroup rpmdep
+ * \file lib/talbench.c
+ * Time the added package index (as rpmtsAddInstallElement() and
+ * rpmtsCheck() use it) on the headers from the argument packages.
+ *
+ * Each loop adds every package to an available list, resolves every
+ * Requires: of every package against it, and then deletes the packages.
+ */
+
+#include "system.h"
+
+#include <rpmio.h>
+#include <rpmiotypes.h>		/* XXX fnpyKey */
+#include <rpmsw.h>
+#include <poptIO.h>
+
+#include <rpmtag.h>
+#include <rpmtypes.h>
+#include <rpmgi.h>
+#include <rpmts.h>
+#include <rpmds.h>
+#include <rpmfi.h>
+#include <rpmal.h>
+#include <rpmcli.h>
+
+#include "debug.h"
+
+static int nloops = 1;
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each loop N times"), N_("N") },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioFtsPoptTable, 0,
+        N_("File tree walk options for fts(3):"),
+        NULL },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmcliAllPoptTable, 0,
+        N_("Common options for all rpm modes and executables:"),
+        NULL },
+
+  POPT_AUTOALIAS
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+/**
+ * Headers from the argument packages, as the available list sees them.
+ */
+struct talPackage_s {
+    Header h;			/*!< Package header. */
+    rpmds provides;		/*!< Provides: dependencies. */
+    rpmds requires;		/*!< Requires: dependencies. */
+    rpmfi fi;			/*!< File info set. */
+    alKey pkgKey;		/*!< Available list key. */
+};
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmcliInit(argc, argv, optionsTable);
+    rpmop addop = memset(alloca(sizeof(*addop)), 0, sizeof(*addop));
+    rpmop lookop = memset(alloca(sizeof(*lookop)), 0, sizeof(*lookop));
+    rpmop delop = memset(alloca(sizeof(*delop)), 0, sizeof(*delop));
+    struct talPackage_s * pkgs = NULL;
+    rpmts ts = NULL;
+    rpmgi gi = NULL;
+    rpmuint32_t tscolor;
+    unsigned nprovides = 0;
+    unsigned nrequires = 0;
+    unsigned nfiles = 0;
+    unsigned nhits = 0;
+    int npkgs = 0;
+    ARGV_t av;
+    int ec = 0;
+    int i, j;
+    int xx;
+
+    if (optCon == NULL)
+	exit(EXIT_FAILURE);
+
+    if ((av = poptGetArgs(optCon)) == NULL || av[0] == NULL) {
+	poptPrintUsage(optCon, stderr, 0);
+	exit(EXIT_FAILURE);
+    }
+
+    if (rpmioFtsOpts == 0)
+	rpmioFtsOpts = (FTS_COMFOLLOW | FTS_LOGICAL | FTS_NOSTAT);
+
+    ts = rpmtsCreate();
+    (void) rpmtsSetVSFlags(ts, _RPMVSF_NOSIGNATURES | _RPMVSF_NODIGESTS);
+    tscolor = rpmtsColor(ts);
+
+    /* Load the headers (untimed). */
+    gi = rpmgiNew(ts, RPMDBI_FTSWALK, NULL, 0);
+    xx = rpmgiSetArgs(gi, av, rpmioFtsOpts, RPMGI_NONE);
+    while (rpmgiNext(gi) == RPMRC_OK) {
+	Header h = rpmgiHeader(gi);
+	struct talPackage_s * p;
+
+	if (h == NULL)
+	    continue;
+	pkgs = xrealloc(pkgs, (npkgs + 1) * sizeof(*pkgs));
+	p = pkgs + npkgs++;
+	p->h = headerLink(h);
+	p->provides = rpmdsNew(h, RPMTAG_PROVIDENAME, 0);
+	p->requires = rpmdsNew(h, RPMTAG_REQUIRENAME, 0);
+	p->fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, 0);
+	p->pkgKey = RPMAL_NOMATCH;
+	nprovides += rpmdsCount(p->provides);
+	nrequires += rpmdsCount(p->requires);
+	nfiles += rpmfiFC(p->fi);
+    }
+    gi = rpmgiFree(gi);
+
+    fprintf(stderr, "===== %d packages, %u provides, %u requires, %u files, %d loops\n",
+		npkgs, nprovides, nrequires, nfiles, nloops);
+    if (npkgs == 0) {
+	ec = 1;
+	goto exit;
+    }
+
+    for (j = 0; j < nloops; j++) {
+	rpmal al = NULL;
+
+	xx = rpmswEnter(addop, 0);
+	for (i = 0; i < npkgs; i++) {
+	    struct talPackage_s * p = pkgs + i;
+	    p->pkgKey = rpmalAdd(&al, RPMAL_NOMATCH, (fnpyKey) p,
+			p->provides, p->fi, tscolor);
+	}
+	rpmalMakeIndex(al);
+	xx = rpmswExit(addop, npkgs);
+
+	nhits = 0;
+	xx = rpmswEnter(lookop, 0);
+	for (i = 0; i < npkgs; i++) {
+	    rpmds requires = pkgs[i].requires;
+	    if (rpmdsInit(requires) != NULL)
+	    while (rpmdsNext(requires) >= 0) {
+		fnpyKey * keys = rpmalAllSatisfiesDepend(al, requires, NULL);
+		if (keys != NULL && keys[0] != NULL)
+		    nhits++;
+		keys = _free(keys);
+	    }
+	}
+	xx = rpmswExit(lookop, nrequires);
+
+	xx = rpmswEnter(delop, 0);
+	for (i = npkgs - 1; i >= 0; i--)
+	    rpmalDel(al, pkgs[i].pkgKey);
+	xx = rpmswExit(delop, npkgs);
+
+	al = rpmalFree(al);
+    }
+
+    fprintf(stderr, "%u of %u requires satisfied by added packages\n",
+		nhits, nrequires);
+    rpmswPrint("   add:", addop, NULL);
+    rpmswPrint("lookup:", lookop, NULL);
+    rpmswPrint("   del:", delop, NULL);
+
+exit:
+    for (i = 0; i < npkgs; i++) {
+	struct talPackage_s * p = pkgs + i;
+	(void) rpmdsFree(p->provides);
+	(void) rpmdsFree(p->requires);
+	(void) rpmfiFree(p->fi);
+	(void) headerFree(p->h);
+    }
+    pkgs = _free(pkgs);
+    (void) rpmtsFree(ts);
+    ts = NULL;
+
+    optCon = rpmcliFini(optCon);
+
+    return ec;
+}
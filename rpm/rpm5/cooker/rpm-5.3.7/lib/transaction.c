@@ -9,6 +9,7 @@
 #include <rpmlog.h>
 #include <rpmmacro.h>	/* XXX for rpmExpand */
 #include <rpmsx.h>
+#include <rpmtpool.h>
 
 #include <rpmtypes.h>
 #include <rpmtag.h>
@@ -911,6 +912,10 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u)\n", __FUNCTION__, ts, (unsigned)fileCount));
 
     (void) rpmmiSort(mi);
 
+    /* Retrieve the (sorted) headers in batches, reading ahead. */
+    xx = rpmmiSetPrefetch(mi, rpmExpandNumeric("%{?_rpmdb_prefetch}"),
+		rpmExpandNumeric("%{?_rpmdb_readahead}"));
+
     return mi;
 }
 
@@ -1226,6 +1231,105 @@ assert(0);
     return 0;
 }
 
+/**
+ * Max. no. of files finger printed by one job.
+ */
+#define	RPMTS_FPCHUNK	1024
+
+/**
+ * A slice of a file info set to finger print.
+ */
+struct rpmtsFpJob_s {
+    fingerPrintCache fpc;	/*!< shared finger print cache */
+    rpmfi fi;			/*!< file info set */
+    int start;			/*!< first file */
+    int count;			/*!< no. of files */
+};
+
+/**
+ * Finger print a slice of a file info set (worker thread).
+ * @param _job		finger print job
+ */
+static void rpmtsFpJob(void * _job)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _job, fileSystem, internalState @*/
+{
+    struct rpmtsFpJob_s * job = _job;
+    rpmfi fi = job->fi;
+
+    fpLookupList(job->fpc, fi->dnl, fi->bnl + job->start,
+		fi->dil + job->start, job->count, fi->fps + job->start);
+}
+
+/**
+ * Finger print the files of all transaction elements, in parallel
+ * with %{_fprint_threads} worker threads. The directory stat(2)'s,
+ * which dominate on slow (e.g. NFS) roots, are overlapped.
+ * @param ts		transaction set
+ * @param fileCount	no. of files in transaction
+ * @param fpc		finger print cache
+ */
+static void rpmtsFpLookupAll(rpmts ts, uint32_t fileCount,
+		fingerPrintCache fpc)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ts, fpc, rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+{
+    int nthreads =
+	rpmExpandNumeric("%{?_fprint_threads}%{!?_fprint_threads:1}");
+    struct rpmtsFpJob_s * jobs = NULL;
+    int njobs = 0;
+    rpmtpool tp = NULL;
+    rpmtsi pi;
+    rpmte p;
+    rpmfi fi;
+    int i;
+    int xx;
+
+    pi = rpmtsiInit(ts);
+    while ((p = rpmtsiNext(pi, 0)) != NULL) {
+	int fc;
+
+	if (p->isSource) continue;
+	if ((fi = rpmtsiFi(pi)) == NULL)
+	    continue;	/* XXX can't happen */
+	if ((fc = rpmfiFC(fi)) <= 0)
+	    continue;
+	if (fi->fps == NULL)
+	    fi->fps = xcalloc(fc, sizeof(*fi->fps));
+	for (i = 0; i < fc; i += RPMTS_FPCHUNK) {
+	    struct rpmtsFpJob_s * job;
+	    if ((njobs % 64) == 0)
+		jobs = xrealloc(jobs, (njobs + 64) * sizeof(*jobs));
+	    job = jobs + njobs++;
+	    job->fpc = fpc;
+	    job->fi = fi;
+	    job->start = i;
+	    job->count = (fc - i < RPMTS_FPCHUNK ? fc - i : RPMTS_FPCHUNK);
+	}
+    }
+    pi = rpmtsiFree(pi);
+
+    /* A single job (or thread) is run by the caller. */
+    if (nthreads != 1 && njobs > 1) {
+	tp = rpmtpoolNew(nthreads);
+	if (rpmtpoolThreads(tp) < 2)
+	    tp = rpmtpoolFree(tp);
+    }
+
+    (void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
+    for (i = 0; i < njobs; i++) {
+	(void) rpmdbCheckSignals();
+	xx = rpmtpoolSubmit(tp, rpmtsFpJob, jobs + i);
+    }
+    if (tp != NULL) {
+	rpmtpoolWait(tp);
+	tp = rpmtpoolFree(tp);
+    }
+    (void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), fileCount);
+
+    jobs = _free(jobs);
+}
+
 /* Add fingerprint for each file not skipped. */
 static void rpmtsAddFingerprints(rpmts ts, uint32_t fileCount, hashTable ht,
 		fingerPrintCache fpc)
@@ -1234,11 +1338,18 @@ static void rpmtsAddFingerprints(rpmts ts, uint32_t fileCount, hashTable ht,
     rpmtsi pi;
     rpmte p;
     rpmfi fi;
+    const void ** keys = NULL;
+    const void ** data = NULL;
+    int nalloc = 0;
+    int nkeys;
     int i;
 
     hashTable symlinks = htCreate(fileCount/16+16, 0, 0, fpHashFunction, fpEqual);
 
 FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCount, ht, fpc));
+    /* Finger print all files (in parallel), then use fi->fps below. */
+    rpmtsFpLookupAll(ts, fileCount, fpc);
+
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
 	(void) rpmdbCheckSignals();
@@ -1249,7 +1360,13 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCo
 
 	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
 
-	rpmfiFpLookup(fi, fpc);
+	/* Each package's entries are added at once (see htAddEntries). */
+	if (rpmfiFC(fi) > nalloc) {
+	    nalloc = rpmfiFC(fi);
+	    keys = xrealloc(keys, nalloc * sizeof(*keys));
+	    data = xrealloc(data, nalloc * sizeof(*data));
+	}
+	nkeys = 0;
 
 	/* Collect symlinks. */
  	fi = rpmfiInit(fi, 0);
@@ -1273,12 +1390,15 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCo
 		ffip->p = p;
 /*@=dependenttrans@*/
 		ffip->fileno = i;
-		htAddEntry(symlinks, fi->fps + i, (void *) ffip);
+		keys[nkeys] = fi->fps + i;
+		data[nkeys] = ffip;
+		nkeys++;
 	    }
 #endif
 	}
+	htAddEntries(symlinks, keys, data, nkeys);
 
-	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), rpmfiFC(fi));
+	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
 
     }
     pi = rpmtsiFree(pi);
@@ -1295,6 +1415,12 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCo
 	if (p->isSource) continue;
 	if ((fi = rpmteFI(p, RPMTAG_BASENAMES)) == NULL)
 	    continue;	/* XXX can't happen */
+	if (rpmfiFC(fi) > nalloc) {
+	    nalloc = rpmfiFC(fi);
+	    keys = xrealloc(keys, nalloc * sizeof(*keys));
+	    data = xrealloc(data, nalloc * sizeof(*data));
+	}
+	nkeys = 0;
 	fi = rpmfiInit(fi, 0);
 	(void) rpmswEnter(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
 	while ((i = rpmfiNext(fi)) >= 0) {
@@ -1305,12 +1431,22 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCo
 	    if (iosmFileActionSkipped(fi->actions[i]))
 		/*@innercontinue@*/ continue;
 #endif
-	    fpLookupSubdir(symlinks, ht, fpc, p, i);
+	    fpLookupSubdir(symlinks, NULL, fpc, p, i);
+	    {	struct rpmffi_s * ffip = xmalloc(sizeof(*ffip));
+		ffip->p = p;
+		ffip->fileno = i;
+		keys[nkeys] = fi->fps + i;
+		data[nkeys] = ffip;
+		nkeys++;
+	    }
 	}
+	htAddEntries(ht, keys, data, nkeys);
 	(void) rpmswExit(rpmtsOp(ts, RPMTS_OP_FINGERPRINT), 0);
     }
     pi = rpmtsiFree(pi);
 
+    keys = _free(keys);
+    data = _free(data);
     symlinks = htFree(symlinks);
 
 }
@@ -1509,7 +1645,7 @@ rpmlog(RPMLOG_DEBUG, D_("computing %u file fingerprints\n"), (unsigned)fileCount
 	(void) rpmtsSetChrootDone(ts, 1);
     }
 
-    ts->ht = htCreate(fileCount/2 + 1, 0, 1, fpHashFunction, fpEqual);
+    ts->ht = htCreate(fileCount + 1, 0, 1, fpHashFunction, fpEqual);
     fpc = fpCacheCreate(fileCount/2 + 10001);
 
 #endif	/* REFERENCE */
@@ -2019,6 +2155,19 @@ cleanup:
 }
 /*@=nullpass@*/
 
+/**
+ * Free the worker thread pools of the package and file state machines,
+ * which are created on demand while a transaction runs.
+ */
+static void rpmtsFreeThreadPools(void)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/
+{
+    rpmpsmFreeThreadPools();
+    fsmFreeThreadPools();
+    iosmFreeThreadPools();
+}
+
 int _rpmtsRun(rpmts ts, rpmps okProbs, rpmprobFilterFlags ignoreSet)
 {
     int ourrc = -1;	/* assume failure */
@@ -2104,6 +2253,7 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
     {
 	lock = rpmtsFreeLock(lock);
 	if (sx != NULL) sx = rpmsxFree(sx);
+	rpmtsFreeThreadPools();
 	return ts->orderCount;
     }
 
@@ -2123,6 +2273,9 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
      */
     ourrc = rpmtsProcess(ts, ignoreSet, rollbackFailures);
 
+    /* Sync files installed by all packages (%_transaction_fsync_policy). */
+    xx = fsmSyncTransaction(ts);
+
     /* ===============================================
      * Run post-transaction scripts unless disabled.
      */
@@ -2141,6 +2294,7 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
 
 exit:
     xx = rpmtsFinish(ts, sx);
+    rpmtsFreeThreadPools();
 
     lock = rpmtsFreeLock(lock);
 
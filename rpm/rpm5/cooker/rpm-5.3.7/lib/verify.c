@@ -8,6 +8,9 @@
 #include <rpmio.h>
 #include <rpmiotypes.h>
 #include <rpmcb.h>
+#include <rpmsw.h>
+#include <rpmtpool.h>
+#include <yarn.h>
 #include "ugid.h"
 
 #include <rpmtypes.h>
@@ -49,6 +52,13 @@ struct rpmvf_s {
     const unsigned char * digest;
     const char * fuser;
     const char * fgroup;
+    struct stat st;		/*!< lstat(2) of the installed file */
+    rpmVerifyAttrs res;		/*!< verify failures */
+    int ec;			/*!< 1 if the file is missing */
+    int serrno;			/*!< lstat(2) errno */
+    int prelinked;		/*!< 1 if digested through prelink -y */
+    struct rpmop_s statop;	/*!< lstat(2) time */
+    struct rpmop_s digestop;	/*!< dodigest() time */
 #if defined(__LCLINT__NOTYET)
 /*@refs@*/
     int nrefs;			/*!< (unused) keep splint happy */
@@ -135,19 +145,17 @@ static rpmvf rpmvfNew(rpmts ts, rpmfi fi, int i, rpmVerifyAttrs omitMask)
     return vf;
 }
 
-/** \ingroup rpmcli
- * Verify file attributes (including file digest).
+/**
+ * Check that a file is installed, and lstat(2) it.
+ * Attributes that cannot be verified are removed from vf->vflags.
  * @param vf		file data to verify
- * #param spew		should verify results be printed?
- * @return		0 on success (or not installed), 1 on error
+ * @return		1 if the file contents should be digested
  */
-static int rpmvfVerify(rpmvf vf, int spew)
+static int rpmvfStat(rpmvf vf)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies vf, fileSystem, internalState @*/
 {
-    rpmVerifyAttrs res = RPMVERIFY_NONE;
-    struct stat sb;
-    int ec = 0;
+    int rc;
 
     /* Check to see if the file was installed - if not pretend all is OK. */
     switch (vf->fstate) {
@@ -156,62 +164,183 @@ static int rpmvfVerify(rpmvf vf, int spew)
     case RPMFILE_STATE_REPLACED:
     case RPMFILE_STATE_NOTINSTALLED:
     case RPMFILE_STATE_WRONGCOLOR:
-	goto exit;
+	vf->vflags = RPMVERIFY_NONE;
+	return 0;
 	/*@notreached@*/ break;
     case RPMFILE_STATE_NORMAL:
 	break;
     }
 
 assert(vf->fn != NULL);
-    if (vf->fn == NULL || Lstat(vf->fn, &sb) != 0) {
-	res |= RPMVERIFY_LSTATFAIL;
-	ec = 1;
-	goto exit;
+    (void) rpmswEnter(&vf->statop, 0);
+    rc = (vf->fn == NULL || Lstat(vf->fn, &vf->st) != 0);
+    if (rc)
+	vf->serrno = errno;
+    (void) rpmswExit(&vf->statop, 0);
+    if (rc) {
+	vf->res |= RPMVERIFY_LSTATFAIL;
+	vf->ec = 1;
+	vf->vflags = RPMVERIFY_NONE;
+	return 0;
     }
 
     /* Not all attributes of non-regular files can be verified. */
-    if (S_ISDIR(sb.st_mode))
+    if (S_ISDIR(vf->st.st_mode))
 	vf->vflags &= ~(RPMVERIFY_FDIGEST | RPMVERIFY_FILESIZE | RPMVERIFY_MTIME |
 			RPMVERIFY_LINKTO | RPMVERIFY_HMAC);
-    else if (S_ISLNK(sb.st_mode)) {
+    else if (S_ISLNK(vf->st.st_mode)) {
 	vf->vflags &= ~(RPMVERIFY_FDIGEST | RPMVERIFY_FILESIZE | RPMVERIFY_MTIME |
 		RPMVERIFY_MODE | RPMVERIFY_HMAC);
 #if CHOWN_FOLLOWS_SYMLINK
 	vf->vflags &= ~(RPMVERIFY_USER | RPMVERIFY_GROUP);
 #endif
     }
-    else if (S_ISFIFO(sb.st_mode))
+    else if (S_ISFIFO(vf->st.st_mode))
 	vf->vflags &= ~(RPMVERIFY_FDIGEST | RPMVERIFY_FILESIZE | RPMVERIFY_MTIME |
 			RPMVERIFY_LINKTO | RPMVERIFY_HMAC);
-    else if (S_ISCHR(sb.st_mode))
+    else if (S_ISCHR(vf->st.st_mode))
 	vf->vflags &= ~(RPMVERIFY_FDIGEST | RPMVERIFY_FILESIZE | RPMVERIFY_MTIME |
 			RPMVERIFY_LINKTO | RPMVERIFY_HMAC);
-    else if (S_ISBLK(sb.st_mode))
+    else if (S_ISBLK(vf->st.st_mode))
 	vf->vflags &= ~(RPMVERIFY_FDIGEST | RPMVERIFY_FILESIZE | RPMVERIFY_MTIME |
 			RPMVERIFY_LINKTO | RPMVERIFY_HMAC);
     else
 	vf->vflags &= ~(RPMVERIFY_LINKTO);
 
-    if (vf->vflags & (RPMVERIFY_FDIGEST | RPMVERIFY_HMAC)) {
-	if (vf->digest == NULL || vf->dlen == 0)
-	    res |= RPMVERIFY_FDIGEST;
-	else {
+    return ((vf->vflags & (RPMVERIFY_FDIGEST | RPMVERIFY_HMAC)) != 0);
+}
+
+/**
+ * Digest a file, comparing with the package file digest.
+ * @param vf		file data to verify
+ */
+static void rpmvfDigest(rpmvf vf)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies vf, fileSystem, internalState @*/
+{
+    if (vf->digest == NULL || vf->dlen == 0)
+	vf->res |= RPMVERIFY_FDIGEST;
+    else {
 	/* XXX If --nofdigest, then prelinked library sizes fail to verify. */
-	    unsigned char * fdigest = memset(alloca(vf->dlen), 0, vf->dlen);
-	    size_t fsize = 0;
+	unsigned char * fdigest = memset(alloca(vf->dlen), 0, vf->dlen);
+	size_t fsize = 0;
 #define	_mask	(RPMVERIFY_FDIGEST|RPMVERIFY_HMAC)
-	    unsigned dflags = (vf->vflags & _mask) == RPMVERIFY_HMAC
+	unsigned dflags = (vf->vflags & _mask) == RPMVERIFY_HMAC
 		? 0x2 : 0x0;
 #undef	_mask
-	    int rc = dodigest(vf->dalgo, vf->fn, fdigest, dflags, &fsize);
-	    sb.st_size = fsize;
-	    if (rc)
-		res |= (RPMVERIFY_READFAIL|RPMVERIFY_FDIGEST);
-	    else
-	    if (memcmp(fdigest, vf->digest, vf->dlen))
-		res |= RPMVERIFY_FDIGEST;
-	}
+	int rc;
+
+	(void) rpmswEnter(&vf->digestop, 0);
+	rc = dodigestPrelink(vf->dalgo, vf->fn, fdigest, dflags, &fsize,
+		&vf->prelinked);
+	(void) rpmswExit(&vf->digestop, fsize);
+	vf->st.st_size = fsize;
+	if (rc)
+	    vf->res |= (RPMVERIFY_READFAIL|RPMVERIFY_FDIGEST);
+	else
+	if (memcmp(fdigest, vf->digest, vf->dlen))
+	    vf->res |= RPMVERIFY_FDIGEST;
+    }
+}
+
+/**
+ * Max. no. of files digested together (see dodigestBatch()).
+ */
+#define	RPMVF_BATCH	8
+
+/**
+ * Can a file be digested in a batch?
+ * @param vf		file data to verify
+ * @return		1 if a binary (not HMAC) digest of a small regular file
+ */
+static int rpmvfBatchable(rpmvf vf)
+	/*@*/
+{
+    return (vf->digest != NULL && vf->dlen > 0
+	&& (vf->vflags & RPMVERIFY_FDIGEST)
+	&& S_ISREG(vf->st.st_mode) && vf->st.st_size <= DODIGEST_BATCHMAX);
+}
+
+/**
+ * Return the no. of files from vfs[0] that can be digested together.
+ * @param vfs		files to digest
+ * @param n		no. of files
+ * @return		no. of files (1 if vfs[0] is digested alone)
+ */
+static int rpmvfBatchLen(rpmvf * vfs, int n)
+	/*@*/
+{
+    int i;
+
+    if (!rpmvfBatchable(vfs[0]))
+	return 1;
+    for (i = 1; i < n && i < RPMVF_BATCH; i++) {
+	if (!rpmvfBatchable(vfs[i]) || vfs[i]->dalgo != vfs[0]->dalgo)
+	    break;
     }
+    return i;
+}
+
+/**
+ * Digest files together, comparing with the package file digests.
+ * The batch is timed as a whole against its first file.
+ * @param vfs		files to digest (see rpmvfBatchLen())
+ * @param n		no. of files
+ */
+static void rpmvfDigestBatch(rpmvf * vfs, int n)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies vfs, fileSystem, internalState @*/
+{
+    const char ** fns = alloca(n * sizeof(*fns));
+    unsigned char ** fdigests = alloca(n * sizeof(*fdigests));
+    size_t * fsizes = memset(alloca(n * sizeof(*fsizes)), 0, n * sizeof(*fsizes));
+    int * prelinked = alloca(n * sizeof(*prelinked));
+    int * rcs = alloca(n * sizeof(*rcs));
+    size_t nb = 0;
+    int i;
+
+    if (n == 1) {
+	rpmvfDigest(vfs[0]);
+	return;
+    }
+
+    for (i = 0; i < n; i++) {
+	fns[i] = vfs[i]->fn;
+	fdigests[i] = memset(alloca(vfs[i]->dlen), 0, vfs[i]->dlen);
+    }
+
+    (void) rpmswEnter(&vfs[0]->digestop, 0);
+    (void) dodigestBatch(vfs[0]->dalgo, n, fns, fdigests, 0, fsizes,
+		prelinked, rcs);
+    for (i = 0; i < n; i++)
+	nb += fsizes[i];
+    (void) rpmswExit(&vfs[0]->digestop, nb);
+
+    for (i = 0; i < n; i++) {
+	rpmvf vf = vfs[i];
+	vf->prelinked = prelinked[i];
+	vf->st.st_size = fsizes[i];
+	if (rcs[i])
+	    vf->res |= (RPMVERIFY_READFAIL|RPMVERIFY_FDIGEST);
+	else
+	if (memcmp(fdigests[i], vf->digest, vf->dlen))
+	    vf->res |= RPMVERIFY_FDIGEST;
+    }
+}
+
+/** \ingroup rpmcli
+ * Verify the remaining file attributes, after rpmvfStat() and rpmvfDigest().
+ * @param vf		file data to verify
+ * #param spew		should verify results be printed?
+ * @return		0 on success (or not installed), 1 on error
+ */
+static int rpmvfReport(rpmvf vf, int spew)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies vf, fileSystem, internalState @*/
+{
+    rpmVerifyAttrs res = vf->res;
+    struct stat * st = &vf->st;
+    int ec = vf->ec;
 
     if (vf->vflags & RPMVERIFY_LINKTO) {
 	char linkto[1024+1];
@@ -227,14 +356,14 @@ assert(vf->fn != NULL);
     }
 
     if (vf->vflags & RPMVERIFY_FILESIZE) {
-	if (sb.st_size != vf->sb.st_size)
+	if (st->st_size != vf->sb.st_size)
 	    res |= RPMVERIFY_FILESIZE;
     }
 
     if (vf->vflags & RPMVERIFY_MODE) {
 	/* XXX AIX has sizeof(mode_t) > sizeof(unsigned short) */
 	unsigned short metamode = (unsigned short)vf->sb.st_mode;
-	unsigned short filemode = (unsigned short)sb.st_mode;
+	unsigned short filemode = (unsigned short)st->st_mode;
 
 	/* Comparing type of %ghost files is meaningless, but perms are OK. */
 	if (vf->fflags & RPMFILE_GHOST) {
@@ -246,11 +375,11 @@ assert(vf->fn != NULL);
     }
 
     if (vf->vflags & RPMVERIFY_RDEV) {
-	if (S_ISCHR(vf->sb.st_mode) != S_ISCHR(sb.st_mode)
-	 || S_ISBLK(vf->sb.st_mode) != S_ISBLK(sb.st_mode))
+	if (S_ISCHR(vf->sb.st_mode) != S_ISCHR(st->st_mode)
+	 || S_ISBLK(vf->sb.st_mode) != S_ISBLK(st->st_mode))
 	    res |= RPMVERIFY_RDEV;
-	else if (S_ISDEV(vf->sb.st_mode) && S_ISDEV(sb.st_mode)) {
-	    rpmuint16_t st_rdev = (rpmuint16_t)(sb.st_rdev & 0xffff);
+	else if (S_ISDEV(vf->sb.st_mode) && S_ISDEV(st->st_mode)) {
+	    rpmuint16_t st_rdev = (rpmuint16_t)(st->st_rdev & 0xffff);
 	    rpmuint16_t frdev = (rpmuint16_t)(vf->sb.st_rdev & 0xffff);
 	    if (st_rdev != frdev)
 		res |= RPMVERIFY_RDEV;
@@ -258,24 +387,22 @@ assert(vf->fn != NULL);
     }
 
     if (vf->vflags & RPMVERIFY_MTIME) {
-	if (sb.st_mtime != vf->sb.st_mtime)
+	if (st->st_mtime != vf->sb.st_mtime)
 	    res |= RPMVERIFY_MTIME;
     }
 
     if (vf->vflags & RPMVERIFY_USER) {
-	const char * fuser = uidToUname(sb.st_uid);
+	const char * fuser = uidToUname(st->st_uid);
 	if (fuser == NULL || vf->fuser == NULL || strcmp(fuser, vf->fuser))
 	    res |= RPMVERIFY_USER;
     }
 
     if (vf->vflags & RPMVERIFY_GROUP) {
-	const char * fgroup = gidToGname(sb.st_gid);
+	const char * fgroup = gidToGname(st->st_gid);
 	if (fgroup == NULL || vf->fgroup == NULL || strcmp(fgroup, vf->fgroup))
 	    res |= RPMVERIFY_GROUP;
     }
 
-exit:
-
     if (spew) {	/* XXX no output w verify(...) probe. */
 	char buf[BUFSIZ];
 	char * t = buf;
@@ -293,9 +420,9 @@ exit:
 			 (vf->fflags & RPMFILE_PUBKEY)	? 'P' :
 			 (vf->fflags & RPMFILE_README)	? 'r' : ' '),
 			vf->fn);
-                if ((res & RPMVERIFY_LSTATFAIL) != 0 && errno != ENOENT) {
+                if ((res & RPMVERIFY_LSTATFAIL) != 0 && vf->serrno != ENOENT) {
 		    te += strlen(te);
-                    sprintf(te, " (%s)", strerror(errno));
+                    sprintf(te, " (%s)", strerror(vf->serrno));
                 }
 	    }
 	} else if (res || rpmIsVerbose()) {
@@ -344,6 +471,172 @@ exit:
     return (res != 0);
 }
 
+/**
+ * Accumulate per-file verify times (rpm -V --stats).
+ * @param ts		transaction set
+ * @param vf		file data to verify
+ */
+static void rpmvfOps(rpmts ts, rpmvf vf)
+	/*@modifies ts @*/
+{
+    (void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_VFYSTAT), &vf->statop);
+    (void) rpmswAdd(rpmtsOp(ts, (vf->prelinked
+		? RPMTS_OP_PRELINK : RPMTS_OP_VFYDIGEST)), &vf->digestop);
+}
+
+/**
+ * Worker threads for the lstat(2) and digest of files (rpm -V).
+ */
+typedef struct rpmvfPool_s * rpmvfPool;
+struct rpmvfPool_s {
+/*@only@*/
+    rpmtpool tp;		/*!< worker thread pool */
+    yarnLock busy;		/*!< no. of files in flight */
+    int window;			/*!< max. no. of files in flight */
+};
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmvfPool _rpmvfPool = NULL;
+
+/**
+ * Create verify worker threads.
+ * @param nthreads	no. of worker threads (<= 0 uses no. of cpus)
+ * @return		worker threads (NULL if not threaded)
+ */
+/*@only@*/ /*@null@*/
+static rpmvfPool rpmvfPoolNew(int nthreads)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/
+{
+    rpmtpool tp = rpmtpoolNew(nthreads);
+    rpmvfPool pool;
+
+    if (rpmtpoolThreads(tp) < 2) {
+	tp = rpmtpoolFree(tp);
+	return NULL;
+    }
+    pool = xcalloc(1, sizeof(*pool));
+    pool->tp = tp;
+    pool->busy = yarnNewLock(0);
+    pool->window = 4 * rpmtpoolThreads(tp);
+    return pool;
+}
+
+/**
+ * Destroy verify worker threads.
+ * @param pool		worker threads
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmvfPool rpmvfPoolFree(/*@only@*/ /*@null@*/ rpmvfPool pool)
+	/*@globals internalState @*/
+	/*@modifies pool, internalState @*/
+{
+    if (pool != NULL) {
+	pool->tp = rpmtpoolFree(pool->tp);
+	pool->busy = yarnFreeLock(pool->busy);
+	pool = _free(pool);
+    }
+    return NULL;
+}
+
+/**
+ * Run a job on a worker thread, waiting while the window is full.
+ * @param pool		worker threads
+ * @param fn		job function
+ * @param arg		job argument
+ */
+static void rpmvfPoolSubmit(rpmvfPool pool, void (*fn) (void * arg), void * arg)
+	/*@globals internalState @*/
+	/*@modifies pool, arg, internalState @*/
+{
+    int xx;
+
+    yarnPossess(pool->busy);
+    yarnWaitFor(pool->busy, TO_BE_LESS_THAN, pool->window);
+    yarnTwist(pool->busy, BY, 1);
+    xx = rpmtpoolSubmit(pool->tp, fn, arg);
+    xx = xx;
+}
+
+/**
+ * Wait for all submitted per-file jobs to finish.
+ * @param pool		worker threads
+ */
+static void rpmvfPoolWait(rpmvfPool pool)
+	/*@globals internalState @*/
+	/*@modifies pool, internalState @*/
+{
+    yarnPossess(pool->busy);
+    yarnWaitFor(pool->busy, TO_BE, 0);
+    yarnRelease(pool->busy);
+}
+
+static void rpmvfStatJob(void * _vf)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies _vf, fileSystem, internalState @*/
+{
+    (void) rpmvfStat((rpmvf)_vf);
+    yarnPossess(_rpmvfPool->busy);
+    yarnTwist(_rpmvfPool->busy, BY, -1);
+}
+
+/**
+ * Files digested together by a worker thread.
+ */
+struct rpmvfBatch_s {
+/*@dependent@*/
+    rpmvf * vfs;
+    int n;
+};
+
+static void rpmvfDigestJob(void * _b)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies _b, fileSystem, internalState @*/
+{
+    struct rpmvfBatch_s * b = _b;
+
+    rpmvfDigestBatch(b->vfs, b->n);
+    b = _free(b);
+    yarnPossess(_rpmvfPool->busy);
+    yarnTwist(_rpmvfPool->busy, BY, -1);
+}
+
+/**
+ * Compare files by device and inode (approximating on-disk order).
+ */
+static int rpmvfCmpIno(const void * a, const void * b)
+	/*@*/
+{
+    const struct stat * ast = &(*(const rpmvf *)a)->st;
+    const struct stat * bst = &(*(const rpmvf *)b)->st;
+
+    if (ast->st_dev != bst->st_dev)
+	return (ast->st_dev < bst->st_dev ? -1 : 1);
+    if (ast->st_ino != bst->st_ino)
+	return (ast->st_ino < bst->st_ino ? -1 : 1);
+    return 0;
+}
+
+/**
+ * Start reading a file into the page cache, ahead of its digest.
+ * @param vf		file data to verify
+ */
+static void rpmvfReadahead(rpmvf vf)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+    if (S_ISREG(vf->st.st_mode) && vf->st.st_size > 0) {
+	int fdno = open(vf->fn, O_RDONLY);
+	if (fdno >= 0) {
+	    (void) posix_fadvise(fdno, 0, 0, POSIX_FADV_WILLNEED);
+	    (void) close(fdno);
+	}
+    }
+#endif
+}
+
 /**
  * Return exit code from running verify script from header.
  * @todo malloc/free/refcount handling is fishy here.
@@ -482,51 +775,97 @@ int showVerifyPackage(QVA_t qva, rpmts ts, Header h)
     int spew = (qva->qva_mode != 'v');	/* XXX no output w verify(...) probe. */
     static int scareMem = 0;
     rpmfi fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, scareMem);
-    rpmvf vf;
+    rpmvfPool pool = _rpmvfPool;
+    rpmvf * vfs = NULL;
+    int nvfs = 0;
     int ec = 0;
     int rc;
     int i;
 
-  if (fi != NULL)
-#if defined(_OPENMP)
-  #pragma omp parallel
-#endif
-  {
-    if (qva->qva_flags & VERIFY_FILES)
-#if defined(_OPENMP)
-    #pragma omp for reduction(+:ec) private(vf,rc,i) nowait
-#endif
-    for (i = 0; i < rpmfiFC(fi); i++) {
-	int fflags = fi->fflags[i];
+  if (fi != NULL) {
+    if (qva->qva_flags & VERIFY_FILES) {
+	vfs = xmalloc((rpmfiFC(fi) + 1) * sizeof(*vfs));
+	for (i = 0; i < rpmfiFC(fi); i++) {
+	    int fflags = fi->fflags[i];
 
-	/* If not querying %config, skip config files. */
-	if ((qva->qva_fflags & RPMFILE_CONFIG) && (fflags & RPMFILE_CONFIG))
-	    continue;
+	    /* If not querying %config, skip config files. */
+	    if ((qva->qva_fflags & RPMFILE_CONFIG) && (fflags & RPMFILE_CONFIG))
+		continue;
 
-	/* If not querying %doc, skip doc files. */
-	if ((qva->qva_fflags & RPMFILE_DOC) && (fflags & RPMFILE_DOC))
-	    continue;
+	    /* If not querying %doc, skip doc files. */
+	    if ((qva->qva_fflags & RPMFILE_DOC) && (fflags & RPMFILE_DOC))
+		continue;
 
-	/* If not verifying %ghost, skip ghost files. */
-	/* XXX the broken!!! logic disables %ghost queries always. */
-	if (!(qva->qva_fflags & RPMFILE_GHOST) && (fflags & RPMFILE_GHOST))
-	    continue;
+	    /* If not verifying %ghost, skip ghost files. */
+	    /* XXX the broken!!! logic disables %ghost queries always. */
+	    if (!(qva->qva_fflags & RPMFILE_GHOST) && (fflags & RPMFILE_GHOST))
+		continue;
 
-	/* Gather per-file data into a carrier. */
-	vf = rpmvfNew(ts, fi, i, omitMask);
+	    /* Gather per-file data into a carrier. */
+	    vfs[nvfs++] = rpmvfNew(ts, fi, i, omitMask);
+	}
 
-	/* Verify per-file metadata. */
-	rc = rpmvfVerify(vf, spew);
-	if (rc)
-	    ec += rc;
+	if (pool != NULL && nvfs > 1) {
+	    rpmvf * dvfs = xmalloc(nvfs * sizeof(*dvfs));
+	    int ndvfs = 0;
+	    int n;
+
+	    /* lstat(2) files on worker threads. */
+	    for (i = 0; i < nvfs; i++)
+		rpmvfPoolSubmit(pool, rpmvfStatJob, vfs[i]);
+	    rpmvfPoolWait(pool);
+
+	    /*
+	     * Digest files in inode order, a batch of small files (or one
+	     * file) per job, starting readahead as each job is queued: the
+	     * window bounds how far ahead of the workers the reads are issued.
+	     */
+	    for (i = 0; i < nvfs; i++) {
+		if (vfs[i]->vflags & (RPMVERIFY_FDIGEST | RPMVERIFY_HMAC))
+		    dvfs[ndvfs++] = vfs[i];
+	    }
+	    if (ndvfs > 1)
+		qsort(dvfs, ndvfs, sizeof(*dvfs), rpmvfCmpIno);
+	    for (i = 0; i < ndvfs; i += n) {
+		struct rpmvfBatch_s * b = xmalloc(sizeof(*b));
+		int j;
+
+		n = rpmvfBatchLen(dvfs + i, ndvfs - i);
+		for (j = i; j < i + n; j++)
+		    rpmvfReadahead(dvfs[j]);
+		b->vfs = dvfs + i;
+		b->n = n;
+		rpmvfPoolSubmit(pool, rpmvfDigestJob, b);
+	    }
+	    rpmvfPoolWait(pool);
+	    dvfs = _free(dvfs);
+	} else {
+	    rpmvf * dvfs = xmalloc((nvfs + 1) * sizeof(*dvfs));
+	    int ndvfs = 0;
+	    int n;
+
+	    for (i = 0; i < nvfs; i++) {
+		if (rpmvfStat(vfs[i]))
+		    dvfs[ndvfs++] = vfs[i];
+	    }
+	    for (i = 0; i < ndvfs; i += n) {
+		n = rpmvfBatchLen(dvfs + i, ndvfs - i);
+		rpmvfDigestBatch(dvfs + i, n);
+	    }
+	    dvfs = _free(dvfs);
+	}
 
-	(void) rpmvfFree(vf);
+	/* Verify the remaining per-file metadata, displayed in package order. */
+	for (i = 0; i < nvfs; i++) {
+	    rc = rpmvfReport(vfs[i], spew);
+	    if (rc)
+		ec += rc;
+	    rpmvfOps(ts, vfs[i]);
+	    (void) rpmvfFree(vfs[i]);
+	}
+	vfs = _free(vfs);
     }
-    if (qva->qva_flags & VERIFY_SCRIPT)
-#if defined(_OPENMP)
-    #pragma omp master
-#endif
-    {
+    if (qva->qva_flags & VERIFY_SCRIPT) {
 	if (headerIsEntry(h, RPMTAG_VERIFYSCRIPT) ||
 	    headerIsEntry(h, RPMTAG_SANITYCHECK))
 	{
@@ -540,11 +879,7 @@ int showVerifyPackage(QVA_t qva, rpmts ts, Header h)
 	    rc = rpmfiSetHeader(fi, NULL);
 	}
     }
-    if (qva->qva_flags & VERIFY_DEPS)
-#if defined(_OPENMP)
-    #pragma omp master
-#endif
-    {
+    if (qva->qva_flags & VERIFY_DEPS) {
 	int save_noise = _rpmds_unspecified_epoch_noise;
 /*@-mods@*/
 	if (rpmIsVerbose())
@@ -566,11 +901,16 @@ int rpmcliVerify(rpmts ts, QVA_t qva, const char ** argv)
     rpmdepFlags depFlags = qva->depFlags, odepFlags;
     rpmtransFlags transFlags = qva->transFlags, otransFlags;
     rpmVSFlags vsflags, ovsflags;
+    int nthreads = rpmExpandNumeric("%{?_verify_threads}%{!?_verify_threads:1}");
     int ec = 0;
 
     if (qva->qva_showPackage == NULL)
         qva->qva_showPackage = showVerifyPackage;
 
+    /* Check files on worker threads, displaying results in order. */
+    if (nthreads != 1 && _rpmvfPool == NULL)
+	_rpmvfPool = rpmvfPoolNew(nthreads);
+
     /* XXX verify flags are inverted from query. */
     vsflags = rpmExpandNumeric("%{?_vsflags_verify}");
     if (!(qva->qva_flags & VERIFY_DIGEST))
@@ -592,6 +932,8 @@ int rpmcliVerify(rpmts ts, QVA_t qva, const char ** argv)
     if (qva->qva_showPackage == showVerifyPackage)
         qva->qva_showPackage = NULL;
 
+    _rpmvfPool = rpmvfPoolFree(_rpmvfPool);
+
     rpmtsEmpty(ts);
 
     return ec;
@@ -552,6 +552,17 @@ static const struct rpmconstant_s rpmtsOpXctbl[] = {
 	{ "RPMTS_OP_READHDR", RPMTS_OP_READHDR }, 
 	{ "RPMTS_OP_HDRLOAD", RPMTS_OP_HDRLOAD }, 
 	{ "RPMTS_OP_HDRGET", RPMTS_OP_HDRGET }, 
+	{ "RPMTS_OP_FSMREAD", RPMTS_OP_FSMREAD }, 
+	{ "RPMTS_OP_FSMWRITE", RPMTS_OP_FSMWRITE }, 
+	{ "RPMTS_OP_FSMWAIT", RPMTS_OP_FSMWAIT }, 
+	{ "RPMTS_OP_FSYNC", RPMTS_OP_FSYNC }, 
+	{ "RPMTS_OP_DEPHIT", RPMTS_OP_DEPHIT }, 
+	{ "RPMTS_OP_DEPMISS", RPMTS_OP_DEPMISS }, 
+	{ "RPMTS_OP_VFYSTAT", RPMTS_OP_VFYSTAT }, 
+	{ "RPMTS_OP_VFYDIGEST", RPMTS_OP_VFYDIGEST }, 
+	{ "RPMTS_OP_PRELINK", RPMTS_OP_PRELINK }, 
+	{ "RPMTS_OP_PKHIT", RPMTS_OP_PKHIT }, 
+	{ "RPMTS_OP_PKMISS", RPMTS_OP_PKMISS }, 
 	{ "RPMTS_OP_DEBUG", RPMTS_OP_DEBUG }, 
 	{ "RPMTS_OP_MAX", RPMTS_OP_MAX }, 
 #endif /* H_RPMTS */
@@ -601,11 +601,9 @@ assert(dbOpts != NULL && *dbOpts != '\0');
     dbOpts = _free(dbOpts);
 
 /*@-assignexpose@*/
-    {	void *use =  dbi->_item.use;
-        void *pool = dbi->_item.pool;
+    {	struct rpmioItem_s item = dbi->_item;
 /*@i@*/	*dbi = db3dbi;	/* structure assignment */
-        dbi->_item.use = use;
-        dbi->_item.pool = pool;
+        dbi->_item = item;	/* structure assignment */
     }
 /*@=assignexpose@*/
 
@@ -0,0 +1,322 @@
+/** \ingroup rpmdb
+ * \file rpmdb/depcache.c
+ */
+
+#include "system.h"
+
+#include <rpmiotypes.h>
+#include <rpmio.h>		/* XXX _free */
+#include <rpmhash.h>		/* XXX hashFunctionString */
+#include <yarn.h>
+
+#include <rpmtag.h>
+
+#define	_DEPCACHE_INTERNAL
+#include "depcache.h"
+
+#include "debug.h"
+
+/*@access depCache @*/
+
+/*@unchecked@*/
+int _depcache_debug = 0;
+
+/**
+ * Return (the shard of) a name.
+ * @param dc		dependency result cache
+ * @param N		dependency name
+ * @retval *hashp	name hash
+ * @return		shard
+ */
+static depCacheShard depCacheShardOf(depCache dc, const char * N,
+		rpmuint32_t * hashp)
+	/*@modifies *hashp @*/
+{
+    rpmuint32_t hash = hashFunctionString(0, N, 0);
+    *hashp = hash;
+    /* XXX the low bits select the bucket, the high bits the shard. */
+    return dc->shards + ((hash >> 24) & (dc->nshards - 1));
+}
+
+/**
+ * Find a name in a (locked) shard.
+ * @param shard		dependency result cache shard
+ * @param N		dependency name
+ * @param hash		name hash
+ * @return		address of the name link (*link is NULL if not found)
+ */
+static depCacheName * depCacheFind(depCacheShard shard, const char * N,
+		rpmuint32_t hash)
+	/*@*/
+{
+    depCacheName * link = shard->buckets + (hash & (shard->nbuckets - 1));
+    depCacheName dn;
+
+    while ((dn = *link) != NULL) {
+	if (dn->hash == hash && !strcmp(dn->N, N))
+	    break;
+	link = &dn->next;
+    }
+    return link;
+}
+
+/**
+ * Double the no. of buckets in a (locked) shard.
+ * @param shard		dependency result cache shard
+ */
+static void depCacheGrow(depCacheShard shard)
+	/*@modifies shard @*/
+{
+    size_t nbuckets = 2 * shard->nbuckets;
+    depCacheName * buckets = xcalloc(nbuckets, sizeof(*buckets));
+    size_t i;
+
+    for (i = 0; i < shard->nbuckets; i++) {
+	depCacheName dn;
+	while ((dn = shard->buckets[i]) != NULL) {
+	    depCacheName * link = buckets + (dn->hash & (nbuckets - 1));
+	    shard->buckets[i] = dn->next;
+	    dn->next = *link;
+	    *link = dn;
+	}
+    }
+    shard->buckets = _free(shard->buckets);
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+}
+
+/**
+ * Free a name, and all results cached for it.
+ * @param dn		dependency name
+ * @return		no. of results freed
+ */
+static int depCacheNameFree(/*@only@*/ depCacheName dn)
+	/*@modifies dn @*/
+{
+    depCacheEntry de;
+    int n = 0;
+
+    while ((de = dn->entries) != NULL) {
+	dn->entries = de->next;
+	de->EVR = _free(de->EVR);
+	de = _free(de);
+	n++;
+    }
+    dn = _free(dn);
+    return n;
+}
+
+depCache depCacheCreate(int nshards)
+{
+    depCache dc = xcalloc(1, sizeof(*dc));
+    size_t i;
+
+    if (nshards <= 0)
+	nshards = 16;
+    /* Round up to a power of 2. */
+    for (dc->nshards = 1; dc->nshards < (size_t)nshards; dc->nshards <<= 1)
+	{};
+
+    dc->shards = xcalloc(dc->nshards, sizeof(*dc->shards));
+    for (i = 0; i < dc->nshards; i++) {
+	depCacheShard shard = dc->shards + i;
+	shard->lock = yarnNewLock(0);
+	shard->nbuckets = 64;
+	shard->buckets = xcalloc(shard->nbuckets, sizeof(*shard->buckets));
+	shard->nnames = 0;
+    }
+    return dc;
+}
+
+depCache depCacheFree(depCache dc)
+{
+    size_t i, j;
+
+    if (dc == NULL)
+	return NULL;
+
+    for (i = 0; i < dc->nshards; i++) {
+	depCacheShard shard = dc->shards + i;
+	for (j = 0; j < shard->nbuckets; j++) {
+	    depCacheName dn;
+	    while ((dn = shard->buckets[j]) != NULL) {
+		shard->buckets[j] = dn->next;
+		(void) depCacheNameFree(dn);
+	    }
+	}
+	shard->buckets = _free(shard->buckets);
+	shard->lock = yarnFreeLock(shard->lock);
+    }
+    dc->shards = _free(dc->shards);
+    dc = _free(dc);
+    return NULL;
+}
+
+int depCacheGet(depCache dc, const char * N, const char * EVR,
+		rpmuint32_t Flags, int * rcp, rpmuint32_t * instancep)
+{
+    depCacheShard shard;
+    depCacheName dn;
+    depCacheEntry de = NULL;
+    rpmuint32_t hash;
+
+    if (dc == NULL || N == NULL)
+	return 0;
+    if (EVR == NULL)
+	EVR = "";
+
+    shard = depCacheShardOf(dc, N, &hash);
+    yarnPossess(shard->lock);
+    if ((dn = *depCacheFind(shard, N, hash)) != NULL)
+    for (de = dn->entries; de != NULL; de = de->next) {
+	if (de->Flags == Flags && !strcmp(de->EVR, EVR)) {
+	    *rcp = de->rc;
+	    *instancep = de->instance;
+	    break;
+	}
+    }
+    yarnRelease(shard->lock);
+
+if (_depcache_debug)
+fprintf(stderr, "<-- %s(%p, %s, %s, 0x%x) %s\n", __FUNCTION__, dc, N, EVR, Flags, (de != NULL ? "hit" : "miss"));
+
+    return (de != NULL ? 1 : 0);
+}
+
+void depCachePut(depCache dc, const char * N, const char * EVR,
+		rpmuint32_t Flags, int rc, rpmuint32_t instance)
+{
+    depCacheShard shard;
+    depCacheName * link;
+    depCacheName dn;
+    depCacheEntry de;
+    rpmuint32_t hash;
+
+    if (dc == NULL || N == NULL)
+	return;
+    if (EVR == NULL)
+	EVR = "";
+
+    shard = depCacheShardOf(dc, N, &hash);
+    yarnPossess(shard->lock);
+    link = depCacheFind(shard, N, hash);
+    if ((dn = *link) == NULL) {
+	size_t nb = strlen(N);
+	dn = xcalloc(1, sizeof(*dn) + nb);
+	dn->hash = hash;
+	memcpy(dn->N, N, nb + 1);
+	*link = dn;
+	if (++shard->nnames > 2 * shard->nbuckets)
+	    depCacheGrow(shard);
+    }
+
+    for (de = dn->entries; de != NULL; de = de->next) {
+	if (de->Flags == Flags && !strcmp(de->EVR, EVR))
+	    break;
+    }
+    if (de == NULL) {
+	de = xcalloc(1, sizeof(*de));
+	de->Flags = Flags;
+	de->EVR = xstrdup(EVR);
+	de->next = dn->entries;
+	dn->entries = de;
+    }
+    de->rc = rc;
+    de->instance = instance;
+    yarnRelease(shard->lock);
+}
+
+int depCacheInvalidate(depCache dc, const char * N)
+{
+    depCacheShard shard;
+    depCacheName * link;
+    depCacheName dn;
+    rpmuint32_t hash;
+    int n = 0;
+
+    if (dc == NULL || N == NULL)
+	return 0;
+
+    shard = depCacheShardOf(dc, N, &hash);
+    yarnPossess(shard->lock);
+    link = depCacheFind(shard, N, hash);
+    if ((dn = *link) != NULL) {
+	*link = dn->next;
+	shard->nnames--;
+	n = depCacheNameFree(dn);
+    }
+    yarnRelease(shard->lock);
+    return n;
+}
+
+int depCacheInvalidateHeader(depCache dc, Header h)
+{
+    HE_t he = memset(alloca(sizeof(*he)), 0, sizeof(*he));
+    const char ** baseNames;
+    const char ** dirNames;
+    rpmuint32_t * dirIndexes;
+    rpmuint32_t nfiles;
+    size_t nb = 0;
+    char * fn = NULL;
+    rpmuint32_t i;
+    int n = 0;
+
+    if (dc == NULL || h == NULL)
+	return 0;
+
+    he->tag = RPMTAG_NAME;
+    if (headerGet(h, he, 0)) {
+	n += depCacheInvalidate(dc, he->p.str);
+	he->p.ptr = _free(he->p.ptr);
+    }
+
+    he->tag = RPMTAG_PROVIDENAME;
+    if (headerGet(h, he, 0)) {
+	for (i = 0; i < he->c; i++)
+	    n += depCacheInvalidate(dc, he->p.argv[i]);
+	he->p.ptr = _free(he->p.ptr);
+    }
+
+    he->tag = RPMTAG_BASENAMES;
+    if (!headerGet(h, he, 0))
+	goto exit;
+    baseNames = he->p.argv;
+    nfiles = he->c;
+    he->tag = RPMTAG_DIRNAMES;
+    if (!headerGet(h, he, 0)) {
+	baseNames = _free(baseNames);
+	goto exit;
+    }
+    dirNames = he->p.argv;
+    he->tag = RPMTAG_DIRINDEXES;
+    if (!headerGet(h, he, 0)) {
+	baseNames = _free(baseNames);
+	dirNames = _free(dirNames);
+	goto exit;
+    }
+    dirIndexes = he->p.ui32p;
+
+    /* Invalidate file dependencies, by (full) path. */
+    for (i = 0; i < nfiles; i++) {
+	const char * dn = dirNames[dirIndexes[i]];
+	size_t dnlen = strlen(dn);
+	size_t bnlen = strlen(baseNames[i]);
+	if (dnlen + bnlen + 1 > nb) {
+	    nb = 2 * (dnlen + bnlen + 1);
+	    fn = xrealloc(fn, nb);
+	}
+	memcpy(fn, dn, dnlen);
+	memcpy(fn + dnlen, baseNames[i], bnlen + 1);
+	n += depCacheInvalidate(dc, fn);
+    }
+
+    fn = _free(fn);
+    baseNames = _free(baseNames);
+    dirNames = _free(dirNames);
+    dirIndexes = _free(dirIndexes);
+
+exit:
+if (_depcache_debug)
+fprintf(stderr, "<-- %s(%p, %p) invalidated %d\n", __FUNCTION__, dc, h, n);
+    return n;
+}
@@ -0,0 +1,142 @@
+#ifndef H_DEPCACHE
+#define H_DEPCACHE
+
+/** \ingroup rpmdb
+ * \file rpmdb/depcache.h
+ * Memoized dependency results against an rpmdb.
+ *
+ * Results are keyed by a dependency (N, Flags, EVR) tuple, and are sharded
+ * by N, each shard with its own lock. Adding or removing a header
+ * invalidates exactly the names the header provides, and the file paths
+ * it contains.
+ */
+
+/**
+ */
+typedef /*@abstract@*/ struct depCache_s * depCache;
+
+#if defined(_DEPCACHE_INTERNAL)
+/**
+ * A cached result.
+ */
+typedef struct depCacheEntry_s * depCacheEntry;
+struct depCacheEntry_s {
+/*@only@*/ /*@null@*/
+    depCacheEntry next;		/*!< next result for the same name */
+    rpmuint32_t Flags;		/*!< dependency comparison flags */
+/*@only@*/
+    const char * EVR;		/*!< dependency EVR */
+    int rc;			/*!< result (0 satisfied, 1 not satisfied) */
+    rpmuint32_t instance;	/*!< satisfying header instance (if any) */
+};
+
+/**
+ * A (interned) dependency name, and the results cached for it.
+ */
+typedef struct depCacheName_s * depCacheName;
+struct depCacheName_s {
+/*@only@*/ /*@null@*/
+    depCacheName next;		/*!< next name in bucket */
+    rpmuint32_t hash;		/*!< name hash */
+/*@only@*/ /*@null@*/
+    depCacheEntry entries;	/*!< cached results */
+    char N[1];			/*!< dependency name */
+};
+
+/**
+ * A shard of the cache.
+ */
+typedef struct depCacheShard_s * depCacheShard;
+struct depCacheShard_s {
+    yarnLock lock;		/*!< shard lock */
+/*@only@*/
+    depCacheName * buckets;	/*!< hash buckets */
+    size_t nbuckets;		/*!< no. of buckets (power of 2) */
+    size_t nnames;		/*!< no. of names */
+};
+
+/**
+ * Dependency result cache.
+ */
+struct depCache_s {
+/*@only@*/
+    struct depCacheShard_s * shards;
+    size_t nshards;		/*!< no. of shards (power of 2) */
+};
+#endif	/* _DEPCACHE_INTERNAL */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create a dependency result cache.
+ * @param nshards	no. of shards (0 uses a default)
+ * @return		new dependency result cache
+ */
+/*@only@*/
+depCache depCacheCreate(int nshards)
+	/*@*/;
+
+/**
+ * Destroy a dependency result cache.
+ * @param dc		dependency result cache
+ * @return		NULL always
+ */
+/*@null@*/
+depCache depCacheFree(/*@only@*/ /*@null@*/ depCache dc)
+	/*@modifies dc @*/;
+
+/**
+ * Look up a dependency result.
+ * @param dc		dependency result cache
+ * @param N		dependency name
+ * @param EVR		dependency EVR (or NULL)
+ * @param Flags		dependency comparison flags
+ * @retval *rcp		cached result
+ * @retval *instancep	header instance that satisfied the dependency (or 0)
+ * @return		1 if found, 0 if not
+ */
+int depCacheGet(/*@null@*/ depCache dc, const char * N,
+		/*@null@*/ const char * EVR, rpmuint32_t Flags,
+		/*@out@*/ int * rcp, /*@out@*/ rpmuint32_t * instancep)
+	/*@modifies dc, *rcp, *instancep @*/;
+
+/**
+ * Save a dependency result.
+ * @param dc		dependency result cache
+ * @param N		dependency name
+ * @param EVR		dependency EVR (or NULL)
+ * @param Flags		dependency comparison flags
+ * @param rc		result (0 satisfied, 1 not satisfied)
+ * @param instance	header instance that satisfied the dependency (or 0)
+ */
+void depCachePut(/*@null@*/ depCache dc, const char * N,
+		/*@null@*/ const char * EVR, rpmuint32_t Flags,
+		int rc, rpmuint32_t instance)
+	/*@modifies dc @*/;
+
+/**
+ * Discard all results for a dependency name.
+ * @param dc		dependency result cache
+ * @param N		dependency name
+ * @return		no. of results discarded
+ */
+int depCacheInvalidate(/*@null@*/ depCache dc, const char * N)
+	/*@modifies dc @*/;
+
+/**
+ * Discard all results that adding/removing a header may change, i.e.
+ * for the names it provides, and for its file paths.
+ * @param dc		dependency result cache
+ * @param h		header
+ * @return		no. of results discarded
+ */
+int depCacheInvalidateHeader(/*@null@*/ depCache dc, Header h)
+	/*@modifies dc, h @*/;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* H_DEPCACHE */
@@ -21,20 +21,40 @@
 fingerPrintCache fpCacheCreate(int sizeHint)
 {
     fingerPrintCache fpc;
+    int i;
 
     fpc = xmalloc(sizeof(*fpc));
-    fpc->ht = htCreate(sizeHint * 2, 0, 1, NULL, NULL);
-assert(fpc->ht != NULL);
+    for (i = 0; i < FPC_NSHARDS; i++) {
+	fpc->ht[i] = htCreate(sizeHint / FPC_NSHARDS + 1, 0, 1, NULL, NULL);
+assert(fpc->ht[i] != NULL);
+	fpc->lock[i] = yarnNewLock(0);
+    }
     return fpc;
 }
 
 fingerPrintCache fpCacheFree(fingerPrintCache cache)
 {
-    cache->ht = htFree(cache->ht);
+    int i;
+
+    for (i = 0; i < FPC_NSHARDS; i++) {
+	cache->ht[i] = htFree(cache->ht[i]);
+	cache->lock[i] = yarnFreeLock(cache->lock[i]);
+    }
     free(cache);
     return NULL;
 }
 
+/**
+ * Return cache shard of a directory name.
+ * @param dirName	directory name
+ * @return		shard index
+ */
+static int cacheShard(const char * dirName)
+	/*@*/
+{
+    return (int)(hashFunctionString(0, dirName, 0) & (FPC_NSHARDS - 1));
+}
+
 /**
  * Find directory name entry in cache.
  * @param cache		pointer to fingerprint cache
@@ -46,11 +66,43 @@ static /*@null@*/ const struct fprintCacheEntry_s * cacheContainsDirectory(
 			    const char * dirName)
 	/*@*/
 {
+    const struct fprintCacheEntry_s * entry = NULL;
+    int ix = cacheShard(dirName);
+    const void ** data;
+
+    yarnPossess(cache->lock[ix]);
+    if (!htGetEntry(cache->ht[ix], dirName, &data, NULL, NULL))
+	entry = data[0];
+    yarnRelease(cache->lock[ix]);
+    return entry;
+}
+
+/**
+ * Add directory name entry to cache, unless another thread already did.
+ * @param cache		pointer to fingerprint cache
+ * @param newEntry	directory name entry (freed if already cached)
+ * @return		cached directory name entry
+ */
+static const struct fprintCacheEntry_s * cacheAddDirectory(
+			    fingerPrintCache cache,
+			    /*@only@*/ struct fprintCacheEntry_s * newEntry)
+	/*@modifies cache, newEntry @*/
+{
+    const struct fprintCacheEntry_s * entry = newEntry;
+    int ix = cacheShard(newEntry->dirName);
     const void ** data;
 
-    if (htGetEntry(cache->ht, dirName, &data, NULL, NULL))
-	return NULL;
-    return data[0];
+    yarnPossess(cache->lock[ix]);
+    if (!htGetEntry(cache->ht[ix], newEntry->dirName, &data, NULL, NULL)) {
+	entry = data[0];
+	newEntry = _free(newEntry);
+    } else {
+	/*@-kepttrans -dependenttrans @*/
+	htAddEntry(cache->ht[ix], newEntry->dirName, newEntry);
+	/*@=kepttrans =dependenttrans @*/
+    }
+    yarnRelease(cache->lock[ix]);
+    return entry;
 }
 
 /**
@@ -144,11 +196,7 @@ static fingerPrint doLookup(fingerPrintCache cache,
 	    newEntry->ino = (ino_t)sb.st_ino;
 	    newEntry->dev = (dev_t)sb.st_dev;
 	    newEntry->dirName = dn;
-	    fp.entry = newEntry;
-
-	    /*@-kepttrans -dependenttrans @*/
-	    htAddEntry(cache->ht, dn, fp.entry);
-	    /*@=kepttrans =dependenttrans @*/
+	    fp.entry = cacheAddDirectory(cache, newEntry);
 	    /*@=usereleased@*/
 	}
 
@@ -197,15 +245,12 @@ rpmuint32_t fpHashFunction(rpmuint32_t h, const void * data,
 		/*@unused@*/ size_t size)
 {
     const fingerPrint * fp = data;
-    const char * chptr = fp->baseName;
-    unsigned char ch = '\0';
 
-    while (*chptr != '\0') ch ^= *chptr++;
+    /* XXX hash all of baseName: files in the same directory share dev/ino. */
+    h = hashFunctionString(h, fp->baseName, 0);
+    h ^= (rpmuint32_t)fp->entry->dev * 0x9e3779b1U;
+    h ^= (rpmuint32_t)fp->entry->ino;
 
-    h |= ((unsigned)ch) << 24;
-    h |= (((((unsigned)fp->entry->dev) >> 8) ^ fp->entry->dev) & 0xFF) << 16;
-    h |= fp->entry->ino & 0xFFFF;
-    
     return h;
 }
 
@@ -313,10 +358,6 @@ void fpLookupSubdir(hashTable symlinks, hashTable fphash, fingerPrintCache fpc,
     char * t;
     char * te;
 
-    struct rpmffi_s * ffi = xmalloc(sizeof(*ffi));
-    ffi->p = p;
-    ffi->fileno = filenr;
-
 restart:
     *cfp = *fps;
     if (cfp->subDir == NULL)
@@ -394,6 +435,11 @@ assert(link[strlen(link)-1] == '/');
     s = _free(s);
 
 exit:
-    htAddEntry(fphash, fps, ffi);
+    if (fphash != NULL) {
+	struct rpmffi_s * ffi = xmalloc(sizeof(*ffi));
+	ffi->p = p;
+	ffi->fileno = filenr;
+	htAddEntry(fphash, fps, ffi);
+    }
     return;
 }
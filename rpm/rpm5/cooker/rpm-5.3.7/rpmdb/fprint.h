@@ -7,6 +7,7 @@
  */
 
 #include "rpmhash.h"
+#include <yarn.h>
 
 /**
  */
@@ -29,11 +30,19 @@ struct fprintCacheEntry_s {
     ino_t ino;				/*!< stat(2) inode number */
 };
 
+/**
+ * No. of finger print cache shards (a power of 2).
+ */
+#define	FPC_NSHARDS	16
+
 /**
  * Finger print cache.
+ * Directories are spread over shards by dirName hash, each shard with its
+ * own lock, so that file lists can be finger printed concurrently.
  */
 struct fprintCache_s {
-    hashTable ht;			/*!< hashed by dirName */
+    hashTable ht[FPC_NSHARDS];		/*!< hashed by dirName */
+    yarnLock lock[FPC_NSHARDS];		/*!< shard locks */
 };
 
 #if defined(_FPRINT_INTERNAL)
@@ -149,6 +158,7 @@ void fpLookupList(fingerPrintCache cache, const char ** dirNames,
  *  correct their fingerprint and add it to newht.
  * @param ht		hash table containing all files fingerprints
  * @param newht		hash table to add the corrected fingerprints
+ *			(NULL if the caller adds them, e.g. htAddEntries())
  * @param fpc		fingerprint cache
  * @param _p		transaction element
  * @param filenr	the number of the file we are dealing with
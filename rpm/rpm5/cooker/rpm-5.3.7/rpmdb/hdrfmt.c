@@ -203,12 +203,12 @@ static char * realDateFormat(HE_t he, /*@unused@*/ /*@null@*/ const char ** av,
     if (he->t != RPM_UINT64_TYPE) {
 	val = xstrdup(_("(not a number)"));
     } else {
-	struct tm * tstruct;
+	struct tm tm, * tstruct;
 	char buf[50];
 
 	/* this is important if sizeof(rpmuint64_t) ! sizeof(time_t) */
 	{   time_t dateint = he->p.ui64p[0];
-	    tstruct = localtime(&dateint);
+	    tstruct = localtime_r(&dateint, &tm);
 	}
 	buf[0] = '\0';
 	if (tstruct)
@@ -1459,7 +1459,8 @@ assert(ix == 0);
 
 	    /* this is important if sizeof(rpmuint32_t) ! sizeof(time_t) */
 	    {	time_t dateint = pgpGrab(sigp->time, sizeof(sigp->time));
-		struct tm * tstruct = localtime(&dateint);
+		struct tm tm;
+		struct tm * tstruct = localtime_r(&dateint, &tm);
 		if (tstruct)
  		    (void) strftime(t, (nb - (t - val)), "%c", tstruct);
 	    }
@@ -5291,6 +5292,15 @@ struct headerSprintfArgs_s {
     size_t alloced;
     size_t numTokens;
     size_t i;
+/*@observer@*/ /*@null@*/
+    spew_t spew;		/*!< Output markup (--xml, --yaml, --json). */
+};
+
+/** \ingroup header
+ * A compiled query format.
+ */
+struct hdrfmt_s {
+    struct headerSprintfArgs_s hsa;
 };
 
 /*@access sprintfTag @*/
@@ -5389,6 +5399,42 @@ freeFormat( /*@only@*/ /*@null@*/ sprintfToken format, size_t num)
     return NULL;
 }
 
+/**
+ * Discard tag values saved in a headerSprintf format array.
+ * @param format	sprintf format array
+ * @param num		number of elements
+ */
+static void cleanFormat(/*@null@*/ sprintfToken format, size_t num)
+	/*@modifies *format @*/
+{
+    unsigned i;
+
+    if (format == NULL) return;
+
+    for (i = 0; i < (unsigned) num; i++) {
+	switch (format[i].type) {
+	case PTOK_TAG:
+	    (void) rpmheClean(&format[i].u.tag.he);
+	    /*@switchbreak@*/ break;
+	case PTOK_ARRAY:
+	    cleanFormat(format[i].u.array.format,
+			format[i].u.array.numTokens);
+	    /*@switchbreak@*/ break;
+	case PTOK_COND:
+	    cleanFormat(format[i].u.cond.ifFormat,
+			format[i].u.cond.numIfTokens);
+	    cleanFormat(format[i].u.cond.elseFormat,
+			format[i].u.cond.numElseTokens);
+	    (void) rpmheClean(&format[i].u.cond.tag.he);
+	    /*@switchbreak@*/ break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	default:
+	    /*@switchbreak@*/ break;
+	}
+    }
+}
+
 /**
  * Initialize an hsa iteration.
  * @param hsa		headerSprintf args
@@ -5463,7 +5509,17 @@ static headerSprintfArgs hsaFini(/*@returned@*/ headerSprintfArgs hsa)
 	/*@globals fileSystem @*/
 	/*@modifies hsa, fileSystem @*/
 {
+    sprintfTag tag =
+	(hsa->format->type == PTOK_TAG
+	    ? &hsa->format->u.tag :
+	(hsa->format->type == PTOK_ARRAY
+	    ? &hsa->format->u.array.format->u.tag :
+	NULL));
+
     if (hsa != NULL) {
+	/* Restore the "*" marker that hsaNext() overwrote while iterating. */
+	if (hsa->hi != NULL && tag != NULL && tag->tagno != NULL)
+	    tag->tagno[0] = (rpmTag)-2;
 	hsa->hi = headerFini(hsa->hi);
 	hsa->i = 0;
     }
@@ -6123,7 +6179,7 @@ static char * formatValue(headerSprintfArgs hsa, sprintfTag tag,
 	    xx = getExtension(hsa, tag->ext, he, hsa->ec + tag->extNum);
 	else {
 	    he->tag = tag->tagno[0];	/* XXX necessary? */
-	    xx = headerGet(hsa->h, he, 0);
+	    xx = headerGet(hsa->h, he, HEADERGET_NOCOPY);
 	}
 	if (!xx) {
 	    (void) rpmheClean(he);
@@ -6365,7 +6421,7 @@ static char * singleSprintf(headerSprintfArgs hsa, sprintfToken token,
 		if (tag->ext)
 		    xx = getExtension(hsa, tag->ext, he, hsa->ec + tag->extNum);
 		else
-		    xx = headerGet(hsa->h, he, 0);
+		    xx = headerGet(hsa->h, he, HEADERGET_NOCOPY);
 		if (!xx) {
 		    (void) rpmheClean(he);
 		    continue;
@@ -6561,22 +6617,21 @@ rpmecFree(const headerSprintfExtension exts, /*@only@*/ HE_t ec)
     return NULL;
 }
 
-char * headerSprintf(Header h, const char * fmt,
-		headerTagTableEntry tags,
-		headerSprintfExtension exts,
-		errmsg_t * errmsg)
+/**
+ * Parse a format, resolving tag names and extensions.
+ * @param hsa		headerSprintf args
+ * @param fmt		format to use
+ * @param tags		array of tag name/value/type triples (NULL uses default)
+ * @param exts		formatting extensions chained table (NULL uses default)
+ * @return		0 on success
+ */
+static int hsaCompile(headerSprintfArgs hsa, const char * fmt,
+		/*@null@*/ headerTagTableEntry tags,
+		/*@null@*/ headerSprintfExtension exts)
+	/*@globals headerCompoundFormats @*/
+	/*@modifies hsa @*/
 {
-    headerSprintfArgs hsa = memset(alloca(sizeof(*hsa)), 0, sizeof(*hsa));
-    sprintfToken nextfmt;
     sprintfTag tag;
-    char * t, * te;
-    int need;
-spew_t spew = NULL;
-
-/*@-modfilesys@*/
-if (_hdrqf_debug)
-fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, exts, errmsg);
-/*@=modfilesys@*/
 
     /* Set some reasonable defaults */
     if (tags == NULL)
@@ -6585,9 +6640,6 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
     if (exts == NULL)
 	exts = headerCompoundFormats;
  
-/*@-assignexpose -castexpose @*/
-    hsa->h = headerLink(h);
-/*@=assignexpose =castexpose @*/
     hsa->fmt = xstrdup(fmt);
 /*@-assignexpose -dependenttrans@*/
     hsa->exts = exts;
@@ -6596,7 +6648,7 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
     hsa->errmsg = NULL;
 
     if (parseFormat(hsa, hsa->fmt, &hsa->format, &hsa->numTokens, NULL, PARSER_BEGIN))
-	goto exit;
+	return 1;
 
     hsa->nec = 0;
     hsa->ec = rpmecNew(hsa->exts, &hsa->nec);
@@ -6609,17 +6661,47 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
 	    ? &hsa->format->u.array.format->u.tag :
 	NULL));
 
-spew = NULL;
+    hsa->spew = NULL;
     /* XXX Ick: +1 needed to handle :extractor |transformer marking. */
     if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
      && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "xml"))
-	spew = &_xml_spew;
+	hsa->spew = &_xml_spew;
     if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
      && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "yaml"))
-	spew = &_yaml_spew;
+	hsa->spew = &_yaml_spew;
     if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
      && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "json"))
-	spew = &_json_spew;
+	hsa->spew = &_json_spew;
+
+    return 0;
+}
+
+/**
+ * Format a header with a parsed format.
+ * Tag values saved while formatting are discarded before returning, so
+ * that the parsed format can be reused with the next header.
+ * @param hsa		headerSprintf args
+ * @param h		header
+ * @return		formatted output (in hsa->val, NULL on error)
+ */
+/*@observer@*/ /*@null@*/
+static const char * hsaRun(headerSprintfArgs hsa, Header h)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies hsa, h, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    spew_t spew = hsa->spew;
+    sprintfToken nextfmt;
+    const char * val = hsa->val;
+    char * t, * te;
+    size_t need;
+    int i;
+
+/*@-assignexpose -castexpose @*/
+    hsa->h = headerLink(h);
+/*@=assignexpose =castexpose @*/
+    hsa->errmsg = NULL;
+    hsa->vallen = 0;
+    *hsa->val = '\0';
 
     if (spew && spew->spew_init && spew->spew_init[0]) {
 	need = strlen(spew->spew_init);
@@ -6634,35 +6716,119 @@ spew = NULL;
 	te = singleSprintf(hsa, nextfmt, 0);
 /*@=globs =mods @*/
 	if (te == NULL) {
-	    hsa->val = _free(hsa->val);
+	    val = NULL;
 	    break;
 	}
     }
     hsa = hsaFini(hsa);
 
-    if (spew && spew->spew_fini && spew->spew_fini[0]) {
+    if (val != NULL && spew && spew->spew_fini && spew->spew_fini[0]) {
 	need = strlen(spew->spew_fini);
 	t = hsaReserve(hsa, need);
 	te = stpcpy(t, spew->spew_fini);
 	hsa->vallen += (te - t);
     }
+    if (val != NULL)
+	val = hsa->val;
 
-    if (hsa->val != NULL && hsa->vallen < hsa->alloced)
-	hsa->val = xrealloc(hsa->val, hsa->vallen+1);	
+    cleanFormat(hsa->format, hsa->numTokens);
+    for (i = 0; i < hsa->nec; i++)
+	(void) rpmheClean(&hsa->ec[i]);
 
-    hsa->ec = rpmecFree(hsa->exts, hsa->ec);
+    (void)headerFree(hsa->h);
+    hsa->h = NULL;
+    return val;
+}
+
+/**
+ * Free the parsed format, and the output, of a headerSprintf.
+ * @param hsa		headerSprintf args
+ */
+static void hsaDestroy(headerSprintfArgs hsa)
+	/*@modifies hsa @*/
+{
+    if (hsa->ec != NULL)
+	hsa->ec = rpmecFree(hsa->exts, hsa->ec);
     hsa->nec = 0;
     hsa->format = freeFormat(hsa->format, hsa->numTokens);
+    hsa->fmt = _free(hsa->fmt);
+    hsa->val = _free(hsa->val);
+}
+
+char * headerSprintf(Header h, const char * fmt,
+		headerTagTableEntry tags,
+		headerSprintfExtension exts,
+		errmsg_t * errmsg)
+{
+    headerSprintfArgs hsa = memset(alloca(sizeof(*hsa)), 0, sizeof(*hsa));
+    char * val = NULL;
+
+/*@-modfilesys@*/
+if (_hdrqf_debug)
+fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, exts, errmsg);
+/*@=modfilesys@*/
+
+    if (hsaCompile(hsa, fmt, tags, exts))
+	goto exit;
+
+    if (hsaRun(hsa, h) != NULL) {
+	val = hsa->val;
+	hsa->val = NULL;
+	if (hsa->vallen < hsa->alloced)
+	    val = xrealloc(val, hsa->vallen+1);	
+    }
 
 exit:
 /*@-dependenttrans -observertrans @*/
     if (errmsg)
 	*errmsg = hsa->errmsg;
 /*@=dependenttrans =observertrans @*/
-    (void)headerFree(hsa->h);
-    hsa->h = NULL;
-    hsa->fmt = _free(hsa->fmt);
+    hsaDestroy(hsa);
 /*@-retexpose@*/
-    return hsa->val;
+    return val;
 /*@=retexpose@*/
 }
+
+hdrfmt_t headerCompileFormat(const char * fmt,
+		headerTagTableEntry tags,
+		headerSprintfExtension exts,
+		errmsg_t * errmsg)
+{
+    hdrfmt_t hfmt = xcalloc(1, sizeof(*hfmt));
+    headerSprintfArgs hsa = &hfmt->hsa;
+
+/*@-modfilesys@*/
+if (_hdrqf_debug)
+fprintf(stderr, "==> headerCompileFormat(\"%s\", %p, %p, %p)\n", fmt, tags, exts, errmsg);
+/*@=modfilesys@*/
+
+    if (hsaCompile(hsa, fmt, tags, exts)) {
+/*@-dependenttrans -observertrans @*/
+	if (errmsg)
+	    *errmsg = hsa->errmsg;
+/*@=dependenttrans =observertrans @*/
+	hfmt = headerFormatFree(hfmt);
+    }
+    return hfmt;
+}
+
+const char * headerFormatRun(Header h, hdrfmt_t hfmt, errmsg_t * errmsg)
+{
+    headerSprintfArgs hsa = &hfmt->hsa;
+    const char * val = hsaRun(hsa, h);
+
+/*@-dependenttrans -observertrans @*/
+    if (errmsg)
+	*errmsg = hsa->errmsg;
+/*@=dependenttrans =observertrans @*/
+    return val;
+}
+
+hdrfmt_t headerFormatFree(hdrfmt_t hfmt)
+{
+    if (hfmt != NULL) {
+	hsaDestroy(&hfmt->hsa);
+	hfmt = _free(hfmt);
+    }
+    return NULL;
+}
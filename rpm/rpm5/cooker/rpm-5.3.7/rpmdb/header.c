@@ -1119,7 +1119,6 @@ errxit:
     /*@-usereleased@*/
     if (h) {
 	h->index = _free(h->index);
-	yarnPossess(h->_item.use);	/* XXX rpmioPutItem expects locked. */
 	h = (Header) rpmioPutPool((rpmioItem)h);
     }
     /*@=usereleased@*/
@@ -1640,12 +1639,41 @@ headerFindI18NString(Header h, indexEntry entry)
     return entry->data;
 }
 
+/**
+ * Can tag data be returned as is (i.e. w/o byte swapping)?
+ * @param he		tag container
+ * @return		1 if no swapping is needed
+ */
+static int rpmheNoSwab(const HE_t he)
+	/*@*/
+{
+    switch (he->t) {
+    case RPM_UINT16_TYPE:
+    case RPM_UINT32_TYPE:
+    case RPM_UINT64_TYPE:
+#if defined(WORDS_BIGENDIAN)
+	return (he->t != RPM_UINT64_TYPE);
+#else
+	return 0;
+#endif
+	/*@notreached@*/ break;
+    case RPM_BIN_TYPE:
+    case RPM_UINT8_TYPE:
+    case RPM_STRING_TYPE:
+	return 1;
+	/*@notreached@*/ break;
+    default:
+	break;
+    }
+    return 0;
+}
+
 /**
  * Retrieve tag data from header.
  * @param h		header
  * @param he		tag container
  * @param flags		headerGet flags
- * @return		1 on success, 0 on not found
+ * @return		1 on success, 2 if borrowed from header, 0 on not found
  */
 static int intGetEntry(Header h, HE_t he, int flags)
 	/*@modifies he @*/
@@ -1665,6 +1693,16 @@ static int intGetEntry(Header h, HE_t he, int flags)
 	return 0;
     }
 
+    /*
+     * Region data is immutable, and (if not swabbed) can be lent, but only
+     * if the header owns its blob: a usermem blob (e.g. a rpmdb cursor
+     * buffer) can disappear while the header is still in use.
+     */
+    if ((flags & HEADERGET_NOCOPY) && ENTRY_IN_REGION(entry)
+     && !ENTRY_IS_REGION(entry)
+     && (h->flags & (HEADERFLAG_ALLOCATED | HEADERFLAG_MAPPED)))
+	minMem = 1;
+
     switch (entry->info.type) {
     case RPM_I18NSTRING_TYPE:
 	if (!(flags & HEADERGET_NOI18NSTRING)) {
@@ -1683,7 +1721,9 @@ static int intGetEntry(Header h, HE_t he, int flags)
     }
 
     /* XXX 1 on success */
-    return (rc == 1 ? 1 : 0);
+    if (rc != 1)
+	return 0;
+    return (minMem && rpmheNoSwab(he) ? 2 : 1);
 }
 
 /**
@@ -2167,13 +2207,35 @@ void headerCopyTags(Header headerFrom, Header headerTo, rpmTag * tagstocopy)
     }
 }
 
+/**
+ * Find the tag extension (if any) that overrides a tag.
+ * @param name		tag name
+ * @return		tag extension (NULL if none)
+ */
+/*@observer@*/ /*@null@*/
+static headerSprintfExtension headerFindExtension(const char * name)
+	/*@globals headerCompoundFormats @*/
+	/*@*/
+{
+    headerSprintfExtension exts = headerCompoundFormats;
+    headerSprintfExtension ext;
+
+    for (ext = exts; ext != NULL && ext->type != HEADER_EXT_LAST;
+	ext = (ext->type == HEADER_EXT_MORE ? *ext->u.more : ext+1))
+    {
+	if (ext->name == NULL || ext->type != HEADER_EXT_TAG)
+	    continue;
+	if (!xstrcasecmp(ext->name + (sizeof("RPMTAG_")-1), name))
+	    return ext;
+    }
+    return NULL;
+}
+
 int headerGet(Header h, HE_t he, unsigned int flags)
 {
     void * sw;
     const char * name;
-    headerSprintfExtension exts = headerCompoundFormats;
     headerSprintfExtension ext = NULL;
-    int extNum;
     int rc;
 
     if (h == NULL || he == NULL)	return 0;	/* XXX this is nutty. */
@@ -2190,22 +2252,17 @@ int headerGet(Header h, HE_t he, unsigned int flags)
 
     /* Search extensions for specific tag override. */
     if (!(flags & HEADERGET_NOEXTENSION))
-    for (ext = exts, extNum = 0; ext != NULL && ext->type != HEADER_EXT_LAST;
-	ext = (ext->type == HEADER_EXT_MORE ? *ext->u.more : ext+1), extNum++)
-    {
-	if (ext->name == NULL || ext->type != HEADER_EXT_TAG)
-	    continue;
-	if (!xstrcasecmp(ext->name + (sizeof("RPMTAG_")-1), name))
-	    break;
-    }
+	ext = headerFindExtension(name);
 
-    if (ext && ext->name != NULL && ext->type == HEADER_EXT_TAG) {
+    if (ext != NULL) {
 	rc = ext->u.tagFunction(h, he);
 	rc = (rc == 0);		/* XXX invert extension return. */
     } else
 	rc = intGetEntry(h, he, flags);
 
-    if (rc)
+    if (rc == 2)	/* XXX borrowed, he->freeData == 0 */
+	rc = 1;
+    else if (rc)
 	rc = rpmheRealloc(he);
 
     if (sw != NULL)	(void) rpmswExit(sw, 0);
@@ -2220,7 +2277,8 @@ int headerGet(Header h, HE_t he, unsigned int flags)
 
 /*@-modfilesys@*/
     if (!((rc == 0 && he->freeData == 0 && he->p.ptr == NULL) ||
-	  (rc == 1 && he->freeData == 1 && he->p.ptr != NULL)))
+	  (rc == 1 && he->freeData == 1 && he->p.ptr != NULL) ||
+	  (rc == 1 && (flags & HEADERGET_NOCOPY) && he->p.ptr != NULL)))
     {
 if (_hdr_debug)
 fprintf(stderr, "==> %s(%u) %u %p[%u] free %u rc %d\n", name, (unsigned) he->tag, (unsigned) he->t, he->p.ptr, (unsigned) he->c, he->freeData, rc);
@@ -2230,6 +2288,134 @@ fprintf(stderr, "==> %s(%u) %u %p[%u] free %u rc %d\n", name, (unsigned) he->tag
     return rc;
 }
 
+int headerGetBlob(const void * uh, size_t uhlen, HE_t he)
+{
+    const rpmuint32_t * ei = (const rpmuint32_t *) uh;
+    rpmuint32_t il, dl;
+    entryInfo pe;
+    const char * dataStart;
+    const char * s;
+    struct entryInfo_s info;
+    rpmuint32_t i;
+    size_t nb;
+    int found = -1;
+
+    {	rpmTag tag = he->tag;
+	memset(he, 0, sizeof(*he));
+	he->tag = tag;
+    }
+
+    /* Tags that are overridden by an extension are decided after loading. */
+    if (headerFindExtension(tagName(he->tag)) != NULL)
+	return -1;
+
+    if (uh == NULL || uhlen < 2 * sizeof(*ei))
+	return -1;
+    il = (rpmuint32_t) ntohl(ei[0]);
+    dl = (rpmuint32_t) ntohl(ei[1]);
+    if (hdrchkTags(il) || hdrchkData(dl))
+	return -1;
+    nb = 2 * sizeof(*ei) + il * sizeof(*pe) + dl;
+    if (nb > uhlen)
+	return -1;
+/*@-castexpose@*/
+    pe = (entryInfo) &ei[2];
+/*@=castexpose@*/
+    dataStart = (const char *) (pe + il);
+
+    /* Find the (one and only) index entry for the tag. */
+    for (i = 0; i < il; i++) {
+	if ((rpmTag) ntohl(pe[i].tag) != he->tag)
+	    continue;
+	if (found >= 0)		/* XXX dribbles are merged when loaded. */
+	    return -1;
+	found = (int) i;
+    }
+    if (found < 0)
+	return 0;
+
+    info.tag = he->tag;
+    info.type = (rpmTagType) ntohl(pe[found].type);
+    /* XXX Convert RPMTAG_FILESTATE to RPM_UINT8_TYPE. */
+    if (info.tag == 1029 && info.type == 1)
+	info.type = RPM_UINT8_TYPE;
+    info.offset = (rpmint32_t) ntohl(pe[found].offset);
+    info.count = (rpmTagCount) ntohl(pe[found].count);
+    if (hdrchkType(info.type) || hdrchkAlign(info.type, info.offset)
+     || hdrchkRange((rpmint32_t)dl, info.offset) || hdrchkData(info.count)
+     || info.count == 0)
+	return -1;
+
+    s = dataStart + info.offset;
+    nb = dl - info.offset;
+    he->t = info.type;
+    he->c = info.count;
+
+    switch (info.type) {
+    case RPM_STRING_TYPE:
+	if (info.count != 1 || memchr(s, '\0', nb) == NULL)
+	    return -1;
+	he->p.str = s;
+	break;
+    case RPM_STRING_ARRAY_TYPE:
+    {	const char ** argv = xmalloc(info.count * sizeof(*argv));
+	const char * se;
+	for (i = 0; i < info.count; i++) {
+	    if ((se = memchr(s, '\0', nb)) == NULL) {
+		argv = _free(argv);
+		return -1;
+	    }
+	    argv[i] = s;
+	    nb -= (se + 1 - s);
+	    s = se + 1;
+	}
+	he->p.argv = argv;
+	he->freeData = 1;
+    }	break;
+    case RPM_UINT8_TYPE:
+    case RPM_BIN_TYPE:
+	if (info.count > nb)
+	    return -1;
+	he->p.ui8p = (rpmuint8_t *) s;
+	break;
+    case RPM_UINT16_TYPE:
+    {	const rpmuint16_t * ss = (const rpmuint16_t *) s;
+	if (info.count > nb / sizeof(*ss))
+	    return -1;
+	he->p.ui16p = xmalloc(info.count * sizeof(*he->p.ui16p));
+	for (i = 0; i < info.count; i++)
+	    he->p.ui16p[i] = (rpmuint16_t) ntohs(ss[i]);
+	he->freeData = 1;
+    }	break;
+    case RPM_UINT32_TYPE:
+    {	const rpmuint32_t * ss = (const rpmuint32_t *) s;
+	if (info.count > nb / sizeof(*ss))
+	    return -1;
+	he->p.ui32p = xmalloc(info.count * sizeof(*he->p.ui32p));
+	for (i = 0; i < info.count; i++)
+	    he->p.ui32p[i] = (rpmuint32_t) ntohl(ss[i]);
+	he->freeData = 1;
+    }	break;
+    case RPM_UINT64_TYPE:
+    {	const rpmuint32_t * ss = (const rpmuint32_t *) s;
+	if (info.count > nb / (2 * sizeof(*ss)))
+	    return -1;
+	he->p.ui64p = xmalloc(info.count * sizeof(*he->p.ui64p));
+	for (i = 0; i < info.count; i++)
+	    he->p.ui64p[i] = ((rpmuint64_t) ntohl(ss[2*i]) << 32)
+			| (rpmuint64_t) ntohl(ss[2*i+1]);
+	he->freeData = 1;
+    }	break;
+    case RPM_I18NSTRING_TYPE:	/* XXX needs the locale, and the i18n table */
+    default:
+	memset(he, 0, sizeof(*he));
+	he->tag = info.tag;
+	return -1;
+	/*@notreached@*/ break;
+    }
+    return 1;
+}
+
 int headerPut(Header h, HE_t he, /*@unused@*/ unsigned int flags)
 {
     int rc;
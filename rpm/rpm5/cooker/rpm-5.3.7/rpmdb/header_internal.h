@@ -138,6 +138,24 @@ extern "C" {
 int headerVerifyInfo(rpmuint32_t il, rpmuint32_t dl, const void * pev, void * iv, int negate)
 	/*@modifies *iv @*/;
 
+/**
+ * Retrieve tag data from a (not loaded) header blob.
+ * Only the index entries of the blob are searched: an indexEntry array is
+ * not built, and the header is not verified. Strings and 8-bit data are
+ * returned as pointers into the blob (he->freeData == 0), other data is
+ * converted to host byte order (he->freeData == 1).
+ *
+ * Tags that headerGet() would return differently from the blob (tags
+ * overridden by extensions, i18n strings, and tags that a dribble also
+ * contains) are not decided, and the header must be loaded.
+ * @param uh		header blob
+ * @param uhlen		no. of bytes in header blob
+ * @retval he		tag container
+ * @return		1 if found, 0 if not found, -1 if undecided
+ */
+int headerGetBlob(const void * uh, size_t uhlen, HE_t he)
+	/*@modifies he @*/;
+
 #ifdef __cplusplus
 }   
 #endif
@@ -38,6 +38,32 @@ typedef long long loff_t;
 
 #define alloca_strdup(_s)	strcpy(alloca(strlen(_s)+1), (_s))
 
+#if defined(HAVE_GELF_H) && defined(HAVE_LIBELF)
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static const char * _prelink_undo_cmd = NULL;	/* XXX memleak */
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static yarnLock _prelink_lock = NULL;		/* XXX memleak */
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_once_t _prelink_once = PTHREAD_ONCE_INIT;
+#endif
+
+/**
+ * Expand %{__prelink_undo_cmd} once (open_dso() runs on verify threads).
+ */
+static void prelinkInit(void)
+	/*@globals _prelink_undo_cmd, _prelink_lock,
+		rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies _prelink_undo_cmd, _prelink_lock,
+		rpmGlobalMacroContext, internalState @*/
+{
+    _prelink_undo_cmd = rpmExpand("%{?__prelink_undo_cmd}", NULL);
+    VALGRIND_HG_CLEAN_MEMORY(_prelink_undo_cmd, sizeof(_prelink_undo_cmd));
+    _prelink_lock = yarnNewLock(0);
+    VALGRIND_HG_CLEAN_MEMORY(_prelink_lock, sizeof(_prelink_lock));
+}
+#endif
+
 /**
  * Open a file descriptor to verify file MD5 and size.
  * @param path		file path
@@ -74,16 +100,16 @@ static int open_dso(const char * path, /*@null@*/ pid_t * pidp, /*@null@*/ size_
     GElf_Shdr shdr;
     GElf_Dyn dyn;
     int bingo;
-    static const char * cmd = NULL;	/* XXX memleak */
-    static yarnLock oneshot = NULL;	/* XXX memleak */
-
-    if (oneshot == NULL) {
-	cmd = rpmExpand("%{?__prelink_undo_cmd}", NULL);
-	VALGRIND_HG_CLEAN_MEMORY(cmd, sizeof(cmd));
-	oneshot = yarnNewLock(0);
-	VALGRIND_HG_CLEAN_MEMORY(oneshot, sizeof(oneshot));
-    }
-    yarnPossess(oneshot);
+    const char * cmd;
+
+#if defined(WITH_PTHREADS)
+    (void) pthread_once(&_prelink_once, prelinkInit);
+#else
+    if (_prelink_lock == NULL)
+	prelinkInit();
+#endif
+    cmd = _prelink_undo_cmd;
+    yarnPossess(_prelink_lock);
     if (!(cmd && *cmd))
 	goto elfexit;
 
@@ -147,7 +173,7 @@ static int open_dso(const char * path, /*@null@*/ pid_t * pidp, /*@null@*/ size_
 
 elfexit:
     if (elf) (void) elf_end(elf);
-    yarnRelease(oneshot);
+    yarnRelease(_prelink_lock);
  }
 #endif
 
@@ -156,10 +182,365 @@ exit:
 }
 /*@=compdef =moduncon =noeffectuncon @*/
 
+/**
+ * Are prelinked ELF files digested through %{__prelink_undo_cmd}?
+ * @return		1 if prelink -y is in use
+ */
+static int prelinkEnabled(void)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+#if defined(HAVE_GELF_H) && defined(HAVE_LIBELF)
+#if defined(WITH_PTHREADS)
+    (void) pthread_once(&_prelink_once, prelinkInit);
+#else
+    if (_prelink_lock == NULL)
+	prelinkInit();
+#endif
+    return (_prelink_undo_cmd != NULL && *_prelink_undo_cmd != '\0');
+#else
+    return 0;
+#endif
+}
+
+/*==============================================================*/
+
+/**
+ * The (optional) persistent file digest cache, %{_dodigest_cache}.
+ *
+ * A file digest is reused while the file's dev, ino, size, mtime and ctime
+ * (with nanoseconds, where available) are unchanged. The file (native
+ * byte order) is a struct dodigestCacheHdr_s followed by entries sorted by
+ * (dev, ino, algo), is mmap'ed read-only, and is replaced atomically (write
+ * a temporary, then rename) by dodigestCacheSync(). Entries that a run
+ * neither looked up nor re-added are dropped when the run saves the cache.
+ */
+#define	DODIGEST_CACHE_MAGIC	"rpmdgst1"
+
+struct dodigestCacheHdr_s {
+    char magic[8];		/*!< DODIGEST_CACHE_MAGIC */
+    uint32_t nentries;		/*!< no. of entries */
+    uint32_t esize;		/*!< sizeof(struct dodigestCacheEntry_s) */
+};
+
+struct dodigestCacheEntry_s {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;		/*!< st_mtime (nsecs) */
+    int64_t ctime;		/*!< st_ctime (nsecs) */
+    uint32_t algo;		/*!< digest algorithm (| 0x10000 for HMAC) */
+    uint32_t dlen;		/*!< digest length */
+    uint64_t fsize;		/*!< digested size (prelink -y size differs) */
+    unsigned char digest[64];	/*!< binary digest */
+};
+
+struct dodigestCache_s {
+/*@only@*/ /*@null@*/
+    const char * fn;		/*!< cache path (NULL if disabled) */
+    int strict;			/*!< %{_dodigest_cache_strict}: don't reuse */
+    yarnLock lock;		/*!< protects the new entries */
+/*@null@*/
+    void * b;			/*!< previous cache (mmap'ed) */
+    size_t nb;
+/*@null@*/ /*@dependent@*/
+    const struct dodigestCacheEntry_s * entries;
+    size_t nentries;
+/*@only@*/ /*@null@*/
+    unsigned char * used;	/*!< previous entries looked up by this run */
+    size_t nused;
+/*@only@*/ /*@null@*/
+    struct dodigestCacheEntry_s * added;	/*!< new entries */
+    size_t nadded;
+};
+
+/*@unchecked@*/
+static struct dodigestCache_s _dodigestCache;
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_once_t _dodigestCacheOnce = PTHREAD_ONCE_INIT;
+#else
+/*@unchecked@*/
+static int _dodigestCacheOnce = 0;
+#endif
+
+/**
+ * Map the digest cache file.
+ * @param dc		digest cache
+ */
+static void dodigestCacheMap(struct dodigestCache_s * dc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies dc, fileSystem, internalState @*/
+{
+    struct dodigestCacheHdr_s hdr;
+    struct stat sb;
+    int fdno;
+
+    if (dc->fn == NULL || (fdno = open(dc->fn, O_RDONLY)) < 0)
+	return;
+    if (fstat(fdno, &sb) == 0 && sb.st_size >= (off_t) sizeof(hdr)) {
+	void * b = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fdno, 0);
+	if (b != MAP_FAILED) {
+	    dc->b = b;
+	    dc->nb = (size_t) sb.st_size;
+	}
+    }
+    (void) close(fdno);
+    if (dc->b == NULL)
+	return;
+
+    memcpy(&hdr, dc->b, sizeof(hdr));
+    if (!memcmp(hdr.magic, DODIGEST_CACHE_MAGIC, sizeof(hdr.magic))
+     && hdr.esize == sizeof(*dc->entries)
+     && hdr.nentries == (dc->nb - sizeof(hdr)) / sizeof(*dc->entries))
+    {
+	dc->entries = (const void *)((const char *)dc->b + sizeof(hdr));
+	dc->nentries = hdr.nentries;
+	dc->used = xcalloc(dc->nentries + 1, sizeof(*dc->used));
+	dc->nused = 0;
+    }
+}
+
+static void dodigestCacheInit(void)
+	/*@globals _dodigestCache, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+	/*@modifies _dodigestCache, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+    struct dodigestCache_s * dc = &_dodigestCache;
+    const char * fn = rpmGetPath("%{?_dodigest_cache}", NULL);
+
+    if (fn != NULL && *fn == '/') {
+	dc->fn = fn;
+	dc->strict = rpmExpandNumeric("%{?_dodigest_cache_strict}");
+	dc->lock = yarnNewLock(0);
+	if (!dc->strict)
+	    dodigestCacheMap(dc);
+    } else
+	fn = _free(fn);
+}
+
+/**
+ * Return the digest cache (NULL if disabled).
+ */
+/*@null@*/
+static struct dodigestCache_s * dodigestCache(void)
+	/*@globals _dodigestCache, rpmGlobalMacroContext, h_errno,
+		fileSystem, internalState @*/
+	/*@modifies _dodigestCache, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+#if defined(WITH_PTHREADS)
+    (void) pthread_once(&_dodigestCacheOnce, dodigestCacheInit);
+#else
+    if (!_dodigestCacheOnce++)
+	dodigestCacheInit();
+#endif
+    return (_dodigestCache.fn != NULL ? &_dodigestCache : NULL);
+}
+
+/**
+ * Fill in a digest cache key from a file's stat(2) info.
+ * @retval e		digest cache entry
+ * @param st		file stat(2) info
+ * @param algo		digest algorithm (| 0x10000 for HMAC)
+ */
+static void dodigestCacheKey(/*@out@*/ struct dodigestCacheEntry_s * e,
+		const struct stat * st, uint32_t algo)
+	/*@modifies e @*/
+{
+    memset(e, 0, sizeof(*e));
+    e->dev = (uint64_t) st->st_dev;
+    e->ino = (uint64_t) st->st_ino;
+    e->size = (uint64_t) st->st_size;
+    e->mtime = (int64_t) st->st_mtime * 1000000000;
+    e->ctime = (int64_t) st->st_ctime * 1000000000;
+#if defined(HAVE_STRUCT_STAT_ST_ATIMESPEC_TV_NSEC) || defined(HAVE_STRUCT_STAT_ST_ATIM_TV_NSEC)
+    e->mtime += st->st_mtimespec.tv_nsec;
+    e->ctime += st->st_ctimespec.tv_nsec;
+#endif
+    e->algo = algo;
+}
+
+static int dodigestCacheCmp(const void * a, const void * b)
+	/*@*/
+{
+    const struct dodigestCacheEntry_s * ea = a;
+    const struct dodigestCacheEntry_s * eb = b;
+
+    if (ea->dev != eb->dev)
+	return (ea->dev < eb->dev ? -1 : 1);
+    if (ea->ino != eb->ino)
+	return (ea->ino < eb->ino ? -1 : 1);
+    if (ea->algo != eb->algo)
+	return (ea->algo < eb->algo ? -1 : 1);
+    return 0;
+}
+
+/**
+ * Find an unchanged file's digest in the cache, marking the entry used.
+ * @param dc		digest cache
+ * @param key		digest cache key
+ * @return		digest cache entry (NULL if missing or changed)
+ */
+/*@null@*/ /*@observer@*/
+static const struct dodigestCacheEntry_s *
+dodigestCacheLookup(struct dodigestCache_s * dc,
+		const struct dodigestCacheEntry_s * key)
+	/*@modifies dc @*/
+{
+    const struct dodigestCacheEntry_s * e;
+    size_t i;
+
+    if (dc->entries == NULL)
+	return NULL;
+    e = bsearch(key, dc->entries, dc->nentries, sizeof(*e), dodigestCacheCmp);
+    if (e == NULL || e->size != key->size || e->mtime != key->mtime
+     || e->ctime != key->ctime || e->dlen > sizeof(e->digest))
+	return NULL;
+    i = (size_t) (e - dc->entries);
+    yarnPossess(dc->lock);
+    if (!dc->used[i]) {
+	dc->used[i] = 1;
+	dc->nused++;
+    }
+    yarnRelease(dc->lock);
+    return e;
+}
+
+/**
+ * Add a file digest to the cache.
+ * @param dc		digest cache
+ * @param key		digest cache key
+ * @param digest	binary digest
+ * @param dlen		digest length
+ * @param fsize		digested size
+ */
+static void dodigestCacheAdd(struct dodigestCache_s * dc,
+		const struct dodigestCacheEntry_s * key,
+		const unsigned char * digest, size_t dlen, size_t fsize)
+	/*@modifies dc @*/
+{
+    struct dodigestCacheEntry_s * e;
+
+    if (dlen > sizeof(e->digest))
+	return;
+    yarnPossess(dc->lock);
+    if ((dc->nadded % 256) == 0)
+	dc->added = xrealloc(dc->added, (dc->nadded + 256) * sizeof(*e));
+    e = dc->added + dc->nadded++;
+    *e = *key;
+    e->dlen = (uint32_t) dlen;
+    e->fsize = (uint64_t) fsize;
+    memcpy(e->digest, digest, dlen);
+    yarnRelease(dc->lock);
+}
+
+int dodigestCacheSync(void)
+{
+    struct dodigestCache_s * dc = &_dodigestCache;
+    struct dodigestCacheHdr_s hdr;
+    const char * tfn = NULL;
+    FILE * fp = NULL;
+    size_t i, j, n;
+    int fdno;
+    int rc = 0;
+
+    /* Nothing new, nothing to prune: keep the cache as is. */
+    if (dc->fn == NULL || (dc->nadded == 0 && dc->nused == dc->nentries))
+	return 0;
+
+    yarnPossess(dc->lock);
+
+    /* Sort the new entries, keeping the last digest of a file. */
+    qsort(dc->added, dc->nadded, sizeof(*dc->added), dodigestCacheCmp);
+    for (i = j = 0; i < dc->nadded; i++) {
+	if (j > 0 && !dodigestCacheCmp(dc->added + j - 1, dc->added + i))
+	    j--;
+	if (j != i)
+	    dc->added[j] = dc->added[i];
+	j++;
+    }
+    dc->nadded = j;
+
+    tfn = rpmGetPath(dc->fn, ".XXXXXX", NULL);
+    if ((fdno = mkstemp((char *)tfn)) < 0 || (fp = fdopen(fdno, "w")) == NULL) {
+	rpmlog(RPMLOG_WARNING, _("cannot create %s: %s\n"), tfn, strerror(errno));
+	if (fdno >= 0)
+	    (void) close(fdno);
+	rc = 1;
+	goto exit;
+    }
+
+    /*
+     * Merge the new entries (which win) with the previous entries that
+     * were looked up by this run.
+     */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DODIGEST_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.esize = sizeof(*dc->added);
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+	rc = 1;
+    for (i = j = n = 0; i < dc->nentries || j < dc->nadded; ) {
+	const struct dodigestCacheEntry_s * e;
+	int cmp = (i >= dc->nentries ? 1 : j >= dc->nadded ? -1
+		: dodigestCacheCmp(dc->entries + i, dc->added + j));
+	if (cmp < 0) {
+	    if (!dc->used[i++])
+		continue;
+	    e = dc->entries + i - 1;
+	} else {
+	    if (cmp == 0)
+		i++;
+	    e = dc->added + j++;
+	}
+	if (fwrite(e, sizeof(*e), 1, fp) != 1)
+	    rc = 1;
+	n++;
+    }
+    hdr.nentries = (uint32_t) n;
+    if (fseek(fp, 0L, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+	rc = 1;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+	rc = 1;
+    if (fclose(fp) != 0)
+	rc = 1;
+    if (rc == 0 && (rc = (chmod(tfn, 0644) || rename(tfn, dc->fn))) != 0)
+	rpmlog(RPMLOG_WARNING, _("cannot replace %s: %s\n"), dc->fn, strerror(errno));
+    if (rc)
+	(void) unlink(tfn);
+
+exit:
+    tfn = _free(tfn);
+    dc->added = _free(dc->added);
+    dc->nadded = 0;
+
+    /* Reuse the digests just saved. */
+    if (dc->b != NULL)
+	(void) munmap(dc->b, dc->nb);
+    dc->b = NULL;
+    dc->nb = 0;
+    dc->entries = NULL;
+    dc->nentries = 0;
+    dc->used = _free(dc->used);
+    dc->nused = 0;
+    if (!dc->strict)
+	dodigestCacheMap(dc);
+
+    yarnRelease(dc->lock);
+    return rc;
+}
+
 static const char hmackey[] = "orboDeJITITejsirpADONivirpUkvarP";
 
 int dodigest(int dalgo, const char * fn, unsigned char * digest,
 		unsigned dflags, size_t *fsizep)
+{
+    return dodigestPrelink(dalgo, fn, digest, dflags, fsizep, NULL);
+}
+
+int dodigestPrelink(int dalgo, const char * fn, unsigned char * digest,
+		unsigned dflags, size_t *fsizep, int *prelinkedp)
 {
     int asAscii = dflags & 0x01;
     int doHmac = dflags & 0x02;
@@ -171,6 +552,8 @@ int dodigest(int dalgo, const char * fn, unsigned char * digest,
     FD_t fd;
     size_t fsize = 0;
     pid_t pid = 0;
+    struct dodigestCache_s * dc = NULL;
+    struct dodigestCacheEntry_s key;
     int use_mmap;
     int rc = 0;
     int fdno;
@@ -178,6 +561,28 @@ int dodigest(int dalgo, const char * fn, unsigned char * digest,
     int xx;
 #endif
 
+    /* Reuse the digest of an unchanged file. */
+    if (!asAscii && (ut == URL_IS_PATH || ut == URL_IS_UNKNOWN)
+     && (dc = dodigestCache()) != NULL)
+    {
+	struct stat sb;
+	const struct dodigestCacheEntry_s * e;
+
+	if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode))
+	    dc = NULL;
+	else {
+	    dodigestCacheKey(&key, &sb, (uint32_t)dalgo | (doHmac ? 0x10000 : 0));
+	    if (!dc->strict && (e = dodigestCacheLookup(dc, &key)) != NULL) {
+		memcpy(digest, e->digest, e->dlen);
+		if (fsizep)
+		    *fsizep = (size_t) e->fsize;
+		if (prelinkedp)
+		    *prelinkedp = 0;
+		return 0;
+	    }
+	}
+    }
+
 /*@-globs -internalglobs -mods @*/
     fdno = open_dso(path, &pid, &fsize);
 /*@=globs =internalglobs =mods @*/
@@ -265,9 +670,139 @@ int dodigest(int dalgo, const char * fn, unsigned char * digest,
 exit:
     if (fsizep)
 	*fsizep = fsize;
-    if (!rc)
+    if (prelinkedp)
+	*prelinkedp = (pid != 0);
+    if (!rc) {
 	memcpy(digest, dsum, dlen);
+	if (dc != NULL)
+	    dodigestCacheAdd(dc, &key, dsum, dlen, fsize);
+    }
     dsum = _free(dsum);
 
     return rc;
 }
+
+int dodigestBatch(int dalgo, int n, const char ** fns,
+		unsigned char ** digests, unsigned dflags, size_t * fsizes,
+		int * prelinked, int * rcs)
+{
+    struct dodigestCache_s * dc = NULL;
+    struct dodigestCacheEntry_s * keys;
+    const void ** bufs;
+    size_t * lens;
+    unsigned char ** dsums;
+    int * ix;
+    DIGEST_CTX ctx;
+    size_t dlen = 0;
+    int prelink;
+    int nb = 0;
+    int nfail = 0;
+    int i;
+    int xx;
+
+    /* Batch binary digests of a known algorithm. */
+    if (dflags != 0 || n < 2
+     || (ctx = rpmDigestInit(dalgo, RPMDIGEST_NONE)) == NULL)
+    {
+	for (i = 0; i < n; i++) {
+	    rcs[i] = dodigestPrelink(dalgo, fns[i], digests[i], dflags,
+			&fsizes[i], &prelinked[i]);
+	    nfail += rcs[i];
+	}
+	return nfail;
+    }
+    xx = rpmDigestFinal(ctx, NULL, &dlen, 0);
+
+    keys = xcalloc(n, sizeof(*keys));
+    bufs = xcalloc(n, sizeof(*bufs));
+    lens = xcalloc(n, sizeof(*lens));
+    dsums = xcalloc(n, sizeof(*dsums));
+    ix = xcalloc(n, sizeof(*ix));
+    prelink = prelinkEnabled();
+    dc = dodigestCache();
+
+    for (i = 0; i < n; i++) {
+	const char * path;
+	urltype ut = urlPath(fns[i], &path);
+	const struct dodigestCacheEntry_s * e;
+	struct stat sb;
+	void * mapped = NULL;
+	int fdno;
+
+	rcs[i] = 0;
+	prelinked[i] = 0;
+	if (!(ut == URL_IS_PATH || ut == URL_IS_UNKNOWN))
+	    goto single;
+	if ((fdno = open(path, O_RDONLY)) < 0)
+	    goto single;
+	if (fstat(fdno, &sb) != 0 || !S_ISREG(sb.st_mode)
+	 || sb.st_size > DODIGEST_BATCHMAX)
+	{
+	    xx = close(fdno);
+	    goto single;
+	}
+
+	/* Reuse the digest of an unchanged file. */
+	if (dc != NULL) {
+	    dodigestCacheKey(&keys[nb], &sb, (uint32_t)dalgo);
+	    if (!dc->strict && (e = dodigestCacheLookup(dc, &keys[nb])) != NULL) {
+		memcpy(digests[i], e->digest, e->dlen);
+		fsizes[i] = (size_t) e->fsize;
+		xx = close(fdno);
+		continue;
+	    }
+	}
+
+#if defined(HAVE_MMAP)
+	if (sb.st_size > 0) {
+	    mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fdno, 0);
+	    if (mapped == (void *)-1)
+		mapped = NULL;
+	}
+#endif
+	xx = close(fdno);
+	if (sb.st_size > 0 && mapped == NULL)
+	    goto single;
+
+	/* Prelinked ELF files are digested through prelink -y. */
+	if (prelink && sb.st_size >= 4 && !memcmp(mapped, "\177ELF", 4)) {
+	    xx = munmap(mapped, sb.st_size);
+	    goto single;
+	}
+
+	bufs[nb] = (mapped != NULL ? mapped : "");
+	lens[nb] = (size_t) sb.st_size;
+	dsums[nb] = digests[i];
+	ix[nb] = i;
+	nb++;
+	continue;
+
+single:
+	rcs[i] = dodigestPrelink(dalgo, fns[i], digests[i], dflags,
+			&fsizes[i], &prelinked[i]);
+	nfail += rcs[i];
+    }
+
+    if (nb > 0) {
+	int rc = rpmDigestBatch(dalgo, nb, bufs, lens, dsums);
+	for (i = 0; i < nb; i++) {
+	    fsizes[ix[i]] = lens[i];
+	    rcs[ix[i]] = (rc != 0);
+	    if (rc == 0 && dc != NULL)
+		dodigestCacheAdd(dc, &keys[i], dsums[i], dlen, lens[i]);
+#if defined(HAVE_MMAP)
+	    if (lens[i] > 0)
+		xx = munmap((void *)bufs[i], lens[i]);
+#endif
+	}
+	if (rc != 0)
+	    nfail += nb;
+    }
+
+    keys = _free(keys);
+    bufs = _free(bufs);
+    lens = _free(lens);
+    dsums = _free(dsums);
+    ix = _free(ix);
+    return nfail;
+}
@@ -19,6 +19,8 @@ extern "C" {
 
 /**
  * Return digest and size of a file.
+ * With %{_dodigest_cache} set, the binary digest of an unchanged file
+ * (dev, ino, size, mtime, ctime) is returned from the digest cache.
  * @param dalgo		digest algorithm to use
  * @param fn		file name
  * @retval *digest	file digest
@@ -31,6 +33,57 @@ int dodigest(int dalgo, const char * fn, /*@out@*/ unsigned char * digest,
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies digest, *fsizep, fileSystem, internalState @*/;
 
+/**
+ * Return digest and size of a file, and whether prelink -y was run.
+ * @param dalgo		digest algorithm to use
+ * @param fn		file name
+ * @retval *digest	file digest
+ * @param dflags	0x1 = return ASCII 0x2 = do HMAC
+ * @retval *fsizep	file size pointer (or NULL)
+ * @retval *prelinkedp	1 if the file was digested through prelink -y (or NULL)
+ * @return		0 on success, 1 on error
+ */
+int dodigestPrelink(int dalgo, const char * fn, /*@out@*/ unsigned char * digest,
+		unsigned dflags, /*@null@*/ /*@out@*/ size_t *fsizep,
+		/*@null@*/ /*@out@*/ int *prelinkedp)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies digest, *fsizep, *prelinkedp, fileSystem, internalState @*/;
+
+/**
+ * Largest file digested in a batch by dodigestBatch().
+ */
+#define	DODIGEST_BATCHMAX	(1024 * 1024)
+
+/**
+ * Return binary digests and sizes of several files, hashing them together
+ * (see rpmDigestBatch()). Files that are ELF (with prelink -y in use),
+ * larger than DODIGEST_BATCHMAX or not local are digested one at a time.
+ * @param dalgo		digest algorithm to use
+ * @param n		no. of files
+ * @param fns		file names
+ * @retval digests	file digests
+ * @param dflags	0x2 = do HMAC (digests one file at a time)
+ * @retval fsizes	file sizes
+ * @retval prelinked	1 if the file was digested through prelink -y
+ * @retval rcs		0 on success, 1 on error, per file
+ * @return		no. of files that failed
+ */
+int dodigestBatch(int dalgo, int n, const char ** fns,
+		unsigned char ** digests, unsigned dflags, size_t * fsizes,
+		int * prelinked, int * rcs)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies *digests, *fsizes, *prelinked, *rcs,
+		fileSystem, internalState @*/;
+
+/**
+ * Save new file digests to the digest cache, %{_dodigest_cache}, dropping
+ * the cached digests that were not used. Call when no dodigest() is in flight.
+ * @return		0 on success (or no cache)
+ */
+int dodigestCacheSync(void)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/;
+
 #ifdef __cplusplus
 }
 #endif
@@ -153,6 +153,176 @@ rpmdb rpmtsGetRdb(rpmts ts)
 /*@=compdef =refcounttrans =usereleased @*/
 }
 
+/**
+ * Pubkey cache entry: the packets of a pubkey that verified a signature,
+ * after their self-signatures were validated.
+ */
+typedef struct rpmpkcEntry_s * rpmpkcEntry;
+struct rpmpkcEntry_s {
+    rpmuint8_t signid[8];	/*!< Signer key id. */
+    rpmuint8_t pubkey_algo;	/*!< Signer pubkey algorithm. */
+/*@only@*/
+    rpmuint8_t * pkt;		/*!< Pubkey packets. */
+    size_t pktlen;
+    int pubx;			/*!< Primary key packet index. */
+    int subx;			/*!< Subkey packet index. */
+    rpmuint8_t subid[8];	/*!< Subkey id. */
+};
+
+/**
+ * Pubkey cache, indexed by signer key id. Only a few keys sign most
+ * packages, so the (8 byte) key ids are searched linearly.
+ */
+typedef struct rpmpkc_s * rpmpkc;
+struct rpmpkc_s {
+    yarnLock lock;		/*!< Serializes the process-wide cache. */
+    unsigned int gen;		/*!< _rpmdb_pubkeygen of the entries. */
+    int shared;			/*!< Process-wide cache? */
+/*@only@*/ /*@null@*/
+    rpmpkcEntry entries;
+    int nentries;
+};
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmpkc _rpmpkc;		/* XXX memleak */
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_once_t _rpmpkc_once = PTHREAD_ONCE_INIT;
+#endif
+
+static rpmpkc rpmpkcNew(int shared)
+	/*@*/
+{
+    rpmpkc pkc = xcalloc(1, sizeof(*pkc));
+    pkc->lock = yarnNewLock(0);
+    pkc->gen = _rpmdb_pubkeygen;
+    pkc->shared = shared;
+    return pkc;
+}
+
+static void rpmpkcFlush(rpmpkc pkc)
+	/*@modifies pkc @*/
+{
+    int i;
+    for (i = 0; i < pkc->nentries; i++)
+	pkc->entries[i].pkt = _free(pkc->entries[i].pkt);
+    pkc->entries = _free(pkc->entries);
+    pkc->nentries = 0;
+}
+
+static void rpmpkcInit(void)
+	/*@globals _rpmpkc @*/
+	/*@modifies _rpmpkc @*/
+{
+    _rpmpkc = rpmpkcNew(1);
+}
+
+/**
+ * Return the pubkey cache of a transaction, creating it as
+ * %{_pubkey_cache} says: 0 disables, 1 lives as long as the transaction,
+ * 2 is shared by all transactions of the process.
+ * @param ts		transaction set
+ * @return		pubkey cache (NULL if disabled)
+ */
+/*@null@*/
+static rpmpkc rpmtsPubkeyCache(rpmts ts)
+	/*@globals _rpmpkc, rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies ts, _rpmpkc, rpmGlobalMacroContext, internalState @*/
+{
+    if (ts->pkc == NULL) {
+	int mode =
+	    rpmExpandNumeric("%{?_pubkey_cache}%{!?_pubkey_cache:1}");
+	if (mode >= 2) {
+#if defined(WITH_PTHREADS)
+	    (void) pthread_once(&_rpmpkc_once, rpmpkcInit);
+#else
+	    if (_rpmpkc == NULL)
+		rpmpkcInit();
+#endif
+	    ts->pkc = _rpmpkc;
+	} else if (mode == 1)
+	    ts->pkc = rpmpkcNew(0);
+    }
+    return ts->pkc;
+}
+
+/**
+ * Load a cached pubkey into a hkp container.
+ * @param pkc		pubkey cache
+ * @param sigp		signature parameters
+ * @param hkp		pubkey container
+ * @return		1 if cached
+ */
+static int rpmpkcGet(rpmpkc pkc, pgpDigParams sigp, rpmhkp hkp)
+	/*@modifies pkc, hkp @*/
+{
+    int found = 0;
+    int i;
+
+    yarnPossess(pkc->lock);
+    /* Pubkeys were imported or erased: start over. */
+    if (pkc->gen != _rpmdb_pubkeygen) {
+	rpmpkcFlush(pkc);
+	pkc->gen = _rpmdb_pubkeygen;
+    }
+    for (i = 0; i < pkc->nentries; i++) {
+	rpmpkcEntry e = pkc->entries + i;
+	if (e->pubkey_algo != sigp->pubkey_algo
+	 || memcmp(e->signid, sigp->signid, sizeof(e->signid)))
+	    continue;
+	hkp->pkt = memcpy(xmalloc(e->pktlen), e->pkt, e->pktlen);
+	hkp->pktlen = e->pktlen;
+	hkp->pubx = e->pubx;
+	hkp->subx = e->subx;
+	memcpy(hkp->subid, e->subid, sizeof(hkp->subid));
+	found = 1;
+	break;
+    }
+    yarnRelease(pkc->lock);
+    return found;
+}
+
+/**
+ * Save the pubkey that verified a signature.
+ * @param pkc		pubkey cache
+ * @param sigp		signature parameters
+ * @param hkp		pubkey container
+ */
+static void rpmpkcPut(rpmpkc pkc, pgpDigParams sigp, rpmhkp hkp)
+	/*@modifies pkc @*/
+{
+    rpmpkcEntry e;
+
+    yarnPossess(pkc->lock);
+    if (pkc->gen != _rpmdb_pubkeygen) {
+	rpmpkcFlush(pkc);
+	pkc->gen = _rpmdb_pubkeygen;
+    }
+    pkc->entries = xrealloc(pkc->entries,
+		(pkc->nentries + 1) * sizeof(*pkc->entries));
+    e = pkc->entries + pkc->nentries++;
+    memcpy(e->signid, sigp->signid, sizeof(e->signid));
+    e->pubkey_algo = sigp->pubkey_algo;
+    e->pkt = memcpy(xmalloc(hkp->pktlen), hkp->pkt, hkp->pktlen);
+    e->pktlen = hkp->pktlen;
+    e->pubx = hkp->pubx;
+    e->subx = hkp->subx;
+    memcpy(e->subid, hkp->subid, sizeof(e->subid));
+    yarnRelease(pkc->lock);
+}
+
+void rpmtsCleanPubkeys(rpmts ts)
+{
+    rpmpkc pkc = ts->pkc;
+
+    if (pkc != NULL && !pkc->shared) {
+	rpmpkcFlush(pkc);
+	pkc->lock = yarnFreeLock(pkc->lock);
+	pkc = _free(pkc);
+    }
+    ts->pkc = NULL;
+}
+
 rpmRC rpmtsFindPubkey(rpmts ts, void * _dig)
 {
     HE_t he = memset(alloca(sizeof(*he)), 0, sizeof(*he));
@@ -164,6 +334,8 @@ rpmRC rpmtsFindPubkey(rpmts ts, void * _dig)
     rpmhkp hkp = NULL;
     rpmbf awol;
     rpmiob iob = NULL;
+    rpmpkc pkc = rpmtsPubkeyCache(ts);
+    int cached = -1;	/* -1 not looked up, 0 miss, 1 hit */
     int krcache = 1;	/* XXX assume pubkeys are cached in keyutils keyring. */
 int validate = 0;
     int xx;
@@ -200,6 +372,19 @@ fprintf(stderr, "*** free pkt %p[%d] id %08x %08x\n", hkp->pkt, hkp->pktlen, pgp
 	memset(hkp->signid, 0, sizeof(hkp->signid));
     }
 
+    /* Try the pubkey cache (validated pubkeys that verified signatures). */
+    if (hkp->pkt == NULL && pkc != NULL) {
+	rpmop op;
+	cached = rpmpkcGet(pkc, sigp, hkp);
+	op = rpmtsOp(ts, (cached ? RPMTS_OP_PKHIT : RPMTS_OP_PKMISS));
+	(void) rpmswEnter(op, 0);
+	(void) rpmswExit(op, 0);
+	if (cached > 0) {
+	    krcache = 0;	/* XXX already in keyutils keyring. */
+	    pubkeysource = xstrdup("cache");
+	}
+    }
+
     /* Has this pubkey failled a previous lookup? */
     if (hkp->pkt == NULL && awol != NULL
      && rpmbfChk(awol, sigp->signid, sizeof(sigp->signid)))
@@ -395,6 +580,10 @@ if (_rpmhkp_debug)
 fprintf(stderr, "\t%s: rpmku  %p[%u]\n", __FUNCTION__, hkp->pkt, (unsigned) hkp->pktlen);
 	}
 
+	/* Save the pubkey for the next signature by the same key. */
+	if (cached == 0)
+	    rpmpkcPut(pkc, sigp, hkp);
+
 	/* Pubkey packet looks good, save the signer id. */
 	memcpy(hkp->signid, pubp->signid, sizeof(hkp->signid));
 
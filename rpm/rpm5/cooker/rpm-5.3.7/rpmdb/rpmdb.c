@@ -15,6 +15,8 @@
 #include <rpmmacro.h>
 #include <rpmsq.h>
 #include <rpmsx.h>
+#include <rpmtpool.h>
+#include <yarn.h>
 #include <argv.h>
 
 #define	_RPMBF_INTERNAL
@@ -27,6 +29,7 @@
 #define	_RPMDB_INTERNAL
 #include "rpmdb.h"
 #include "pkgio.h"
+#include "depcache.h"
 #include "fprint.h"
 #include "legacy.h"
 
@@ -56,6 +59,9 @@ int _rpmdb_debug = 0;
 /*@unchecked@*/
 int _rpmmi_debug = 0;
 
+/*@unchecked@*/
+unsigned int _rpmdb_pubkeygen = 0;
+
 #define	_DBI_FLAGS	0
 #define	_DBI_PERMS	0644
 #define	_DBI_MAJOR	-1
@@ -426,6 +432,53 @@ dbiIndexSet dbiFreeIndexSet(dbiIndexSet set) {
     return set;
 }
 
+/**
+ * A prefetched header.
+ */
+typedef struct rpmmiEntry_s * rpmmiEntry;
+struct rpmmiEntry_s {
+    uint32_t hdrNum;		/*!< header instance (native endian) */
+/*@only@*/ /*@null@*/
+    void * uh;			/*!< header blob (until loaded) */
+    size_t uhlen;		/*!< no. of bytes in header blob */
+    int map;			/*!< is header blob mmap'd? */
+    int skip;			/*!< -1 if selectors must be applied to header */
+    int bad;			/*!< header blob cannot be loaded? */
+/*@refcounted@*/ /*@null@*/
+    Header h;			/*!< loaded header (NULL if skipped) */
+};
+
+/**
+ * A batch of prefetched headers.
+ */
+typedef struct rpmmiBatch_s * rpmmiBatch;
+struct rpmmiBatch_s {
+/*@only@*/
+    struct rpmmiEntry_s * entries;	/*!< headers, in set order */
+    int n;			/*!< no. of headers in batch */
+    int i;			/*!< next header to return */
+    yarnLock loaded;		/*!< 1 when headers have been loaded */
+};
+
+/**
+ * Batched header prefetch for an iterator with a set of instances.
+ */
+typedef struct rpmmiPrefetch_s * rpmmiPrefetch;
+struct rpmmiPrefetch_s {
+    int nbatch;			/*!< no. of headers per batch */
+    uint32_t setx;		/*!< next set item to prefetch */
+/*@dependent@*/
+    rpmmiBatch cur;		/*!< batch being returned */
+/*@dependent@*/
+    rpmmiBatch next;		/*!< batch being read ahead */
+    struct rpmmiBatch_s batches[2];
+/*@only@*/ /*@null@*/
+    rpmtpool tp;		/*!< read ahead thread (NULL loads inline) */
+/*@only@*/ /*@null@*/
+    void * bulk;		/*!< bulk retrieval buffer */
+    size_t bulklen;		/*!< no. of bytes in bulk retrieval buffer */
+};
+
 struct rpmmi_s {
     struct rpmioItem_s _item;	/*!< usage mutex and pool identifier. */
 /*@dependent@*/ /*@null@*/
@@ -453,6 +506,8 @@ struct rpmmi_s {
     int			mi_nre;
 /*@only@*/ /*@null@*/
     miRE		mi_re;
+/*@only@*/ /*@null@*/
+    rpmmiPrefetch	mi_pf;		/* Batched header prefetch. */
 
 };
 
@@ -758,13 +813,12 @@ int rpmdbClose(rpmdb db)
     if (db == NULL)
 	return rc;
 
-    yarnPossess(db->_item.use);
 /*@-modfilesys@*/
 if (_rpmdb_debug)
-fprintf(stderr, "--> db %p -- %ld %s at %s:%u\n", db, yarnPeekLock(db->_item.use), msg, __FILE__, __LINE__);
+fprintf(stderr, "--> db %p -- %ld %s at %s:%u\n", db, db->_item.refs, msg, __FILE__, __LINE__);
 
     /*@-usereleased@*/
-    if (yarnPeekLock(db->_item.use) <= 1L) {
+    if (rpmioDerefPoolItem((rpmioItem)db) <= 0L) {
 
 	if (db->_dbi)
 	for (dbix = db->db_ndbi; dbix;) {
@@ -778,6 +832,7 @@ fprintf(stderr, "--> db %p -- %ld %s at %s:%u\n", db, yarnPeekLock(db->_item.use
 	    db->_dbi[dbix] = NULL;
 	    /*@=unqualifiedtrans@*/
 	}
+	db->db_depcache = depCacheFree(db->db_depcache);
 	db->db_errpfx = _free(db->db_errpfx);
 	db->db_root = _free(db->db_root);
 	db->db_home = _free(db->db_home);
@@ -808,8 +863,7 @@ fprintf(stderr, "--> db %p -- %ld %s at %s:%u\n", db, yarnPeekLock(db->_item.use
 
     /*@=usereleased@*/
 	db = (rpmdb)rpmioPutPool((rpmioItem)db);
-    } else
-	yarnTwist(db->_item.use, BY, -1);
+    }
 
     return rc;
 }
@@ -924,6 +978,7 @@ fprintf(stderr, "==> rpmdbNew(%s, %s, 0x%x, 0%o, 0x%x) db %p\n", root, home, mod
     db->db_realloc = NULL;
     db->db_free = NULL;
     db->db_export = rpmdbExportInfo;
+    db->db_depcache = NULL;
     db->db_h = NULL;
 
     db->db_next = NULL;
@@ -1114,28 +1169,34 @@ int rpmdbCountPackages(rpmdb db, const char * N)
 static const char * stemEnd(const char * s)
 	/*@*/
 {
+    const char * prev = s;	/* start of the last stem character */
     int c;
 
     while ((c = (int)*s)) {
 	switch (c) {
+	case '?':
+	case '*':
+	case '{':
+	    /* The previous character is optional, and not part of the stem. */
+	    s = prev;
+	    goto exit;
+	    /*@notreached@*/ /*@switchbreak@*/ break;
 	case '.':
 	case '^':
 	case '$':
-	case '?':
-	case '*':
 	case '+':
 	case '|':
 	case '[':
 	case '(':
-	case '{':
 	case '\0':
 	    goto exit;
 	    /*@notreached@*/ /*@switchbreak@*/ break;
 	case '\\':
-	    s++;
+	    prev = s++;
 	    if (*s == '\0') goto exit;
-	    /*@fallthrough@*/
+	    /*@switchbreak@*/ break;
 	default:
+	    prev = s;
 	    /*@switchbreak@*/ break;
 	}
 	s++;
@@ -1224,9 +1285,15 @@ assert(0);			/* XXX sanity */
 	    /*@notreached@*/ break;
 	case RPMMIRE_GLOB:
 	    break;
+	case RPMMIRE_DEFAULT:	/* XXX mireDup() anchors as "^...$" */
 	case RPMMIRE_REGEX:
 	case RPMMIRE_PCRE:
-	    if (*pat == '^') pat++;
+	    /* A stem needs an anchored pattern without alternatives. */
+	    if (*pat != '^' || strchr(pat, '|') != NULL) {
+		k.doff = 0;
+		goto doit;
+	    }
+	    pat++;
 
 	    /* If partial match on stem won't help, just iterate. */
 	    nb = stemEnd(pat) - pat;
@@ -1543,6 +1610,71 @@ static int miFreeHeader(rpmmi mi, dbiIndex dbi)
 /*@=nullstate@*/
 }
 
+/**
+ * Free a batch's headers, and any header blobs not yet loaded.
+ * @param b		batch of prefetched headers
+ */
+static void rpmmiBatchClean(rpmmiBatch b)
+	/*@modifies b @*/
+{
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+	rpmmiEntry e = b->entries + i;
+	if (e->uh != NULL) {
+	    if (!e->map)
+		e->uh = _free(e->uh);
+	    else if (munmap(e->uh, e->uhlen) != 0)
+		fprintf(stderr, "==> munmap(%p[%u]) error(%d): %s\n",
+			e->uh, (unsigned)e->uhlen, errno, strerror(errno));
+	    e->uh = NULL;
+	}
+	if (e->h != NULL)
+	    (void) headerFree(e->h);
+	e->h = NULL;
+    }
+    b->n = 0;
+    b->i = 0;
+}
+
+/**
+ * Wait until a batch's headers have been loaded.
+ * @param b		batch of prefetched headers
+ */
+static void rpmmiBatchWait(rpmmiBatch b)
+	/*@modifies b @*/
+{
+    yarnPossess(b->loaded);
+    yarnWaitFor(b->loaded, TO_BE, 1);
+    yarnRelease(b->loaded);
+}
+
+/**
+ * Destroy batched header prefetch.
+ * @param pf		batched header prefetch
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmmiPrefetch rpmmiPrefetchFree(/*@only@*/ /*@null@*/ rpmmiPrefetch pf)
+	/*@globals internalState @*/
+	/*@modifies pf, internalState @*/
+{
+    int i;
+
+    if (pf == NULL)
+	return NULL;
+    pf->tp = rpmtpoolFree(pf->tp);	/* XXX runs pending loads first */
+    for (i = 0; i < 2; i++) {
+	rpmmiBatch b = pf->batches + i;
+	rpmmiBatchClean(b);
+	b->entries = _free(b->entries);
+	b->loaded = yarnFreeLock(b->loaded);
+    }
+    pf->bulk = _free(pf->bulk);
+    pf = _free(pf);
+    return NULL;
+}
+
 static void rpmmiFini(void * _mi)
 	/*@globals rpmmiRock @*/
 	/*@modifies _mi, rpmmiRock @*/
@@ -1582,6 +1714,7 @@ assert(dbi != NULL);				/* XXX sanity */
 
     (void) rpmbfFree(mi->mi_bf);
     mi->mi_bf = NULL;
+    mi->mi_pf = rpmmiPrefetchFree(mi->mi_pf);
     mi->mi_set = dbiFreeIndexSet(mi->mi_set);
 
     mi->mi_keyp = _free(mi->mi_keyp);
@@ -1819,8 +1952,7 @@ assert(nmire != NULL);
 	mi->mi_re = mireGetPool(_mirePool);
 	mire = mireLink(mi->mi_re);
     } else {
-	void *use =  mi->mi_re->_item.use;
-	void *pool = mi->mi_re->_item.pool;
+	struct rpmioItem_s item = mi->mi_re->_item;
 	mi->mi_re = xrealloc(mi->mi_re, (mi->mi_nre + 1) * sizeof(*mi->mi_re));
 if (_mire_debug)
 fprintf(stderr, "    mire %p[%u] realloc\n", mi->mi_re, mi->mi_nre+1);
@@ -1828,8 +1960,8 @@ fprintf(stderr, "    mire %p[%u] realloc\n", mi->mi_re, mi->mi_nre+1);
 	memset(mire, 0, sizeof(*mire));
 	/* XXX ensure no segfault, copy the use/pool from 1st item. */
 /*@-assignexpose@*/
-	mire->_item.use = use;
-	mire->_item.pool = pool;
+	mire->_item.use = item.use;
+	mire->_item.pool = item.pool;
 /*@=assignexpose@*/
     }
     mi->mi_nre++;
@@ -1901,11 +2033,18 @@ static char * bin2hex(const void *data, size_t size)
 
 /**
  * Return iterator selector match.
+ * With a header blob, the selectors are applied before the header is
+ * loaded, and tag values that cannot be retrieved from the blob leave
+ * the match undecided.
  * @param mi		rpm database iterator
- * @return		1 if header should be skipped
+ * @param h		header (used if no header blob)
+ * @param uh		header blob (or NULL)
+ * @param uhlen		no. of bytes in header blob
+ * @return		1 if header should be skipped, 0 if not, -1 if undecided
  */
 /*@-onlytrans@*/	/* XXX miRE array, not refcounted. */
-static int mireSkip (const rpmmi mi)
+static int mireSkip (const rpmmi mi, /*@null@*/ Header h,
+		/*@null@*/ const void * uh, size_t uhlen)
 	/*@globals internalState @*/
 	/*@modifies mi->mi_re, internalState @*/
 {
@@ -1914,10 +2053,11 @@ static int mireSkip (const rpmmi mi)
     miRE mire;
     int ntags = 0;
     int nmatches = 0;
+    int undecided = 0;
     int i;
     int rc;
 
-    if (mi->mi_h == NULL)	/* XXX can't happen */
+    if (uh == NULL && h == NULL)	/* XXX can't happen */
 	return 1;
 
     /*
@@ -1932,7 +2072,17 @@ static int mireSkip (const rpmmi mi)
 
 	he->tag = mire->tag;
 
-	if (!headerGet(mi->mi_h, he, 0)) {
+	rc = (uh != NULL ? headerGetBlob(uh, uhlen, he) : headerGet(h, he, 0));
+	if (rc < 0) {
+	    /* Skip the other patterns for the same tag too. */
+	    while ((i+1) < mi->mi_nre && mire[0].tag == mire[1].tag) {
+		i++;
+		mire++;
+	    }
+	    undecided++;
+	    continue;
+	}
+	if (rc == 0) {
 	    if (he->tag != RPMTAG_EPOCH) {
 		ntags++;
 		continue;
@@ -1940,6 +2090,7 @@ static int mireSkip (const rpmmi mi)
 	    he->t = RPM_UINT32_TYPE;
 	    he->p.ui32p = xcalloc(1, sizeof(*he->p.ui32p));
 	    he->c = 1;
+	    he->freeData = 1;
 	}
 
 	anymatch = 0;		/* no matches yet */
@@ -2015,13 +2166,18 @@ assert(he->p.ptr != NULL);
 	    /*@innerbreak@*/ break;
 	}
 
-	he->p.ptr = _free(he->p.ptr);
+	if (he->freeData)
+	    he->p.ptr = _free(he->p.ptr);
+	he->freeData = 0;
 
 	if (anymatch)
 	    nmatches++;
 	ntags++;
     }
 
+    /* A decided mismatch skips the header, whatever is undecided. */
+    if (undecided)
+	return (ntags > nmatches ? 1 : -1);
     return (ntags > 0 && ntags == nmatches ? 0 : 1);
 }
 /*@=onlytrans@*/
@@ -2108,7 +2264,96 @@ fprintf(stderr, "<-- %s(%p(%s),%p,%p,%p,0x%x) rc %d\n", __FUNCTION__, dbi, tagNa
     return rc;
 }
 
-Header rpmmiNext(rpmmi mi)
+/**
+ * Use a secondary index to find the headers that iterator selectors on
+ * Name or Providename can match, rather than loading every header from
+ * Packages. The selectors are still applied to each header retrieved.
+ * @param mi		rpm database iterator
+ * @return		0 if the iterator now has a set of header instances
+ */
+static int rpmmiIndexPatterns(rpmmi mi)
+	/*@globals internalState @*/
+	/*@modifies mi, internalState @*/
+{
+    static rpmTag _tags[] = { RPMTAG_NAME, RPMTAG_PROVIDENAME };
+    dbiIndexSet set = NULL;
+    miRE mire;
+    size_t k;
+    int nre;
+    int i, j;
+    int rc = 1;
+
+    for (k = 0; rc && k < sizeof(_tags)/sizeof(_tags[0]); k++) {
+
+	/* Every (or'ed) pattern for the tag must select by index key. */
+	for (i = 0, nre = 0, mire = mi->mi_re; i < mi->mi_nre; i++, mire++) {
+	    if (mire->tag != _tags[k])
+		continue;
+	    if (mire->notmatch || mire->pattern == NULL)
+		break;
+	    nre++;
+	}
+	if (i < mi->mi_nre || nre == 0)
+	    continue;
+
+	for (i = 0, mire = mi->mi_re; i < mi->mi_nre; i++, mire++) {
+	    dbiIndexSet matches = NULL;
+	    if (mire->tag != _tags[k])
+		continue;
+	    /* Without an index, fall back to iterating Packages. */
+	    if (dbiMireKeys(mi->mi_db, mire->tag, mire->mode, mire->pattern,
+			&matches, NULL))
+		break;
+	    if (set == NULL)
+		set = xcalloc(1, sizeof(*set));
+	    if (matches != NULL)
+		(void) dbiAppendSet(set, matches->recs, matches->count,
+			sizeof(*matches->recs), 0);
+	    matches = dbiFreeIndexSet(matches);
+	}
+	if (i < mi->mi_nre) {
+	    set = dbiFreeIndexSet(set);
+	    continue;
+	}
+	rc = 0;
+    }
+
+    if (rc == 0 && set != NULL) {
+	/* Sort and uniqify, a header can provide several matching names. */
+	if (set->count > 1)
+	    qsort(set->recs, set->count, sizeof(*set->recs), hdrNumCmp);
+	for (i = 0, j = 0; i < (int)set->count; i++) {
+	    if (j > 0 && set->recs[j-1].hdrNum == set->recs[i].hdrNum)
+		continue;
+	    set->recs[j].hdrNum = set->recs[i].hdrNum;
+	    set->recs[j].tagNum = 0;
+	    j++;
+	}
+	set->count = j;
+	mi->mi_set = set;
+	mi->mi_setx = 0;
+	mi->mi_sorted = 1;
+    }
+
+if (_rpmmi_debug)
+fprintf(stderr, "<-- %s(%p) rc %d set %p[%u]\n", __FUNCTION__, mi, rc, mi->mi_set, (unsigned)(mi->mi_set ? mi->mi_set->count : 0));
+    return rc;
+}
+
+/**
+ * Return next header blob from iteration, with selectors (if any) applied.
+ * @param mi		rpm database iterator
+ * @retval *dbip	database index (for rewriting the current header)
+ * @retval *uhp		header blob
+ * @retval *uhlenp	no. of bytes in header blob
+ * @retval *mapp	is header blob mmap'd (rather than owned by the dbi)?
+ * @retval *skipp	-1 if selectors must be applied to the loaded header
+ * @return		0 on success, 1 if the current header repeats, -1 at end
+ */
+static int rpmmiNextBlob(rpmmi mi, dbiIndex * dbip, void ** uhp,
+		size_t * uhlenp, int * mapp, int * skipp)
+	/*@globals internalState @*/
+	/*@modifies mi, *dbip, *uhp, *uhlenp, *mapp, *skipp, internalState @*/
 {
     dbiIndex dbi;
     DBT k = DBT_INIT;
@@ -2119,18 +2364,21 @@ Header rpmmiNext(rpmmi mi)
 rpmTag tag;
 unsigned int _flags;
     int map;
+    int skip;
     int rc;
     int xx;
 
-    if (mi == NULL)
-	return NULL;
+    /* Turn selectors into an index scan before iterating Packages. */
+    if (mi->mi_dbc == NULL && mi->mi_set == NULL && mi->mi_re != NULL
+     && mi->mi_rpmtag == RPMDBI_PACKAGES && mi->mi_keyp == NULL)
+	xx = rpmmiIndexPatterns(mi);
 
     /* Find the tag to open. */
     tag = (mi->mi_set == NULL && mi->mi_primary != NULL
 		? mi->mi_rpmtag : RPMDBI_PACKAGES);
     dbi = dbiOpen(mi->mi_db, tag, 0);
     if (dbi == NULL)
-	return NULL;
+	return -1;
 
     switch (dbi->dbi_rpmdb->db_api) {
     default:	map = 0;		break;
@@ -2160,14 +2408,14 @@ next:
     if (mi->mi_set) {
 	/* The set of header instances is known in advance. */
 	if (!(mi->mi_setx < mi->mi_set->count))
-	    return NULL;
+	    return -1;
 	mi->mi_offset = _hton_ui(dbiIndexRecordOffset(mi->mi_set, mi->mi_setx));
 	mi->mi_bntag = dbiIndexRecordFileNumber(mi->mi_set, mi->mi_setx);
 	mi->mi_setx++;
 
 	/* If next header is identical, return it now. */
 	if (mi->mi_offset == mi->mi_prevoffset && mi->mi_h != NULL)
-	    return mi->mi_h;
+	    return 1;
 
 	/* Should this header be skipped? */
 	if (mi->mi_bf != NULL
@@ -2186,7 +2434,7 @@ next:
 assert(0);
 	    /*@notreached@*/ break;
 	case DB_NOTFOUND:
-	    return NULL;
+	    return -1;
 	    /*@notreached@*/ break;
 	case 0:
 	    mi->mi_setx++;
@@ -2194,7 +2442,7 @@ assert((size_t)p.size == sizeof(mi->mi_offset));
 	    memcpy(&mi->mi_offset, p.data, sizeof(mi->mi_offset));
 	    /* If next header is identical, return it now. */
 	    if (mi->mi_offset == mi->mi_prevoffset && mi->mi_h != NULL)
-		return mi->mi_h;
+		return 1;
 	    break;
 	}
 	_flags = DB_NEXT_DUP;
@@ -2217,7 +2465,7 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
 
     /* Did the header blob load correctly? */
     if (rc)
-	return NULL;
+	return -1;
 
     /* Should this header be skipped? */
     if (mi->mi_set == NULL && mi->mi_bf != NULL
@@ -2227,11 +2475,385 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
     uh = v.data;
     uhlen = v.size;
     if (uh == NULL)
+	return -1;
+
+    /* Apply iterator selectors (if any) before loading the header. */
+    skip = (mi->mi_re != NULL ? mireSkip(mi, NULL, uh, uhlen) : 0);
+    if (skip > 0) {
+	if (map && munmap(uh, uhlen) != 0)
+	    fprintf(stderr, "==> munmap(%p[%u]) error(%d): %s\n",
+		uh, (unsigned)uhlen, errno, strerror(errno));
+	goto next;
+    }
+
+    *dbip = dbi;
+    *uhp = uh;
+    *uhlenp = uhlen;
+    *mapp = map;
+    *skipp = skip;
+    return 0;
+}
+
+#if defined(DB_MULTIPLE_KEY_NEXT)
+/**
+ * Retrieve a batch of (sorted, dense) header blobs with bulk gets.
+ * Blobs not retrieved are left for DB_SET gets.
+ * @param mi		rpm database iterator
+ * @param dbi		Packages index
+ * @param b		batch of prefetched headers
+ */
+static void rpmmiBatchBulk(rpmmi mi, dbiIndex dbi, rpmmiBatch b)
+	/*@globals internalState @*/
+	/*@modifies mi, dbi, b, internalState @*/
+{
+    rpmmiPrefetch pf = mi->mi_pf;
+    uint32_t offset = _hton_ui(b->entries[0].hdrNum);
+    uint32_t last = b->entries[b->n-1].hdrNum;
+    uint32_t hdrNum = 0;
+    unsigned int _flags = DB_SET_RANGE;
+    DBT k = DBT_INIT;
+    DBT v = DBT_INIT;
+    int grown = 0;
+    int i = 0;
+    int rc;
+
+    if (pf->bulk == NULL) {
+	pf->bulklen = 1024 * 1024;
+	pf->bulk = xmalloc(pf->bulklen);
+    }
+
+    k.data = &offset;
+    k.size = (UINT32_T) sizeof(offset);
+    while (i < b->n && hdrNum < last) {
+	void * p;
+
+	memset(&v, 0, sizeof(v));
+	v.data = pf->bulk;
+	v.ulen = (UINT32_T) pf->bulklen;
+	v.flags = DB_DBT_USERMEM;
+	rc = dbiGet(dbi, mi->mi_dbc, &k, &v, _flags | DB_MULTIPLE_KEY);
+	if (rc == DB_BUFFER_SMALL && !grown) {
+	    /* Make room for (at least) the next header, in whole pages. */
+	    pf->bulklen = 2 * (((size_t)v.size + 1023) & ~1023);
+	    pf->bulk = xrealloc(pf->bulk, pf->bulklen);
+	    grown = 1;
+	    continue;
+	}
+	if (rc)
+	    break;
+	grown = 0;
+
+	DB_MULTIPLE_INIT(p, &v);
+	for (;;) {
+	    void * kp;
+	    void * dp;
+	    u_int32_t kl;
+	    u_int32_t dl;
+
+	    DB_MULTIPLE_KEY_NEXT(p, &v, kp, kl, dp, dl);
+	    if (p == NULL)
+		/*@innerbreak@*/ break;
+	    if (kl != sizeof(hdrNum))
+		/*@innercontinue@*/ continue;
+	    memcpy(&hdrNum, kp, sizeof(hdrNum));
+	    hdrNum = _ntoh_ui(hdrNum);
+	    while (i < b->n && b->entries[i].hdrNum < hdrNum)
+		i++;
+	    if (i < b->n && b->entries[i].hdrNum == hdrNum) {
+		rpmmiEntry e = b->entries + i++;
+		e->uh = memcpy(xmalloc(dl), dp, dl);
+		e->uhlen = dl;
+		e->map = 0;
+	    }
+	}
+	_flags = DB_NEXT;
+    }
+}
+#endif
+
+/**
+ * Retrieve the next batch of header blobs from the set of instances, and
+ * apply selectors (if any) to the blobs.
+ * @param mi		rpm database iterator
+ * @param dbi		Packages index
+ * @param b		batch of prefetched headers
+ */
+static void rpmmiBatchFetch(rpmmi mi, dbiIndex dbi, rpmmiBatch b)
+	/*@globals internalState @*/
+	/*@modifies mi, dbi, b, internalState @*/
+{
+    rpmmiPrefetch pf = mi->mi_pf;
+    int i;
+
+    /* Collect the next distinct header instances. */
+    b->n = 0;
+    b->i = 0;
+    while (b->n < pf->nbatch && pf->setx < mi->mi_set->count) {
+	uint32_t hdrNum = dbiIndexRecordOffset(mi->mi_set, pf->setx);
+	uint32_t offset = _hton_ui(hdrNum);
+	rpmmiEntry e;
+
+	pf->setx++;
+	if (b->n > 0 && b->entries[b->n-1].hdrNum == hdrNum)
+	    continue;
+	if (mi->mi_bf != NULL
+	 && rpmbfChk(mi->mi_bf, &offset, sizeof(offset)) > 0)
+	    continue;
+	e = b->entries + b->n++;
+	memset(e, 0, sizeof(*e));
+	e->hdrNum = hdrNum;
+    }
+    if (b->n == 0)
+	return;
+
+#if defined(DB_MULTIPLE_KEY_NEXT)
+    /* Sorted instances that are close together are retrieved in bulk. */
+    if (mi->mi_sorted && b->n > 1 && dbi->dbi_rpmdb->db_api == 3
+     && dbi->dbi_type == DB_BTREE
+     && (b->entries[b->n-1].hdrNum - b->entries[0].hdrNum) < (uint32_t)(2 * b->n))
+	rpmmiBatchBulk(mi, dbi, b);
+#endif
+
+    for (i = 0; i < b->n; i++) {
+	rpmmiEntry e = b->entries + i;
+
+	if (e->uh == NULL) {
+	    uint32_t offset = _hton_ui(e->hdrNum);
+	    DBT k = DBT_INIT;
+	    DBT v = DBT_INIT;
+	    int map;
+
+	    switch (dbi->dbi_rpmdb->db_api) {
+	    default:	map = 0;		/*@switchbreak@*/ break;
+	    case 3:	map = _rpmmi_usermem;	/*@switchbreak@*/ break;
+	    }
+	    k.data = &offset;
+	    k.size = (UINT32_T) sizeof(offset);
+	    if (rpmmiGet(dbi, mi->mi_dbc, &k, NULL, &v, DB_SET) || v.data == NULL)
+		continue;
+	    /* The dbi owns an unmapped blob, and reuses it on the next get. */
+	    e->uh = (map ? v.data : memcpy(xmalloc(v.size), v.data, v.size));
+	    e->uhlen = v.size;
+	    e->map = map;
+	}
+
+	/* Apply iterator selectors (if any) before loading the header. */
+	e->skip = (mi->mi_re != NULL ? mireSkip(mi, NULL, e->uh, e->uhlen) : 0);
+	if (e->skip > 0) {
+	    if (!e->map)
+		e->uh = _free(e->uh);
+	    else if (munmap(e->uh, e->uhlen) != 0)
+		fprintf(stderr, "==> munmap(%p[%u]) error(%d): %s\n",
+			e->uh, (unsigned)e->uhlen, errno, strerror(errno));
+	    e->uh = NULL;
+	}
+    }
+}
+
+/**
+ * Load a batch of header blobs (on the read ahead thread).
+ * @param _b		batch of prefetched headers
+ */
+static void rpmmiBatchLoad(void * _b)
+	/*@globals internalState @*/
+	/*@modifies _b, internalState @*/
+{
+    rpmmiBatch b = _b;
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+	rpmmiEntry e = b->entries + i;
+	if (e->uh == NULL)
+	    continue;
+	e->h = headerLoad(e->uh);
+	if (e->h != NULL) {
+	    e->h->flags |= (e->map
+		? (HEADERFLAG_MAPPED | HEADERFLAG_RDONLY) : HEADERFLAG_ALLOCATED);
+	    e->uh = NULL;
+	} else
+	    e->bad = 1;		/* XXX blob is freed by rpmmiBatchClean */
+    }
+    yarnPossess(b->loaded);
+    yarnTwist(b->loaded, TO, 1);
+}
+
+/**
+ * Retrieve, and load, the next batch of headers.
+ * @param mi		rpm database iterator
+ * @param dbi		Packages index
+ * @param b		batch of prefetched headers
+ * @param tp		read ahead thread (NULL loads inline)
+ */
+static void rpmmiBatchNext(rpmmi mi, dbiIndex dbi, rpmmiBatch b,
+		/*@null@*/ rpmtpool tp)
+	/*@globals internalState @*/
+	/*@modifies mi, dbi, b, tp, internalState @*/
+{
+    rpmmiBatchClean(b);
+    rpmmiBatchFetch(mi, dbi, b);
+    yarnPossess(b->loaded);
+    yarnTwist(b->loaded, TO, 0);
+    (void) rpmtpoolSubmit(tp, rpmmiBatchLoad, b);
+}
+
+/**
+ * Return next prefetched header from the set of instances.
+ * @param mi		rpm database iterator
+ * @retval *dbip	database index (for rewriting the current header)
+ * @retval *hp		header
+ * @retval *skipp	-1 if selectors must be applied to the loaded header
+ * @return		0 on success, 1 if the current header repeats, -1 at end
+ */
+static int rpmmiPrefetchNext(rpmmi mi, dbiIndex * dbip, Header * hp,
+		int * skipp)
+	/*@globals internalState @*/
+	/*@modifies mi, *dbip, *hp, *skipp, internalState @*/
+{
+    rpmmiPrefetch pf = mi->mi_pf;
+    rpmmiBatch b;
+    rpmmiEntry e;
+    dbiIndex dbi;
+    uint32_t hdrNum;
+    int xx;
+
+    dbi = dbiOpen(mi->mi_db, RPMDBI_PACKAGES, 0);
+    if (dbi == NULL)
+	return -1;
+    *dbip = dbi;
+
+    if (mi->mi_dbc == NULL) {
+	/* Retrieve in Packages order, each header instance once. */
+	if (!mi->mi_sorted && mi->mi_setx == 0)
+	    xx = rpmmiSort(mi);
+	xx = dbiCopen(dbi, dbiTxnid(dbi), &mi->mi_dbc, mi->mi_cflags);
+    }
+
+next:
+    if (!(mi->mi_setx < mi->mi_set->count))
+	return -1;
+    mi->mi_offset = _hton_ui(dbiIndexRecordOffset(mi->mi_set, mi->mi_setx));
+    mi->mi_bntag = dbiIndexRecordFileNumber(mi->mi_set, mi->mi_setx);
+    mi->mi_setx++;
+
+    /* If next header is identical, return it now. */
+    if (mi->mi_offset == mi->mi_prevoffset && mi->mi_h != NULL)
+	return 1;
+
+    /* Should this header be skipped? */
+    if (mi->mi_bf != NULL
+     && rpmbfChk(mi->mi_bf, &mi->mi_offset, sizeof(mi->mi_offset)) > 0)
+	goto next;
+
+    hdrNum = _ntoh_ui(mi->mi_offset);
+    b = pf->cur;
+
+    /* The instance repeats a header that was skipped. */
+    if (b->i > 0 && b->entries[b->i-1].hdrNum == hdrNum)
+	goto next;
+
+    /* Switch to the batch read ahead, and start reading the one after. */
+    if (b->i >= b->n && pf->next->n > 0) {
+	rpmmiBatchWait(pf->next);
+	pf->next = b;
+	pf->cur = b = (b == pf->batches ? pf->batches + 1 : pf->batches);
+	rpmmiBatchNext(mi, dbi, pf->next, pf->tp);
+    }
+
+    /* Out of step with the set (or 1st call): restart from here. */
+    if (b->i >= b->n || b->entries[b->i].hdrNum != hdrNum) {
+	rpmmiBatchWait(pf->next);
+	rpmmiBatchClean(pf->next);
+	pf->setx = mi->mi_setx - 1;
+	rpmmiBatchNext(mi, dbi, b, NULL);
+	if (pf->tp != NULL)
+	    rpmmiBatchNext(mi, dbi, pf->next, pf->tp);
+	if (b->n == 0 || b->entries[0].hdrNum != hdrNum)
+	    goto next;
+    }
+
+    e = b->entries + b->i++;
+    if (e->bad)
+	rpmlog(RPMLOG_ERR,
+		_("rpmdb: header #%u cannot be loaded -- skipping.\n"),
+		(unsigned)hdrNum);
+    if (e->h == NULL)
+	goto next;
+
+    *hp = headerLink(e->h);
+    *skipp = e->skip;
+    return 0;
+}
+
+int rpmmiSetPrefetch(rpmmi mi, int nbatch, int readahead)
+{
+    rpmmiPrefetch pf;
+    int i;
+
+    if (mi == NULL)
+	return -1;
+
+    mi->mi_pf = rpmmiPrefetchFree(mi->mi_pf);
+    if (nbatch <= 0)
+	return 0;
+
+    pf = xcalloc(1, sizeof(*pf));
+    pf->nbatch = nbatch;
+    pf->setx = 0;
+    for (i = 0; i < 2; i++) {
+	rpmmiBatch b = pf->batches + i;
+	b->entries = xcalloc(nbatch, sizeof(*b->entries));
+	b->n = 0;
+	b->i = 0;
+	b->loaded = yarnNewLock(1);
+    }
+    pf->cur = pf->batches;
+    pf->next = pf->batches + 1;
+    if (readahead) {
+	pf->tp = rpmtpoolNew(1);
+	if (rpmtpoolThreads(pf->tp) == 0)
+	    pf->tp = rpmtpoolFree(pf->tp);
+    }
+    mi->mi_pf = pf;
+    return 0;
+}
+
+Header rpmmiNext(rpmmi mi)
+{
+    dbiIndex dbi = NULL;
+    Header h = NULL;
+    void * uh = NULL;
+    size_t uhlen = 0;
+    int map = 0;
+    int skip = 0;
+    int rc;
+    int xx;
+
+    if (mi == NULL)
+	return NULL;
+
+next:
+    if (mi->mi_pf != NULL && mi->mi_set != NULL)
+	rc = rpmmiPrefetchNext(mi, &dbi, &h, &skip);
+    else
+	rc = rpmmiNextBlob(mi, &dbi, &uh, &uhlen, &map, &skip);
+    switch (rc) {
+    case 0:
+	break;
+    case 1:
+	return mi->mi_h;
+	/*@notreached@*/ break;
+    default:
 	return NULL;
+	/*@notreached@*/ break;
+    }
 
     /* Rewrite current header (if necessary) and unlink. */
     xx = miFreeHeader(mi, dbi);
 
+    if (h != NULL) {
+	mi->mi_h = h;		/* XXX prefetched, and already loaded. */
+	h = NULL;
+    } else
     if (map) {
 /*@-onlytrans@*/
 	mi->mi_h = headerLoad(uh);
@@ -2257,7 +2879,7 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
     }
 
     /* Skip this header if iterator selector (if any) doesn't match. */
-    if (mireSkip(mi))
+    if (skip < 0 && mireSkip(mi, mi->mi_h, NULL, 0))
 	goto next;
 
     /* Mark header with its instance number. */
@@ -2276,6 +2898,317 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
 /*@=compdef =retalias =retexpose =usereleased @*/
 }
 
+/**
+ * A header blob queued for rpmmiParallel() worker threads.
+ */
+typedef struct rpmmiJob_s * rpmmiJob;
+struct rpmmiJob_s {
+/*@null@*/
+    rpmmiJob next;		/*!< next queued job */
+/*@null@*/
+    rpmmiJob link;		/*!< next job in iterator order */
+/*@only@*/ /*@null@*/
+    void * uh;			/*!< header blob (NULL stops a worker) */
+    size_t uhlen;		/*!< no. of bytes in header blob */
+    int map;			/*!< is header blob mmap'd? */
+    int skip;			/*!< -1 if selectors must be applied to header */
+    uint32_t hdrNum;		/*!< header instance */
+/*@refcounted@*/ /*@null@*/
+    Header h;			/*!< loaded header (NULL if skipped) */
+/*@null@*/
+    void * result;		/*!< work function result */
+/*@null@*/
+    yarnLock finished;		/*!< 1 when the job has been run */
+};
+
+/**
+ * Shared state of rpmmiParallel() worker threads.
+ */
+typedef struct rpmmiPar_s * rpmmiPar;
+struct rpmmiPar_s {
+/*@dependent@*/
+    rpmmi mi;			/*!< rpm database iterator */
+/*@null@*/
+    rpmmiWorkFunc work;		/*!< per-header function (on workers) */
+/*@null@*/
+    rpmmiDoneFunc done;		/*!< per-header function (one at a time) */
+/*@shared@*/ /*@null@*/
+    void * arg;			/*!< per-header function argument */
+    int ordered;		/*!< call done in iterator order? */
+    yarnLock have;		/*!< no. of queued jobs, lock for queue */
+/*@null@*/
+    rpmmiJob head;		/*!< queued jobs */
+/*@dependent@*/
+    rpmmiJob * tail;		/*!< end of job queue */
+    yarnLock lock;		/*!< serializes selectors, and unordered done */
+};
+
+/**
+ * A rpmmiParallel() worker thread.
+ */
+typedef struct rpmmiWorker_s * rpmmiWorker;
+struct rpmmiWorker_s {
+/*@dependent@*/
+    rpmmiPar par;		/*!< shared state */
+    int tid;			/*!< worker thread no. */
+};
+
+/**
+ * Append a job to the worker thread queue.
+ * @param par		shared state
+ * @param job		job
+ */
+static void rpmmiParPush(rpmmiPar par, rpmmiJob job)
+	/*@modifies par, job @*/
+{
+    job->next = NULL;
+    yarnPossess(par->have);
+    *par->tail = job;
+    par->tail = &job->next;
+    yarnTwist(par->have, BY, 1);
+}
+
+/**
+ * Load a header blob, apply selectors, and run the work function.
+ * @param par		shared state
+ * @param job		job
+ * @param tid		worker thread no.
+ */
+static void rpmmiParRun(rpmmiPar par, rpmmiJob job, int tid)
+	/*@globals internalState @*/
+	/*@modifies par, job, internalState @*/
+{
+    Header h = headerLoad(job->uh);
+
+    if (h != NULL)
+	h->flags |= (job->map
+		? (HEADERFLAG_MAPPED | HEADERFLAG_RDONLY) : HEADERFLAG_ALLOCATED);
+    else if (!job->map)
+	job->uh = _free(job->uh);
+    else if (munmap(job->uh, job->uhlen) != 0)
+	fprintf(stderr, "==> munmap(%p[%u]) error(%d): %s\n",
+		job->uh, (unsigned)job->uhlen, errno, strerror(errno));
+    job->uh = NULL;
+
+    if (h == NULL) {
+	rpmlog(RPMLOG_ERR,
+		_("rpmdb: header #%u cannot be loaded -- skipping.\n"),
+		(unsigned)job->hdrNum);
+	goto exit;
+    }
+
+    /* Skip this header if iterator selector (if any) doesn't match. */
+    if (job->skip < 0) {
+	int skip;
+	yarnPossess(par->lock);
+	skip = mireSkip(par->mi, h, NULL, 0);
+	yarnRelease(par->lock);
+	if (skip) {
+	    (void) headerFree(h);
+	    h = NULL;
+	    goto exit;
+	}
+    }
+
+    /* Mark header with its instance number. */
+    {	char origin[32];
+	sprintf(origin, "rpmdb (h#%u)", (unsigned)job->hdrNum);
+	(void) headerSetOrigin(h, origin);
+	(void) headerSetInstance(h, job->hdrNum);
+    }
+
+    if (par->work != NULL)
+	job->result = (*par->work) (par->arg, h, tid);
+
+    if (!par->ordered && par->done != NULL) {
+	yarnPossess(par->lock);
+	(*par->done) (par->arg, h, job->result);
+	yarnRelease(par->lock);
+	job->result = NULL;
+    }
+
+exit:
+    job->h = h;
+    yarnPossess(job->finished);
+    yarnTwist(job->finished, TO, 1);
+}
+
+/**
+ * Run queued jobs until a stop job is found.
+ * @param _w		worker thread
+ */
+static void rpmmiParWorker(void * _w)
+	/*@globals internalState @*/
+	/*@modifies _w, internalState @*/
+{
+    rpmmiWorker w = _w;
+    rpmmiPar par = w->par;
+    rpmmiJob job;
+
+    for (;;) {
+	yarnPossess(par->have);
+	yarnWaitFor(par->have, NOT_TO_BE, 0);
+	job = par->head;
+assert(job != NULL);
+	if ((par->head = job->next) == NULL)
+	    par->tail = &par->head;
+	yarnTwist(par->have, BY, -1);
+
+	if (job->uh == NULL) {
+	    job = _free(job);
+	    break;
+	}
+	rpmmiParRun(par, job, w->tid);
+    }
+}
+
+/**
+ * Wait for a job to be run, call the done function (if in order), and
+ * free the job.
+ * @param par		shared state
+ * @param job		job
+ * @retval *np		incremented if the header was selected
+ * @return		next job in iterator order
+ */
+/*@null@*/
+static rpmmiJob rpmmiParReap(rpmmiPar par, /*@only@*/ rpmmiJob job, int * np)
+	/*@modifies par, job, *np @*/
+{
+    rpmmiJob link = job->link;
+
+    yarnPossess(job->finished);
+    yarnWaitFor(job->finished, TO_BE, 1);
+    yarnRelease(job->finished);
+    job->finished = yarnFreeLock(job->finished);
+
+    if (job->h != NULL) {
+	if (par->ordered && par->done != NULL)
+	    (*par->done) (par->arg, job->h, job->result);
+	(void) headerFree(job->h);
+	job->h = NULL;
+	(*np)++;
+    }
+    job = _free(job);
+    return link;
+}
+
+int rpmmiParallel(rpmmi mi, int nthreads, int flags,
+		rpmmiWorkFunc work, rpmmiDoneFunc done, void * arg)
+{
+    struct rpmmiPar_s _par;
+    rpmmiPar par = &_par;
+    rpmmiWorker workers = NULL;
+    rpmtpool tp = NULL;
+    rpmmiJob head = NULL;
+    rpmmiJob * tail = &head;
+    rpmmiJob job;
+    int inflight = 0;
+    int window;
+    int n = 0;
+    int i;
+    int xx;
+
+    if (mi == NULL)
+	return -1;
+
+    if (nthreads <= 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (cpus > 0 ? (int) cpus : 1);
+    }
+
+    /* Rewriting iterators (and single threads) run serially. */
+    if (nthreads > 1 && !(mi->mi_cflags & DB_WRITECURSOR)) {
+	tp = rpmtpoolNew(nthreads);
+	nthreads = rpmtpoolThreads(tp);
+    }
+    if (tp == NULL || nthreads < 2) {
+	Header h;
+	tp = rpmtpoolFree(tp);
+	while ((h = rpmmiNext(mi)) != NULL) {
+	    void * result = (work != NULL ? (*work) (arg, h, 0) : NULL);
+	    if (done != NULL)
+		(*done) (arg, h, result);
+	    n++;
+	}
+	goto exit;
+    }
+
+    /* Headers are owned by the jobs, not by the iterator. */
+    xx = miFreeHeader(mi, NULL);
+
+    /* XXX create the header pool before the workers race to. */
+    (void) headerFree(headerNew());
+
+    memset(par, 0, sizeof(*par));
+    par->mi = mi;
+    par->work = work;
+    par->done = done;
+    par->arg = arg;
+    par->ordered = (flags & RPMMI_ORDERED) ? 1 : 0;
+    par->have = yarnNewLock(0);
+    par->head = NULL;
+    par->tail = &par->head;
+    par->lock = yarnNewLock(0);
+
+    workers = xcalloc(nthreads, sizeof(*workers));
+    for (i = 0; i < nthreads; i++) {
+	workers[i].par = par;
+	workers[i].tid = i;
+	xx = rpmtpoolSubmit(tp, rpmmiParWorker, workers + i);
+    }
+
+    /* Read blobs (serially) from the cursor, and queue them to workers. */
+    window = 4 * nthreads;
+    for (;;) {
+	dbiIndex dbi = NULL;
+	void * uh = NULL;
+	size_t uhlen = 0;
+	int map = 0;
+	int skip = 0;
+
+	xx = rpmmiNextBlob(mi, &dbi, &uh, &uhlen, &map, &skip);
+	if (xx < 0)
+	    break;
+	if (xx > 0)		/* XXX can't happen, mi->mi_h is NULL. */
+	    continue;
+
+	job = xcalloc(1, sizeof(*job));
+	/* The dbi owns an unmapped blob, and reuses it on the next get. */
+	job->uh = (map ? uh : memcpy(xmalloc(uhlen), uh, uhlen));
+	job->uhlen = uhlen;
+	job->map = map;
+	job->skip = skip;
+	job->hdrNum = _ntoh_ui(mi->mi_offset);
+	job->finished = yarnNewLock(0);
+	*tail = job;
+	tail = &job->link;
+	rpmmiParPush(par, job);
+
+	/* Bound the no. of headers in flight. */
+	if (++inflight >= window) {
+	    if ((head = rpmmiParReap(par, head, &n)) == NULL)
+		tail = &head;
+	    inflight--;
+	}
+    }
+    while (head != NULL)
+	head = rpmmiParReap(par, head, &n);
+
+    /* Queue a stop job for each worker, then join them all. */
+    for (i = 0; i < nthreads; i++)
+	rpmmiParPush(par, xcalloc(1, sizeof(*job)));
+    tp = rpmtpoolFree(tp);
+    workers = _free(workers);
+
+    par->have = yarnFreeLock(par->have);
+    par->lock = yarnFreeLock(par->lock);
+
+exit:
+if (_rpmmi_debug)
+fprintf(stderr, "<-- %s(%p, %d, 0x%x, %p, %p, %p) headers %d\n", __FUNCTION__, mi, nthreads, flags, work, done, arg, n);
+    return n;
+}
+
 int rpmmiSort(rpmmi mi)
 {
     int rc = 0;
@@ -2533,6 +3466,7 @@ assert(keylen == sizeof(he->p.ui64p[0]));
     mi->mi_offset = 0;
     mi->mi_nre = 0;
     mi->mi_re = NULL;
+    mi->mi_pf = NULL;
 
 exit:
     return mi;
@@ -2574,6 +3508,11 @@ int rpmdbRemove(rpmdb db, /*@unused@*/ int rid, uint32_t hdrNum,
     rpmlog(RPMLOG_DEBUG, "  --- h#%8u %s\n", (unsigned)hdrNum, he->p.str);
     he->p.ptr = _free(he->p.ptr);
 
+    /* Discard cached dependency results that may change. */
+    (void) depCacheInvalidateHeader(db->db_depcache, h);
+    if (headerIsEntry(h, RPMTAG_PUBKEYS))
+	_rpmdb_pubkeygen++;
+
     (void) blockSignals(db, &signalMask);
 
     dbix = db->db_ndbi - 1;
@@ -2687,6 +3626,11 @@ assert(headerIsEntry(h, RPMTAG_REMOVETID) == 0);	/* XXX sanity */
 /* XXX pubkeys used to set RPMTAG_PACKAGECOLOR here. */
 assert(headerIsEntry(h, RPMTAG_PACKAGECOLOR) != 0);	/* XXX sanity */
 
+    /* Discard cached dependency results that may change. */
+    (void) depCacheInvalidateHeader(db->db_depcache, h);
+    if (headerIsEntry(h, RPMTAG_PUBKEYS))
+	_rpmdb_pubkeygen++;
+
     (void) blockSignals(db, &signalMask);
 
     /* Assign a primary Packages key for new Header's. */
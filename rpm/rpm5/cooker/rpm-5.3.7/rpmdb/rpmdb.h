@@ -32,6 +32,13 @@ extern int _rpmdb_debug;
 extern int _rpmmi_debug;
 /*@=exportlocal@*/
 
+/**
+ * Pubkey generation, incremented whenever a pubkey is added to, or
+ * removed from, an rpmdb (invalidates cached pubkeys).
+ */
+/*@unchecked@*/
+extern unsigned int _rpmdb_pubkeygen;
+
 #ifdef	NOTYET
 /** \ingroup rpmdb
  * Database of headers and tag value indices.
@@ -479,6 +486,9 @@ struct rpmdb_s {
 
     int	(*db_export) (rpmdb db, Header h, int adding);
 
+/*@only@*/ /*@null@*/
+    struct depCache_s * db_depcache;	/*!< Dependency results cache. */
+
 /*@refcounted@*/
     Header db_h;		/*!< Currently active header */
 
@@ -1346,6 +1356,22 @@ rpmmi rpmmiInit(/*@null@*/ rpmdb db, rpmTag tag,
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies db, rpmGlobalMacroContext, fileSystem, internalState @*/;
 
+/** \ingroup rpmdb
+ * Prefetch headers in batches when the set of instances is known.
+ * The set is sorted by instance (i.e. in Packages order) before the 1st
+ * header is retrieved, and each header instance is retrieved once.
+ * Berkeley DB retrieves dense batches with bulk gets. With read ahead,
+ * the next batch is loaded on a worker thread while the current batch
+ * is returned.
+ * @param mi		rpm database iterator
+ * @param nbatch	no. of headers per batch (0 disables)
+ * @param readahead	load the next batch on a worker thread?
+ * @return		0 on success, -1 on bad args
+ */
+int rpmmiSetPrefetch(/*@null@*/ rpmmi mi, int nbatch, int readahead)
+	/*@globals internalState @*/
+	/*@modifies mi, internalState @*/;
+
 /** \ingroup rpmdb
  * Return next package header from iteration.
  * @param mi		rpm database iterator
@@ -1356,6 +1382,54 @@ Header rpmmiNext(/*@null@*/ rpmmi mi)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies mi, rpmGlobalMacroContext, fileSystem, internalState @*/;
 
+/** \ingroup rpmdb
+ * Per-header function, run by rpmmiParallel() on worker threads.
+ * @param arg		per-header function argument
+ * @param h		header
+ * @param tid		worker thread no. (0 <= tid < nthreads)
+ * @return		result passed to the done function
+ */
+typedef /*@null@*/ void * (*rpmmiWorkFunc) (/*@null@*/ void * arg,
+		Header h, int tid)
+	/*@*/;
+
+/** \ingroup rpmdb
+ * Per-header function, run by rpmmiParallel() one header at a time.
+ * @param arg		per-header function argument
+ * @param h		header
+ * @param result	work function result (the done function owns it)
+ */
+typedef void (*rpmmiDoneFunc) (/*@null@*/ void * arg,
+		Header h, /*@only@*/ /*@null@*/ void * result)
+	/*@*/;
+
+/** \ingroup rpmdb
+ * rpmmiParallel() flags.
+ */
+#define	RPMMI_ORDERED	(1 << 0)	/*!< call done in iterator order */
+
+/** \ingroup rpmdb
+ * Iterate, loading headers and applying selectors on worker threads.
+ * Header blobs are read from the database by the calling thread. The
+ * work function runs on the worker thread that loaded the header, and
+ * the done function runs one header at a time: with RPMMI_ORDERED, on
+ * the calling thread in iterator order, otherwise in completion order.
+ * Headers are freed after the done function returns.
+ * Rewriting iterators, or a single thread, iterate serially.
+ * @param mi		rpm database iterator
+ * @param nthreads	no. of worker threads (<= 0 uses no. of cpus)
+ * @param flags		RPMMI_ORDERED
+ * @param work		per-header function (on worker threads, or NULL)
+ * @param done		per-header function (one at a time, or NULL)
+ * @param arg		per-header function argument
+ * @return		no. of headers iterated (-1 on bad args)
+ */
+int rpmmiParallel(/*@null@*/ rpmmi mi, int nthreads, int flags,
+		/*@null@*/ rpmmiWorkFunc work, /*@null@*/ rpmmiDoneFunc done,
+		/*@null@*/ void * arg)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies mi, rpmGlobalMacroContext, fileSystem, internalState @*/;
+
 /** \ingroup rpmdb
  * Check rpmdb signal handler for trapped signal and/or requested exit.
  * Clean up any open iterators and databases on termination condition.
@@ -4,9 +4,11 @@
 #include "system.h"
 
 #include <rpmiotypes.h>
+#include <rpmio.h>
 #include <rpmmacro.h>
 #define	_MIRE_INTERNAL
 #include <mire.h>
+#include <yarn.h>
 
 #include <rpmtag.h>
 #define	_RPMEVR_INTERNAL
@@ -145,47 +147,147 @@ static const char * _evr_tuple_match =
 const char * evr_tuple_match = NULL;
 /*@unchecked@*/ /*@refcounted@*/ /*@null@*/
 miRE evr_tuple_mire = NULL;
+/*@unchecked@*/
+static int _evr_tuple_default = 0;	/* Is evr_tuple_match the default? */
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static yarnLock _evr_lock = NULL;	/* XXX memleak */
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_once_t _evr_once = PTHREAD_ONCE_INIT;
+#endif
 
-static miRE rpmEVRmire(void)
+static void rpmEVRlockInit(void)
+	/*@globals _evr_lock @*/
+	/*@modifies _evr_lock @*/
+{
+    _evr_lock = yarnNewLock(0);
+}
+
+/**
+ * Expand %{evr_tuple_match}, compiling the pattern unless it is the default.
+ * @return		1 if the default pattern (see rpmEVRsplit())
+ */
+static int rpmEVRmatch(void)
 	/*@*/
 {
 /*@-globs -internalglobs -mods @*/
-    if (evr_tuple_mire == NULL) {
-	int xx;
-	evr_tuple_match = rpmExpand("%{?evr_tuple_match}", NULL);
-	if (evr_tuple_match == NULL || evr_tuple_match[0] == '\0')
-	    evr_tuple_match = xstrdup(_evr_tuple_match);
+    if (evr_tuple_match == NULL) {
+#if defined(WITH_PTHREADS)
+	(void) pthread_once(&_evr_once, rpmEVRlockInit);
+#else
+	if (_evr_lock == NULL)
+	    rpmEVRlockInit();
+#endif
+	yarnPossess(_evr_lock);
+	if (evr_tuple_match == NULL) {
+	    const char * match = rpmExpand("%{?evr_tuple_match}", NULL);
+	    int xx;
+
+	    if (match == NULL || match[0] == '\0') {
+		match = _free(match);
+		match = xstrdup(_evr_tuple_match);
+	    }
+	    _evr_tuple_default = !strcmp(match, _evr_tuple_match);
+	    evr_tuple_mire = mireFree(evr_tuple_mire);
+	    if (!_evr_tuple_default) {
+		evr_tuple_mire = mireNew(RPMMIRE_REGEX, 0);
+		xx = mireSetCOptions(evr_tuple_mire, RPMMIRE_REGEX, 0, 0, NULL);
+		xx = mireRegcomp(evr_tuple_mire, match);
+	    }
+	    evr_tuple_match = match;
+	}
+	yarnRelease(_evr_lock);
+    }
+/*@=globs =internalglobs =mods @*/
+assert(evr_tuple_match != NULL);
+    return _evr_tuple_default;
+}
 
-	evr_tuple_mire = mireNew(RPMMIRE_REGEX, 0);
-	xx = mireSetCOptions(evr_tuple_mire, RPMMIRE_REGEX, 0, 0, NULL);
-	xx = mireRegcomp(evr_tuple_mire, evr_tuple_match);
+/**
+ * Fields of the default %{evr_tuple_match}, by the separators between
+ * the ':' and '-' separated tokens of an EVR string.
+ */
+/*@unchecked@*/ /*@observer@*/
+static const char * _evr_split[][2] = {
+    { "",	"V" },
+    { ":",	"EV" },
+    { "-",	"VR" },
+    { ":-",	"EVR" },
+    { "-:",	"VRD" },
+    { "::",	"EVD" },
+    { ":-:",	"EVRD" },
+};
 
+/**
+ * Split [E:]V[-R][:D] in place, as the default %{evr_tuple_match} would.
+ * @param s		EVR string (separators are overwritten)
+ * @retval F		parsed fields (\1=E, \2=V, \3=R, \4=D), unset if no match
+ * @return		0 on match, -1 otherwise
+ */
+static int rpmEVRsplit(char * s, const char ** F)
+	/*@modifies s, F @*/
+{
+    char * t[4];
+    char seps[4];
+    int nt = 0;
+    int i, j;
+
+    /* Non-empty tokens, at most 4 of them. */
+    for (;;) {
+	char * b = s;
+	while (*s != '\0' && *s != ':' && *s != '-')
+	    s++;
+	if (s == b || nt == 4)
+	    return -1;
+	t[nt] = b;
+	seps[nt++] = *s;
+	if (*s++ == '\0')
+	    break;
     }
-/*@=globs =internalglobs =mods @*/
-assert(evr_tuple_match != NULL && evr_tuple_mire != NULL);
-/*@-globstate -retalias@*/
-    return evr_tuple_mire;
-/*@=globstate =retalias@*/
+    seps[nt - 1] = '\0';
+
+    for (i = 0; i < (int)(sizeof(_evr_split)/sizeof(_evr_split[0])); i++) {
+	const char * fields = _evr_split[i][1];
+	if (strcmp(seps, _evr_split[i][0]))
+	    continue;
+	for (j = 0; j < nt; j++) {
+	    int ix;
+	    switch ((int)fields[j]) {
+	    default:
+	    case 'E':	ix = RPMEVR_E;	/*@switchbreak@*/ break;
+	    case 'V':	ix = RPMEVR_V;	/*@switchbreak@*/ break;
+	    case 'R':	ix = RPMEVR_R;	/*@switchbreak@*/ break;
+	    case 'D':	ix = RPMEVR_D;	/*@switchbreak@*/ break;
+	    }
+	    F[ix] = t[j];
+	    if (j > 0)
+		t[j][-1] = '\0';
+	}
+	return 0;
+    }
+    return -1;
 }
 
-int rpmEVRparse(const char * evrstr, EVR_t evr)
-	/*@modifies evrstr, evr @*/
+/**
+ * Split an EVR string in place with a custom %{evr_tuple_match} pattern.
+ * @param evr		EVR container (evr->str is split)
+ */
+static void rpmEVRregex(EVR_t evr)
+	/*@modifies evr @*/
 {
-    miRE mire = rpmEVRmire();
+    miRE mire = evr_tuple_mire;
     int noffsets = 6 * 3;
     int offsets[6 * 3];
-    size_t nb;
+    size_t nb = strlen(evr->str);
     int xx;
     int i;
 
-    memset(evr, 0, sizeof(*evr));
-    evr->str = xstrdup(evrstr);
-    nb = strlen(evr->str);
-
+    /* The match offsets are set in the (shared) pattern. */
+    yarnPossess(_evr_lock);
     memset(offsets, -1, sizeof(offsets));
     xx = mireSetEOptions(mire, offsets, noffsets);
 
-    xx = mireRegexec(mire, evr->str, strlen(evr->str));
+    xx = mireRegexec(mire, evr->str, nb);
 
     for (i = 0; i < noffsets; i += 2) {
 	int ix;
@@ -212,6 +314,22 @@ assert(offsets[i+1] >= 0 && offsets[i+1] <= (int)nb);
 
     }
 
+    xx = mireSetEOptions(mire, NULL, 0);
+    yarnRelease(_evr_lock);
+}
+
+int rpmEVRparse(const char * evrstr, EVR_t evr)
+	/*@modifies evrstr, evr @*/
+{
+    memset(evr, 0, sizeof(*evr));
+    evr->str = xstrdup(evrstr);
+
+    /* The default pattern is split by hand, others need the regex. */
+    if (rpmEVRmatch())
+	(void) rpmEVRsplit((char *) evr->str, evr->F);
+    else
+	rpmEVRregex(evr);
+
     /* XXX HACK: postpone committing to single "missing" value for now. */
 /*@-observertrans -readonlytrans@*/
     if (evr->F[RPMEVR_E] == NULL) evr->F[RPMEVR_E] = "0";
@@ -222,8 +340,6 @@ assert(offsets[i+1] >= 0 && offsets[i+1] <= (int)nb);
 
     evr->Elong = strtoul(evr->F[RPMEVR_E], NULL, 10);
 
-    xx = mireSetEOptions(mire, NULL, 0);
-
     return 0;
 }
 
@@ -51,6 +51,9 @@ extern int sqlite3_close(sqlite3 * db)
 #include <rpmlog.h>
 #include <rpmurl.h>
 #include <poptIO.h>
+#include <rpmhash.h>
+#include <rpmtpool.h>
+#include <yarn.h>
 
 #define	_RPMREPO_INTERNAL
 #include <rpmrepo.h>
@@ -304,6 +307,7 @@ static struct rpmrepo_s __repo = {
     .markup	= ".xml",
     .pkgalgo	= PGPHASHALGO_SHA1,
     .algo	= PGPHASHALGO_SHA1,
+    .nthreads	= 1,
     .primary	= {
 	.type	= "primary",
 	.xml_init= primary_xml_init,
@@ -706,7 +710,7 @@ int rpmrepoCheckTimeStamps(rpmrepo repo)
  * @param spew		contents
  * @return		0 on success
  */
-static int rpmrfileXMLWrite(rpmrfile rfile, const char * spew)
+static int rpmrfileWrite(rpmrfile rfile, /*@null@*/ const char * spew)
 	/*@globals fileSystem @*/
 	/*@modifies rfile, fileSystem @*/
 {
@@ -720,6 +724,20 @@ static int rpmrfileXMLWrite(rpmrfile rfile, const char * spew)
 		(unsigned)nspew, (unsigned)nb, Fstrerror(rfile->fd));
 	rc = 1;
     }
+    return rc;
+}
+
+/**
+ * Write to a repository metadata file, freeing the contents.
+ * @param rfile		repository metadata file
+ * @param spew		contents
+ * @return		0 on success
+ */
+static int rpmrfileXMLWrite(rpmrfile rfile, /*@only@*/ const char * spew)
+	/*@globals fileSystem @*/
+	/*@modifies rfile, fileSystem @*/
+{
+    int rc = rpmrfileWrite(rfile, spew);
     spew = _free(spew);
     return rc;
 }
@@ -1355,9 +1373,12 @@ int rpmrepoDoFinalMove(rpmrepo repo)
  * Read a header from a repository package file, computing package file digest.
  * @param repo		repository
  * @param path		package file path
+ * @param instance	header instance
+ * @param tslock	lock to serialize rpmReadPackageFile() (or NULL)
  * @return		header (NULL on error)
  */
-static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
+static Header rpmrepoReadHeader(rpmrepo repo, const char * path,
+		unsigned instance, /*@null@*/ yarnLock tslock)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies repo, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
@@ -1374,7 +1395,12 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
 	    fdInitDigest(fd, algo, 0);
 
 	/* XXX what if path needs expansion? */
+	/* XXX the transaction (and its pgpDig) is shared by worker threads. */
+	if (tslock != NULL)
+	    yarnPossess(tslock);
 	rpmrc = rpmReadPackageFile(ts, fd, path, &h);
+	if (tslock != NULL)
+	    yarnRelease(tslock);
 	if (algo != PGPHASHALGO_NONE) {
 	    char buffer[32 * BUFSIZ];
 	    size_t nb = sizeof(buffer);
@@ -1408,7 +1434,7 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
 	case RPMRC_OK:
 	    if (repo->baseurl)
 		(void) headerSetBaseURL(h, repo->baseurl);
-	    (void) headerSetInstance(h, (uint32_t)repo->current+1);
+	    (void) headerSetInstance(h, (uint32_t)instance);
 	    break;
 	}
     }
@@ -1419,14 +1445,22 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
  * Return header query.
  * @param h		header
  * @param qfmt		query format
- * @return		query format result
+ * @retval *hfmtp	compiled query format (compiled on first use)
+ * @return		query format result (owned by *hfmtp)
  */
-static const char * rfileHeaderSprintf(Header h, const char * qfmt)
+/*@observer@*/
+static const char * rfileHeaderSprintf(Header h, const char * qfmt,
+		hdrfmt_t * hfmtp)
 	/*@globals fileSystem @*/
-	/*@modifies h, fileSystem @*/
+	/*@modifies h, *hfmtp, fileSystem @*/
 {
     const char * msg = NULL;
-    const char * s = headerSprintf(h, qfmt, NULL, NULL, &msg);
+    const char * s = NULL;
+
+    if (*hfmtp == NULL)
+	*hfmtp = headerCompileFormat(qfmt, NULL, NULL, &msg);
+    if (*hfmtp != NULL)
+	s = headerFormatRun(h, *hfmtp, &msg);
     if (s == NULL)
 	rpmrepoError(1, _("headerSprintf(%s): %s"), qfmt, msg);
 assert(s != NULL);
@@ -1435,26 +1469,19 @@ assert(s != NULL);
 
 #if defined(WITH_SQLITE)
 /**
- * Return header query, with "XXX" replaced by rpmdb header instance.
- * @param h		header
- * @param qfmt		query format
- * @return		query format result
+ * Return sqlite3 command, with "'XXX'" replaced by rpmdb header instance.
+ * @param s		sqlite3 command (malloc'ed)
+ * @param instance	rpmdb header instance
+ * @return		sqlite3 command (malloc'ed)
  */
-static const char * rfileHeaderSprintfHack(Header h, const char * qfmt)
-	/*@globals fileSystem @*/
-	/*@modifies h, fileSystem @*/
+static const char * rfileSQLInstance(/*@only@*/ char * s, uint32_t instance)
+	/*@modifies s @*/
 {
     static const char mark[] = "'XXX'";
     static size_t nmark = sizeof("'XXX'") - 1;
-    const char * msg = NULL;
-    char * s = (char *) headerSprintf(h, qfmt, NULL, NULL, &msg);
     char * f, * fe;
     int nsubs = 0;
 
-    if (s == NULL)
-	rpmrepoError(1, _("headerSprintf(%s): %s"), qfmt, msg);
-assert(s != NULL);
-
     /* XXX Find & replace 'XXX' with '%{DBINSTANCE}' the hard way. */
 /*@-nullptrarith@*/
     for (f = s; *f != '\0' && (fe = strstr(f, "'XXX'")) != NULL; fe += nmark, f = fe)
@@ -1462,10 +1489,9 @@ assert(s != NULL);
 /*@=nullptrarith@*/
 
     if (nsubs > 0) {
-	char instance[64];
-	int xx = snprintf(instance, sizeof(instance), "'%u'",
-		(uint32_t) headerGetInstance(h));
-	size_t tlen = strlen(s) + nsubs * ((int)strlen(instance) - (int)nmark);
+	char _instance[64];
+	int xx = snprintf(_instance, sizeof(_instance), "'%u'", instance);
+	size_t tlen = strlen(s) + nsubs * ((int)strlen(_instance) - (int)nmark);
 	char * t = xmalloc(tlen + 1);
 	char * te = t;
 
@@ -1473,7 +1499,7 @@ assert(s != NULL);
 /*@-nullptrarith@*/
 	for (f = s; *f != '\0' && (fe = strstr(f, mark)) != NULL; fe += nmark, f = fe) {
 	    *fe = '\0';
-	    te = stpcpy( stpcpy(te, f), instance);
+	    te = stpcpy( stpcpy(te, f), _instance);
 	}
 /*@=nullptrarith@*/
 	if (*f != '\0')
@@ -1487,29 +1513,697 @@ assert(s != NULL);
 #endif
 
 /**
- * Export a single package's metadata to repository metadata file(s).
+ * Display progress after a package's metadata has been written.
  * @param repo		repository
- * @param rfile		repository metadata file
- * @param h		header
- * @return		0 on success
+ * @param pkg		package path
  */
-static int rpmrepoWriteMDFile(rpmrepo repo, rpmrfile rfile, Header h)
-	/*@globals fileSystem @*/
-	/*@modifies rfile, h, fileSystem @*/
+static void rpmrepoPkgProgress(rpmrepo repo, const char * pkg)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
 {
-    int rc = 0;
+    if (!repo->quiet) {
+	if (repo->verbose)
+	    rpmrepoError(0, "%d/%d - %s", repo->current, repo->pkgcount, pkg);
+	else
+	    rpmrepoProgress(repo, pkg, repo->current, repo->pkgcount);
+    }
+}
 
-    if (rfile->xml_qfmt != NULL) {
-	if (rpmrfileXMLWrite(rfile, rfileHeaderSprintf(h, rfile->xml_qfmt)))
-	    rc = 1;
+/**
+ * Return a package metadata file.
+ * @param repo		repository
+ * @param i		0 = primary, 1 = filelists, 2 = other
+ * @return		repository metadata file
+ */
+/*@dependent@*/
+static rpmrfile rpmrepoPkgRfile(rpmrepo repo, int i)
+	/*@*/
+{
+    switch (i) {
+    default:	/*@fallthrough@*/
+    case 0:	return &repo->primary;
+    case 1:	return &repo->filelists;
+    case 2:	return &repo->other;
     }
+    /*@notreached@*/
+}
+
+/*==============================================================*/
+
+/**
+ * The --update cache of per-package metadata fragments.
+ *
+ * The file (native byte order) is
+ *	RPMREPO_CACHE_MAGIC
+ *	NUL terminated paths and fragments
+ *	struct rpmrepoCacheEntry_s [nentries], sorted by path
+ *	struct rpmrepoCacheTrailer_s
+ * and is mmap'ed as is by the next --update run.
+ */
+#define	RPMREPO_CACHE		"rpmrepo.cache"
+#define	RPMREPO_CACHE_MAGIC	"rpmrepo1"
+
+/**
+ * A cached package: file identity and fragment offsets (0 if none).
+ */
+struct rpmrepoCacheEntry_s {
+    uint64_t size;		/*!< package st_size */
+    uint64_t mtime;		/*!< package st_mtime */
+    uint64_t ino;		/*!< package st_ino */
+    uint64_t path;		/*!< package path */
+    uint64_t frags[6];		/*!< primary/filelists/other xml, then sql */
+};
+
+struct rpmrepoCacheTrailer_s {
+    uint64_t entries;		/*!< offset of entries */
+    uint32_t nentries;		/*!< no. of entries */
+    uint32_t key;		/*!< hash of the options fragments depend on */
+    char magic[8];		/*!< RPMREPO_CACHE_MAGIC */
+};
 
+/**
+ * A package added to the new cache.
+ */
+struct rpmrepoCacheAdded_s {
+/*@observer@*/
+    const char * path;		/*!< package path (the sort key) */
+    struct rpmrepoCacheEntry_s e;
+};
+
+typedef struct rpmrepoCache_s * rpmrepoCache;
+struct rpmrepoCache_s {
+    uint32_t key;		/*!< hash of the options fragments depend on */
+/*@null@*/
+    const char * b;		/*!< previous cache (mmap'ed) */
+    size_t nb;
+    size_t ns;			/*!< end of previous cache strings */
+/*@null@*/
+    const struct rpmrepoCacheEntry_s * entries;
+    size_t nentries;
+/*@only@*/
+    const char * fn;		/*!< new cache path */
+/*@null@*/
+    FD_t fd;			/*!< new cache */
+    uint64_t off;		/*!< new cache write offset */
+/*@only@*/ /*@null@*/
+    struct rpmrepoCacheAdded_s * added;	/*!< new cache entries */
+    size_t nadded;
+    int rc;			/*!< 0 until a write fails */
+};
+
+/**
+ * Return hash of the options and formats that metadata fragments depend on.
+ * @param repo		repository
+ * @return		cache key
+ */
+static uint32_t rpmrepoCacheKey(rpmrepo repo)
+	/*@*/
+{
+    uint32_t key = 0;
+    char b[64];
+    int i;
+
+    (void) snprintf(b, sizeof(b), "%d %d %u", repo->pkgalgo,
+		(REPO_ISSET(DATABASE) ? 1 : 0),
+		(unsigned) sizeof(struct rpmrepoCacheEntry_s));
+    key = hashFunctionString(key, b, 0);
+    if (repo->baseurl != NULL)
+	key = hashFunctionString(key, repo->baseurl, 0);
+    for (i = 0; i < 3; i++) {
+	rpmrfile rfile = rpmrepoPkgRfile(repo, i);
+	if (rfile->xml_qfmt != NULL)
+	    key = hashFunctionString(key, rfile->xml_qfmt, 0);
+	if (rfile->sql_qfmt != NULL)
+	    key = hashFunctionString(key, rfile->sql_qfmt, 0);
+    }
+    return key;
+}
+
+/**
+ * Map the previous run's cache (if usable), and start the new cache.
+ * @param repo		repository
+ * @return		cache
+ */
+/*@only@*/
+static rpmrepoCache rpmrepoCacheNew(rpmrepo repo)
+	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrepoCache cache = xcalloc(1, sizeof(*cache));
+    const char * fn = rpmGetPath(repo->outputdir, "/", repo->finaldir,
+		"/" RPMREPO_CACHE, NULL);
+    struct stat sb;
+    int fdno;
+
+    cache->key = rpmrepoCacheKey(repo);
+
+    if ((fdno = open(fn, O_RDONLY)) >= 0) {
+	if (fstat(fdno, &sb) == 0
+	 && sb.st_size > (off_t)(sizeof(RPMREPO_CACHE_MAGIC) - 1
+			+ sizeof(struct rpmrepoCacheTrailer_s)))
+	{
+	    void * b = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED,
+			fdno, 0);
+	    if (b != MAP_FAILED) {
+		cache->b = b;
+		cache->nb = (size_t) sb.st_size;
+	    }
+	}
+	(void) close(fdno);
+    }
+
+    if (cache->b != NULL) {
+	struct rpmrepoCacheTrailer_s t;
+	size_t nt = sizeof(t);
+	memcpy(&t, cache->b + cache->nb - nt, nt);
+	if (!memcmp(t.magic, RPMREPO_CACHE_MAGIC, sizeof(t.magic))
+	 && t.key == cache->key
+	 && (t.entries % sizeof(uint64_t)) == 0
+	 && t.entries <= cache->nb - nt
+	 && t.nentries == (cache->nb - nt - t.entries) / sizeof(*cache->entries))
+	{
+	    cache->ns = (size_t) t.entries;
+	    cache->entries = (const void *)(cache->b + t.entries);
+	    cache->nentries = t.nentries;
+	}
+if (_rpmrepo_debug)
+fprintf(stderr, "--> %s: %s: %u entries\n", __FUNCTION__, fn,
+		(unsigned) cache->nentries);
+    }
+    fn = _free(fn);
+
+    cache->fn = rpmGetPath(repo->outputdir, "/", repo->tempdir,
+		"/" RPMREPO_CACHE, NULL);
+    cache->fd = Fopen(cache->fn, "w.ufdio");
+    if (cache->fd == NULL || Ferror(cache->fd)) {
+	rpmrepoError(0, _("cannot create %s: %s"), cache->fn,
+		Fstrerror(cache->fd));
+	if (cache->fd != NULL)
+	    (void) Fclose(cache->fd);
+	cache->fd = NULL;
+    } else
+    if (Fwrite(RPMREPO_CACHE_MAGIC, 1, sizeof(RPMREPO_CACHE_MAGIC) - 1,
+		cache->fd) != sizeof(RPMREPO_CACHE_MAGIC) - 1)
+	cache->rc = 1;
+    cache->off = sizeof(RPMREPO_CACHE_MAGIC) - 1;
+
+    return cache;
+}
+
+/**
+ * Return a string from the previous cache.
+ * @param cache		cache
+ * @param off		string offset (0 if none)
+ * @return		string (NULL if none, or not within the strings)
+ */
+/*@observer@*/ /*@null@*/
+static const char * rpmrepoCacheString(rpmrepoCache cache, uint64_t off)
+	/*@*/
+{
+    const char * s;
+
+    if (off < sizeof(RPMREPO_CACHE_MAGIC) - 1 || off >= cache->ns)
+	return NULL;
+    s = cache->b + off;
+    /* A corrupt cache could have an unterminated string. */
+    if (memchr(s, '\0', cache->ns - (size_t) off) == NULL)
+	return NULL;
+    return s;
+}
+
+static int rpmrepoCacheCmp(const void * a, const void * b)
+	/*@*/
+{
+    return strcmp(((const struct rpmrepoCacheAdded_s *)a)->path,
+		((const struct rpmrepoCacheAdded_s *)b)->path);
+}
+
+/**
+ * Find an unchanged package in the previous cache.
+ * @param cache		cache
+ * @param path		package path
+ * @param st		package stat(2) info
+ * @return		cache entry (NULL if missing or changed)
+ */
+/*@observer@*/ /*@null@*/
+static const struct rpmrepoCacheEntry_s *
+rpmrepoCacheLookup(rpmrepoCache cache, const char * path, struct stat * st)
+	/*@*/
+{
+    size_t l = 0;
+    size_t u = cache->nentries;
+
+    while (l < u) {
+	size_t i = (l + u) / 2;
+	const struct rpmrepoCacheEntry_s * e = cache->entries + i;
+	const char * epath = rpmrepoCacheString(cache, e->path);
+	int rc = (epath != NULL ? strcmp(path, epath) : -1);
+
+	if (rc < 0)
+	    u = i;
+	else if (rc > 0)
+	    l = i + 1;
+	else if (e->size == (uint64_t) st->st_size
+	      && e->mtime == (uint64_t) st->st_mtime
+	      && e->ino == (uint64_t) st->st_ino)
+	    return e;
+	else
+	    break;
+    }
+    return NULL;
+}
+
+/**
+ * Append a string to the new cache.
+ * @param cache		cache
+ * @param s		string (NULL if none)
+ * @return		string offset (0 if none)
+ */
+static uint64_t rpmrepoCacheWrite(rpmrepoCache cache, /*@null@*/ const char * s)
+	/*@modifies cache @*/
+{
+    uint64_t off = cache->off;
+    size_t ns;
+
+    if (s == NULL || cache->fd == NULL)
+	return 0;
+    ns = strlen(s) + 1;
+    if (Fwrite(s, 1, ns, cache->fd) != ns)
+	cache->rc = 1;
+    cache->off += ns;
+    return off;
+}
+
+/**
+ * Add a package's metadata fragments to the new cache.
+ * @param cache		cache
+ * @param path		package path
+ * @param st		package stat(2) info
+ * @param frags		primary/filelists/other xml, then sql fragments
+ */
+static void rpmrepoCacheAdd(rpmrepoCache cache, const char * path,
+		struct stat * st, const char ** frags)
+	/*@modifies cache @*/
+{
+    struct rpmrepoCacheEntry_s * e;
+    int i;
+
+    if (cache->fd == NULL)
+	return;
+    if ((cache->nadded % 128) == 0)
+	cache->added = xrealloc(cache->added,
+		(cache->nadded + 128) * sizeof(*cache->added));
+    cache->added[cache->nadded].path = path;
+    e = &cache->added[cache->nadded++].e;
+
+    e->size = (uint64_t) st->st_size;
+    e->mtime = (uint64_t) st->st_mtime;
+    e->ino = (uint64_t) st->st_ino;
+    e->path = rpmrepoCacheWrite(cache, path);
+    for (i = 0; i < 6; i++)
+	e->frags[i] = rpmrepoCacheWrite(cache, frags[i]);
+}
+
+/**
+ * Finish the new cache (removed unless rc == 0), and unmap the previous cache.
+ * @param cache		cache
+ * @param rc		0 if all package metadata was written
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmrepoCache rpmrepoCacheFree(/*@only@*/ rpmrepoCache cache, int rc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies cache, fileSystem, internalState @*/
+{
+    if (cache->fd != NULL) {
+	struct rpmrepoCacheTrailer_s t;
+	static const char pad[sizeof(uint64_t)];
+	size_t npad = (size_t)(-cache->off % sizeof(uint64_t));
+	size_t i;
+
+	if (cache->nadded > 1)
+	    qsort(cache->added, cache->nadded, sizeof(*cache->added),
+			rpmrepoCacheCmp);
+
+	if (npad > 0 && Fwrite(pad, 1, npad, cache->fd) != npad)
+	    cache->rc = 1;
+	memset(&t, 0, sizeof(t));
+	t.entries = cache->off + npad;
+	t.nentries = (uint32_t) cache->nadded;
+	t.key = cache->key;
+	memcpy(t.magic, RPMREPO_CACHE_MAGIC, sizeof(t.magic));
+	for (i = 0; i < cache->nadded; i++) {
+	    if (Fwrite(&cache->added[i].e, 1, sizeof(cache->added[i].e),
+			cache->fd) != sizeof(cache->added[i].e))
+		cache->rc = 1;
+	}
+	if (Fwrite(&t, 1, sizeof(t), cache->fd) != sizeof(t))
+	    cache->rc = 1;
+	if (Fclose(cache->fd) != 0)
+	    cache->rc = 1;
+	cache->fd = NULL;
+	if (rc != 0 || cache->rc != 0) {
+	    if (cache->rc != 0)
+		rpmrepoError(0, _("cannot write %s"), cache->fn);
+	    (void) Unlink(cache->fn);
+	}
+    }
+    if (cache->b != NULL)
+	(void) munmap((void *)cache->b, cache->nb);
+    cache->added = _free(cache->added);
+    cache->fn = _free(cache->fn);
+    cache = _free(cache);
+    return NULL;
+}
+
+/*==============================================================*/
+
+/**
+ * A package to be read, formatted and written.
+ */
+typedef struct rpmrepoJob_s * rpmrepoJob;
+struct rpmrepoJob_s {
+/*@null@*/
+    rpmrepoJob next;		/*!< next queued job */
+/*@null@*/
+    rpmrepoJob link;		/*!< next job in pkglist order */
+/*@observer@*/ /*@null@*/
+    const char * path;		/*!< package path (NULL stops a worker) */
+    unsigned instance;		/*!< header instance */
+    int rc;			/*!< 0 on success */
+    int stated;			/*!< 1 if sb is valid */
+    struct stat sb;		/*!< package stat(2) info (for --update) */
+/*@only@*/ /*@null@*/
+    const char * frags[6];	/*!< primary/filelists/other xml, then sql */
+/*@null@*/
+    yarnLock finished;		/*!< 1 when the job has been run */
+};
+
+/**
+ * Shared state of repoWriteMetadataDocs() worker threads.
+ */
+typedef struct rpmrepoPar_s * rpmrepoPar;
+struct rpmrepoPar_s {
+/*@dependent@*/
+    rpmrepo repo;		/*!< repository */
+/*@null@*/
+    rpmrepoCache cache;		/*!< --update cache */
+    yarnLock have;		/*!< no. of queued jobs, lock for queue */
+/*@null@*/
+    rpmrepoJob head;		/*!< queued jobs */
+/*@dependent@*/
+    rpmrepoJob * tail;		/*!< end of job queue */
+    yarnLock tslock;		/*!< serializes rpmReadPackageFile() */
+};
+
+/**
+ * A repoWriteMetadataDocs() worker thread.
+ */
+typedef struct rpmrepoWorker_s * rpmrepoWorker;
+struct rpmrepoWorker_s {
+/*@dependent@*/
+    rpmrepoPar par;		/*!< shared state */
+/*@only@*/ /*@null@*/
+    hdrfmt_t xml_hdrfmt[3];	/*!< compiled xml_qfmt (per-thread) */
 #if defined(WITH_SQLITE)
-    if (REPO_ISSET(DATABASE)) {
-	if (rpmrfileSQLWrite(rfile, rfileHeaderSprintfHack(h, rfile->sql_qfmt)))
-	    rc = 1;
+/*@only@*/ /*@null@*/
+    hdrfmt_t sql_hdrfmt[3];	/*!< compiled sql_qfmt (per-thread) */
+#endif
+};
+
+/**
+ * Free a worker's compiled query formats.
+ * @param w		worker thread
+ */
+static void rpmrepoWorkerFini(rpmrepoWorker w)
+	/*@modifies w @*/
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	w->xml_hdrfmt[i] = headerFormatFree(w->xml_hdrfmt[i]);
+#if defined(WITH_SQLITE)
+	w->sql_hdrfmt[i] = headerFormatFree(w->sql_hdrfmt[i]);
+#endif
+    }
+}
+
+/**
+ * Read, digest and format a package, saving the metadata fragments.
+ * With --update, an unchanged package's fragments are copied from the
+ * previous run's cache instead.
+ * @param w		worker thread
+ * @param job		job
+ */
+static void rpmrepoPkgRun(rpmrepoWorker w, rpmrepoJob job)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies w, job, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrepoPar par = w->par;
+    rpmrepo repo = par->repo;
+    Header h;
+    int i;
+
+    if (par->cache != NULL && Stat(job->path, &job->sb) == 0) {
+	const struct rpmrepoCacheEntry_s * e =
+		rpmrepoCacheLookup(par->cache, job->path, &job->sb);
+	job->stated = 1;
+	if (e != NULL) {
+	    for (i = 0; i < 6; i++) {
+		const char * s = rpmrepoCacheString(par->cache, e->frags[i]);
+		if (s != NULL)
+		    job->frags[i] = xstrdup(s);
+	    }
+	    return;
+	}
+    }
+
+    h = rpmrepoReadHeader(repo, job->path, job->instance, par->tslock);
+    if (h == NULL) {
+	job->rc = 1;
+	return;
+    }
+
+    for (i = 0; i < 3; i++) {
+	rpmrfile rfile = rpmrepoPkgRfile(repo, i);
+	if (rfile->xml_qfmt != NULL)
+	    job->frags[i] = xstrdup(rfileHeaderSprintf(h, rfile->xml_qfmt,
+			&w->xml_hdrfmt[i]));
+#if defined(WITH_SQLITE)
+	if (REPO_ISSET(DATABASE))
+	    job->frags[3+i] = xstrdup(rfileHeaderSprintf(h, rfile->sql_qfmt,
+			&w->sql_hdrfmt[i]));
+#endif
+    }
+    (void) headerFree(h);
+    h = NULL;
+}
+
+/**
+ * Append a package's metadata fragments (unless an earlier package failed),
+ * add them to the --update cache, and free the job.
+ * @param par		shared state
+ * @param job		job
+ * @param rc		0 if all earlier packages succeeded
+ * @return		0 on success
+ */
+static int rpmrepoPkgWrite(rpmrepoPar par, /*@only@*/ rpmrepoJob job, int rc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies par, job, fileSystem, internalState @*/
+{
+    rpmrepo repo = par->repo;
+    int i;
+
+    /* XXX repoReadHeader() displays error. Continuing is foolish */
+    if (rc == 0) {
+	repo->current++;
+	if ((rc = job->rc) == 0)
+	for (i = 0; i < 3; i++) {
+	    rpmrfile rfile = rpmrepoPkgRfile(repo, i);
+	    if (job->frags[i] != NULL) {
+		if (rpmrfileWrite(rfile, job->frags[i]))
+		    rc = 1;
+	    }
+#if defined(WITH_SQLITE)
+	    if (job->frags[3+i] != NULL) {
+		if (rpmrfileSQLWrite(rfile, rfileSQLInstance(
+			xstrdup(job->frags[3+i]), job->instance)))
+		    rc = 1;
+	    }
+#endif
+	}
+	if (rc == 0) {
+	    if (par->cache != NULL && job->stated)
+		rpmrepoCacheAdd(par->cache, job->path, &job->sb, job->frags);
+	    rpmrepoPkgProgress(repo, job->path);
+	}
+    }
+
+    for (i = 0; i < 6; i++)
+	job->frags[i] = _free(job->frags[i]);
+    job = _free(job);
+    return rc;
+}
+
+/**
+ * Append a job to the worker thread queue.
+ * @param par		shared state
+ * @param job		job
+ */
+static void rpmrepoParPush(rpmrepoPar par, rpmrepoJob job)
+	/*@modifies par, job @*/
+{
+    job->next = NULL;
+    yarnPossess(par->have);
+    *par->tail = job;
+    par->tail = &job->next;
+    yarnTwist(par->have, BY, 1);
+}
+
+/**
+ * Run queued jobs until a stop job is found.
+ * @param _w		worker thread
+ */
+static void rpmrepoParWorker(void * _w)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies _w, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrepoWorker w = _w;
+    rpmrepoPar par = w->par;
+    rpmrepoJob job;
+
+    for (;;) {
+	yarnPossess(par->have);
+	yarnWaitFor(par->have, NOT_TO_BE, 0);
+	job = par->head;
+assert(job != NULL);
+	if ((par->head = job->next) == NULL)
+	    par->tail = &par->head;
+	yarnTwist(par->have, BY, -1);
+
+	if (job->path == NULL) {
+	    job = _free(job);
+	    break;
+	}
+	rpmrepoPkgRun(w, job);
+	yarnPossess(job->finished);
+	yarnTwist(job->finished, TO, 1);
     }
+}
+
+/**
+ * Wait for a job to be run, then write it.
+ * @param par		shared state
+ * @param job		job
+ * @param rc		0 if all earlier packages succeeded
+ * @return		0 on success
+ */
+static int rpmrepoParReap(rpmrepoPar par, /*@only@*/ rpmrepoJob job, int rc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies par, job, fileSystem, internalState @*/
+{
+    yarnPossess(job->finished);
+    yarnWaitFor(job->finished, TO_BE, 1);
+    yarnRelease(job->finished);
+    job->finished = yarnFreeLock(job->finished);
+
+    return rpmrepoPkgWrite(par, job, rc);
+}
+
+/**
+ * Export all package metadata to repository metadata file(s), reading
+ * and formatting packages on worker threads.
+ * The fragments are appended in pkglist order, so the output is the same
+ * as when run serially.
+ * @param par		shared state
+ * @param tp		worker thread pool
+ * @return		0 on success
+ */
+static int repoWriteMetadataDocsParallel(rpmrepoPar par, /*@only@*/ rpmtpool tp)
+	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies par, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrepo repo = par->repo;
+    rpmrepoWorker workers;
+    const char ** pkglist = repo->pkglist;
+    const char * pkg;
+    int nthreads = rpmtpoolThreads(tp);
+    rpmrepoJob head = NULL;
+    rpmrepoJob * tail = &head;
+    rpmrepoJob job;
+    int inflight = 0;
+    int window;
+    int rc = 0;
+    int i, j;
+    int xx;
+
+    /* XXX create the header pool before the workers race to. */
+    (void) headerFree(headerNew());
+
+    par->have = yarnNewLock(0);
+    par->head = NULL;
+    par->tail = &par->head;
+    par->tslock = yarnNewLock(0);
+
+    /* Compile per-thread query formats (hdrfmt_t is not reentrant). */
+    workers = xcalloc(nthreads, sizeof(*workers));
+    for (i = 0; i < nthreads; i++) {
+	rpmrepoWorker w = workers + i;
+	w->par = par;
+	for (j = 0; j < 3; j++) {
+	    rpmrfile rfile = rpmrepoPkgRfile(repo, j);
+	    const char * msg = NULL;
+	    if (rfile->xml_qfmt != NULL
+	     && (w->xml_hdrfmt[j] = headerCompileFormat(rfile->xml_qfmt,
+			NULL, NULL, &msg)) == NULL)
+		rpmrepoError(1, _("headerSprintf(%s): %s"), rfile->xml_qfmt, msg);
+#if defined(WITH_SQLITE)
+	    if (REPO_ISSET(DATABASE)
+	     && (w->sql_hdrfmt[j] = headerCompileFormat(rfile->sql_qfmt,
+			NULL, NULL, &msg)) == NULL)
+		rpmrepoError(1, _("headerSprintf(%s): %s"), rfile->sql_qfmt, msg);
 #endif
+	}
+	xx = rpmtpoolSubmit(tp, rpmrepoParWorker, w);
+    }
+
+    /* Queue packages to workers, appending fragments in pkglist order. */
+    window = 4 * nthreads;
+    if (pkglist)
+    while (rc == 0 && (pkg = *pkglist++) != NULL) {
+	job = xcalloc(1, sizeof(*job));
+	job->path = pkg;
+	job->instance = (unsigned)(pkglist - repo->pkglist);
+	job->finished = yarnNewLock(0);
+	*tail = job;
+	tail = &job->link;
+	rpmrepoParPush(par, job);
+
+	/* Bound the no. of packages in flight. */
+	if (++inflight >= window) {
+	    job = head;
+	    if ((head = job->link) == NULL)
+		tail = &head;
+	    rc = rpmrepoParReap(par, job, rc);
+	    inflight--;
+	}
+    }
+    while ((job = head) != NULL) {
+	head = job->link;
+	rc = rpmrepoParReap(par, job, rc);
+    }
+
+    /* Queue a stop job for each worker, then join them all. */
+    for (i = 0; i < nthreads; i++)
+	rpmrepoParPush(par, xcalloc(1, sizeof(*job)));
+    tp = rpmtpoolFree(tp);
+
+    for (i = 0; i < nthreads; i++)
+	rpmrepoWorkerFini(workers + i);
+    workers = _free(workers);
+
+    par->have = yarnFreeLock(par->have);
+    par->tslock = yarnFreeLock(par->tslock);
 
     return rc;
 }
@@ -1523,21 +2217,46 @@ static int repoWriteMetadataDocs(rpmrepo repo)
 	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
 	/*@modifies repo, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
+    struct rpmrepoPar_s _par;
+    rpmrepoPar par = &_par;
     const char ** pkglist = repo->pkglist;
     const char * pkg;
+    int nthreads = repo->nthreads;
     int rc = 0;
 
-    if (pkglist)
-    while ((pkg = *pkglist++) != NULL) {
-	Header h = rpmrepoReadHeader(repo, pkg);
-
-	repo->current++;
+    memset(par, 0, sizeof(*par));
+    par->repo = repo;
+    par->tail = &par->head;
+    if (REPO_ISSET(UPDATE))
+	par->cache = rpmrepoCacheNew(repo);
 
-	/* XXX repoReadHeader() displays error. Continuing is foolish */
-	if (h == NULL) {
-	    rc = 1;
-	    break;
+    if (nthreads <= 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (cpus > 0 ? (int) cpus : 1);
+    }
+    /* XXX i18n lookups through %{_i18ndomains} change $LANGUAGE. */
+    if (nthreads > 1) {
+	char * s = rpmExpand("%{?_i18ndomains}", NULL);
+	if (*s != '\0')
+	    nthreads = 1;
+	s = _free(s);
+    }
+    if (nthreads > 1) {
+	rpmtpool tp = rpmtpoolNew(nthreads);
+	if (rpmtpoolThreads(tp) > 1) {
+	    rc = repoWriteMetadataDocsParallel(par, tp);
+	    goto exit;
 	}
+	tp = rpmtpoolFree(tp);
+    }
+
+  { struct rpmrepoWorker_s _w;
+    rpmrepoWorker w = memset(&_w, 0, sizeof(_w));
+
+    w->par = par;
+    if (pkglist)
+    while (rc == 0 && (pkg = *pkglist++) != NULL) {
+	rpmrepoJob job = xcalloc(1, sizeof(*job));
 
 #ifdef	REFERENCE
 	/* XXX todo: rpmGetPath(mydir, "/", filematrix[mydir], NULL); */
@@ -1547,22 +2266,17 @@ static int repoWriteMetadataDocs(rpmrepo repo)
 	self.otherfile.write(po.do_other_xml_dump())
 #endif
 
-	if (rpmrepoWriteMDFile(repo, &repo->primary, h)
-	 || rpmrepoWriteMDFile(repo, &repo->filelists, h)
-	 || rpmrepoWriteMDFile(repo, &repo->other, h))
-	    rc = 1;
-
-	(void) headerFree(h);
-	h = NULL;
-	if (rc) break;
-
-	if (!repo->quiet) {
-	    if (repo->verbose)
-		rpmrepoError(0, "%d/%d - %s", repo->current, repo->pkgcount, pkg);
-	    else
-		rpmrepoProgress(repo, pkg, repo->current, repo->pkgcount);
-	}
+	job->path = pkg;
+	job->instance = (unsigned)(pkglist - repo->pkglist);
+	rpmrepoPkgRun(w, job);
+	rc = rpmrepoPkgWrite(par, job, rc);
     }
+    rpmrepoWorkerFini(w);
+  }
+
+exit:
+    if (par->cache != NULL)
+	par->cache = rpmrepoCacheFree(par->cache, rc);
     return rc;
 }
 
@@ -1698,6 +2412,10 @@ static struct poptOption _rpmrepoOptions[] = {
 	N_("ignore symlinks of packages"), NULL },
  { "unique-md-filenames", '\0', POPT_BIT_SET|POPT_ARGFLAG_DOC_HIDDEN, &__repo.flags, REPO_FLAGS_UNIQUEMDFN,
 	N_("include the file's checksum in the filename, helps with proxies"), NULL },
+ { "update", '\0', POPT_BIT_SET,		&__repo.flags, REPO_FLAGS_UPDATE,
+	N_("reuse the metadata of unchanged packages from the previous run"), NULL },
+ { "workers", '\0', POPT_ARG_INT,		&__repo.nthreads, 0,
+	N_("read and format packages with N threads (0 uses no. of cpus)"), N_("N") },
 
   POPT_TABLEEND
 
@@ -1730,8 +2448,7 @@ static struct poptOption rpmrepoOptionsTable[] = {
 static int rpmrepoInitPopt(rpmrepo repo, char ** av)
 	/*@modifies repo @*/
 {
-    void *use =  repo->_item.use;
-    void *pool = repo->_item.pool;
+    struct rpmioItem_s item = repo->_item;
     int ac = argvCount((ARGV_t)av);
     poptContext con = rpmioInit(ac, av, rpmrepoOptionsTable);
     int rc = 0;		/* XXX assume success */
@@ -1739,8 +2456,7 @@ static int rpmrepoInitPopt(rpmrepo repo, char ** av)
     int i;
 
     *repo = *_repo;	/* structure assignment */
-    repo->_item.use = use;
-    repo->_item.pool = pool;
+    repo->_item = item;		/* structure assignment */
 
     repo->con = con;
 
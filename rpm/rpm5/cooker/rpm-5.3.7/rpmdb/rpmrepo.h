@@ -89,8 +89,9 @@ typedef enum rpmrepoFlags_e {
     REPO_FLAGS_SPLIT		= _RFB( 4), /*!<    --split ... */
     REPO_FLAGS_NOFOLLOW		= _RFB( 5), /*!< -S,--skip-symlinks ... */
     REPO_FLAGS_UNIQUEMDFN	= _RFB( 6), /*!<    --unique-md-filenames ... */
+    REPO_FLAGS_UPDATE		= _RFB( 7), /*!<    --update ... */
 
-	/* 7-31 unused */
+	/* 8-31 unused */
 } rpmrepoFlags;
 
 #define REPO_ISSET(_FLAG) ((repo->flags & ((REPO_FLAGS_##_FLAG) & ~0x40000000)) != REPO_FLAGS_NONE)
@@ -151,6 +152,7 @@ struct rpmrepo_s {
     uint32_t pkgalgo;
     uint32_t algo;
     int compression;
+    int nthreads;		/*!< no. of package worker threads */
 /*@observer@*/
     const char * markup;
 /*@observer@*/ /*@null@*/
@@ -132,6 +132,10 @@ typedef /*@abstract@*/ struct headerTagIndices_s * headerTagIndices;
  */
 typedef /*@abstract@*/ const struct headerSprintfExtension_s * headerSprintfExtension;
 
+/** \ingroup header
+ */
+typedef /*@abstract@*/ struct hdrfmt_s * hdrfmt_t;
+
 /**
  * Pseudo-tags used by the rpmdb and rpmgi iterator API's.
  */
@@ -756,9 +760,64 @@ char * headerSprintf(Header h, const char * fmt,
 	/*@globals headerCompoundFormats, fileSystem, internalState @*/
 	/*@modifies h, *errmsg, fileSystem, internalState @*/;
 
+/** \ingroup header
+ * Compile a query format, for use with headerFormatRun().
+ * Tag names and extensions are resolved once, when the format is compiled,
+ * rather than for each header formatted.
+ *
+ * @param fmt		format to use
+ * @param tags		array of tag name/value/type triples (NULL uses default)
+ * @param exts		formatting extensions chained table (NULL uses default)
+ * @retval errmsg	error message (if any)
+ * @return		compiled format (NULL on error)
+ */
+/*@only@*/ /*@null@*/
+hdrfmt_t headerCompileFormat(const char * fmt,
+		/*@null@*/ headerTagTableEntry tags,
+		/*@null@*/ headerSprintfExtension exts,
+		/*@null@*/ /*@out@*/ errmsg_t * errmsg)
+	/*@globals headerCompoundFormats @*/
+	/*@modifies *errmsg @*/;
+
+/** \ingroup header
+ * Return formatted output string from header tags, using a compiled format.
+ * The returned string is owned by the compiled format, and is overwritten
+ * by the next call. A compiled format may be used by one thread at a time.
+ *
+ * @param h		header
+ * @param hfmt		compiled format
+ * @retval errmsg	error message (if any)
+ * @return		formatted output string (NULL on error)
+ */
+/*@observer@*/ /*@null@*/
+const char * headerFormatRun(Header h, hdrfmt_t hfmt,
+		/*@null@*/ /*@out@*/ errmsg_t * errmsg)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies h, hfmt, *errmsg, fileSystem, internalState @*/;
+
+/** \ingroup header
+ * Destroy a compiled format.
+ * @param hfmt		compiled format
+ * @return		NULL always
+ */
+/*@null@*/
+hdrfmt_t headerFormatFree(/*@only@*/ /*@null@*/ hdrfmt_t hfmt)
+	/*@modifies hfmt @*/;
+
 /** \ingroup header
  * Retrieve extension or tag value from a header.
  *
+ * With HEADERGET_NOCOPY, tag data within the immutable region of a header
+ * that owns its blob is borrowed rather than copied. Data that needs no
+ * byte swapping is returned as a pointer into the header blob, with
+ * he->freeData == 0. String arrays are returned as a malloc'd argv
+ * (he->freeData == 1) whose strings point into the header blob. Data
+ * outside the region, or in a header loaded from usermem, is copied.
+ *
+ * Either way, the returned strings/data are only valid while the caller
+ * holds a reference to the header: modifying a region tag replaces,
+ * rather than overwrites, the data.
+ *
  * @param h		header
  * @param he		tag container
  * @param flags		tag retrieval flags
@@ -769,6 +828,7 @@ int headerGet(Header h, HE_t he, unsigned int flags)
 	/*@modifies he, internalState @*/;
 #define	HEADERGET_NOEXTENSION	(1 << 0) /*!< Extension search disabler. */
 #define	HEADERGET_NOI18NSTRING	(1 << 1) /*!< Return i18n strings as argv. */
+#define	HEADERGET_NOCOPY	(1 << 2) /*!< Borrow (if possible) tag data. */
 
 /** \ingroup header
  * Add or append tag container to header.
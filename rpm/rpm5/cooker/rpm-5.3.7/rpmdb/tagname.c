@@ -179,6 +179,69 @@ static struct headerTagIndices_s _rpmTags = {
 headerTagIndices rpmTags = &_rpmTags;
 /*@=compmempass@*/
 
+#if defined(WITH_PTHREADS) && defined(HAVE_PTHREAD_H) && !defined(__LCLINT__)
+/*@unchecked@*/
+static pthread_mutex_t _rpmTagsLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/**
+ * Per-thread tagName() return buffer (headers are formatted on threads).
+ */
+#if defined(WITH_PTHREADS) && defined(__GNUC__) && defined(__ELF__) && !defined(__LCLINT__)
+#define	TAGNAME_NAMEBUF	256
+/*@unchecked@*/
+static __thread char _tagNameBuf[TAGNAME_NAMEBUF];
+#endif
+
+/**
+ * Tag indices are published (and tested) atomically, after being sorted.
+ */
+#if defined(__ATOMIC_ACQUIRE)
+#define	TAGS_LOADED(_ip)	(__atomic_load_n(&(_ip), __ATOMIC_ACQUIRE) != NULL)
+#define	TAGS_PUBLISH(_ip, _v)	__atomic_store_n(&(_ip), (_v), __ATOMIC_RELEASE)
+#else
+#define	TAGS_LOADED(_ip)	((_ip) != NULL)
+#define	TAGS_PUBLISH(_ip, _v)	((_ip) = (_v))
+#endif
+
+/**
+ * Load the arbitrary tags and tag indices (if not already loaded).
+ * The tables are loaded under a lock so that lookups can run on threads.
+ * @param byName	also load the by-name index?
+ */
+static void tagLoadTables(int byName)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    headerTagTableEntry * ip;
+    size_t n;
+    int xx;
+
+    /* XXX aTags is loaded before byValue is published. */
+    if (TAGS_LOADED(_rpmTags.byValue)
+     && (!byName || TAGS_LOADED(_rpmTags.byName)))
+	return;
+
+#if defined(WITH_PTHREADS) && defined(HAVE_PTHREAD_H) && !defined(__LCLINT__)
+    (void) pthread_mutex_lock(&_rpmTagsLock);
+#endif
+    if (_rpmTags.aTags == NULL)
+	xx = tagLoadATags(&_rpmTags.aTags, NULL);
+    if (_rpmTags.byValue == NULL) {
+	xx = tagLoadIndex(&ip, &n, tagCmpValue);
+	_rpmTags.byValueSize = n;
+	TAGS_PUBLISH(_rpmTags.byValue, ip);
+    }
+    if (byName && _rpmTags.byName == NULL) {
+	xx = tagLoadIndex(&ip, &n, tagCmpName);
+	_rpmTags.byNameSize = n;
+	TAGS_PUBLISH(_rpmTags.byName, ip);
+    }
+#if defined(WITH_PTHREADS) && defined(HAVE_PTHREAD_H) && !defined(__LCLINT__)
+    (void) pthread_mutex_unlock(&_rpmTagsLock);
+#endif
+}
+
 /*@-mods@*/
 static const char * _tagName(rpmTag tag)
 {
@@ -190,18 +253,19 @@ static const char * _tagName(rpmTag tag)
     int xx;
     char *s;
 
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byValue == NULL)
-	xx = tagLoadIndex(&_rpmTags.byValue, &_rpmTags.byValueSize,
-		tagCmpValue);
+    tagLoadTables(0);
+#if defined(TAGNAME_NAMEBUF)
+    nameBuf = _tagNameBuf;
+    nameBufLen = sizeof(_tagNameBuf);
+#else
     if (_rpmTags.nameBufLen == 0)
 	_rpmTags.nameBufLen = 256;
     if (_rpmTags.nameBuf == NULL)
 	_rpmTags.nameBuf = xcalloc(1, _rpmTags.nameBufLen);
     nameBuf = _rpmTags.nameBuf;
-    nameBuf[0] = nameBuf[1] = '\0';
     nameBufLen = _rpmTags.nameBufLen;
+#endif
+    nameBuf[0] = nameBuf[1] = '\0';
 
     switch (tag) {
     case RPMDBI_PACKAGES:
@@ -279,7 +343,7 @@ static const char * _tagName(rpmTag tag)
 		    t = _rpmTags.byValue[i];
 		}
 		s = (*_rpmTags.tagCanonicalize) (t->name);
-		strncpy(nameBuf, s, nameBufLen);
+		xx = snprintf(nameBuf, nameBufLen, "%s", s);
 		s = _free(s);
 		/*@loopbreak@*/ break;
 	    }
@@ -289,7 +353,7 @@ static const char * _tagName(rpmTag tag)
     if (nameBuf[0] == '\0')
 	xx = snprintf(nameBuf, nameBufLen, "Tag_0x%08x", (unsigned) tag);
     nameBuf[nameBufLen-1] = '\0';
-/*@-globstate@*/	/* _rpmTags.nameBuf reachable. */
+/*@-globstate@*/	/* _rpmTags.nameBuf (or _tagNameBuf) reachable. */
     return nameBuf;
 /*@=globstate@*/
 }
@@ -300,12 +364,8 @@ static unsigned int _tagType(rpmTag tag)
     headerTagTableEntry t;
     size_t i, l, u;
     int comparison;
-    int xx;
 
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byValue == NULL)
-	xx = tagLoadIndex(&_rpmTags.byValue, &_rpmTags.byValueSize, tagCmpValue);
+    tagLoadTables(0);
 
     switch (tag) {
     case RPMDBI_PACKAGES:
@@ -358,7 +418,6 @@ static rpmTag _tagValue(const char * tagstr)
     size_t i, l, u;
     const char * s;
     rpmTag tag;
-    int xx;
 
     /* XXX headerSprintf looks up by "RPMTAG_FOO", not "FOO". */
     if (!strncasecmp(tagstr, "RPMTAG_", sizeof("RPMTAG_")-1))
@@ -391,10 +450,7 @@ static rpmTag _tagValue(const char * tagstr)
     if (!xstrcasecmp(tagstr, "Recno"))
 	return RPMDBI_RECNO;
 
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byName == NULL)
-	xx = tagLoadIndex(&_rpmTags.byName, &_rpmTags.byNameSize, tagCmpName);
+    tagLoadTables(1);
     if (_rpmTags.byName == NULL)
 	goto exit;
 
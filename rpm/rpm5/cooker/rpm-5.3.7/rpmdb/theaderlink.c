@@ -0,0 +1,121 @@
+/** \ingroup header
+ * \file rpmdb/theaderlink.c
+ * Time headerLink/headerFree refcount cycles, and headerNew/headerFree
+ * pool get/put cycles, against a mutex protected refcount.
+ */
+
+#include "system.h"
+
+#include <rpmio.h>
+#include <rpmsw.h>
+#include <poptIO.h>
+#include <yarn.h>
+
+#include <rpmtag.h>
+
+#include "debug.h"
+
+static int nloops = 1000000;
+static int nthreads = 1;
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each cycle N times (per thread)"), N_("N") },
+ { "threads", 'j', POPT_ARG_INT,	&nthreads, 0,
+	N_("run N threads concurrently"), N_("N") },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
+	N_("Common options for all rpmio executables:"),
+	NULL },
+
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+/*@unchecked@*/
+static Header sharedh;
+
+/*@unchecked@*/
+static yarnLock sharedlock;
+
+/**
+ * The refcount cycle as it was done before atomics: possess/twist the
+ * item usage mutex for every Link and Free.
+ */
+static void mutexCycle(/*@unused@*/ void * _arg)
+{
+    int i;
+    for (i = 0; i < nloops; i++) {
+	yarnPossess(sharedlock);
+	yarnTwist(sharedlock, BY, 1);
+	yarnPossess(sharedlock);
+	yarnTwist(sharedlock, BY, -1);
+    }
+}
+
+static void linkCycle(/*@unused@*/ void * _arg)
+{
+    int i;
+    for (i = 0; i < nloops; i++) {
+	Header h = headerLink(sharedh);
+	(void) headerFree(h);
+    }
+}
+
+static void poolCycle(/*@unused@*/ void * _arg)
+{
+    int i;
+    for (i = 0; i < nloops; i++) {
+	Header h = headerNew();
+	(void) headerFree(h);
+    }
+}
+
+static void runCycle(rpmop op, void (*cycle) (void *))
+{
+    int xx;
+    int i;
+
+    xx = rpmswEnter(op, 0);
+    if (nthreads <= 1)
+	(*cycle) (NULL);
+    else {
+	for (i = 0; i < nthreads; i++)
+	    (void) yarnLaunch(cycle, NULL);
+	xx = yarnJoinAll();
+    }
+    xx = rpmswExit(op, nloops * (nthreads > 1 ? nthreads : 1));
+}
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmioInit(argc, argv, optionsTable);
+    rpmop mutexop = memset(alloca(sizeof(*mutexop)), 0, sizeof(*mutexop));
+    rpmop linkop = memset(alloca(sizeof(*linkop)), 0, sizeof(*linkop));
+    rpmop poolop = memset(alloca(sizeof(*poolop)), 0, sizeof(*poolop));
+
+    sharedlock = yarnNewLock(1);
+    sharedh = headerNew();
+
+    runCycle(mutexop, mutexCycle);
+    runCycle(linkop, linkCycle);
+    runCycle(poolop, poolCycle);
+
+    if (yarnPeekLock(sharedlock) != 1L || ((rpmioItem)sharedh)->refs != 1L)
+	fprintf(stderr, "FAIL: refs mutex %ld atomic %ld\n",
+		yarnPeekLock(sharedlock), ((rpmioItem)sharedh)->refs);
+
+    sharedh = headerFree(sharedh);
+    sharedlock = yarnFreeLock(sharedlock);
+
+    fprintf(stderr, "===== %d loops, %d thread(s)\n", nloops, nthreads);
+    rpmswPrint("  mutex Link/Free:", mutexop, NULL);
+    rpmswPrint(" atomic Link/Free:", linkop, NULL);
+    rpmswPrint("   pool  New/Free:", poolop, NULL);
+
+    optCon = rpmioFini(optCon);
+
+    return 0;
+}
@@ -104,6 +104,8 @@
 
 #include "tiger.h"
 
+#include "mbdigest.h"
+
 #include "debug.h"
 
 /*@unchecked@*/
@@ -274,6 +276,17 @@ rpmDigestInit(pgpHashAlgo hashalgo, rpmDigestFlags flags)
     case PGPHASHALGO_SHA1:
 	ctx->name = "SHA1";
 	ctx->digestsize = 160/8;
+	ctx->asn1 = "3021300906052b0e03021a05000414";
+	if (mbdISA() & MBD_ISA_SHANI) {
+	    ctx->paramsize = sizeof(mbdParam);
+	    ctx->param = xcalloc(1, ctx->paramsize);
+/*@-type@*/
+	    ctx->Reset = (int (*)(void *)) mbdSHA1Reset;
+	    ctx->Update = (int (*)(void *, const byte *, size_t)) mbdUpdate;
+	    ctx->Digest = (int (*)(void *, byte *)) mbdDigest;
+/*@=type@*/
+	    break;
+	}
 /*@-sizeoftype@*/ /* FIX: union, not void pointer */
 	ctx->paramsize = sizeof(sha1Param);
 /*@=sizeoftype@*/
@@ -283,7 +296,6 @@ rpmDigestInit(pgpHashAlgo hashalgo, rpmDigestFlags flags)
 	ctx->Update = (int (*)(void *, const byte *, size_t)) sha1Update;
 	ctx->Digest = (int (*)(void *, byte *)) sha1Digest;
 /*@=type@*/
-	ctx->asn1 = "3021300906052b0e03021a05000414";
 	break;
     case PGPHASHALGO_RIPEMD128:
 	ctx->name = "RIPEMD128";
@@ -494,6 +506,17 @@ rpmDigestInit(pgpHashAlgo hashalgo, rpmDigestFlags flags)
     case PGPHASHALGO_SHA256:
 	ctx->name = "SHA256";
 	ctx->digestsize = 256/8;
+	ctx->asn1 = "3031300d060960864801650304020105000420";
+	if (mbdISA() & MBD_ISA_SHANI) {
+	    ctx->paramsize = sizeof(mbdParam);
+	    ctx->param = xcalloc(1, ctx->paramsize);
+/*@-type@*/
+	    ctx->Reset = (int (*)(void *)) mbdSHA256Reset;
+	    ctx->Update = (int (*)(void *, const byte *, size_t)) mbdUpdate;
+	    ctx->Digest = (int (*)(void *, byte *)) mbdDigest;
+/*@=type@*/
+	    break;
+	}
 /*@-sizeoftype@*/ /* FIX: union, not void pointer */
 	ctx->paramsize = sizeof(sha256Param);
 /*@=sizeoftype@*/
@@ -503,7 +526,6 @@ rpmDigestInit(pgpHashAlgo hashalgo, rpmDigestFlags flags)
 	ctx->Update = (int (*)(void *, const byte *, size_t)) sha256Update;
 	ctx->Digest = (int (*)(void *, byte *)) sha256Digest;
 /*@=type@*/
-	ctx->asn1 = "3031300d060960864801650304020105000420";
 	break;
     case PGPHASHALGO_SHA384:
 	ctx->name = "SHA384";
@@ -976,6 +998,31 @@ DPRINTF((stderr, "==> ctx %p ==== Final(%s,%p,%p,%d) param %p digest %p[%u]\n",
     return 0;
 }
 
+int
+rpmDigestBatch(pgpHashAlgo hashalgo, int n, const void ** bufs,
+		const size_t * lens, unsigned char ** digests)
+{
+    int i;
+
+    /* MD5, SHA1 and SHA256 hash several buffers at once. */
+    if (mbdBatch(hashalgo, n, bufs, lens, digests) == 0)
+	return 0;
+
+    for (i = 0; i < n; i++) {
+	DIGEST_CTX ctx = rpmDigestInit(hashalgo, RPMDIGEST_NONE);
+	byte * digest = NULL;
+	size_t digestlen = 0;
+
+	if (ctx == NULL)
+	    return -1;
+	(void) rpmDigestUpdate(ctx, bufs[i], lens[i]);
+	(void) rpmDigestFinal(ctx, &digest, &digestlen, 0);
+	memcpy(digests[i], digest, digestlen);
+	digest = _free(digest);
+    }
+    return 0;
+}
+
 int
 rpmHmacInit(DIGEST_CTX ctx, const void * key, size_t keylen)
 {
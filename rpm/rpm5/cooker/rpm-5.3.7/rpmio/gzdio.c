@@ -21,9 +21,15 @@ typedef	enum { true = 1, false = 0 } bool;
 #include <zlib.h>
 /*@=noparams@*/
 
+#include "rpmzlog.h"
+#define	_RPMZQ_INTERNAL
+#include "rpmzq.h"
+
 #include "debug.h"
 
 /*@access FD_t @*/
+/*@access rpmzJob @*/
+/*@access rpmzSpace @*/
 
 #define	GZDONLY(fd)	assert(fdGetIo(fd) == gzdio)
 
@@ -47,6 +53,12 @@ typedef struct rpmGZFILE_s {
     struct rsync_state_s rs;
     struct cpio_state_s cs;
     rpmuint32_t nb;			/* bytes pending for sync */
+    rpmzPipe zp;			/* block-parallel deflate (if threaded) */
+    int fdno;				/* (threaded) output file descriptor */
+    int level;				/* (threaded) compression level */
+    int strategy;			/* (threaded) compression strategy */
+    rpmuint32_t crc;			/* (threaded) crc32 of input */
+    rpmuint32_t isize;			/* (threaded) input size (mod 2^32) */
 } * rpmGZFILE;				/* like FILE, to use with star */
 
 /* Should gzflush be called only after RSYNC_WIN boundaries? */
@@ -221,6 +233,229 @@ rsyncable_gzwrite(rpmGZFILE rpmgz, const unsigned char *const buf, const size_t
     return n_written;
 }
 
+/* =============================================================== */
+/* Parallel gzip (as pigz does), with blocks compressed by rpmzq threads. */
+
+#define	GZ_BLOCKSIZE	(256 * 1024)	/* pipe block size */
+#define	GZ_RSYNC_MIN	(128 * 1024)	/* min. block size at a sync hint */
+#define	GZ_DICT		(32 * 1024)	/* deflate window size */
+
+/**
+ * Return no. of threads to compress with (%_compress_threads).
+ * @param fmode		open mode
+ * @return		no. of threads (0 uses no. of cpus)
+ */
+static unsigned int gzThreads(const char * fmode)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    int threads;
+
+    /* Only (truncating) writes are threaded. */
+    if (fmode == NULL || fmode[0] != 'w' || strchr(fmode, '+') != NULL)
+	return 1;
+    threads = rpmExpandNumeric(
+		"%{?_compress_threads}%{!?_compress_threads:1}");
+    return (threads < 0 ? 1 : (unsigned int) threads);
+}
+
+/**
+ * Deflate a block (on a worker thread), ending with a sync flush, or with
+ * the final (empty) block for the last block.
+ * @param _rpmgz	gzip file
+ * @param job		block to compress
+ * @param dict		previous input (NULL for the first block)
+ * @return		0 on success
+ */
+static int gzDeflateBlock(void * _rpmgz, rpmzJob job,
+		/*@null@*/ rpmzSpace dict)
+	/*@modifies job @*/
+{
+    rpmGZFILE rpmgz = _rpmgz;
+    z_stream strm;
+    size_t outlen;
+    int ret;
+
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, rpmgz->level, Z_DEFLATED, -15, 8,
+		rpmgz->strategy) != Z_OK)
+	return -1;
+    if (dict != NULL && dict->len > 0) {
+	size_t n = (dict->len > GZ_DICT ? GZ_DICT : dict->len);
+	(void) deflateSetDictionary(&strm, dict->buf + dict->len - n,
+			(uInt) n);
+    }
+
+    outlen = deflateBound(&strm, (uLong) job->in->len) + 64;
+    job->out = rpmzqNewSpace(NULL, outlen);
+    strm.next_in = job->in->buf;
+    strm.avail_in = (uInt) job->in->len;
+    strm.next_out = job->out->buf;
+    strm.avail_out = (uInt) outlen;
+    ret = deflate(&strm, (job->more ? Z_SYNC_FLUSH : Z_FINISH));
+    job->out->len = outlen - strm.avail_out;
+    job->check = crc32(crc32(0L, Z_NULL, 0), job->in->buf,
+			(uInt) job->in->len);
+    (void) deflateEnd(&strm);
+
+    if (strm.avail_in != 0)
+	return -1;
+    return (ret == (job->more ? Z_OK : Z_STREAM_END) ? 0 : -1);
+}
+
+/**
+ * Write all of a buffer.
+ * @param fdno		file descriptor
+ * @param b		buffer
+ * @param nb		no. of bytes
+ * @return		0 on success
+ */
+static int gzWriteAll(int fdno, const unsigned char * b, size_t nb)
+	/*@globals fileSystem @*/
+	/*@modifies fileSystem @*/
+{
+    while (nb > 0) {
+	ssize_t rc = write(fdno, b, nb);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return -1;
+	b += rc;
+	nb -= rc;
+    }
+    return 0;
+}
+
+/**
+ * Write a deflated block, accumulating crc32 and size (in order).
+ * @param _rpmgz	gzip file
+ * @param job		compressed block
+ * @return		0 on success
+ */
+static int gzWriteBlock(void * _rpmgz, rpmzJob job)
+	/*@globals fileSystem @*/
+	/*@modifies _rpmgz, fileSystem @*/
+{
+    rpmGZFILE rpmgz = _rpmgz;
+
+    if (gzWriteAll(rpmgz->fdno, job->out->buf, job->out->len))
+	return -1;
+    rpmgz->crc = crc32_combine(rpmgz->crc, job->check, (z_off_t) job->in->len);
+    rpmgz->isize += (rpmuint32_t) job->in->len;
+    return 0;
+}
+
+/**
+ * Start a (threaded) gzip stream.
+ * @param rpmgz		gzip file
+ * @param fdno		output file descriptor
+ * @param fmode		open mode (level and strategy as gzopen(3))
+ * @param threads	no. of threads (0 uses no. of cpus)
+ * @return		0 on success
+ */
+static int gzPipeOpen(rpmGZFILE rpmgz, int fdno, const char * fmode,
+		unsigned int threads)
+	/*@globals fileSystem @*/
+	/*@modifies rpmgz, fileSystem @*/
+{
+    unsigned char hdr[10];
+    const char * s;
+
+    rpmgz->level = Z_DEFAULT_COMPRESSION;
+    rpmgz->strategy = Z_DEFAULT_STRATEGY;
+    for (s = fmode; *s != '\0'; s++) {
+	if (*s >= '0' && *s <= '9')
+	    rpmgz->level = (int)(*s - '0');
+	else if (*s == 'f')
+	    rpmgz->strategy = Z_FILTERED;
+	else if (*s == 'h')
+	    rpmgz->strategy = Z_HUFFMAN_ONLY;
+	else if (*s == 'R')
+	    rpmgz->strategy = Z_RLE;
+    }
+
+    /* A gzip header w/o name or time (as gzopen(3) writes). */
+    hdr[0] = 0x1f;
+    hdr[1] = 0x8b;
+    hdr[2] = Z_DEFLATED;
+    hdr[3] = 0;
+    hdr[4] = hdr[5] = hdr[6] = hdr[7] = 0;
+    hdr[8] = (rpmgz->level == 9 ? 2 : (rpmgz->level == 1 ? 4 : 0));
+    hdr[9] = 3;				/* OS_CODE (unix) */
+    if (gzWriteAll(fdno, hdr, sizeof(hdr)))
+	return -1;
+
+    rpmgz->fdno = fdno;
+    rpmgz->crc = crc32(0L, Z_NULL, 0);
+    rpmgz->isize = 0;
+    rpmgz->zp = rpmzqNewPipe(threads, GZ_BLOCKSIZE, 1,
+		gzDeflateBlock, gzWriteBlock, rpmgz);
+    return 0;
+}
+
+/**
+ * Finish a (threaded) gzip stream, and close the file descriptor.
+ * @param rpmgz		gzip file
+ * @return		0 on success
+ */
+static int gzPipeClose(rpmGZFILE rpmgz)
+	/*@globals fileSystem @*/
+	/*@modifies rpmgz, fileSystem @*/
+{
+    unsigned char ftr[8];
+    int rc;
+    int i;
+
+    rc = rpmzqPipeFinish(rpmgz->zp);
+    rpmgz->zp = rpmzqFreePipe(rpmgz->zp);
+    if (rc == 0) {
+	for (i = 0; i < 4; i++) {
+	    ftr[i] = (unsigned char)(rpmgz->crc >> (8 * i));
+	    ftr[4 + i] = (unsigned char)(rpmgz->isize >> (8 * i));
+	}
+	rc = gzWriteAll(rpmgz->fdno, ftr, sizeof(ftr));
+    }
+    if (close(rpmgz->fdno) < 0 && rc == 0)
+	rc = Z_ERRNO;
+    rpmgz->fdno = -1;
+    return (rc ? Z_ERRNO : Z_OK);
+}
+
+/**
+ * Write to a threaded gzip stream, ending blocks at rsync(1) friendly
+ * boundaries (once a block is big enough to be worth a thread).
+ * @param rpmgz		gzip file
+ * @param buf		data
+ * @param len		no. of bytes
+ * @return		no. of bytes written, -1 on error
+ */
+static ssize_t
+rsyncable_zpwrite(rpmGZFILE rpmgz, const unsigned char *const buf, const size_t len)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies rpmgz, fileSystem, internalState @*/
+{
+    const unsigned char *begin = buf;
+    size_t n;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	if (!sync_hint(rpmgz, buf[i]))
+	    continue;
+	n = i + 1 - (begin - buf);
+	if (rpmzqPipeWrite(rpmgz->zp, begin, n) < 0)
+	    return -1;
+	begin += n;
+	if (rpmzqPipeCut(rpmgz->zp, GZ_RSYNC_MIN))
+	    return -1;
+    }
+    if (begin < buf + len) {
+	n = len - (begin - buf);
+	if (rpmzqPipeWrite(rpmgz->zp, begin, n) < 0)
+	    return -1;
+    }
+    return len;
+}
+
 /* =============================================================== */
 /*@-moduncon@*/
 
@@ -250,10 +485,20 @@ FD_t gzdOpen(const char * path, const char * fmode)
     FD_t fd;
     rpmGZFILE rpmgz;
     mode_t mode = (fmode && fmode[0] == 'w' ? O_WRONLY : O_RDONLY);
+    unsigned int threads;
 
     rpmgz = xcalloc(1, sizeof(*rpmgz));
-    rpmgz->gz = gzopen(path, fmode);
-    if (rpmgz->gz == NULL) {
+    rpmgz->fdno = -1;
+    if ((threads = gzThreads(fmode)) != 1) {
+	int fdno = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fdno < 0 || gzPipeOpen(rpmgz, fdno, fmode, threads)) {
+	    if (fdno >= 0)
+		(void) close(fdno);
+	    rpmgz = _free(rpmgz);
+	    return NULL;
+	}
+    } else
+    if ((rpmgz->gz = gzopen(path, fmode)) == NULL) {
 	rpmgz = _free(rpmgz);
 	return NULL;
     }
@@ -272,14 +517,21 @@ static /*@null@*/ FD_t gzdFdopen(void * cookie, const char *fmode)
     FD_t fd = c2f(cookie);
     int fdno;
     rpmGZFILE rpmgz;
+    unsigned int threads;
 
     if (fmode == NULL) return NULL;
     fdno = fdFileno(fd);
     fdSetFdno(fd, -1);		/* XXX skip the fdio close */
     if (fdno < 0) return NULL;
     rpmgz = xcalloc(1, sizeof(*rpmgz));
-    rpmgz->gz = gzdopen(fdno, fmode);
-    if (rpmgz->gz == NULL) {
+    rpmgz->fdno = -1;
+    if ((threads = gzThreads(fmode)) != 1) {
+	if (gzPipeOpen(rpmgz, fdno, fmode, threads)) {
+	    rpmgz = _free(rpmgz);
+	    return NULL;
+	}
+    } else
+    if ((rpmgz->gz = gzdopen(fdno, fmode)) == NULL) {
 	rpmgz = _free(rpmgz);
 	return NULL;
     }
@@ -296,6 +548,8 @@ static int gzdFlush(void * cookie)
     rpmGZFILE rpmgz;
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;
+    if (rpmgz->zp != NULL)
+	return rpmzqPipeCut(rpmgz->zp, 1);
     return gzflush(rpmgz->gz, Z_SYNC_FLUSH);	/* XXX W2DO? */
 }
 
@@ -313,6 +567,7 @@ static ssize_t gzdRead(void * cookie, /*@out@*/ char * buf, size_t count)
 
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
+    if (rpmgz->gz == NULL) return -2;	/* XXX threaded writes only */
 
     fdstat_enter(fd, FDSTAT_READ);
     rc = gzread(rpmgz->gz, buf, (unsigned)count);
@@ -348,12 +603,19 @@ static ssize_t gzdWrite(void * cookie, const char * buf, size_t count)
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
 
     fdstat_enter(fd, FDSTAT_WRITE);
-    if (enable_rsync)
+    if (rpmgz->zp != NULL) {
+	if (enable_rsync)
+	    rc = rsyncable_zpwrite(rpmgz, (void *)buf, count);
+	else
+	    rc = rpmzqPipeWrite(rpmgz->zp, buf, count);
+	if (rc < 0)
+	    fd->errcookie = "gzip: compression error";
+    } else if (enable_rsync)
 	rc = rsyncable_gzwrite(rpmgz, (void *)buf, (unsigned)count);
     else
 	rc = gzwrite(rpmgz->gz, (void *)buf, (unsigned)count);
 DBGIO(fd, (stderr, "==>\tgzdWrite(%p,%p,%u) rc %lx %s\n", cookie, buf, (unsigned)count, (unsigned long)rc, fdbg(fd)));
-    if (rc < (ssize_t)count) {
+    if (rpmgz->gz != NULL && rc < (ssize_t)count) {
 	int zerror = 0;
 	fd->errcookie = gzerror(rpmgz->gz, &zerror);
 	if (zerror == Z_ERRNO) {
@@ -387,6 +649,7 @@ static int gzdSeek(void * cookie, _libio_pos_t pos, int whence)
 
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
+    if (rpmgz->gz == NULL) return -2;	/* XXX threaded writes can't seek */
 
     fdstat_enter(fd, FDSTAT_SEEK);
     rc = gzseek(rpmgz->gz, (long)p, whence);
@@ -420,7 +683,7 @@ static int gzdClose( /*@only@*/ void * cookie)
 
     fdstat_enter(fd, FDSTAT_CLOSE);
     /*@-dependenttrans@*/
-    rc = gzclose(rpmgz->gz);
+    rc = (rpmgz->zp != NULL ? gzPipeClose(rpmgz) : gzclose(rpmgz->gz));
     /*@=dependenttrans@*/
     rpmgz->gz = NULL;
 /*@-dependenttrans@*/
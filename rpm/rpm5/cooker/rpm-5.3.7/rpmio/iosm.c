@@ -10,6 +10,7 @@
 #include <ugid.h>		/* XXX unameToUid() and gnameToGid() */
 
 #include <rpmsq.h>		/* XXX rpmsqJoin()/rpmsqThread() */
+#include <yarn.h>
 #include <rpmsw.h>		/* XXX rpmswAdd() */
 #include <rpmsx.h>
 
@@ -72,6 +73,9 @@ int _iosm_debug = _IOSM_DEBUG;
 int _iosm_threads = 0;
 /*@=exportheadervar@*/
 
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmtpool _iosmTPool;
+
 /*@-redecl@*/
 int (*_iosmNext) (IOSM_t iosm, iosmFileStage nstage)
         /*@modifies iosm @*/ = &iosmNext;
@@ -438,7 +442,6 @@ const char * dnlNextIterator(/*@null@*/ DNLI_t dnli)
     return dn;
 }
 
-#if defined(WITH_PTHREADS)
 static void * iosmThread(void * arg)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies arg, fileSystem, internalState @*/
@@ -448,20 +451,175 @@ static void * iosmThread(void * arg)
     return ((void *) ((long)iosmStage(iosm, iosm->nstage)));
 /*@=unqualifiedtrans@*/
 }
-#endif
 
 int iosmNext(IOSM_t iosm, iosmFileStage nstage)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies iosm, fileSystem, internalState @*/
 {
     iosm->nstage = nstage;
-#if defined(WITH_PTHREADS)
-    if (iosm->multithreaded)
-	return rpmsqJoin( rpmsqThread(iosmThread, iosm) );
-#endif
+    if (iosm->multithreaded && iosm->tpool != NULL)
+	return (int)(long) rpmtpoolCall(iosm->tpool, iosmThread, iosm);
     return iosmStage(iosm, iosm->nstage);
 }
 
+/*==============================================================*/
+
+#define	IOSM_RA_NBUFS	4		/*!< no. of read-ahead buffers */
+#define	IOSM_RA_BUFSIZE	(128 * 1024)	/*!< size of read-ahead buffers */
+
+/**
+ * Payload read-ahead buffer.
+ */
+struct iosmRABuf_s {
+    char * b;			/*!< buffer */
+    ssize_t nb;			/*!< no. of bytes (0 on EOF, -1 on error) */
+};
+
+/**
+ * Payload read-ahead, a ring of buffers filled by a worker thread.
+ */
+struct iosmReadAhead_s {
+    yarnLock have;		/*!< no. of filled buffers */
+    yarnLock done;		/*!< 1 when the reader has exited */
+/*@dependent@*/
+    FD_t cfd;			/*!< payload */
+    int stop;			/*!< should the reader exit? */
+    unsigned int head;		/*!< next buffer to consume */
+    size_t off;			/*!< offset into next buffer */
+    struct iosmRABuf_s bufs[IOSM_RA_NBUFS];
+};
+
+/**
+ * Read payload into buffers until EOF, error, or told to stop.
+ * @param _ra		payload read-ahead
+ */
+static void iosmReadAheadThread(void * _ra)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _ra, fileSystem, internalState @*/
+{
+    struct iosmReadAhead_s * ra = _ra;
+    unsigned int tail = 0;
+    int stop;
+
+    do {
+	struct iosmRABuf_s * rab = ra->bufs + tail;
+
+	yarnPossess(ra->have);
+	yarnWaitFor(ra->have, TO_BE_LESS_THAN, IOSM_RA_NBUFS);
+	stop = ra->stop;
+	yarnRelease(ra->have);
+	if (stop)
+	    break;
+
+	/* The buffer is not visible to the consumer until it is counted. */
+	rab->nb = Fread(rab->b, sizeof(*rab->b), IOSM_RA_BUFSIZE, ra->cfd);
+	if (Ferror(ra->cfd))
+	    rab->nb = -1;
+	if (rab->nb <= 0)	/* XXX EOF and error buffers are never consumed */
+	    stop = 1;
+	tail = (tail + 1) % IOSM_RA_NBUFS;
+
+	yarnPossess(ra->have);
+	yarnTwist(ra->have, BY, 1);
+    } while (!stop);
+
+    yarnPossess(ra->done);
+    yarnTwist(ra->done, TO, 1);
+}
+
+/**
+ * Copy read-ahead payload into a buffer.
+ * @param ra		payload read-ahead
+ * @param b		buffer
+ * @param blen		no. of bytes to read
+ * @retval *errp	1 on payload read error
+ * @return		no. of bytes read
+ */
+static size_t iosmReadAheadRead(struct iosmReadAhead_s * ra, char * b,
+		size_t blen, int * errp)
+	/*@modifies ra, *b, *errp @*/
+{
+    size_t nb = 0;
+
+    *errp = 0;
+    while (nb < blen) {
+	struct iosmRABuf_s * rab = ra->bufs + ra->head;
+	size_t n;
+
+	yarnPossess(ra->have);
+	yarnWaitFor(ra->have, TO_BE_MORE_THAN, 0);
+	yarnRelease(ra->have);
+
+	if (rab->nb <= 0) {
+	    *errp = (rab->nb < 0);
+	    break;
+	}
+
+	n = (size_t)rab->nb - ra->off;
+	if (n > blen - nb)
+	    n = blen - nb;
+	memcpy(b + nb, rab->b + ra->off, n);
+	nb += n;
+	ra->off += n;
+
+	if (ra->off == (size_t)rab->nb) {
+	    ra->off = 0;
+	    ra->head = (ra->head + 1) % IOSM_RA_NBUFS;
+	    yarnPossess(ra->have);
+	    yarnTwist(ra->have, BY, -1);
+	}
+    }
+    return nb;
+}
+
+int iosmReadAheadStart(IOSM_t iosm, rpmtpool tp)
+{
+    struct iosmReadAhead_s * ra;
+    int i;
+
+    if (iosm->ra != NULL)
+	return 0;
+    if (iosm->cfd == NULL || rpmtpoolThreads(tp) < 2)
+	return 1;
+
+    ra = xcalloc(1, sizeof(*ra));
+    ra->have = yarnNewLock(0);
+    ra->done = yarnNewLock(0);
+    ra->cfd = iosm->cfd;
+    for (i = 0; i < IOSM_RA_NBUFS; i++)
+	ra->bufs[i].b = xmalloc(IOSM_RA_BUFSIZE);
+    iosm->ra = ra;
+    return rpmtpoolSubmit(tp, iosmReadAheadThread, ra);
+}
+
+void iosmReadAheadStop(IOSM_t iosm)
+{
+    struct iosmReadAhead_s * ra = iosm->ra;
+    int i;
+
+    if (ra == NULL)
+	return;
+
+    /* Discard unread buffers and wait for the reader to exit. */
+    yarnPossess(ra->have);
+    ra->stop = 1;
+    yarnTwist(ra->have, TO, 0);
+    yarnPossess(ra->done);
+    yarnWaitFor(ra->done, TO_BE, 1);
+    yarnRelease(ra->done);
+
+    for (i = 0; i < IOSM_RA_NBUFS; i++)
+	ra->bufs[i].b = _free(ra->bufs[i].b);
+    ra->have = yarnFreeLock(ra->have);
+    ra->done = yarnFreeLock(ra->done);
+    iosm->ra = _free(ra);
+}
+
+void iosmFreeThreadPools(void)
+{
+    _iosmTPool = rpmtpoolFree(_iosmTPool);
+}
+
 /** \ingroup payload
  * Save hard link in chain.
  * @param iosm		file state machine data
@@ -679,6 +837,11 @@ int iosmSetup(IOSM_t iosm, iosmFileStage goal, const char * afmt,
     iosm->debug = _iosm_debug;
     iosm->multithreaded = _iosm_threads;
     iosm->adding = adding;
+    if (iosm->multithreaded) {
+	if (_iosmTPool == NULL)
+	    _iosmTPool = rpmtpoolNew(2);
+	iosm->tpool = _iosmTPool;
+    }
 
 /*@+voidabstract -nullpass@*/
 if (iosm->debug < 0)
@@ -722,6 +885,8 @@ fprintf(stderr, "\tcpio vectors set\n");
 /*@=assignexpose@*/
 	pos = fdGetCpioPos(iosm->cfd);
 	fdSetCpioPos(iosm->cfd, 0);
+	if (iosm->multithreaded && goal == IOSM_PKGINSTALL)
+	    (void) iosmReadAheadStart(iosm, iosm->tpool);
     }
 /*@-mods@*/	/* WTF? */
     iosm->iter = mapInitIterator(fi, reverse);
@@ -811,10 +976,12 @@ fprintf(stderr, "--> iosmTeardown(%p)\n", iosm);
 	iosm->iter->ts = NULL;
 	iosm->iter = mapFreeIterator(iosm->iter);
     }
+    iosmReadAheadStop(iosm);
     if (iosm->cfd != NULL) {
 	iosm->cfd = fdFree(iosm->cfd, "persist (iosm)");
 	iosm->cfd = NULL;
     }
+    iosm->tpool = NULL;
     iosm->failedFile = NULL;
     return rc;
 }
@@ -2566,13 +2733,20 @@ assert(iosm->lpath != NULL);
 	rc = (*iosm->headerWrite) (iosm, st);	/* Write next payload header. */
 	break;
     case IOSM_DREAD:
-	iosm->rdnb = Fread(iosm->wrbuf, sizeof(*iosm->wrbuf), iosm->wrlen, iosm->cfd);
+      {	int ferr;
+	if (iosm->ra != NULL)
+	    iosm->rdnb = iosmReadAheadRead(iosm->ra, iosm->wrbuf, iosm->wrlen, &ferr);
+	else {
+	    iosm->rdnb = Fread(iosm->wrbuf, sizeof(*iosm->wrbuf), iosm->wrlen, iosm->cfd);
+	    ferr = Ferror(iosm->cfd);
+	}
 	if (iosm->debug && (stage & IOSM_SYSCALL))
 	    rpmlog(RPMLOG_DEBUG, " %8s (%s, %d, cfd)\trdnb %d\n",
 		cur, (iosm->wrbuf == iosm->wrb ? "wrbuf" : "mmap"),
 		(int)iosm->wrlen, (int)iosm->rdnb);
-	if (iosm->rdnb != iosm->wrlen || Ferror(iosm->cfd))
+	if (iosm->rdnb != iosm->wrlen || ferr)
 	    rc = IOSMERR_READ_FAILED;
+      }
 	if (iosm->rdnb > 0)
 	    fdSetCpioPos(iosm->cfd, fdGetCpioPos(iosm->cfd) + iosm->rdnb);
 	break;
@@ -10,6 +10,7 @@
 #include <rpmiotypes.h>
 #include <rpmio.h>	/* XXX FD_t */
 #include <rpmsw.h>
+#include <rpmtpool.h>
 
 /** \ingroup payload
  * File state machine data.
@@ -279,6 +280,14 @@ struct iosm_s {
     int repackaged;		/*!< Is payload repackaged? */
     int strict_erasures;	/*!< Are Rmdir/Unlink failures errors? */
     int multithreaded;		/*!< Run stages on their own thread? */
+/*@dependent@*/ /*@null@*/
+    rpmtpool tpool;		/*!< Worker threads (if multithreaded). */
+/*@only@*/ /*@null@*/
+    struct iosmReadAhead_s * ra;/*!< Payload read-ahead (if multithreaded). */
+/*@only@*/ /*@null@*/
+    struct fsmWriters_s * writers;/*!< File writer threads (lib/fsm.c). */
+/*@only@*/ /*@null@*/
+    struct fsmSync_s * sync;	/*!< Files to sync later (lib/fsm.c). */
     int adding;			/*!< Is the rpmte element type TR_ADDED? */
     int debug;			/*!< Print detailed operations? */
     int nofdigests;		/*!< Disable file digests? */
@@ -399,6 +408,34 @@ int iosmTeardown(IOSM_t iosm)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies iosm, fileSystem, internalState @*/;
 
+/**
+ * Start reading the payload ahead of IOSM_DREAD on a worker thread.
+ * Decompression of the payload then overlaps with writing files.
+ * A worker must be available while stages run, so at least 2 threads
+ * are needed, otherwise the payload is read synchronously.
+ * @param iosm		I/O state machine
+ * @param tp		worker thread pool
+ * @return		0 if started
+ */
+int iosmReadAheadStart(IOSM_t iosm, /*@null@*/ rpmtpool tp)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies iosm, fileSystem, internalState @*/;
+
+/**
+ * Stop payload read-ahead (before the payload is closed).
+ * @param iosm		I/O state machine
+ */
+void iosmReadAheadStop(IOSM_t iosm)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies iosm, fileSystem, internalState @*/;
+
+/**
+ * Free the I/O state machine thread pool (at transaction end).
+ */
+void iosmFreeThreadPools(void)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/;
+
 #if defined(_IOSM_INTERNAL)
 /*@-exportlocal@*/
 /**
@@ -142,6 +142,8 @@ typedef /*@abstract@*/ struct MacroBuf_s {
     void * spec;		/*!< (future) %file expansion info?. */
 /*@kept@*/ /*@exposed@*/
     MacroContext mc;
+/*@kept@*/ /*@exposed@*/ /*@null@*/
+    MacroContext args;		/*!< Parameterized macro arguments. */
 } * MacroBuf;
 
 #define SAVECHAR(_mb, _c) { *(_mb)->t = (char) (_c), (_mb)->t++, (_mb)->nb--; }
@@ -171,6 +173,54 @@ int _max_load_depth = _MAX_LOAD_DEPTH;
 /*@unchecked@*/
 static size_t _macro_BUFSIZ = 16 * 1024;
 
+/**
+ * Macro context lock, held while a macro table is searched or changed:
+ * headers are formatted (and macros expanded) on worker threads. The lock
+ * is recursive, as table walks (e.g. rpmLoadMacros()) add macros.
+ */
+#if defined(WITH_PTHREADS) && defined(HAVE_PTHREAD_H) && !defined(__LCLINT__)
+/*@unchecked@*/
+static pthread_mutex_t _macroLock;
+/*@unchecked@*/
+static pthread_once_t _macroLockOnce = PTHREAD_ONCE_INIT;
+
+static void macroLockInit(void)
+	/*@*/
+{
+    pthread_mutexattr_t attr;
+    (void) pthread_mutexattr_init(&attr);
+    (void) pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    (void) pthread_mutex_init(&_macroLock, &attr);
+    (void) pthread_mutexattr_destroy(&attr);
+}
+
+#define	MACRO_LOCK()	\
+    ((void) pthread_once(&_macroLockOnce, macroLockInit), \
+     (void) pthread_mutex_lock(&_macroLock))
+#define	MACRO_UNLOCK()	((void) pthread_mutex_unlock(&_macroLock))
+#else
+#define	MACRO_LOCK()	/* nothing */
+#define	MACRO_UNLOCK()	/* nothing */
+#endif
+
+/**
+ * Arguments (%0, %1, %*, %-f, ...) of the parameterized macros being
+ * expanded by this thread, shared with nested expansions (e.g. rpm.expand()
+ * within %{lua:...}). Arguments are never added to the macro context.
+ */
+#if defined(WITH_PTHREADS) && defined(__GNUC__) && defined(__ELF__) && !defined(__LCLINT__)
+/*@unchecked@*/ /*@null@*/
+static __thread MacroContext _macroArgs;
+#define	MACRO_EXPAND_LOCK()	/* nothing */
+#define	MACRO_EXPAND_UNLOCK()	/* nothing */
+#else
+/* Without thread local storage, expansions are serialized. */
+/*@unchecked@*/ /*@null@*/
+static MacroContext _macroArgs;
+#define	MACRO_EXPAND_LOCK()	MACRO_LOCK()
+#define	MACRO_EXPAND_UNLOCK()	MACRO_UNLOCK()
+#endif
+
 /* forward ref */
 static int expandMacro(MacroBuf mb)
 	/*@globals rpmGlobalMacroContext,
@@ -204,6 +254,23 @@ compareMacroName(const void * ap, const void * bp)
     return strcmp(ame->name, bme->name);
 }
 
+/**
+ * Return hash value of a macro name (DJBX33A, as hashFunctionString()).
+ * @param name		macro name
+ * @param namelen	no. of bytes
+ * @return		hash value
+ */
+static unsigned int
+macroHash(const char * name, size_t namelen)
+	/*@*/
+{
+    unsigned int h = 5381;
+
+    while (namelen-- > 0)
+	h = ((h << 5) + h) + (unsigned int) *name++;
+    return h;
+}
+
 /**
  * Enlarge macro table.
  * @param mc		macro context
@@ -218,37 +285,151 @@ expandMacroTable(MacroContext mc)
 	    xmalloc(sizeof(*(mc->macroTable)) * mc->macrosAllocated);
 	mc->firstFree = 0;
     } else {
-	mc->macrosAllocated += MACRO_CHUNK_SIZE;
+	mc->macrosAllocated *= 2;
 	mc->macroTable = (MacroEntry *)
 	    xrealloc(mc->macroTable, sizeof(*(mc->macroTable)) *
 			mc->macrosAllocated);
     }
-    memset(&mc->macroTable[mc->firstFree], 0, MACRO_CHUNK_SIZE * sizeof(*(mc->macroTable)));
+    memset(&mc->macroTable[mc->firstFree], 0,
+	(mc->macrosAllocated - mc->firstFree) * sizeof(*(mc->macroTable)));
 }
 
 /**
- * Sort entries in macro table.
+ * Enlarge (and rehash) macro name index.
  * @param mc		macro context
  */
 static void
-sortMacroTable(MacroContext mc)
+expandMacroIndex(MacroContext mc)
 	/*@modifies mc @*/
 {
-    int i;
+    struct MacroIndex_s * omi = mc->macroIndex;
+    unsigned int onbuckets = (omi != NULL ? mc->indexMask + 1 : 0);
+    unsigned int nbuckets = (omi != NULL ? 2 * onbuckets : 4 * MACRO_CHUNK_SIZE);
+    unsigned int i;
 
-    if (mc == NULL || mc->macroTable == NULL)
-	return;
+    mc->macroIndex = xcalloc(nbuckets, sizeof(*mc->macroIndex));
+    mc->indexMask = nbuckets - 1;
 
-    qsort(mc->macroTable, mc->firstFree, sizeof(mc->macroTable[0]),
-		compareMacroName);
+    for (i = 0; i < onbuckets; i++) {
+	unsigned int j;
+	if (omi[i].slot == 0)
+	    continue;
+	j = omi[i].hash & mc->indexMask;
+	while (mc->macroIndex[j].slot != 0)
+	    j = (j + 1) & mc->indexMask;
+	mc->macroIndex[j] = omi[i];
+    }
+    omi = _free(omi);
+}
+
+/**
+ * Find macro name in the index.
+ * @param mc		macro context
+ * @param name		macro name
+ * @param namelen	no. of bytes
+ * @param hash		macro name hash
+ * @return		index bucket with name (or empty bucket to use)
+ */
+static struct MacroIndex_s *
+findIndex(MacroContext mc, const char * name, size_t namelen,
+		unsigned int hash)
+	/*@*/
+{
+    unsigned int i = hash & mc->indexMask;
+    struct MacroIndex_s * mi;
+
+    while ((mi = mc->macroIndex + i)->slot != 0) {
+	MacroEntry me = mc->macroTable[mi->slot - 1];
+	if (mi->hash == hash && me != NULL
+	 && !strncmp(me->name, name, namelen) && me->name[namelen] == '\0')
+	    break;
+	i = (i + 1) & mc->indexMask;
+    }
+    return mi;
+}
 
-    /* Empty pointers are now at end of table. Reset first free index. */
-    for (i = 0; i < mc->firstFree; i++) {
-	if (mc->macroTable[i] != NULL)
+/**
+ * Add an empty slot for a new macro name to the macro table.
+ * @param mc		macro context
+ * @param name		macro name
+ * @return		address of new slot in macro table
+ */
+static MacroEntry *
+newEntry(MacroContext mc, const char * name)
+	/*@modifies mc @*/
+{
+    size_t namelen = strlen(name);
+    struct MacroIndex_s * mi;
+
+    if (mc->macroTable == NULL || mc->firstFree == mc->macrosAllocated)
+	expandMacroTable(mc);
+    /* Keep the index at most half full. */
+    if (mc->macroIndex == NULL || 2 * (mc->firstFree + 1) > mc->indexMask + 1)
+	expandMacroIndex(mc);
+
+    mi = findIndex(mc, name, namelen, macroHash(name, namelen));
+    mi->hash = macroHash(name, namelen);
+    mi->slot = mc->firstFree + 1;
+    return mc->macroTable + mc->firstFree++;
+}
+
+/**
+ * Remove a macro name from the index and its (empty) slot from the table.
+ * The last slot is moved into the hole, keeping the macro table dense.
+ * @param mc		macro context
+ * @param mi		index bucket of macro name
+ */
+static void
+delEntry(MacroContext mc, struct MacroIndex_s * mi)
+	/*@modifies mc @*/
+{
+    int slot = mi->slot - 1;
+    int last = mc->firstFree - 1;
+    unsigned int i = (unsigned int)(mi - mc->macroIndex);
+    unsigned int j = i;
+
+    /* Shift following buckets back so that probe sequences stay intact. */
+    mc->macroIndex[i].slot = 0;
+    while (mc->macroIndex[(j = (j + 1) & mc->indexMask)].slot != 0) {
+	unsigned int k = mc->macroIndex[j].hash & mc->indexMask;
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
 	    continue;
-	mc->firstFree = i;
-	break;
+	mc->macroIndex[i] = mc->macroIndex[j];
+	mc->macroIndex[j].slot = 0;
+	i = j;
+    }
+
+    if (slot != last) {
+	MacroEntry me = mc->macroTable[last];
+	size_t namelen = strlen(me->name);
+	mi = findIndex(mc, me->name, namelen, macroHash(me->name, namelen));
+	mi->slot = slot + 1;
+	mc->macroTable[slot] = me;
     }
+    mc->macroTable[last] = NULL;
+    mc->firstFree--;
+}
+
+/**
+ * Return a sorted copy of entries in macro table.
+ * @param mc		macro context
+ * @return		sorted macro entries (NULL if empty)
+ */
+/*@only@*/ /*@null@*/
+static MacroEntry *
+sortMacroTable(MacroContext mc)
+	/*@*/
+{
+    MacroEntry * mtab;
+    size_t nb;
+
+    if (mc == NULL || mc->macroTable == NULL || mc->firstFree == 0)
+	return NULL;
+
+    nb = mc->firstFree * sizeof(*mtab);
+    mtab = memcpy(xmalloc(nb), mc->macroTable, nb);
+    qsort(mtab, mc->firstFree, sizeof(*mtab), compareMacroName);
+    return mtab;
 }
 
 #if !defined(DEBUG_MACROS)
@@ -290,11 +471,13 @@ rpmDumpMacroTable(MacroContext mc, FILE * fp)
     if (fp == NULL) fp = stderr;
     
     fprintf(fp, "========================\n");
+    MACRO_LOCK();
     if (mc->macroTable != NULL) {
+	MacroEntry * mtab = sortMacroTable(mc);
 	int i;
 	for (i = 0; i < mc->firstFree; i++) {
 	    MacroEntry me;
-	    if ((me = mc->macroTable[i]) == NULL) {
+	    if ((me = mtab[i]) == NULL) {
 		/* XXX this should never happen */
 		nempty++;
 		continue;
@@ -308,7 +491,9 @@ rpmDumpMacroTable(MacroContext mc, FILE * fp)
 	    fprintf(fp, "\n");
 	    nactive++;
 	}
+	mtab = _free(mtab);
     }
+    MACRO_UNLOCK();
     fprintf(fp, _("======================== active %d empty %d\n"),
 		nactive, nempty);
 }
@@ -331,21 +516,26 @@ rpmGetMacroEntries(MacroContext mc, void * _mire, int used,
     if (avp == NULL)
 	return mc->firstFree;
 
+    MACRO_LOCK();
     av = xcalloc( (mc->firstFree+1), sizeof(mc->macroTable[0]));
-    if (mc->macroTable != NULL)
-    for (i = 0; i < mc->firstFree; i++) {
-	MacroEntry me;
-	me = mc->macroTable[i];
-	if (used > 0 && me->used < used)
-	    continue;
-	if (used == 0 && me->used != 0)
-	    continue;
+    if (mc->macroTable != NULL) {
+	MacroEntry * mtab = sortMacroTable(mc);
+	for (i = 0; i < mc->firstFree; i++) {
+	    MacroEntry me;
+	    me = mtab[i];
+	    if (used > 0 && me->used < used)
+		continue;
+	    if (used == 0 && me->used != 0)
+		continue;
 #if !defined(DEBUG_MACROS)	/* XXX preserve standalone build */
-	if (mire != NULL && mireRegexec(mire, me->name, 0) < 0)
-	    continue;
+	    if (mire != NULL && mireRegexec(mire, me->name, 0) < 0)
+		continue;
 #endif
-	av[ac++] = dupMacroEntry(me);
+	    av[ac++] = dupMacroEntry(me);
+	}
+	mtab = _free(mtab);
     }
+    MACRO_UNLOCK();
     av[ac] = NULL;
     *avp = av = xrealloc(av, (ac+1) * sizeof(*av));
     
@@ -365,28 +555,19 @@ static MacroEntry *
 findEntry(MacroContext mc, const char * name, size_t namelen)
 	/*@*/
 {
-    MacroEntry key, *ret;
+    struct MacroIndex_s * mi;
 
 /*@-globs@*/
     if (mc == NULL) mc = rpmGlobalMacroContext;
 /*@=globs@*/
-    if (mc->macroTable == NULL || mc->firstFree == 0)
+    if (mc->macroIndex == NULL || mc->firstFree == 0)
 	return NULL;
 
-    if (namelen > 0) {
-	char * t = strncpy(alloca(namelen + 1), name, namelen);
-	t[namelen] = '\0';
-	name = t;
-    }
-    
-    key = memset(alloca(sizeof(*key)), 0, sizeof(*key));
-    /*@-temptrans -assignexpose@*/
-    key->name = (char *)name;
-    /*@=temptrans =assignexpose@*/
-    ret = (MacroEntry *) bsearch(&key, mc->macroTable, mc->firstFree,
-			sizeof(*(mc->macroTable)), compareMacroName);
-    /* XXX TODO: find 1st empty slot and return that */
-    return ret;
+    if (namelen == 0)
+	namelen = strlen(name);
+
+    mi = findIndex(mc, name, namelen, macroHash(name, namelen));
+    return (mi->slot != 0 ? mc->macroTable + (mi->slot - 1) : NULL);
 }
 
 /* =============================================================== */
@@ -972,22 +1153,101 @@ popMacro(MacroEntry * mep)
 }
 
 /**
- * Free parsed arguments for parameterized macro.
+ * Pop macro definition, removing the macro name when the stack is empty.
+ * @param mc		macro context
+ * @param mep		address of macro entry slot
+ */
+static void
+popEntry(MacroContext mc, MacroEntry * mep)
+	/*@modifies mc, *mep @*/
+{
+    MacroEntry me = *mep;
+    struct MacroIndex_s * mi = NULL;
+
+    if (me == NULL)
+	return;
+    if (me->prev == NULL) {
+	size_t namelen = strlen(me->name);
+	mi = findIndex(mc, me->name, namelen, macroHash(me->name, namelen));
+    }
+    popMacro(mep);
+    if (mi != NULL)
+	delEntry(mc, mi);
+}
+
+/**
+ * Add (or push) macro definition (the macro context must be locked).
+ * @param mc		macro context (NULL uses global context).
+ * @param n		macro name
+ * @param o		macro parameters
+ * @param b		macro body
+ * @param level		macro recursion level (0 is entry API)
+ */
+static void
+_addMacro(/*@null@*/ MacroContext mc,
+		const char * n, /*@null@*/ const char * o,
+		/*@null@*/ const char * b, int level)
+	/*@modifies mc @*/
+{
+    MacroEntry * mep;
+    const char * name = n;
+
+    if (*name == '.')		/* XXX readonly macros */
+	name++;
+    if (*name == '.')		/* XXX readonly macros */
+	name++;
+
+    if (mc == NULL) mc = rpmGlobalMacroContext;
+
+    /* If new name, add slot to macro table */
+    if ((mep = findEntry(mc, name, 0)) == NULL)
+	mep = newEntry(mc, name);
+
+    if (mep != NULL) {
+	/* XXX permit "..foo" to be pushed over ".foo" */
+	if (*mep && (*mep)->flags && !(n[0] == '.' && n[1] == '.')) {
+	    /* XXX avoid error message for %buildroot */
+	    if (strcmp((*mep)->name, "buildroot"))
+		rpmlog(RPMLOG_ERR, _("Macro '%s' is readonly and cannot be changed.\n"), n);
+	} else {
+	    /* Push macro over previous definition */
+	    pushMacro(mep, n, o, b, level);
+	}
+    }
+}
+
+/**
+ * Add parameterized macro argument at the current expansion depth.
  * @param mb		macro expansion state
+ * @param n		argument name
+ * @param b		argument value
  */
 static void
-freeArgs(MacroBuf mb)
+addArg(MacroBuf mb, const char * n, const char * b)
 	/*@modifies mb @*/
 {
-    MacroContext mc = mb->mc;
-    int ndeleted = 0;
+    if (mb->args != NULL)
+	_addMacro(mb->args, n, NULL, b, mb->depth);
+    else
+	addMacro(mb->mc, n, NULL, b, mb->depth);
+}
+
+/**
+ * Pop macro definitions at or below an expansion depth.
+ * @param mc		macro context
+ * @param depth		expansion depth
+ */
+static void
+popLevel(/*@null@*/ MacroContext mc, int depth)
+	/*@modifies mc @*/
+{
     int i;
 
     if (mc == NULL || mc->macroTable == NULL)
 	return;
 
-    /* Delete dynamic macro definitions */
-    for (i = 0; i < mc->firstFree; i++) {
+    /* Delete dynamic macro definitions, last slot first (see delEntry). */
+    for (i = mc->firstFree - 1; i >= 0; i--) {
 	MacroEntry *mep, me;
 	int skiptest = 0;
 	mep = &mc->macroTable[i];
@@ -995,7 +1255,7 @@ freeArgs(MacroBuf mb)
 
 	if (me == NULL)		/* XXX this should never happen */
 	    continue;
-	if (me->level < mb->depth)
+	if (me->level < depth)
 	    continue;
 	if (strlen(me->name) == 1 && strchr("#*0", *me->name)) {
 	    if (*me->name == '*' && me->used > 0)
@@ -1007,14 +1267,23 @@ freeArgs(MacroBuf mb)
 			me->name, me->body, me->level);
 #endif
 	}
-	popMacro(mep);
-	if (!(mep && *mep))
-	    ndeleted++;
+	popEntry(mc, mep);
     }
+}
 
-    /* If any deleted macros, sort macro table */
-    if (ndeleted)
-	sortMacroTable(mc);
+/**
+ * Free parsed arguments for parameterized macro.
+ * @param mb		macro expansion state
+ */
+static void
+freeArgs(MacroBuf mb)
+	/*@modifies mb @*/
+{
+    popLevel(mb->args, mb->depth);
+    /* Also pop the %define's local to the macro body. */
+    MACRO_LOCK();
+    popLevel(mb->mc, mb->depth);
+    MACRO_UNLOCK();
 }
 
 /**
@@ -1048,7 +1317,7 @@ grabArgs(MacroBuf mb, const MacroEntry me, /*@returned@*/ const char * se,
     buf[0] = '\0';
     b = be = stpcpy(buf, me->name);
 
-    addMacro(mb->mc, "0", NULL, buf, mb->depth);
+    addArg(mb, "0", buf);
     
     argc = 1;	/* XXX count argv[0] */
 
@@ -1083,7 +1352,7 @@ grabArgs(MacroBuf mb, const MacroEntry me, /*@returned@*/ const char * se,
  * This is the (potential) justification for %{**} ...
  */
     /* Add unexpanded args as macro */
-    addMacro(mb->mc, "**", NULL, b, mb->depth);
+    addArg(mb, "**", b);
 
 #ifdef NOTYET
     /* XXX if macros can be passed as args ... */
@@ -1146,10 +1415,10 @@ grabArgs(MacroBuf mb, const MacroEntry me, /*@returned@*/ const char * se,
 	}
 	*be++ = '\0';
 	aname[0] = '-'; aname[1] = (char)c; aname[2] = '\0';
-	addMacro(mb->mc, aname, NULL, b, mb->depth);
+	addArg(mb, aname, b);
 	if (optArg != NULL) {
 	    aname[0] = '-'; aname[1] = (char)c; aname[2] = '*'; aname[3] = '\0';
-	    addMacro(mb->mc, aname, NULL, optArg, mb->depth);
+	    addArg(mb, aname, optArg);
 	}
 	be = b; /* reuse the space */
 /*@-dependenttrans -modobserver -observertrans @*/
@@ -1171,7 +1440,7 @@ grabArgs(MacroBuf mb, const MacroEntry me, /*@returned@*/ const char * se,
     
     /* Add arg count as macro. */
     sprintf(aname, "%d", argc);
-    addMacro(mb->mc, "#", NULL, aname, mb->depth);
+    addArg(mb, "#", aname);
 
     /* Add macro for each arg. Concatenate args for %*. */
     if (be) {
@@ -1179,14 +1448,14 @@ grabArgs(MacroBuf mb, const MacroEntry me, /*@returned@*/ const char * se,
 	if (argv != NULL)
 	for (c = 0; c < argc; c++) {
 	    sprintf(aname, "%d", (c + 1));
-	    addMacro(mb->mc, aname, NULL, argv[c], mb->depth);
+	    addArg(mb, aname, argv[c]);
 	    if (be != b) *be++ = ' '; /* Add space between args */
 	    be = stpcpy(be, argv[c]);
 	}
     }
 
     /* Add unexpanded args as macro. */
-    addMacro(mb->mc, "*", NULL, b, mb->depth);
+    addArg(mb, "*", b);
 
 exit:
     optCon = poptFreeContext(optCon);
@@ -1446,6 +1715,90 @@ doFoo(MacroBuf mb, int negate, const char * f, size_t fn,
     }
 }
 
+/**
+ * Copy a macro definition (and, for %{@name}, its stack), so that the
+ * macro can be expanded while other threads change the macro table.
+ * @param mc		macro context
+ * @param name		macro name
+ * @param namelen	no. of bytes
+ * @param stack		copy the whole macro entry stack?
+ * @return		macro entry copy (NULL if not defined)
+ */
+/*@only@*/ /*@null@*/
+static MacroEntry
+copyEntry(MacroContext mc, const char * name, size_t namelen, int stack)
+	/*@*/
+{
+    MacroEntry * mep;
+    MacroEntry me;
+    MacroEntry nme = NULL;
+    MacroEntry * nmep = &nme;
+
+    MACRO_LOCK();
+    mep = findEntry(mc, name, namelen);
+    for (me = (mep ? *mep : NULL); me != NULL; me = (stack ? me->prev : NULL)) {
+	size_t nb = sizeof(*me) + strlen(me->name) + 1 + strlen(me->body) + 1
+		+ (me->opts ? strlen(me->opts) + 1 : 0);
+	MacroEntry t = xmalloc(nb);
+	char * te = (char *) (t + 1);
+
+	*t = *me;	/* structure assignment */
+	t->prev = NULL;
+	t->name = te;
+	te = stpcpy(te, me->name) + 1;
+	t->body = te;
+	te = stpcpy(te, me->body) + 1;
+	if (me->opts != NULL) {
+	    t->opts = te;
+	    te = stpcpy(te, me->opts) + 1;
+	}
+	*nmep = t;
+	nmep = &t->prev;
+    }
+    MACRO_UNLOCK();
+    return nme;
+}
+
+/**
+ * Free a macro definition copy.
+ * @param me		macro entry copy
+ * @return		NULL always
+ */
+/*@null@*/
+static MacroEntry
+freeEntry(/*@only@*/ /*@null@*/ MacroEntry me)
+	/*@modifies me @*/
+{
+    while (me != NULL) {
+	MacroEntry prev = me->prev;
+	me = _free(me);
+	me = prev;
+    }
+    return NULL;
+}
+
+/**
+ * Mark macro as used.
+ * @param mc		macro context
+ * @param me		macro entry (or copy)
+ * @param copied	is me a copy of the macro context entry?
+ */
+static void
+markUsed(MacroContext mc, MacroEntry me, int copied)
+	/*@modifies mc, me @*/
+{
+    MacroEntry * mep;
+
+    if (!copied) {
+	me->used++;
+	return;
+    }
+    MACRO_LOCK();
+    if ((mep = findEntry(mc, me->name, 0)) != NULL && *mep != NULL)
+	(*mep)->used++;
+    MACRO_UNLOCK();
+}
+
 static int expandFIFO(MacroBuf mb, MacroEntry me, const char *g, size_t gn)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies mb, rpmGlobalMacroContext, fileSystem, internalState @*/
@@ -1640,6 +1993,7 @@ expandMacro(MacroBuf mb)
 {
     MacroEntry *mep;
     MacroEntry me;
+    MacroEntry mec = NULL;	/* copy of a macro context entry */
     const char *s = mb->s, *se;
     const char *f, *fe;
     const char *g, *ge;
@@ -2322,14 +2676,18 @@ assert(0);
 		continue;
 	}
 
-	/* Expand defined macros */
-	mep = findEntry(mb->mc, f, fn);
-	me = (mep ? *mep : NULL);
+	/* Expand defined macros (arguments first) */
+	mec = freeEntry(mec);
+	mep = (mb->args ? findEntry(mb->args, f, fn) : NULL);
+	if (mep != NULL)
+		me = *mep;
+	else
+		me = mec = copyEntry(mb->mc, f, fn, stackarray);
 
 	/* XXX Special processing for flags */
 	if (*f == '-') {
 		if (me)
-			me->used++;	/* Mark macro as used */
+			markUsed(mb->mc, me, (me == mec));
 		if ((me == NULL && !negate) ||	/* Without -f, skip %{-f...} */
 		    (me != NULL && negate)) {	/* With -f, skip %{!-f...} */
 			s = se;
@@ -2406,10 +2764,10 @@ assert(0);
 		if (lastc != NULL) {
 			se = grabArgs(mb, me, fe, lastc);
 		} else {
-			addMacro(mb->mc, "**", NULL, "", mb->depth);
-			addMacro(mb->mc, "*", NULL, "", mb->depth);
-			addMacro(mb->mc, "#", NULL, "0", mb->depth);
-			addMacro(mb->mc, "0", NULL, me->name, mb->depth);
+			addArg(mb, "**", "");
+			addArg(mb, "*", "");
+			addArg(mb, "#", "0");
+			addArg(mb, "0", me->name);
 		}
 	}
 
@@ -2418,7 +2776,7 @@ assert(0);
 		mb->s = me->body;
 		rc = expandMacro(mb);
 		if (rc == 0)
-			me->used++;	/* Mark macro as used */
+			markUsed(mb->mc, me, (me == mec));
 	}
 
 	/* Free args for "%name " macros with opts */
@@ -2427,6 +2785,7 @@ assert(0);
 
 	s = se;
     }
+    mec = freeEntry(mec);
 
     *mb->t = '\0';
     mb->s = s;
@@ -2599,10 +2958,41 @@ exit:
 
 /* =============================================================== */
 
+/**
+ * Free macro table (a shared macro context must be locked).
+ * @param mc		macro context
+ */
+static void
+freeMacroTable(MacroContext mc)
+	/*@modifies mc @*/
+{
+    if (mc->macroTable != NULL) {
+	int i;
+	for (i = 0; i < mc->firstFree; i++) {
+	    MacroEntry me;
+	    while ((me = mc->macroTable[i]) != NULL) {
+		/* XXX cast to workaround const */
+		/*@-onlytrans@*/
+		if ((mc->macroTable[i] = me->prev) == NULL)
+		    me->name = _free(me->name);
+		/*@=onlytrans@*/
+		me->opts = _free(me->opts);
+		me->body = _free(me->body);
+		me = _free(me);
+	    }
+	}
+	mc->macroTable = _free(mc->macroTable);
+    }
+    mc->macroIndex = _free(mc->macroIndex);
+    memset(mc, 0, sizeof(*mc));
+}
+
 int
 expandMacros(void * spec, MacroContext mc, char * sbuf, size_t slen)
 {
     MacroBuf mb = alloca(sizeof(*mb));
+    struct MacroContext_s args;
+    MacroContext oargs;
     char *tbuf;
     int rc;
 
@@ -2623,7 +3013,18 @@ expandMacros(void * spec, MacroContext mc, char * sbuf, size_t slen)
     mb->spec = spec;	/* (future) %file expansion info */
     mb->mc = mc;
 
+    MACRO_EXPAND_LOCK();
+    /* Nested expansions (e.g. rpm.expand() in %{lua:...}) share arguments. */
+    if ((oargs = _macroArgs) == NULL) {
+	memset(&args, 0, sizeof(args));
+	_macroArgs = &args;
+    }
+    mb->args = _macroArgs;
     rc = expandMacro(mb);
+    _macroArgs = oargs;
+    MACRO_EXPAND_UNLOCK();
+    if (mb->args == &args)
+	freeMacroTable(&args);
 
     tbuf[slen] = '\0';
     if (mb->nb == 0)
@@ -2638,39 +3039,9 @@ void
 addMacro(MacroContext mc,
 	const char * n, const char * o, const char * b, int level)
 {
-    MacroEntry * mep;
-    const char * name = n;
-
-    if (*name == '.')		/* XXX readonly macros */
-	name++;
-    if (*name == '.')		/* XXX readonly macros */
-	name++;
-
-    if (mc == NULL) mc = rpmGlobalMacroContext;
-
-    /* If new name, expand macro table */
-    if ((mep = findEntry(mc, name, 0)) == NULL) {
-	if (mc->firstFree == mc->macrosAllocated)
-	    expandMacroTable(mc);
-	if (mc->macroTable != NULL)
-	    mep = mc->macroTable + mc->firstFree++;
-    }
-
-    if (mep != NULL) {
-	/* XXX permit "..foo" to be pushed over ".foo" */
-	if (*mep && (*mep)->flags && !(n[0] == '.' && n[1] == '.')) {
-	    /* XXX avoid error message for %buildroot */
-	    if (strcmp((*mep)->name, "buildroot"))
-		rpmlog(RPMLOG_ERR, _("Macro '%s' is readonly and cannot be changed.\n"), n);
-	    return;
-	}
-	/* Push macro over previous definition */
-	pushMacro(mep, n, o, b, level);
-
-	/* If new name, sort macro table */
-	if ((*mep)->prev == NULL)
-	    sortMacroTable(mc);
-    }
+    MACRO_LOCK();
+    _addMacro(mc, n, o, b, level);
+    MACRO_UNLOCK();
 }
 
 void
@@ -2679,13 +3050,11 @@ delMacro(MacroContext mc, const char * n)
     MacroEntry * mep;
 
     if (mc == NULL) mc = rpmGlobalMacroContext;
+    MACRO_LOCK();
     /* If name exists, pop entry */
-    if ((mep = findEntry(mc, n, 0)) != NULL) {
-	popMacro(mep);
-	/* If deleted name, sort macro table */
-	if (!(mep && *mep))
-	    sortMacroTable(mc);
-    }
+    if ((mep = findEntry(mc, n, 0)) != NULL)
+	popEntry(mc, mep);
+    MACRO_UNLOCK();
 }
 
 /*@-mustmod@*/ /* LCL: mc is modified through mb->mc, mb is abstract */
@@ -2718,6 +3087,7 @@ rpmLoadMacros(MacroContext mc, int level)
     if (mc == NULL || mc == rpmGlobalMacroContext)
 	return;
 
+    MACRO_LOCK();
     if (mc->macroTable != NULL) {
 	int i;
 	for (i = 0; i < mc->firstFree; i++) {
@@ -2730,6 +3100,7 @@ rpmLoadMacros(MacroContext mc, int level)
 	    addMacro(NULL, me->name, me->opts, me->body, (level - 1));
 	}
     }
+    MACRO_UNLOCK();
 }
 
 #if defined(RPM_VENDOR_OPENPKG) /* expand-macrosfile-macro */
@@ -2914,24 +3285,9 @@ rpmFreeMacros(MacroContext mc)
     
     if (mc == NULL) mc = rpmGlobalMacroContext;
 
-    if (mc->macroTable != NULL) {
-	int i;
-	for (i = 0; i < mc->firstFree; i++) {
-	    MacroEntry me;
-	    while ((me = mc->macroTable[i]) != NULL) {
-		/* XXX cast to workaround const */
-		/*@-onlytrans@*/
-		if ((mc->macroTable[i] = me->prev) == NULL)
-		    me->name = _free(me->name);
-		/*@=onlytrans@*/
-		me->opts = _free(me->opts);
-		me->body = _free(me->body);
-		me = _free(me);
-	    }
-	}
-	mc->macroTable = _free(mc->macroTable);
-    }
-    memset(mc, 0, sizeof(*mc));
+    MACRO_LOCK();
+    freeMacroTable(mc);
+    MACRO_UNLOCK();
 }
 /*@=globstate@*/
 
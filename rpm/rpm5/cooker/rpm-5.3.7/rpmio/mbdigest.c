@@ -0,0 +1,567 @@
+/** \ingroup rpmio
+ * \file rpmio/mbdigest.c
+ * Multi-buffer MD5, SHA-1 and SHA-256.
+ *
+ * Files are usually small, and the block function of a single digest is
+ * one long dependency chain. Hashing 4 (SSE2) or 8 (AVX2) independent
+ * buffers at once, one buffer per vector lane, keeps the vector units busy
+ * instead. SHA-1 and SHA-256 use the SHA-NI instructions (one buffer at a
+ * time) when the cpu has them. The kernels are chosen by cpuid at run time.
+ */
+
+#include "system.h"
+
+#if defined(__GNUC__) && (__GNUC__ >= 5) && (defined(__x86_64__) || defined(__i386__))
+#define	MBD_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#include <rpmiotypes.h>
+#include "mbdigest.h"
+
+#include "debug.h"
+
+/*@unchecked@*/
+int _mbd_isa = -1;
+
+#define	MBD_ROTL(_x, _n)	(((_x) << (_n)) | ((_x) >> (32 - (_n))))
+#define	MBD_ROTR(_x, _n)	(((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+#define	MBD_BE32(_p)	\
+    (((rpmuint32_t)(_p)[0] << 24) | ((rpmuint32_t)(_p)[1] << 16) | \
+     ((rpmuint32_t)(_p)[2] <<  8) |  (rpmuint32_t)(_p)[3])
+#define	MBD_LE32(_p)	\
+    (((rpmuint32_t)(_p)[3] << 24) | ((rpmuint32_t)(_p)[2] << 16) | \
+     ((rpmuint32_t)(_p)[1] <<  8) |  (rpmuint32_t)(_p)[0])
+
+#if defined(__GNUC__) && (__GNUC__ >= 8)
+#define	MBD_UNROLL	_Pragma("GCC unroll 80")
+#else
+#define	MBD_UNROLL
+#endif
+
+/*@observer@*/ /*@unchecked@*/
+static const rpmuint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const int md5R[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const rpmuint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const rpmuint32_t md5IV[4] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const rpmuint32_t sha1IV[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const rpmuint32_t sha256IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/* ===== Lane kernels: 1 (portable C), 4 (SSE2) and 8 (AVX2) lanes. */
+
+#define	MBD_N		1
+#define	MBD_V		rpmuint32_t
+#define	MBD_ATTR
+#define	MBD_NAME(_f)	_f##_x1
+#include "mbdigest_lanes.c"
+#undef	MBD_N
+#undef	MBD_V
+#undef	MBD_ATTR
+#undef	MBD_NAME
+
+#if defined(MBD_X86) && defined(__SSE2__)
+typedef rpmuint32_t mbdV4 __attribute__ ((vector_size (16)));
+#define	MBD_N		4
+#define	MBD_V		mbdV4
+#define	MBD_ATTR
+#define	MBD_NAME(_f)	_f##_x4
+#include "mbdigest_lanes.c"
+#undef	MBD_N
+#undef	MBD_V
+#undef	MBD_ATTR
+#undef	MBD_NAME
+#endif
+
+#if defined(MBD_X86)
+typedef rpmuint32_t mbdV8 __attribute__ ((vector_size (32)));
+#define	MBD_N		8
+#define	MBD_V		mbdV8
+#define	MBD_ATTR	__attribute__ ((target ("avx2")))
+#define	MBD_NAME(_f)	_f##_x8
+#include "mbdigest_lanes.c"
+#undef	MBD_N
+#undef	MBD_V
+#undef	MBD_ATTR
+#undef	MBD_NAME
+#endif
+
+/* ===== SHA-NI kernels (single stream, the state is in h[] order). */
+
+#if defined(MBD_X86)
+#define	MBD_SHANI	__attribute__ ((target ("sha,sse4.1")))
+
+static MBD_SHANI void mbdSHA1_shani(rpmuint32_t * st,
+		const rpmuint8_t * const * blk)
+	/*@modifies st @*/
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    const rpmuint8_t * p = blk[0];
+    __m128i abcd, abcd0, e0, e1, e00;
+    __m128i m[4];
+    int g;
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) st), 0x1b);
+    e0 = _mm_set_epi32((int)st[4], 0, 0, 0);
+    abcd0 = abcd;
+    e00 = e0;
+    e1 = e0;
+
+    /* 20 groups of 4 rounds, alternating e0/e1 (as in Intel's example). */
+MBD_UNROLL
+    for (g = 0; g < 20; g++) {
+	__m128i * e = (g & 1) ? &e1 : &e0;
+	__m128i * enext = (g & 1) ? &e0 : &e1;
+
+	if (g < 4)
+	    m[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * g)), mask);
+	if (g == 0)
+	    *e = _mm_add_epi32(*e, m[0]);
+	else
+	    *e = _mm_sha1nexte_epu32(*e, m[g & 3]);
+	*enext = abcd;
+	if (g >= 3 && g <= 18)
+	    m[(g + 1) & 3] = _mm_sha1msg2_epu32(m[(g + 1) & 3], m[g & 3]);
+	switch (g / 5) {
+	case 0:	abcd = _mm_sha1rnds4_epu32(abcd, *e, 0);	break;
+	case 1:	abcd = _mm_sha1rnds4_epu32(abcd, *e, 1);	break;
+	case 2:	abcd = _mm_sha1rnds4_epu32(abcd, *e, 2);	break;
+	default: abcd = _mm_sha1rnds4_epu32(abcd, *e, 3);	break;
+	}
+	if (g >= 1 && g <= 16)
+	    m[(g - 1) & 3] = _mm_sha1msg1_epu32(m[(g - 1) & 3], m[g & 3]);
+	if (g >= 2 && g <= 17)
+	    m[(g - 2) & 3] = _mm_xor_si128(m[(g - 2) & 3], m[g & 3]);
+    }
+
+    e0 = _mm_sha1nexte_epu32(e0, e00);
+    abcd = _mm_add_epi32(abcd, abcd0);
+    _mm_storeu_si128((__m128i *) st, _mm_shuffle_epi32(abcd, 0x1b));
+    st[4] = (rpmuint32_t) _mm_extract_epi32(e0, 3);
+}
+
+static MBD_SHANI void mbdSHA256_shani(rpmuint32_t * st,
+		const rpmuint8_t * const * blk)
+	/*@modifies st @*/
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const rpmuint8_t * p = blk[0];
+    __m128i s0, s1, s00, s10, x;
+    __m128i m[4];
+    int i;
+
+    /* h[] to the ABEF/CDGH layout of sha256rnds2. */
+    x = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &st[0]), 0xb1);
+    s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &st[4]), 0x1b);
+    s0 = _mm_alignr_epi8(x, s1, 8);
+    s1 = _mm_blend_epi16(s1, x, 0xf0);
+    s00 = s0;
+    s10 = s1;
+
+MBD_UNROLL
+    for (i = 0; i < 16; i++) {
+	if (i < 4)
+	    m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)), mask);
+	else {
+	    x = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+	    x = _mm_add_epi32(x, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+	    m[i & 3] = _mm_sha256msg2_epu32(x, m[(i + 3) & 3]);
+	}
+	x = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *) &sha256K[4 * i]));
+	s1 = _mm_sha256rnds2_epu32(s1, s0, x);
+	s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(x, 0x0e));
+    }
+
+    s0 = _mm_add_epi32(s0, s00);
+    s1 = _mm_add_epi32(s1, s10);
+
+    x = _mm_shuffle_epi32(s0, 0x1b);
+    s1 = _mm_shuffle_epi32(s1, 0xb1);
+    _mm_storeu_si128((__m128i *) &st[0], _mm_blend_epi16(x, s1, 0xf0));
+    _mm_storeu_si128((__m128i *) &st[4], _mm_alignr_epi8(s1, x, 8));
+}
+#endif
+
+/* ===== Kernel selection. */
+
+typedef void (*mbdBlock) (rpmuint32_t * st, const rpmuint8_t * const * blk);
+
+/**
+ * Digest kernels, best first.
+ */
+struct mbdKernel_s {
+/*@observer@*/
+    const char * name;
+    int isa;			/*!< required MBD_ISA_* bits */
+    int lanes;			/*!< no. of streams hashed at once */
+/*@null@*/
+    mbdBlock md5;
+/*@null@*/
+    mbdBlock sha1;
+/*@null@*/
+    mbdBlock sha256;
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const struct mbdKernel_s mbdKernels[] = {
+#if defined(MBD_X86)
+    { "shani",	MBD_ISA_SHANI,	1, NULL, mbdSHA1_shani, mbdSHA256_shani },
+    { "avx2x8",	MBD_ISA_AVX2,	8, mbdMD5_x8, mbdSHA1_x8, mbdSHA256_x8 },
+#if defined(__SSE2__)
+    { "sse2x4",	MBD_ISA_SSE2,	4, mbdMD5_x4, mbdSHA1_x4, mbdSHA256_x4 },
+#endif
+#endif
+    { "c",	0,		1, mbdMD5_x1, mbdSHA1_x1, mbdSHA256_x1 },
+};
+#define	NKERNELS	(int)(sizeof(mbdKernels) / sizeof(mbdKernels[0]))
+
+/**
+ * Digest algorithm parameters.
+ */
+struct mbdAlgo_s {
+    pgpHashAlgo algo;
+    int nwords;			/*!< no. of state (and digest) words */
+    int be;			/*!< big endian words and length? */
+/*@observer@*/
+    const rpmuint32_t * iv;
+};
+
+/*@observer@*/ /*@unchecked@*/
+static const struct mbdAlgo_s mbdAlgos[] = {
+    { PGPHASHALGO_MD5,		4, 0, md5IV },
+    { PGPHASHALGO_SHA1,		5, 1, sha1IV },
+    { PGPHASHALGO_SHA256,	8, 1, sha256IV },
+};
+
+int mbdISA(void)
+{
+    if (_mbd_isa < 0) {
+	int isa = 0;
+#if defined(MBD_X86)
+	unsigned a, b, c, d;
+
+#if defined(__SSE2__)
+	isa |= MBD_ISA_SSE2;
+#endif
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    isa |= MBD_ISA_AVX2;
+	/* SHA (leaf 7 ebx bit 29), and SSE4.1 (leaf 1 ecx bit 19). */
+	if (__get_cpuid_max(0, NULL) >= 7
+	 && __get_cpuid(1, &a, &b, &c, &d) && (c & (1U << 19)))
+	{
+	    __cpuid_count(7, 0, a, b, c, d);
+	    if (b & (1U << 29))
+		isa |= MBD_ISA_SHANI;
+	}
+#endif
+	_mbd_isa = isa;
+    }
+    return _mbd_isa;
+}
+
+/**
+ * Return the parameters of a digest algorithm.
+ * @param algo		digest algorithm
+ * @return		parameters, NULL if not supported
+ */
+/*@observer@*/ /*@null@*/
+static const struct mbdAlgo_s * mbdAlgo(pgpHashAlgo algo)
+	/*@*/
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(mbdAlgos) / sizeof(mbdAlgos[0])); i++) {
+	if (mbdAlgos[i].algo == algo)
+	    return &mbdAlgos[i];
+    }
+    return NULL;
+}
+
+/**
+ * Return the block function of a kernel for an algorithm.
+ */
+/*@null@*/
+static mbdBlock mbdKernelBlock(const struct mbdKernel_s * k, pgpHashAlgo algo)
+	/*@*/
+{
+    switch (algo) {
+    case PGPHASHALGO_MD5:	return k->md5;
+    case PGPHASHALGO_SHA1:	return k->sha1;
+    case PGPHASHALGO_SHA256:	return k->sha256;
+    default:			break;
+    }
+    return NULL;
+}
+
+/**
+ * Choose the best kernel available for an algorithm.
+ * @param algo		digest algorithm
+ * @param multi		permit multi-lane kernels?
+ * @return		kernel
+ */
+/*@observer@*/
+static const struct mbdKernel_s * mbdSelect(pgpHashAlgo algo, int multi)
+	/*@globals _mbd_isa @*/
+	/*@modifies _mbd_isa @*/
+{
+    int isa = mbdISA();
+    int i;
+
+    for (i = 0; i < NKERNELS - 1; i++) {
+	const struct mbdKernel_s * k = &mbdKernels[i];
+	if ((k->isa & isa) != k->isa)
+	    continue;
+	if (k->lanes > 1 && !multi)
+	    continue;
+	if (mbdKernelBlock(k, algo) != NULL)
+	    return k;
+    }
+    return &mbdKernels[NKERNELS - 1];
+}
+
+const char * mbdKernel(pgpHashAlgo algo)
+{
+    return (mbdAlgo(algo) != NULL ? mbdSelect(algo, 1)->name : NULL);
+}
+
+/* ===== Batched digests. */
+
+/**
+ * Per-lane progress through a buffer.
+ */
+struct mbdLane_s {
+    int job;			/*!< buffer index (-1 if idle) */
+    size_t off;			/*!< offset of next full block */
+    size_t nfull;		/*!< no. bytes in full blocks */
+    int ntail;			/*!< no. of padded tail blocks (1 or 2) */
+    int itail;			/*!< next tail block */
+    rpmuint8_t tail[128];	/*!< last partial block and padding */
+};
+
+static void mbdPutLength(rpmuint8_t * p, rpmuint64_t bits, int be)
+	/*@modifies p @*/
+{
+    int i;
+    for (i = 0; i < 8; i++)
+	p[be ? 7 - i : i] = (rpmuint8_t)(bits >> (8 * i));
+}
+
+static void mbdPutWord(rpmuint8_t * p, rpmuint32_t w, int be)
+	/*@modifies p @*/
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	p[be ? 3 - i : i] = (rpmuint8_t)(w >> (8 * i));
+}
+
+int mbdBatch(pgpHashAlgo algo, int n, const void ** bufs,
+		const size_t * lens, unsigned char ** digests)
+{
+    static const rpmuint8_t zero[64];
+    const struct mbdAlgo_s * a = mbdAlgo(algo);
+    const struct mbdKernel_s * k;
+    struct mbdLane_s lanes[MBD_MAXLANES];
+    rpmuint32_t st[8 * MBD_MAXLANES];
+    const rpmuint8_t * blk[MBD_MAXLANES];
+    mbdBlock block;
+    int next = 0;
+    int N;
+    int l, w;
+
+    if (a == NULL)
+	return -1;
+    k = mbdSelect(algo, (n > 1));
+    block = mbdKernelBlock(k, algo);
+    N = k->lanes;
+
+    for (l = 0; l < N; l++)
+	lanes[l].job = -1;
+
+    for (;;) {
+	int active = 0;
+
+	/* Start the next buffer on each idle lane. */
+	for (l = 0; l < N; l++) {
+	    struct mbdLane_s * lp = &lanes[l];
+	    if (lp->job < 0 && next < n) {
+		const rpmuint8_t * b = bufs[next];
+		size_t len = lens[next];
+		size_t rem = len & 63;
+
+		lp->job = next++;
+		lp->off = 0;
+		lp->nfull = len - rem;
+		lp->ntail = (rem + 9 > 64 ? 2 : 1);
+		lp->itail = 0;
+		memset(lp->tail, 0, sizeof(lp->tail));
+		if (rem)
+		    memcpy(lp->tail, b + lp->nfull, rem);
+		lp->tail[rem] = 0x80;
+		mbdPutLength(lp->tail + 64 * lp->ntail - 8,
+			(rpmuint64_t)len << 3, a->be);
+		for (w = 0; w < a->nwords; w++)
+		    st[w * N + l] = a->iv[w];
+	    }
+	    if (lp->job < 0) {
+		blk[l] = zero;
+		continue;
+	    }
+	    active++;
+	    if (lp->off < lp->nfull) {
+		blk[l] = (const rpmuint8_t *) bufs[lp->job] + lp->off;
+		lp->off += 64;
+	    } else
+		blk[l] = lp->tail + 64 * lp->itail++;
+	}
+	if (active == 0)
+	    break;
+
+	(*block) (st, blk);
+
+	/* Return the digests of finished buffers. */
+	for (l = 0; l < N; l++) {
+	    struct mbdLane_s * lp = &lanes[l];
+	    if (lp->job < 0 || lp->off < lp->nfull || lp->itail < lp->ntail)
+		continue;
+	    for (w = 0; w < a->nwords; w++)
+		mbdPutWord(digests[lp->job] + 4 * w, st[w * N + l], a->be);
+	    lp->job = -1;
+	}
+    }
+    return 0;
+}
+
+/* ===== Single stream SHA-1/SHA-256. */
+
+static int mbdReset(mbdParam * mp, pgpHashAlgo algo)
+	/*@modifies mp @*/
+{
+    const struct mbdAlgo_s * a = mbdAlgo(algo);
+    memset(mp, 0, sizeof(*mp));
+    mp->algo = algo;
+    memcpy(mp->h, a->iv, a->nwords * sizeof(mp->h[0]));
+    return 0;
+}
+
+int mbdSHA1Reset(mbdParam * mp)
+{
+    return mbdReset(mp, PGPHASHALGO_SHA1);
+}
+
+int mbdSHA256Reset(mbdParam * mp)
+{
+    return mbdReset(mp, PGPHASHALGO_SHA256);
+}
+
+int mbdUpdate(mbdParam * mp, const rpmuint8_t * data, size_t size)
+{
+    mbdBlock block = mbdKernelBlock(mbdSelect(mp->algo, 0), mp->algo);
+    const rpmuint8_t * blk;
+
+    mp->length += size;
+    if (mp->offset > 0) {
+	size_t nb = 64 - mp->offset;
+	if (nb > size)
+	    nb = size;
+	memcpy(mp->buf + mp->offset, data, nb);
+	mp->offset += nb;
+	data += nb;
+	size -= nb;
+	if (mp->offset < 64)
+	    return 0;
+	blk = mp->buf;
+	(*block) (mp->h, &blk);
+	mp->offset = 0;
+    }
+    while (size >= 64) {
+	blk = data;
+	(*block) (mp->h, &blk);
+	data += 64;
+	size -= 64;
+    }
+    if (size > 0) {
+	memcpy(mp->buf, data, size);
+	mp->offset = size;
+    }
+    return 0;
+}
+
+int mbdDigest(mbdParam * mp, rpmuint8_t * digest)
+{
+    const struct mbdAlgo_s * a = mbdAlgo(mp->algo);
+    mbdBlock block = mbdKernelBlock(mbdSelect(mp->algo, 0), mp->algo);
+    const rpmuint8_t * blk = mp->buf;
+    rpmuint64_t bits = mp->length << 3;
+    int w;
+
+    mp->buf[mp->offset++] = 0x80;
+    if (mp->offset > 56) {
+	memset(mp->buf + mp->offset, 0, 64 - mp->offset);
+	(*block) (mp->h, &blk);
+	mp->offset = 0;
+    }
+    memset(mp->buf + mp->offset, 0, 56 - mp->offset);
+    mbdPutLength(mp->buf + 56, bits, a->be);
+    (*block) (mp->h, &blk);
+
+    for (w = 0; w < a->nwords; w++)
+	mbdPutWord(digest + 4 * w, mp->h[w], a->be);
+    return mbdReset(mp, mp->algo);
+}
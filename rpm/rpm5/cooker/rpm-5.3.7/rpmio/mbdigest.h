@@ -0,0 +1,116 @@
+/*!\file mbdigest.h
+ * \brief Multi-buffer (and SHA-NI) MD5, SHA-1 and SHA-256 kernels.
+ */
+
+#include <sys/types.h>
+#include <rpmiotypes.h>
+
+#ifndef  _MBDIGEST_H
+#define  _MBDIGEST_H
+
+/**
+ * Instruction set extensions used by the digest kernels.
+ */
+#define	MBD_ISA_SSE2	(1 << 0)	/*!< 4 lanes */
+#define	MBD_ISA_AVX2	(1 << 1)	/*!< 8 lanes */
+#define	MBD_ISA_SHANI	(1 << 2)	/*!< SHA-1/SHA-256 single stream */
+
+/**
+ * Max. no. of lanes of any kernel.
+ */
+#define	MBD_MAXLANES	8
+
+/**
+ * Extensions available to the kernels (-1 probes the cpu on first use).
+ * Clear bits to force a slower kernel.
+ */
+/*@unchecked@*/
+extern int _mbd_isa;
+
+/**
+ * Single stream SHA-1/SHA-256 parameters (SHA-NI).
+ */
+typedef struct {
+    rpmuint32_t h[8];
+    rpmuint64_t length;
+    rpmuint32_t offset;
+    rpmuint8_t buf[64];
+    pgpHashAlgo algo;
+} mbdParam;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Return extensions available to the digest kernels.
+ * @return		MBD_ISA_* bits
+ */
+int mbdISA(void)
+	/*@globals _mbd_isa @*/
+	/*@modifies _mbd_isa @*/;
+
+/**
+ * Return the name of the kernel used for an algorithm.
+ * @param algo		digest algorithm
+ * @return		kernel name, NULL if not supported
+ */
+/*@observer@*/ /*@null@*/
+const char * mbdKernel(pgpHashAlgo algo)
+	/*@globals _mbd_isa @*/
+	/*@modifies _mbd_isa @*/;
+
+/**
+ * Digest independent buffers, hashing several at once.
+ * @param algo		PGPHASHALGO_{MD5,SHA1,SHA256}
+ * @param n		no. of buffers
+ * @param bufs		buffers
+ * @param lens		buffer lengths
+ * @retval digests	binary digests (caller provides digest size bytes)
+ * @return		0 on success, -1 if algo is not supported
+ */
+int mbdBatch(pgpHashAlgo algo, int n, const void ** bufs,
+		const size_t * lens, unsigned char ** digests)
+	/*@globals _mbd_isa @*/
+	/*@modifies *digests, _mbd_isa @*/;
+
+/**
+ * Reset SHA-1 parameters.
+ * @param mp		parameters
+ * @return		0 always
+ */
+int mbdSHA1Reset(mbdParam * mp)
+	/*@modifies mp @*/;
+
+/**
+ * Reset SHA-256 parameters.
+ * @param mp		parameters
+ * @return		0 always
+ */
+int mbdSHA256Reset(mbdParam * mp)
+	/*@modifies mp @*/;
+
+/**
+ * Update single stream digest.
+ * @param mp		parameters
+ * @param data		next data buffer
+ * @param size		no. bytes of data
+ * @return		0 always
+ */
+int mbdUpdate(mbdParam * mp, const rpmuint8_t * data, size_t size)
+	/*@modifies mp @*/;
+
+/**
+ * Return single stream digest and reset parameters.
+ * @param mp		parameters
+ * @retval digest	binary digest
+ * @return		0 always
+ */
+int mbdDigest(mbdParam * mp, rpmuint8_t * digest)
+	/*@modifies mp, digest @*/;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
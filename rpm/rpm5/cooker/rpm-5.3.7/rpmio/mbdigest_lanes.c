@@ -0,0 +1,160 @@
+/** \ingroup rpmio
+ * \file rpmio/mbdigest_lanes.c
+ * MD5, SHA-1 and SHA-256 block functions over MBD_N independent lanes,
+ * included by mbdigest.c once for each vector width:
+ *	MBD_N		no. of lanes
+ *	MBD_V		type holding one 32-bit word of every lane
+ *	MBD_ATTR	function attributes (e.g. target ISA)
+ *	MBD_NAME(f)	name of the function for this width
+ * The state is word-major: word w of lane l is st[w * MBD_N + l]. Each
+ * call processes one 64 byte block of every lane.
+ */
+
+/**
+ * Load message word t of every lane.
+ */
+static MBD_ATTR void MBD_NAME(mbdLoad) (MBD_V * w,
+		const rpmuint8_t * const * blk, int t, int be)
+	/*@modifies *w @*/
+{
+    rpmuint32_t x[MBD_N];
+    int l;
+
+    for (l = 0; l < MBD_N; l++) {
+	const rpmuint8_t * p = blk[l] + 4 * t;
+	x[l] = (be ? MBD_BE32(p) : MBD_LE32(p));
+    }
+    memcpy(w, x, sizeof(*w));
+}
+
+static MBD_ATTR void MBD_NAME(mbdMD5) (rpmuint32_t * st,
+		const rpmuint8_t * const * blk)
+	/*@modifies st @*/
+{
+    MBD_V w[16];
+    MBD_V a, b, c, d, f;
+    MBD_V aa, bb, cc, dd;
+    int t;
+
+    for (t = 0; t < 16; t++)
+	MBD_NAME(mbdLoad) (w + t, blk, t, 0);
+    memcpy(&a, st + 0 * MBD_N, sizeof(a));
+    memcpy(&b, st + 1 * MBD_N, sizeof(b));
+    memcpy(&c, st + 2 * MBD_N, sizeof(c));
+    memcpy(&d, st + 3 * MBD_N, sizeof(d));
+    aa = a; bb = b; cc = c; dd = d;
+
+MBD_UNROLL
+    for (t = 0; t < 64; t++) {
+	int g;
+	switch (t >> 4) {
+	case 0:	f = d ^ (b & (c ^ d));	g = t;			break;
+	case 1:	f = c ^ (d & (b ^ c));	g = (5 * t + 1) & 15;	break;
+	case 2:	f = b ^ c ^ d;		g = (3 * t + 5) & 15;	break;
+	default: f = c ^ (b | ~d);	g = (7 * t) & 15;	break;
+	}
+	f = f + a + w[g] + md5K[t];
+	a = d; d = c; c = b;
+	b = b + MBD_ROTL(f, md5R[t]);
+    }
+
+    a += aa; b += bb; c += cc; d += dd;
+    memcpy(st + 0 * MBD_N, &a, sizeof(a));
+    memcpy(st + 1 * MBD_N, &b, sizeof(b));
+    memcpy(st + 2 * MBD_N, &c, sizeof(c));
+    memcpy(st + 3 * MBD_N, &d, sizeof(d));
+}
+
+static MBD_ATTR void MBD_NAME(mbdSHA1) (rpmuint32_t * st,
+		const rpmuint8_t * const * blk)
+	/*@modifies st @*/
+{
+    MBD_V w[16];
+    MBD_V a, b, c, d, e, f, x;
+    MBD_V aa, bb, cc, dd, ee;
+    int t;
+
+    for (t = 0; t < 16; t++)
+	MBD_NAME(mbdLoad) (w + t, blk, t, 1);
+    memcpy(&a, st + 0 * MBD_N, sizeof(a));
+    memcpy(&b, st + 1 * MBD_N, sizeof(b));
+    memcpy(&c, st + 2 * MBD_N, sizeof(c));
+    memcpy(&d, st + 3 * MBD_N, sizeof(d));
+    memcpy(&e, st + 4 * MBD_N, sizeof(e));
+    aa = a; bb = b; cc = c; dd = d; ee = e;
+
+MBD_UNROLL
+    for (t = 0; t < 80; t++) {
+	rpmuint32_t k;
+	if (t >= 16) {
+	    x = w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15];
+	    w[t & 15] = MBD_ROTL(x, 1);
+	}
+	switch (t / 20) {
+	case 0:	f = d ^ (b & (c ^ d));		k = 0x5a827999;	break;
+	case 1:	f = b ^ c ^ d;			k = 0x6ed9eba1;	break;
+	case 2:	f = (b & c) | (d & (b | c));	k = 0x8f1bbcdc;	break;
+	default: f = b ^ c ^ d;			k = 0xca62c1d6;	break;
+	}
+	x = MBD_ROTL(a, 5) + f + e + w[t & 15] + k;
+	e = d; d = c;
+	c = MBD_ROTL(b, 30);
+	b = a; a = x;
+    }
+
+    a += aa; b += bb; c += cc; d += dd; e += ee;
+    memcpy(st + 0 * MBD_N, &a, sizeof(a));
+    memcpy(st + 1 * MBD_N, &b, sizeof(b));
+    memcpy(st + 2 * MBD_N, &c, sizeof(c));
+    memcpy(st + 3 * MBD_N, &d, sizeof(d));
+    memcpy(st + 4 * MBD_N, &e, sizeof(e));
+}
+
+static MBD_ATTR void MBD_NAME(mbdSHA256) (rpmuint32_t * st,
+		const rpmuint8_t * const * blk)
+	/*@modifies st @*/
+{
+    MBD_V w[16];
+    MBD_V v[8];
+    MBD_V s0, s1, t1, t2;
+    int i, t;
+
+    for (t = 0; t < 16; t++)
+	MBD_NAME(mbdLoad) (w + t, blk, t, 1);
+    memcpy(v, st, sizeof(v));
+
+MBD_UNROLL
+    for (t = 0; t < 64; t++) {
+	/* v[] rotates: a is v[-t & 7], b is v[(1-t) & 7], ... */
+	MBD_V * a = &v[(0 - t) & 7];
+	MBD_V * b = &v[(1 - t) & 7];
+	MBD_V * c = &v[(2 - t) & 7];
+	MBD_V * d = &v[(3 - t) & 7];
+	MBD_V * e = &v[(4 - t) & 7];
+	MBD_V * f = &v[(5 - t) & 7];
+	MBD_V * g = &v[(6 - t) & 7];
+	MBD_V * h = &v[(7 - t) & 7];
+
+	if (t >= 16) {
+	    MBD_V x = w[(t - 15) & 15];
+	    MBD_V y = w[(t - 2) & 15];
+	    s0 = MBD_ROTR(x, 7) ^ MBD_ROTR(x, 18) ^ (x >> 3);
+	    s1 = MBD_ROTR(y, 17) ^ MBD_ROTR(y, 19) ^ (y >> 10);
+	    w[t & 15] += s0 + w[(t - 7) & 15] + s1;
+	}
+	t1 = *h + (MBD_ROTR(*e, 6) ^ MBD_ROTR(*e, 11) ^ MBD_ROTR(*e, 25))
+		+ (*g ^ (*e & (*f ^ *g))) + sha256K[t] + w[t & 15];
+	t2 = (MBD_ROTR(*a, 2) ^ MBD_ROTR(*a, 13) ^ MBD_ROTR(*a, 22))
+		+ ((*a & *b) | (*c & (*a | *b)));
+	*d += t1;
+	*h = t1 + t2;	/* the new a */
+    }
+
+    /* After 64 (a multiple of 8) rounds, v[] is back in a..h order. */
+    for (i = 0; i < 8; i++) {
+	MBD_V x;
+	memcpy(&x, st + i * MBD_N, sizeof(x));
+	v[i] += x;
+    }
+    memcpy(st, v, sizeof(v));
+}
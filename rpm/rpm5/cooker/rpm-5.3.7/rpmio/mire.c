@@ -98,7 +98,7 @@ void * mireFreeAll(miRE mire, int nmire)
 	while (--nmire > 0)
 	    (void) mireClean(mire + nmire);
 	/* XXX rpmgrep doesn't use mire pools yet. retrofit a fix. */
-	if (mire->_item.use != NULL && mire->_item.pool != NULL)
+	if (mire->_item.pool != NULL)
 	    mire = (miRE)rpmioFreePoolItem((rpmioItem)mire, __FUNCTION__, __FILE__, __LINE__);
 	else
 	    mire = _free(mire);
@@ -1837,11 +1837,8 @@ DAVDEBUG(-1, (stderr, "--> %s(%s,0x%x,0%o,%p)\n", __FUNCTION__, url, flags, (uns
     if (u->ctrl == NULL)
 	u->ctrl = fdNew("persist ctrl (davOpen)");
     else {
-	yarnLock use = u->ctrl->_item.use;
-	yarnPossess(use);
-	if (yarnPeekLock(use) > 2L && u->data == NULL)
+	if (u->ctrl->_item.refs > 2L && u->data == NULL)
 	    u->data = fdNew("persist data (davOpen)");
-	yarnRelease(use);
     }
 
     if (u->ctrl->u == NULL)
@@ -2208,11 +2205,8 @@ FD_t httpOpen(const char * url, /*@unused@*/ int flags,
     if (u->ctrl == NULL)
         u->ctrl = fdNew("persist ctrl (httpOpen)");
     if (u->ctrl != NULL) {	/* XXX can't happen */
-	yarnLock use = u->ctrl->_item.use;
-	yarnPossess(use);
-	if (yarnPeekLock(use) > 2L && u->data == NULL)
+	if (u->ctrl->_item.refs > 2L && u->data == NULL)
 	    u->data = fdNew("persist data (httpOpen)");
-	yarnRelease(use);
     }
 
     if (u->ctrl->u == NULL)
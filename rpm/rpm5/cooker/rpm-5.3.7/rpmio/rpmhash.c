@@ -17,22 +17,24 @@ typedef /*@owned@*/ const void * voidptr;
 typedef	struct hashBucket_s * hashBucket;
 
 /**
+ * Hash table entry, stored in-line in an open addressed table.
  */
 struct hashBucket_s {
-    voidptr key;			/*!< hash key */
+    voidptr key;			/*!< hash key (NULL if unused) */
 /*@owned@*/ voidptr * data;		/*!< pointer to hashed data */
     int dataCount;			/*!< length of data (0 if unknown) */
-/*@dependent@*/hashBucket next;		/*!< pointer to next item in bucket */
+    rpmuint32_t hash;			/*!< (mixed) hash value of key */
 };
 
 /**
  */
 struct hashTable_s {
     struct rpmioItem_s _item;	/*!< usage mutex and pool identifier. */
-    int numBuckets;			/*!< number of hash buckets */
+    int numBuckets;			/*!< number of hash buckets (2^N) */
+    int numEntries;			/*!< number of used hash buckets */
     size_t keySize;			/*!< size of key (0 if unknown) */
     int freeData;	/*!< should data be freed when table is destroyed? */
-    hashBucket * buckets;		/*!< hash bucket array */
+    hashBucket buckets;			/*!< hash bucket array */
 /*@relnull@*/
     hashFunctionType fn;		/*!< generate hash value for key */
 /*@relnull@*/
@@ -44,29 +46,101 @@ struct hashTable_s {
 };
 
 /**
- * Find entry in hash table.
- * @param ht            pointer to hash table
- * @param key           pointer to key value
- * @return pointer to hash bucket of key (or NULL)
+ * Return (mixed) hash value of key.
+ * The murmur3 finalizer spreads weak hash functions across the low bits
+ * that are used to index the table.
+ * @param ht		pointer to hash table
+ * @param key		pointer to key value
+ * @return		hash value
  */
-static /*@shared@*/ /*@null@*/
-hashBucket findEntry(hashTable ht, const void * key)
+static inline rpmuint32_t htHash(hashTable ht, const void * key)
+	/*@*/
+{
+    rpmuint32_t h = ht->fn(0, key, 0);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Find entry (or the empty bucket where the entry belongs) in hash table.
+ * @param ht		pointer to hash table
+ * @param key		pointer to key value
+ * @param hash		hash value of key
+ * @return		pointer to hash bucket
+ */
+static /*@shared@*/
+hashBucket htFind(hashTable ht, const void * key, rpmuint32_t hash)
 	/*@*/
 {
-    rpmuint32_t hash = 0;
+    rpmuint32_t mask = (rpmuint32_t) ht->numBuckets - 1;
+    rpmuint32_t i = hash & mask;
     hashBucket b;
 
     /*@-modunconnomods@*/
-    hash = ht->fn(hash, key, 0) % ht->numBuckets;
-    b = ht->buckets[hash];
-
-    while (b && b->key && ht->eq(b->key, key))
-	b = b->next;
+    while ((b = ht->buckets + i)->key != NULL) {
+	if (b->hash == hash && !ht->eq(b->key, key))
+	    break;
+	i = (i + 1) & mask;
+    }
     /*@=modunconnomods@*/
 
     return b;
 }
 
+/**
+ * Resize hash table to hold (at least) nentries entries.
+ * @param ht		pointer to hash table
+ * @param nentries	number of entries
+ */
+static void htResize(hashTable ht, int nentries)
+	/*@modifies ht @*/
+{
+    hashBucket obuckets = ht->buckets;
+    int onumBuckets = ht->numBuckets;
+    int numBuckets = 16;
+    int i;
+
+    /* Keep the table (at most) 3/4 full. */
+    while (numBuckets - numBuckets/4 < nentries)
+	numBuckets <<= 1;
+    if (numBuckets <= onumBuckets)
+	return;
+
+    ht->numBuckets = numBuckets;
+    ht->buckets = xcalloc(numBuckets, sizeof(*ht->buckets));
+    for (i = 0; i < onumBuckets; i++) {
+	hashBucket ob = obuckets + i;
+	rpmuint32_t mask = (rpmuint32_t) numBuckets - 1;
+	rpmuint32_t j;
+	if (ob->key == NULL)
+	    continue;
+	j = ob->hash & mask;
+	while (ht->buckets[j].key != NULL)
+	    j = (j + 1) & mask;
+	ht->buckets[j] = *ob;		/* structure assignment */
+    }
+    obuckets = _free(obuckets);
+}
+
+/**
+ * Find entry in hash table.
+ * @param ht            pointer to hash table
+ * @param key           pointer to key value
+ * @return pointer to hash bucket of key (or NULL)
+ */
+static /*@shared@*/ /*@null@*/
+hashBucket findEntry(hashTable ht, const void * key)
+	/*@*/
+{
+    hashBucket b = htFind(ht, key, htHash(ht, key));
+    return (b->key != NULL ? b : NULL);
+}
+
 int hashEqualityString(const void * key1, const void * key2)
 {
     const char *k1 = (const char *)key1;
@@ -141,19 +215,20 @@ rpmuint32_t hashFunctionString(rpmuint32_t h, const void * data, size_t size)
     return h;
 }
 
-void htAddEntry(hashTable ht, const void * key, const void * data)
+/**
+ * Add item to hash table, the table must have room for a new entry.
+ * @param ht		pointer to hash table
+ * @param key		pointer to key
+ * @param hash		hash value of key
+ * @param data		pointer to data value
+ */
+static void htInsert(hashTable ht, const void * key, rpmuint32_t hash,
+		const void * data)
+	/*@modifies ht @*/
 {
-    rpmuint32_t hash = 0;
-    hashBucket b;
-
-    hash = ht->fn(hash, key, 0) % ht->numBuckets;
-    b = ht->buckets[hash];
-
-    while (b && b->key && ht->eq(b->key, key))
-	b = b->next;
+    hashBucket b = htFind(ht, key, hash);
 
-    if (b == NULL) {
-	b = xmalloc(sizeof(*b));
+    if (b->key == NULL) {
 	if (ht->keySize) {
 	    char *k = xmalloc(ht->keySize);
 	    memcpy(k, key, ht->keySize);
@@ -161,16 +236,45 @@ void htAddEntry(hashTable ht, const void * key, const void * data)
 	} else {
 	    b->key = key;
 	}
+	b->hash = hash;
 	b->dataCount = 0;
-	b->next = ht->buckets[hash];
 	b->data = NULL;
-	ht->buckets[hash] = b;
+	ht->numEntries++;
     }
 
-    b->data = xrealloc(b->data, sizeof(*b->data) * (b->dataCount + 1));
+    /* Grow the data array in powers of 2. */
+    if ((b->dataCount & (b->dataCount - 1)) == 0)
+	b->data = xrealloc(b->data,
+		sizeof(*b->data) * (b->dataCount ? 2 * b->dataCount : 1));
     b->data[b->dataCount++] = data;
 }
 
+void htAddEntry(hashTable ht, const void * key, const void * data)
+{
+    if (ht->numEntries >= ht->numBuckets - ht->numBuckets/4)
+	htResize(ht, ht->numEntries + 1);
+    htInsert(ht, key, htHash(ht, key), data);
+}
+
+void htAddEntries(hashTable ht, const void ** keys, const void ** data,
+		int nentries)
+{
+    rpmuint32_t * hashes;
+    int i;
+
+    if (nentries <= 0)
+	return;
+
+    /* Resize once, and compute hashes before probing the table. */
+    htResize(ht, ht->numEntries + nentries);
+    hashes = xmalloc(nentries * sizeof(*hashes));
+    for (i = 0; i < nentries; i++)
+	hashes[i] = htHash(ht, keys[i]);
+    for (i = 0; i < nentries; i++)
+	htInsert(ht, keys[i], hashes[i], data[i]);
+    hashes = _free(hashes);
+}
+
 int htHasEntry(hashTable ht, const void * key)
 {
     hashBucket b;
@@ -198,22 +302,14 @@ int htGetEntry(hashTable ht, const void * key, const void * data,
 
 const void ** htGetKeys(hashTable ht)
 {
-    const void ** keys = xcalloc(ht->numBuckets+1, sizeof(const void*));
+    const void ** keys = xcalloc(ht->numEntries+1, sizeof(const void*));
     const void ** keypointer = keys;
-    hashBucket b, n;
+    hashBucket b;
     int i;
 
-    for (i = 0; i < ht->numBuckets; i++) {
-	b = ht->buckets[i];
-	if (b == NULL)
-	    continue;
-	if (b->data)
+    for (i = 0, b = ht->buckets; i < ht->numBuckets; i++, b++) {
+	if (b->key != NULL)
 	    *(keys++) = b->key;
-	do {
-	    n = b->next;
-	    if(n != NULL)
-    		*(keys++) = n->key;
-	} while ((b = n) != NULL);
     }
 
     return keypointer;
@@ -224,28 +320,24 @@ static void htFini(void * _ht)
 	/*@modifies _ht @*/
 {
     hashTable ht = _ht;
-    hashBucket b, n;
+    hashBucket b;
     int i;
 
-    for (i = 0; i < ht->numBuckets; i++) {
-	b = ht->buckets[i];
-	if (b == NULL)
+    for (i = 0, b = ht->buckets; i < ht->numBuckets; i++, b++) {
+	if (b->key == NULL)
 	    continue;
-	ht->buckets[i] = NULL;
 	if (ht->keySize > 0)
 	    b->key = _free(b->key);
-	do {
-	    n = b->next;
-	    if (b->data) {
-		if (ht->freeData)
-		    *b->data = _free(*b->data);
-		b->data = _free(b->data);
-	    }
-	    b = _free(b);
-	} while ((b = n) != NULL);
+	if (b->data) {
+	    if (ht->freeData)
+		*b->data = _free(*b->data);
+	    b->data = _free(b->data);
+	}
     }
 
     ht->buckets = _free(ht->buckets);
+    ht->numBuckets = 0;
+    ht->numEntries = 0;
 }
 /*@=mustmod@*/
 
@@ -271,8 +363,10 @@ hashTable htCreate(int numBuckets, size_t keySize, int freeData,
 {
     hashTable ht = htGetPool(_htPool);
 
-    ht->numBuckets = numBuckets;
-    ht->buckets = xcalloc(numBuckets, sizeof(*ht->buckets));
+    ht->numBuckets = 0;
+    ht->numEntries = 0;
+    ht->buckets = NULL;
+    htResize(ht, numBuckets);
     ht->keySize = keySize;
     ht->freeData = freeData;
     /*@-assignexpose@*/
@@ -65,6 +65,19 @@ void htAddEntry(hashTable ht, /*@owned@*/ const void * key,
 		/*@owned@*/ const void * data)
 	/*@modifies ht */;
 
+/**
+ * Add items to hash table.
+ * The table is resized (at most) once, and key hashes are computed
+ * before the table is probed.
+ * @param ht            pointer to hash table
+ * @param keys          array of pointers to keys
+ * @param data          array of pointers to data values
+ * @param nentries      number of items
+ */
+void htAddEntries(hashTable ht, /*@owned@*/ const void ** keys,
+		/*@owned@*/ const void ** data, int nentries)
+	/*@modifies ht */;
+
 /**
  * Retrieve item from hash table.
  * @param ht		pointer to hash table
@@ -135,7 +148,8 @@ hashTable htFree( /*@only@*/ hashTable ht)
  * Create hash table.
  * If keySize > 0, the key is duplicated within the table (which costs
  * memory, but may be useful anyway.
- * @param numBuckets    number of hash buckets
+ * The table grows as needed, NULL keys are not permitted.
+ * @param numBuckets    expected number of keys (a sizing hint)
  * @param keySize       size of key (0 if unknown)
  * @param freeData      Should data be freed when table is destroyed?
  * @param fn            function to generate hash key (NULL for default)
@@ -820,6 +820,14 @@ rpmioItem rpmioLinkPoolItem(/*@returned@*/ /*@null@*/ rpmioItem item,
 	/*@globals fileSystem @*/
 	/*@modifies item, fileSystem @*/;
 
+/**
+ * Atomically decrement a pool item refcount, without returning to pool.
+ * @param item		pool item
+ * @return		remaining refcount (<= 0 on last dereference)
+ */
+long rpmioDerefPoolItem(/*@null@*/ rpmioItem item)
+	/*@modifies item @*/;
+
 /**
  * Free a pool item.
  * @param item		pool item
@@ -33,9 +33,10 @@ typedef /*@signedintegraltype@*/	int			rpmint32_t;
 typedef	/*@refcounted@*/ struct rpmioItem_s * rpmioItem;
 struct rpmioItem_s {
 /*@null@*/
-    void *use;			/*!< use count -- return to pool when zero */
+    void *use;			/*!< usage mutex (only with pool debugging) */
 /*@kept@*/ /*@null@*/
     void *pool;			/*!< pool (or NULL if malloc'd) */
+    volatile long refs;		/*!< use count -- return to pool when zero */
 #if defined(__LCLINT__)
 /*@refs@*/
     int nrefs;			/*!< (unused) keep splint happy */
@@ -417,6 +418,21 @@ int rpmDigestFinal(/*@only@*/ /*@null@*/ DIGEST_CTX ctx,
 	/*@null@*/ /*@out@*/ size_t * lenp, int asAscii)
 		/*@modifies *datap, *lenp @*/;
 
+/** \ingroup rpmpgp
+ * Digest independent buffers, hashing several at once where possible.
+ * MD5, SHA1 and SHA256 use multi-buffer (or SHA-NI) kernels, chosen at
+ * run time, other algorithms digest one buffer at a time.
+ * @param hashalgo	type of digest
+ * @param n		no. of buffers
+ * @param bufs		buffers
+ * @param lens		no. bytes in each buffer
+ * @retval digests	binary digests (caller provides digest size bytes)
+ * @return		0 on success
+ */
+int rpmDigestBatch(pgpHashAlgo hashalgo, int n, const void ** bufs,
+		const size_t * lens, unsigned char ** digests)
+	/*@modifies *digests @*/;
+
 /** \ingroup rpmpgp
  *
  * Compute key material and add to digest context.
@@ -15,6 +15,19 @@ static int nrecs = 0;
 /*@unchecked@*/
 static /*@only@*/ /*@null@*/ rpmlogRec recs = NULL;
 
+/**
+ * Messages are logged from worker threads too: the lock protects recs.
+ */
+#if defined(WITH_PTHREADS) && defined(HAVE_PTHREAD_H) && !defined(__LCLINT__)
+/*@unchecked@*/
+static pthread_mutex_t _rpmlogLock = PTHREAD_MUTEX_INITIALIZER;
+#define	RPMLOG_LOCK()	((void) pthread_mutex_lock(&_rpmlogLock))
+#define	RPMLOG_UNLOCK()	((void) pthread_mutex_unlock(&_rpmlogLock))
+#else
+#define	RPMLOG_LOCK()	/* nothing */
+#define	RPMLOG_UNLOCK()	/* nothing */
+#endif
+
 /**
  * Wrapper to free(3), hides const compilation noise, permit NULL, return NULL.
  * @param p		memory to free
@@ -29,21 +42,31 @@ _free(/*@only@*/ /*@null@*/ /*@out@*/ const void * p) /*@modifies p@*/
 
 int rpmlogGetNrecs(void)
 {
-    return nrecs;
+    int n;
+    RPMLOG_LOCK();
+    n = nrecs;
+    RPMLOG_UNLOCK();
+    return n;
 }
 
 int rpmlogCode(void)
 {
+    int code = -1;
+    RPMLOG_LOCK();
     if (recs != NULL && nrecs > 0)
-	return recs[nrecs-1].code;
-    return -1;
+	code = recs[nrecs-1].code;
+    RPMLOG_UNLOCK();
+    return code;
 }
 
 const char * rpmlogMessage(void)
 {
+    const char * msg = _("(no error)");
+    RPMLOG_LOCK();
     if (recs != NULL && nrecs > 0)
-	return recs[nrecs-1].message;
-    return _("(no error)");
+	msg = recs[nrecs-1].message;
+    RPMLOG_UNLOCK();
+    return msg;
 }
 
 const char * rpmlogRecMessage(rpmlogRec rec)
@@ -66,12 +89,14 @@ void rpmlogPrint(FILE *f)
     if (f == NULL)
 	f = stderr;
 
+    RPMLOG_LOCK();
     if (recs)
     for (i = 0; i < nrecs; i++) {
 	rpmlogRec rec = recs + i;
 	if (rec->message && *rec->message)
 	    fprintf(f, "    %s", rec->message);
     }
+    RPMLOG_UNLOCK();
 }
 /*@=modfilesys@*/
 
@@ -81,6 +106,7 @@ void rpmlogClose (void)
 {
     int i;
 
+    RPMLOG_LOCK();
     if (recs)
     for (i = 0; i < nrecs; i++) {
 	rpmlogRec rec = recs + i;
@@ -88,6 +114,7 @@ void rpmlogClose (void)
     }
     recs = _free(recs);
     nrecs = 0;
+    RPMLOG_UNLOCK();
 }
 
 void rpmlogOpen (/*@unused@*/ const char *ident,
@@ -257,6 +284,7 @@ void vrpmlog (unsigned code, const char *fmt, va_list ap)
 
     /* Save copy of all messages at warning (or below == "more important"). */
     if (pri <= RPMLOG_WARNING) {
+	RPMLOG_LOCK();
 	if (recs == NULL)
 	    recs = xmalloc((nrecs+2) * sizeof(*recs));
 	else
@@ -268,6 +296,7 @@ void vrpmlog (unsigned code, const char *fmt, va_list ap)
 	recs[nrecs].code = 0;
 	recs[nrecs].pri = 0;
 	recs[nrecs].message = NULL;
+	RPMLOG_UNLOCK();
     }
 
     if (_rpmlogCallback) {
@@ -19,12 +19,21 @@ struct MacroEntry_s {
     unsigned short flags;	/*!< Flags. */
 };
 
+/*! The structure used to index macro names in a context. */
+struct MacroIndex_s {
+    unsigned int hash;		/*!< Macro name hash. */
+    int slot;			/*!< Macro table slot + 1 (0 if empty). */
+};
+
 /*! The structure used to store the set of macros in a context. */
 struct MacroContext_s {
 /*@owned@*//*@null@*/
-    MacroEntry *macroTable;	/*!< Macro entry table for context. */
+    MacroEntry *macroTable;	/*!< Macro entry table for context (unsorted). */
     int	macrosAllocated;	/*!< No. of allocated macros. */
     int	firstFree;		/*!< No. of macros. */
+/*@owned@*//*@null@*/
+    struct MacroIndex_s *macroIndex;	/*!< Open addressed macro name index. */
+    unsigned int indexMask;	/*!< No. of index buckets - 1 (power of 2). */
 };
 #endif
 
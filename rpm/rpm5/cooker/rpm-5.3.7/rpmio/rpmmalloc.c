@@ -7,6 +7,9 @@
 #include <rpmio.h>
 #include <rpmlog.h>
 #include <yarn.h>
+#if defined(WITH_PTHREADS)
+#include <pthread.h>
+#endif
 #include "debug.h"
 
 #if defined(WITH_DMALLOC)
@@ -32,6 +35,72 @@
 }
 /*@=modfilesys@*/
 
+/**
+ * Atomic use count operations.
+ */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))
+#define	rpmioAtomicAdd(_p, _n)	__sync_add_and_fetch((_p), (_n))
+#else
+/*@unchecked@*/
+static yarnLock _rpmioAtomicLock;
+
+static long rpmioAtomicAdd(volatile long * p, long n)
+	/*@modifies *p @*/
+{
+    long rc;
+    /* XXX the first pool is created before any threads are launched. */
+    if (_rpmioAtomicLock == NULL)
+	_rpmioAtomicLock = yarnNewLock(0);
+    yarnPossess(_rpmioAtomicLock);
+    rc = (*p += n);
+    yarnRelease(_rpmioAtomicLock);
+    return rc;
+}
+#endif
+
+/**
+ * Per-thread caches of unused items, avoiding the pool lock.
+ * Only unlimited pools w/o debugging are cached.
+ */
+#if defined(WITH_PTHREADS) && defined(__GNUC__) && defined(__ELF__) && !defined(__LCLINT__)
+#define	RPMIO_POOL_CACHE	16	/*!< no. of per-thread caches */
+#define	RPMIO_POOL_CACHEMAX	32	/*!< no. of items in a cache */
+
+struct rpmioCache_s {
+/*@dependent@*/ /*@null@*/
+    rpmioPool pool;		/*!< pool (NULL if unused) */
+    unsigned long serial;	/*!< pool serial no. (pool address is reused) */
+/*@null@*/
+    rpmioItem head;		/*!< linked list of cached items */
+    int count;			/*!< no. of cached items */
+};
+
+/**
+ * A thread's caches, linked so that rpmioFreePool can reach them all.
+ */
+struct rpmioCaches_s {
+/*@null@*/
+    struct rpmioCaches_s * next;	/*!< next thread's caches */
+    struct rpmioCache_s cache[RPMIO_POOL_CACHE];
+};
+
+/*@unchecked@*/
+static __thread struct rpmioCaches_s _rpmioCache;
+
+/*@unchecked@*/ /*@null@*/
+static struct rpmioCaches_s * _rpmioCaches;	/*!< all threads' caches */
+/*@unchecked@*/
+static pthread_mutex_t _rpmioCachesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*@unchecked@*/
+static volatile long _rpmioPoolSerial;
+
+/*@unchecked@*/
+static pthread_key_t _rpmioCacheKey;
+/*@unchecked@*/
+static pthread_once_t _rpmioCacheOnce = PTHREAD_ONCE_INIT;
+#endif
+
 /**
  */
 struct rpmioPool_s {
@@ -54,14 +123,96 @@ struct rpmioPool_s {
 /*@null@*/
     void (*fini) (void *item)
 	/*@modifies *item @*/;	/*!< destroy item contents. */
-    int reused;			/*!< number of items reused */
+    volatile long reused;	/*!< number of items reused */
     int made;			/*!< number of items made */
 /*@observer@*/
     const char *name;
 /*@null@*/
     void * zlog;
+    unsigned long serial;	/*!< pool serial no. */
 };
 
+#if defined(RPMIO_POOL_CACHE)
+/**
+ * Return an exiting thread's cached items to their pools.
+ * @param _caches	per-thread caches
+ */
+static void rpmioCacheFlush(void * _caches)
+	/*@*/
+{
+    struct rpmioCaches_s * caches = _caches;
+    struct rpmioCaches_s ** cp;
+    struct rpmioCache_s * c = caches->cache;
+    int i;
+
+    /* rpmioFreePool empties the slots of a pool under the same lock. */
+    (void) pthread_mutex_lock(&_rpmioCachesLock);
+    for (cp = &_rpmioCaches; *cp != NULL; cp = &(*cp)->next) {
+	if (*cp != caches)
+	    continue;
+	*cp = caches->next;
+	break;
+    }
+    caches->next = NULL;
+
+    for (i = 0; i < RPMIO_POOL_CACHE; i++, c++) {
+	rpmioPool pool = c->pool;
+	if (pool == NULL || c->head == NULL || c->serial != pool->serial) {
+	    memset(c, 0, sizeof(*c));
+	    continue;
+	}
+	yarnPossess(pool->have);
+	*pool->tail = c->head;
+	while (*pool->tail != NULL)
+	    pool->tail = (void *)&(*pool->tail)->pool;	/* XXX pool == next */
+	yarnTwist(pool->have, BY, c->count);
+	memset(c, 0, sizeof(*c));
+    }
+    (void) pthread_mutex_unlock(&_rpmioCachesLock);
+}
+
+static void rpmioCacheInit(void)
+	/*@*/
+{
+    (void) pthread_key_create(&_rpmioCacheKey, rpmioCacheFlush);
+}
+
+/**
+ * Return per-thread item cache for a pool.
+ * @param pool		memory pool
+ * @return		item cache (NULL if not cached, or slot is busy)
+ */
+/*@null@*/
+static struct rpmioCache_s * rpmioPoolCache(rpmioPool pool)
+	/*@*/
+{
+    struct rpmioCache_s * c;
+
+    if (pool->limit >= 0 || pool->flags)
+	return NULL;
+    c = &_rpmioCache.cache[(((unsigned long)pool) >> 4) % RPMIO_POOL_CACHE];
+    /* an empty cache can be claimed by another pool */
+    if (c->pool == NULL || c->count == 0) {
+	/* arrange to flush the caches when the thread exits */
+	if (c->pool == NULL) {
+	    (void) pthread_once(&_rpmioCacheOnce, rpmioCacheInit);
+	    if (pthread_getspecific(_rpmioCacheKey) == NULL) {
+		(void) pthread_mutex_lock(&_rpmioCachesLock);
+		_rpmioCache.next = _rpmioCaches;
+		_rpmioCaches = &_rpmioCache;
+		(void) pthread_mutex_unlock(&_rpmioCachesLock);
+		(void) pthread_setspecific(_rpmioCacheKey, &_rpmioCache);
+	    }
+	}
+	c->pool = pool;
+	c->serial = pool->serial;
+	c->head = NULL;
+	c->count = 0;
+    }
+    return (c->pool == pool && c->serial == pool->serial ? c : NULL);
+}
+#endif
+
 /*@unchecked@*/ /*@only@*/ /*@null@*/
 static rpmioPool _rpmioPool;
 
@@ -76,6 +227,27 @@ rpmioPool rpmioFreePool(rpmioPool pool)
     if (pool != NULL) {
 	rpmioItem item;
 	int count = 0;
+#if defined(RPMIO_POOL_CACHE)
+	struct rpmioCaches_s * caches;
+
+	/* empty every thread's cache of this pool, not just our own */
+	(void) pthread_mutex_lock(&_rpmioCachesLock);
+	for (caches = _rpmioCaches; caches != NULL; caches = caches->next) {
+	    struct rpmioCache_s * c = caches->cache;
+	    int i;
+	    for (i = 0; i < RPMIO_POOL_CACHE; i++, c++) {
+		if (c->pool != pool || c->serial != pool->serial)
+		    continue;
+		while ((item = c->head) != NULL) {
+		    c->head = item->pool;	/* XXX pool == next */
+		    item = _free(item);
+		    count++;
+		}
+		memset(c, 0, sizeof(*c));
+	    }
+	}
+	(void) pthread_mutex_unlock(&_rpmioCachesLock);
+#endif
 	yarnPossess(pool->have);
 	while ((item = pool->head) != NULL) {
 	    pool->head = item->pool;	/* XXX pool == next */
@@ -86,7 +258,7 @@ rpmioPool rpmioFreePool(rpmioPool pool)
 	}
 	yarnRelease(pool->have);
 	pool->have = yarnFreeLock(pool->have);
-	rpmlog(RPMLOG_DEBUG, D_("pool %s:\treused %d, alloc'd %d, free'd %d items.\n"), pool->name, pool->reused, pool->made, count);
+	rpmlog(RPMLOG_DEBUG, D_("pool %s:\treused %d, alloc'd %d, free'd %d items.\n"), pool->name, (int)pool->reused, pool->made, count);
 #ifdef	NOTYET
 assert(pool->made == count);
 #else
@@ -128,6 +300,9 @@ rpmioPool rpmioNewPool(const char * name, size_t size, int limit, int flags,
     pool->made = 0;
     pool->name = name;
     pool->zlog = NULL;
+#if defined(RPMIO_POOL_CACHE)
+    pool->serial = (unsigned long) rpmioAtomicAdd(&_rpmioPoolSerial, 1);
+#endif
     rpmlog(RPMLOG_DEBUG, D_("pool %s:\tcreated size %u limit %d flags %d\n"), pool->name, (unsigned)pool->size, pool->limit, pool->flags);
     return pool;
 }
@@ -139,15 +314,19 @@ rpmioItem rpmioUnlinkPoolItem(rpmioItem item, const char * msg,
 {
     rpmioPool pool;
     if (item == NULL) return NULL;
-    yarnPossess(item->use);
-    if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
-	const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
+    if (item->use != NULL) {
+	yarnPossess(item->use);
+	if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
+	    const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
 /*@-modfilesys@*/
-	fprintf(stderr, "--> %s %p -- %ld %s at %s:%u%s\n", pool->name,
-			item, yarnPeekLock(item->use), msg, fn, ln, imsg);
+	    fprintf(stderr, "--> %s %p -- %ld %s at %s:%u%s\n", pool->name,
+			item, item->refs, msg, fn, ln, imsg);
 /*@=modfilesys@*/
-    }
-    yarnTwist(item->use, BY, -1);
+	}
+	(void) rpmioAtomicAdd(&item->refs, -1);
+	yarnRelease(item->use);
+    } else
+	(void) rpmioAtomicAdd(&item->refs, -1);
 /*@-retalias@*/	/* XXX returning the deref'd item is used to detect nrefs = 0 */
     return item;
 /*@=retalias@*/
@@ -160,19 +339,28 @@ rpmioItem rpmioLinkPoolItem(rpmioItem item, const char * msg,
 {
     rpmioPool pool;
     if (item == NULL) return NULL;
-    yarnPossess(item->use);
-    if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
-	const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
+    if (item->use != NULL) {
+	yarnPossess(item->use);
+	if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
+	    const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
 /*@-modfilesys@*/
-	fprintf(stderr, "--> %s %p ++ %ld %s at %s:%u%s\n", pool->name,
-			item, yarnPeekLock(item->use)+1, msg, fn, ln, imsg);
+	    fprintf(stderr, "--> %s %p ++ %ld %s at %s:%u%s\n", pool->name,
+			item, item->refs+1, msg, fn, ln, imsg);
 /*@=modfilesys@*/
-    }
-    yarnTwist(item->use, BY, 1);
+	}
+	(void) rpmioAtomicAdd(&item->refs, 1);
+	yarnRelease(item->use);
+    } else
+	(void) rpmioAtomicAdd(&item->refs, 1);
     return item;
 }
 /*@=internalglobs@*/
 
+long rpmioDerefPoolItem(rpmioItem item)
+{
+    return (item != NULL ? rpmioAtomicAdd(&item->refs, -1) : 0);
+}
+
 /*@-internalglobs@*/
 /*@null@*/
 void * rpmioFreePoolItem(/*@killref@*/ /*@null@*/ rpmioItem item,
@@ -180,26 +368,36 @@ void * rpmioFreePoolItem(/*@killref@*/ /*@null@*/ rpmioItem item,
         /*@modifies item @*/
 {
     rpmioPool pool;
+    long refs;
+
     if (item == NULL) return NULL;
 
 #ifdef	NOTYET
 assert(item->pool != NULL);	/* XXX (*pool->fini) is likely necessary */
 #endif
-    yarnPossess(item->use);
-    if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
-	const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
+    if (item->use != NULL) {
+	yarnPossess(item->use);
+	if ((pool = item->pool) != NULL && pool->flags && msg != NULL) {
+	    const char * imsg = (pool->dbg ? (*pool->dbg)((void *)item) : "");
 /*@-modfilesys@*/
-	fprintf(stderr, "--> %s %p -- %ld %s at %s:%u%s\n", pool->name,
-			item, yarnPeekLock(item->use), msg, fn, ln, imsg);
+	    fprintf(stderr, "--> %s %p -- %ld %s at %s:%u%s\n", pool->name,
+			item, item->refs, msg, fn, ln, imsg);
 /*@=modfilesys@*/
+	}
+	refs = rpmioAtomicAdd(&item->refs, -1);
+	yarnRelease(item->use);
+    } else {
+	pool = item->pool;
+	refs = rpmioAtomicAdd(&item->refs, -1);
     }
-    if (yarnPeekLock(item->use) <= 1L) {
+
+    /* The caller that drops the last reference returns the item. */
+    if (refs <= 0) {
 	if (pool != NULL && pool->fini != NULL)
 	    (*pool->fini) ((void *)item);
 	VALGRIND_MEMPOOL_FREE(pool, item + 1);
 	item = rpmioPutPool(item);
-    } else
-	yarnTwist(item->use, BY, -1);
+    }
 /*@-retalias@*/	/* XXX returning the deref'd item is used to detect nrefs = 0 */
     return (void *) item;
 /*@=retalias@*/
@@ -212,6 +410,23 @@ rpmioItem rpmioGetPool(rpmioPool pool, size_t size)
     rpmioItem item;
 
     if (pool != NULL) {
+#if defined(RPMIO_POOL_CACHE)
+	struct rpmioCache_s * c = rpmioPoolCache(pool);
+
+	/* if this thread has a cached item, use it w/o locking the pool */
+	if (c != NULL && (item = c->head) != NULL) {
+	    c->head = item->pool;	/* XXX pool == next */
+	    c->count--;
+	    (void) rpmioAtomicAdd(&pool->reused, 1);
+	    item->pool = pool;		/* remember the pool this belongs to */
+	    item->refs = 0;
+	    VALGRIND_MEMPOOL_ALLOC(pool,
+		item + 1,
+		size - sizeof(struct rpmioItem_s));
+	    return item;
+	}
+#endif
+
 	/* if can't create any more, wait for a space to show up */
 	yarnPossess(pool->have);
 	if (pool->limit == 0)
@@ -223,8 +438,11 @@ rpmioItem rpmioGetPool(rpmioPool pool, size_t size)
 	    pool->head = item->pool;	/* XXX pool == next */
 	    if (pool->head == NULL)
 		pool->tail = &pool->head;
-	    pool->reused++;
+	    (void) rpmioAtomicAdd(&pool->reused, 1);
 	    item->pool = pool;		/* remember the pool this belongs to */
+	    item->refs = 0;
+	    if (item->use == NULL && pool->flags)
+		item->use = yarnNewLock(0);
 	    yarnTwist(pool->have, BY, -1);      /* one less in pool */
 	    VALGRIND_MEMPOOL_ALLOC(pool,
 		item + 1,
@@ -241,8 +459,10 @@ assert(pool->limit != 0);
     }
 
     item = xcalloc(1, size);
-    item->use = yarnNewLock(0);		/* XXX newref? */
+    /* XXX the usage mutex only serializes pool debugging spew. */
+    item->use = (pool != NULL && pool->flags ? yarnNewLock(0) : NULL);
     item->pool = pool;
+    item->refs = 0;		/* XXX newref? */
     VALGRIND_MEMPOOL_ALLOC(pool,
 	item + 1,
 	size - sizeof(struct rpmioItem_s));
@@ -255,21 +475,29 @@ rpmioItem rpmioPutPool(rpmioItem item)
 {
     rpmioPool pool;
 
+    item->refs = 0;
     if ((pool = item->pool) != NULL) {
+#if defined(RPMIO_POOL_CACHE)
+	struct rpmioCache_s * c = rpmioPoolCache(pool);
+
+	/* keep a few items in this thread's cache w/o locking the pool */
+	if (c != NULL && c->count < RPMIO_POOL_CACHEMAX) {
+	    item->pool = c->head;	/* XXX pool == next */
+	    c->head = item;
+	    c->count++;
+	    return NULL;
+	}
+#endif
 	yarnPossess(pool->have);
 	item->pool = NULL;		/* XXX pool == next */
 	*pool->tail = item;
 	pool->tail = (void *)&item->pool;/* XXX pool == next */
 	yarnTwist(pool->have, BY, 1);
-	if (item->use != NULL)
-	    yarnTwist(item->use, TO, 0);
 	return NULL;
     }
 
-    if (item->use != NULL) {
-	yarnTwist(item->use, TO, 0);
+    if (item->use != NULL)
 	item->use = yarnFreeLock(item->use);
-    }
     (void) _free(item);
     return NULL;
 }
@@ -3752,8 +3752,7 @@ const char ** rpmnixArgv(rpmnix nix, int * argcp)
 static void rpmnixInitPopt(rpmnix nix, int ac, char ** av, poptOption tbl)
 	/*@modifies nix @*/
 {
-    void *use =  nix->_item.use;
-    void *pool = nix->_item.pool;
+    struct rpmioItem_s item = nix->_item;
     char * av1 = NULL;
     poptContext con;
     int rc;
@@ -3829,8 +3828,7 @@ fprintf(stderr, "\tpoptGetNextOpt loop end: rc(%d): %s\n", rc, poptStrerror(rc))
 
     *nix = _nix;	/* structure assignment */
     memset(&_nix, 0, sizeof(_nix));
-    nix->_item.use = use;
-    nix->_item.pool = pool;
+    nix->_item = item;		/* structure assignment */
     rc = argvAppend(&nix->av, poptGetArgs(con));
 #ifdef	DYING
     nix->con = (void *) con;
@@ -1144,15 +1144,8 @@ static void pgpDigFini(void * __dig)
     dig->pub = _free(dig->pub);
     dig->publen = 0;
 
-    /* XXX there's a recursion here ... release and reacquire the lock */
-#ifndef	BUGGY
-    yarnRelease(dig->_item.use);
-#endif
     /* Dump the signature/pubkey data. */
     pgpDigClean(dig);
-#ifndef	BUGGY
-    yarnPossess(dig->_item.use);
-#endif
 
     if (dig->hdrctx != NULL)
 	(void) rpmDigestFinal(dig->hdrctx, NULL, NULL, 0);
@@ -64,6 +64,26 @@ static struct rpmsql_s _sql;
 #define VTDBG(_vt, _l) if ((_vt)->debug) fprintf _l
 #define VTDBGNOISY(_vt, _l) if ((_vt)->debug < 0) fprintf _l
 
+/**
+ * A column value of a row.
+ */
+struct rpmvtKey_s {
+/*@dependent@*/ /*@null@*/
+    const char * s;		/*!< value (NULL sorts first) */
+    size_t ns;			/*!< value length */
+    int ix;			/*!< row index */
+};
+
+/**
+ * Rows sorted by a column value.
+ */
+typedef struct rpmvtIdx_s * rpmvtIdx;
+struct rpmvtIdx_s {
+    struct rpmvtKey_s * keys;	/*!< all rows, in value order */
+    int n;			/*!< no. of rows */
+    int nnull;			/*!< no. of rows with NULL value */
+};
+
 /**
  * rpmvt pool destructor.
  */
@@ -76,6 +96,18 @@ static void rpmvtFini(void * _VT)
     
 
 VTDBGNOISY(vt, (stderr, "==> %s(%p)\n", __FUNCTION__, vt));
+    if (vt->_idx) {
+	int i;
+	for (i = 0; i < vt->ncols; i++) {
+	    rpmvtIdx idx = vt->_idx[i];
+	    if (idx == NULL)
+		continue;
+	    idx->keys = _free(idx->keys);
+	    idx = _free(idx);
+	}
+	vt->_idx = _free(vt->_idx);
+    }
+    vt->_mire = mireFree((miRE)vt->_mire);
     vt->argv = argvFree(vt->argv);
     vt->argc = 0;
     vt->fields = argvFree(vt->fields);
@@ -213,6 +245,7 @@ assert(av);
     u = _rpmvtJoin("", av, "");
     u[strlen(u)-2] = ' ';	/* XXX nuke the final comma */
     xx = argvAppend(&vt->cols, av);
+    vt->ncols = argvCount(vt->cols);
 
 #define	dbN	vt->argv[1]
 #define	tblN	vt->argv[2]
@@ -227,6 +260,216 @@ VTDBG(vt, (stderr, "%s\n", hu));
     return hu;
 }
 
+/**
+ * Does a column (declaration) have a name?
+ * @param col		column declaration, e.g. "path HIDDEN"
+ * @param name		column name
+ * @return		1 if col declares name
+ */
+static int rpmvtColIs(const char * col, const char * name)
+	/*@*/
+{
+    size_t nb = strcspn(col, " \t");
+    return (strlen(name) == nb && !strncmp(col, name, nb));
+}
+
+/**
+ * Return the compiled vd->regex of a virtual table.
+ * @param vt		virtual table
+ * @return		compiled pattern
+ */
+static miRE rpmvtMire(rpmvt vt)
+	/*@modifies vt @*/
+{
+    if (vt->_mire == NULL) {
+	miRE mire = mireNew(RPMMIRE_REGEX, 0);
+	int xx;
+	xx = mireSetCOptions(mire, RPMMIRE_REGEX, 0, 0, NULL);
+	xx = mireRegcomp(mire, vt->vd->regex);
+	vt->_mire = mire;
+    }
+    return (miRE) vt->_mire;
+}
+
+/**
+ * Find a column value parsed from a row with vd->regex.
+ * @param vt		virtual table
+ * @param path		row
+ * @param col		column declaration
+ * @retval *sp		value (NULL if none)
+ * @retval *nsp		value length
+ * @return		0 if found, 1 if the value is the file path/col, -1 if none
+ */
+static int rpmvtRegexValue(rpmvt vt, const char * path, const char * col,
+		const char ** sp, size_t * nsp)
+	/*@modifies vt, *sp, *nsp @*/
+{
+    int rc = -1;
+    int i;
+
+    *sp = NULL;
+    *nsp = 0;
+assert(vt->fields);
+    for (i = 0; i < vt->nfields; i++) {
+	/* Slurp file contents for unknown field values. */
+	/* XXX procdb/yumdb */
+	/* XXX uri's? */
+	if (path[0] == '/' && !strcmp("*", vt->fields[i])) {
+	    rc = 1;
+	    break;
+	}
+	if (rpmvtColIs(col, vt->fields[i])) {
+	    miRE mire = rpmvtMire(vt);
+	    int offsets[10 * 3];
+	    int noffsets = (int)(sizeof(offsets)/sizeof(offsets[0]));
+	    int ix = 2 * (i + 1);
+	    int xx;
+
+	    memset(offsets, -1, sizeof(offsets));
+	    xx = mireSetEOptions(mire, offsets, noffsets);
+	    xx = mireRegexec(mire, path, strlen(path));
+	    if (xx == 0 && ix < noffsets && offsets[ix] >= 0
+	     && offsets[ix+1] >= offsets[ix])
+	    {
+		*sp = path + offsets[ix];
+		*nsp = offsets[ix+1] - offsets[ix];
+		rc = 0;
+	    }
+	    xx = mireSetEOptions(mire, NULL, 0);
+	    break;
+	}
+    }
+    return rc;
+}
+
+/**
+ * Can a column be searched using a sorted index?
+ * Only text values with the default (binary) collation are indexed.
+ * @param vt		virtual table
+ * @param colx		column index
+ * @return		1 if indexable
+ */
+static int rpmvtIndexable(rpmvt vt, int colx)
+	/*@*/
+{
+    const char * col;
+    const char * t;
+    int i;
+
+    if (colx < 0 || colx >= vt->ncols)
+	return 0;
+    col = vt->cols[colx];
+    if (strcasestr(col, "collate") != NULL)
+	return 0;
+    if ((t = hasSqlType(col)) != NULL
+     && !(t - col >= 5 && !strncasecmp(t - 5, " text", 5)))
+	return 0;
+    if (rpmvtColIs(col, "path"))
+	return 1;
+    if (vt->vd->regex == NULL || vt->fields == NULL)
+	return 0;
+    for (i = 0; i < vt->nfields; i++) {
+	if (!strcmp("*", vt->fields[i]))
+	    break;
+	if (rpmvtColIs(col, vt->fields[i]))
+	    return 1;
+    }
+    return 0;
+}
+
+static int rpmvtKeyCmp(const void * _a, const void * _b)
+	/*@*/
+{
+    const struct rpmvtKey_s * a = _a;
+    const struct rpmvtKey_s * b = _b;
+    int rc;
+
+    if (a->s == NULL || b->s == NULL)
+	rc = (a->s != NULL) - (b->s != NULL);
+    else {
+	rc = memcmp(a->s, b->s, (a->ns < b->ns ? a->ns : b->ns));
+	if (rc == 0)
+	    rc = (a->ns > b->ns) - (a->ns < b->ns);
+    }
+    if (rc == 0)
+	rc = (a->ix > b->ix) - (a->ix < b->ix);
+    return rc;
+}
+
+/**
+ * Return the rows of a virtual table sorted by a column value.
+ * The index is built on first use, and kept until the table is freed.
+ * @param vt		virtual table
+ * @param colx		(indexable) column index
+ * @return		sorted rows
+ */
+static rpmvtIdx rpmvtIndex(rpmvt vt, int colx)
+	/*@modifies vt @*/
+{
+    const char * col = vt->cols[colx];
+    int ispath = rpmvtColIs(col, "path");
+    rpmvtIdx idx;
+    int i;
+
+    if (vt->_idx == NULL)
+	vt->_idx = xcalloc(vt->ncols, sizeof(*vt->_idx));
+    if ((idx = vt->_idx[colx]) != NULL)
+	return idx;
+
+    idx = xcalloc(1, sizeof(*idx));
+    idx->keys = xmalloc((vt->ac + 1) * sizeof(*idx->keys));
+    for (i = 0; i < vt->ac; i++) {
+	struct rpmvtKey_s * k = idx->keys + i;
+	const char * path = vt->av[i];
+
+	k->ix = i;
+	if (ispath) {
+	    k->s = path;
+	    k->ns = strlen(path);
+	} else
+	if (rpmvtRegexValue(vt, path, col, &k->s, &k->ns) != 0) {
+	    k->s = NULL;
+	    k->ns = 0;
+	}
+	if (k->s == NULL)
+	    idx->nnull++;
+    }
+    idx->n = vt->ac;
+    qsort(idx->keys, idx->n, sizeof(*idx->keys), rpmvtKeyCmp);
+    vt->_idx[colx] = idx;
+
+VTDBG(vt, (stderr, "\tindex %s: %d rows (%d NULL)\n", col, idx->n, idx->nnull));
+    return idx;
+}
+
+/**
+ * Find the first (non-NULL) sorted row with a value >= (or >) s.
+ * @param idx		sorted rows
+ * @param s		value
+ * @param ns		value length
+ * @param after		0 finds the first value >= s, 1 the first value > s
+ * @return		sorted row index
+ */
+static int rpmvtIdxSearch(rpmvtIdx idx, const char * s, size_t ns, int after)
+	/*@*/
+{
+    int lo = idx->nnull;
+    int hi = idx->n;
+
+    while (lo < hi) {
+	int mid = lo + (hi - lo) / 2;
+	const struct rpmvtKey_s * k = idx->keys + mid;
+	int rc = memcmp(k->s, s, (k->ns < ns ? k->ns : ns));
+	if (rc == 0)
+	    rc = (k->ns > ns) - (k->ns < ns);
+	if (rc < 0 || (after && rc == 0))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
 int rpmvtLoadArgv(rpmvt vt, rpmvt * vtp)
 {
     sqlite3 * db = (sqlite3 *) vt->db;
@@ -380,46 +623,184 @@ int rpmvtConnect(void * _db, void * pAux,
     return rpmvtLoadArgv(rpmvtNew(_db, pAux, argv, &_argVD), vtp);
 }
 
-#ifdef	NOTYET
 static void dumpInfo(const char * msg, const struct sqlite3_index_info * s)
 {
 fprintf(stderr, "--------------------- %s\n", (msg ? msg : ""));
 #define _PRT(f,v) fprintf(stderr, "%20s: " #f "\n", #v, s->v)
         _PRT(%p, aConstraintUsage);
-        _PRT(%d, idxNum);
-        _PRT(%s, idxStr);
+        _PRT(0x%x, idxNum);
+        _PRT(%p, idxStr);
         _PRT(%d, needToFreeIdxStr);
         _PRT(%d, orderByConsumed);
         _PRT(%g, estimatedCost);
 #undef  _PRT
 }
-#endif
+
+/* rpmvtBestIndex() plans: flags, column index << RPMVT_IDX_SHIFT. */
+#define	RPMVT_IDX_EQ	(1 << 0)	/*!< col = argv[0] */
+#define	RPMVT_IDX_LO	(1 << 1)	/*!< col > argv[] (lower bound) */
+#define	RPMVT_IDX_LOEQ	(1 << 2)	/*!< ... col >= argv[] */
+#define	RPMVT_IDX_HI	(1 << 3)	/*!< col < argv[] (upper bound) */
+#define	RPMVT_IDX_HIEQ	(1 << 4)	/*!< ... col <= argv[] */
+#define	RPMVT_IDX_ORDER	(1 << 5)	/*!< rows in col order */
+#define	RPMVT_IDX_DESC	(1 << 6)	/*!< ... descending */
+#define	RPMVT_IDX_SHIFT	8
+
+/**
+ * Rank the uniqueness of an (indexable) column.
+ * @param vt		virtual table
+ * @param colx		column index
+ * @return		2 for path, 1 for the key column (vd->idx), else 0
+ */
+static int rpmvtColRank(rpmvt vt, int colx)
+	/*@*/
+{
+    const char * col = vt->cols[colx];
+    rpmvd vd = vt->vd;
+
+    if (rpmvtColIs(col, "path"))
+	return 2;
+    if (vd->idx > 0 && vd->idx <= vt->nfields
+     && rpmvtColIs(col, vt->fields[vd->idx - 1]))
+	return 1;
+    return 0;
+}
 
 int rpmvtBestIndex(rpmvt vt, void * _pInfo)
 {
     sqlite3_index_info * pInfo = (sqlite3_index_info *) _pInfo;
+    double nrows = (vt->ac > 0 ? (double) vt->ac : 1.0);
+    double rows = nrows;
+    int nlog = 1;
+    int eq = -1;
+    int lo = -1;
+    int hi = -1;
+    int colx = -1;
+    int flags = 0;
     int rc = SQLITE_OK;
-#ifdef	NOTYET
     int i;
-#endif
 
 VTDBG(vt, (stderr, "--> %s(%p,%p)\n", __FUNCTION__, vt, pInfo));
 
-#ifdef	NOTYET
-    if (pInfo->aConstraint)
+    if (vt->debug) {
+	if (pInfo->aConstraint)
+	for (i = 0; i < pInfo->nConstraint; i++) {
+	    const struct sqlite3_index_constraint * p = pInfo->aConstraint + i;
+	    fprintf(stderr, "\tcol %s(%d) 0x%02x 0x%02x\n",
+		(p->iColumn >= 0 ? vt->cols[p->iColumn] : "rowid"), p->iColumn,
+		p->op, p->usable);
+	}
+	if (pInfo->aOrderBy)
+	for (i = 0; i < pInfo->nOrderBy; i++) {
+	    const struct sqlite3_index_orderby * p = pInfo->aOrderBy + i;
+	    fprintf(stderr, "\tcol %s(%d) %s\n",
+		(p->iColumn >= 0 ? vt->cols[p->iColumn] : "rowid"), p->iColumn,
+		(p->desc ? "DESC" : "ASC"));
+	}
+    }
+
+    /* Prefer an equality on path, then on the key column, then any. */
     for (i = 0; i < pInfo->nConstraint; i++) {
 	const struct sqlite3_index_constraint * p = pInfo->aConstraint + i;
-	fprintf(stderr, "\tcol %s(%d) 0x%02x 0x%02x\n", vt->cols[p->iColumn], p->iColumn,
-		p->op, p->usable);
+	if (!p->usable || p->op != SQLITE_INDEX_CONSTRAINT_EQ
+	 || !rpmvtIndexable(vt, p->iColumn))
+	    continue;
+	if (eq < 0 || rpmvtColRank(vt, p->iColumn)
+		> rpmvtColRank(vt, pInfo->aConstraint[eq].iColumn))
+	    eq = i;
     }
-    if (pInfo->aOrderBy)
-    for (i = 0; i < pInfo->nOrderBy; i++) {
-	const struct sqlite3_index_orderby * p = pInfo->aOrderBy + i;
-	fprintf(stderr, "\tcol %s(%d) %s\n", vt->cols[p->iColumn], p->iColumn,
-		(p->desc ? "DESC" : "ASC"));
+
+    if (eq >= 0) {
+	colx = pInfo->aConstraint[eq].iColumn;
+	flags |= RPMVT_IDX_EQ;
+    } else {
+	/* Otherwise use a range, preferably on the ORDER BY column. */
+	int ocolx = (pInfo->nOrderBy == 1 ? pInfo->aOrderBy[0].iColumn : -1);
+	for (i = 0; i < pInfo->nConstraint; i++) {
+	    const struct sqlite3_index_constraint * p = pInfo->aConstraint + i;
+	    if (!p->usable || !rpmvtIndexable(vt, p->iColumn))
+		continue;
+	    switch (p->op) {
+	    case SQLITE_INDEX_CONSTRAINT_GT:
+	    case SQLITE_INDEX_CONSTRAINT_GE:
+	    case SQLITE_INDEX_CONSTRAINT_LT:
+	    case SQLITE_INDEX_CONSTRAINT_LE:
+		/*@switchbreak@*/ break;
+	    default:
+		continue;
+		/*@notreached@*/ /*@switchbreak@*/ break;
+	    }
+	    if (colx < 0 || (p->iColumn == ocolx && colx != ocolx)) {
+		colx = p->iColumn;
+		lo = hi = -1;
+	    }
+	    if (p->iColumn != colx)
+		continue;
+	    if (p->op == SQLITE_INDEX_CONSTRAINT_GT
+	     || p->op == SQLITE_INDEX_CONSTRAINT_GE)
+	    {
+		if (lo < 0)
+		    lo = i;
+	    } else {
+		if (hi < 0)
+		    hi = i;
+	    }
+	}
+	if (lo >= 0) {
+	    flags |= RPMVT_IDX_LO;
+	    if (pInfo->aConstraint[lo].op == SQLITE_INDEX_CONSTRAINT_GE)
+		flags |= RPMVT_IDX_LOEQ;
+	}
+	if (hi >= 0) {
+	    flags |= RPMVT_IDX_HI;
+	    if (pInfo->aConstraint[hi].op == SQLITE_INDEX_CONSTRAINT_LE)
+		flags |= RPMVT_IDX_HIEQ;
+	}
+    }
+
+    /* Return rows in index order when that satisfies ORDER BY. */
+    if (pInfo->nOrderBy == 1) {
+	const struct sqlite3_index_orderby * p = pInfo->aOrderBy;
+	if (colx < 0 && rpmvtIndexable(vt, p->iColumn))
+	    colx = p->iColumn;
+	if (colx >= 0 && p->iColumn == colx) {
+	    flags |= RPMVT_IDX_ORDER;
+	    if (p->desc)
+		flags |= RPMVT_IDX_DESC;
+	    pInfo->orderByConsumed = 1;
+	}
     }
-    dumpInfo(__FUNCTION__, pInfo);
+
+    /* Constraint values are passed to rpmvcFilter() as eq, lo, hi. */
+    i = 0;
+    if (eq >= 0)
+	pInfo->aConstraintUsage[eq].argvIndex = ++i;
+    if (lo >= 0)
+	pInfo->aConstraintUsage[lo].argvIndex = ++i;
+    if (hi >= 0)
+	pInfo->aConstraintUsage[hi].argvIndex = ++i;
+
+    /* Cost: a binary search, then the rows returned. */
+    while (nlog < 31 && (1 << nlog) < vt->ac)
+	nlog++;
+    if (flags & RPMVT_IDX_EQ)
+	rows = (rpmvtColRank(vt, colx) > 0 ? 1.0 : 10.0);
+    else if ((flags & RPMVT_IDX_LO) && (flags & RPMVT_IDX_HI))
+	rows = nrows / 4;
+    else if (flags & (RPMVT_IDX_LO | RPMVT_IDX_HI))
+	rows = nrows / 2;
+    if (rows > nrows)
+	rows = nrows;
+    pInfo->estimatedCost = rows;
+    if (flags & (RPMVT_IDX_EQ | RPMVT_IDX_LO | RPMVT_IDX_HI))
+	pInfo->estimatedCost += nlog;
+#if SQLITE_VERSION_NUMBER >= 3008002
+    pInfo->estimatedRows = (sqlite3_int64) rows;
 #endif
+    pInfo->idxNum = (flags ? (flags | (colx << RPMVT_IDX_SHIFT)) : 0);
+
+if (vt->debug)
+dumpInfo(__FUNCTION__, pInfo);
 
 VTDBG(vt, (stderr, "<-- %s(%p,%p) rc %d\n", __FUNCTION__, vt, pInfo, rc));
 
@@ -588,6 +969,8 @@ static void rpmvcFini(void * _VC)
     rpmvc vc = &VC->vc;
 
 VCDBGNOISY(vc, (stderr, "==> %s(%p)\n", __FUNCTION__, vc));
+    vc->sel = _free(vc->sel);
+    vc->nsel = 0;
     if (vc->vt)
 	(void) rpmvtFree(vc->vt);
     vc->vt = NULL;
@@ -660,8 +1043,63 @@ int rpmvcFilter(rpmvc vc, int idxNum, const char * idxStr,
     int rc = SQLITE_OK;
 
 VCDBGNOISY(vc, (stderr, "--> %s(%p,%d,%s,%p[%u]) [%d:%d]\n", __FUNCTION__, vc, idxNum, idxStr, argv, (unsigned)argc, vc->ix, vc->nrows));
+if (vc->debug)
 dumpArgv(__FUNCTION__, argc, _argv);
 
+    vc->sel = _free(vc->sel);
+    vc->nsel = 0;
+    vc->sx = 0;
+    vc->ix = -1;
+
+    if (idxNum != 0) {
+	/* Select the rows from a sorted index (see rpmvtBestIndex). */
+	rpmvtIdx idx = rpmvtIndex(vc->vt, idxNum >> RPMVT_IDX_SHIFT);
+	int lo = 0;
+	int hi = idx->n;
+	int ax = 0;
+	int i;
+
+	if (idxNum & (RPMVT_IDX_EQ | RPMVT_IDX_LO | RPMVT_IDX_HI))
+	    lo = idx->nnull;	/* NULL never compares true */
+	if (idxNum & RPMVT_IDX_EQ) {
+	    const char * s = (const char *) sqlite3_value_text(argv[ax]);
+	    size_t ns = sqlite3_value_bytes(argv[ax]);
+	    ax++;
+	    if (s != NULL) {
+		lo = rpmvtIdxSearch(idx, s, ns, 0);
+		hi = rpmvtIdxSearch(idx, s, ns, 1);
+	    } else
+		hi = lo;
+	}
+	/* Non-text bounds compare by type, not value: just scan. */
+	if (idxNum & RPMVT_IDX_LO) {
+	    if (sqlite3_value_type(argv[ax]) == SQLITE_TEXT) {
+		const char * s = (const char *) sqlite3_value_text(argv[ax]);
+		size_t ns = sqlite3_value_bytes(argv[ax]);
+		i = rpmvtIdxSearch(idx, s, ns, !(idxNum & RPMVT_IDX_LOEQ));
+		if (i > lo)
+		    lo = i;
+	    }
+	    ax++;
+	}
+	if (idxNum & RPMVT_IDX_HI) {
+	    if (sqlite3_value_type(argv[ax]) == SQLITE_TEXT) {
+		const char * s = (const char *) sqlite3_value_text(argv[ax]);
+		size_t ns = sqlite3_value_bytes(argv[ax]);
+		i = rpmvtIdxSearch(idx, s, ns, (idxNum & RPMVT_IDX_HIEQ));
+		if (i < hi)
+		    hi = i;
+	    }
+	    ax++;
+	}
+
+	vc->nsel = (hi > lo ? hi - lo : 0);
+	vc->sel = xmalloc((vc->nsel + 1) * sizeof(*vc->sel));
+	for (i = 0; i < vc->nsel; i++)
+	    vc->sel[i] = idx->keys[(idxNum & RPMVT_IDX_DESC)
+			? hi - 1 - i : lo + i].ix;
+	vc->ix = (vc->nsel > 0 ? vc->sel[0] : vc->nrows);
+    } else
     if (vc->nrows > 0)
 	vc->ix = 0;
 
@@ -674,6 +1112,11 @@ int rpmvcNext(rpmvc vc)
 {
     int rc = SQLITE_OK;
 
+    if (vc->sel != NULL) {
+	if (vc->sx < vc->nsel)
+	    vc->sx++;
+	vc->ix = (vc->sx < vc->nsel ? vc->sel[vc->sx] : vc->nrows);
+    } else
     if (vc->ix >= 0 && vc->ix < vc->nrows)		/* XXX needed? */
 	vc->ix++;
 
@@ -702,70 +1145,41 @@ int rpmvcColumn(rpmvc vc, void * _pContext, int colx)
     const char * col = vt->cols[colx];
     int rc = SQLITE_OK;
 
-    size_t nb;
-    miRE mire = NULL;
-    int noffsets = 0;
-    int * offsets = NULL;
+    const char * s;
+    size_t ns;
     int xx;
     int i;
 
-    /* Use a PCRE pattern for parsing column value. */
-    if (vd->regex) {
-	mire = mireNew(RPMMIRE_REGEX, 0);
-	xx = mireSetCOptions(mire, RPMMIRE_REGEX, 0, 0, NULL);
-	xx = mireRegcomp(mire, vd->regex);	/* XXX move to rpmvtNew */
-
-	noffsets = 10 * 3;
-	nb = noffsets * sizeof(*offsets);
-	offsets = memset(alloca(nb), -1, nb);
-	xx = mireSetEOptions(mire, offsets, noffsets);
-
-nb = strlen(path);
-	xx = mireRegexec(mire, path, nb);
-assert(xx == 0);
-
-	for (i = 0; i < noffsets; i += 2) {
-	    if (offsets[i] < 0)
-		continue;
-assert(offsets[i  ] >= 0 && offsets[i  ] <= (int)nb);
-assert(offsets[i+1] >= 0 && offsets[i+1] <= (int)nb);
-	    offsets[i+1] -= offsets[i];	/* XXX convert offset to length */
-VCDBGNOISY(vc, (stderr, "\t%d [%d,%d] %.*s\n", i/2, offsets[i], offsets[i+1], offsets[i+1], path+offsets[i]));
-	}
-
-    }
-
-    if (!strcmp(col, "path"))
+    if (rpmvtColIs(col, "path"))
 	sqlite3_result_text(pContext, path, -1, SQLITE_STATIC);
     else
     if (vd->regex) {
 	/* Use a PCRE pattern for parsing column value. */
-assert(vt->fields);
-	for (i = 0; i < vt->nfields; i++) {
-	    /* Slurp file contents for unknown field values. */
-	    /* XXX procdb/yumdb */
-	    /* XXX uri's? */
-	    if (path[0] == '/' && !strcmp("*", vt->fields[i])) {
-		const char * fn = rpmGetPath(path, "/", col, NULL);
-		if (!Access(fn, R_OK)) {
-		    rpmiob iob = NULL;
-		    xx = rpmiobSlurp(fn, &iob);
-		    sqlite3_result_text(pContext, rpmiobStr(iob), rpmiobLen(iob), SQLITE_TRANSIENT);
-		    iob = rpmiobFree(iob);
-		} else
-		    sqlite3_result_null(pContext);
-		break;
+	switch (rpmvtRegexValue(vt, path, col, &s, &ns)) {
+	case 0:
+VCDBGNOISY(vc, (stderr, "\t%s [%d] %.*s\n", col, (int)ns, (int)ns, s));
+	    sqlite3_result_text(pContext, s, ns, SQLITE_STATIC);
+	    break;
+	case 1:
+	{   /* Slurp file contents for unknown field values. */
+	    char * name = xstrdup(col);
+	    const char * fn;
+	    name[strcspn(name, " \t")] = '\0';
+	    fn = rpmGetPath(path, "/", name, NULL);
+	    if (!Access(fn, R_OK)) {
+		rpmiob iob = NULL;
+		xx = rpmiobSlurp(fn, &iob);
+		sqlite3_result_text(pContext, rpmiobStr(iob), rpmiobLen(iob), SQLITE_TRANSIENT);
+		iob = rpmiobFree(iob);
 	    } else
-	    if (!strcmp(col, vt->fields[i])) {
-		int ix = 2 * (i + 1);
-		const char * s = path + offsets[ix];
-		size_t ns = offsets[ix+1]; /* XXX convert offset to length */
-		sqlite3_result_text(pContext, s, ns, SQLITE_STATIC);
-		break;
-	    }
-	}
-	if (i == vt->nfields)
+		sqlite3_result_null(pContext);
+	    fn = _free(fn);
+	    name = _free(name);
+	}   break;
+	default:
 	    sqlite3_result_null(pContext);
+	    break;
+	}
     } else
     if (vd->split && strlen(vd->split) == 1 && vt->nfields > 0) {
 	/* Simple argv split on a separator char. */
@@ -774,7 +1188,7 @@ assert(vt->fields);
 	xx = argvSplit(&av, path, vd->split);
 assert(vt->fields);
 	for (i = 0; i < vt->nfields; i++) {
-	    if (strcmp(col, vt->fields[i]))
+	    if (!rpmvtColIs(col, vt->fields[i]))
 		continue;
 	    sqlite3_result_text(pContext, av[i], -1, SQLITE_TRANSIENT);
 	    break;
@@ -785,11 +1199,6 @@ assert(vt->fields);
     } else
 	sqlite3_result_null(pContext);	/* XXX unnecessary */
 
-    if (mire) {
-	xx = mireSetEOptions(mire, NULL, 0);
-	mire = mireFree(mire);
-    }
-
 if (rc)
 VCDBG(vc, (stderr, "<-- %s(%p,%p,%d) rc %d\n", __FUNCTION__, vc, pContext, colx, rc));
 
@@ -2615,7 +3024,7 @@ if (_stat_debug < 0)
 fprintf(stderr, "--> %s(%p,%p,%d)\n", __FUNCTION__, vc, pContext, colx);
 
 
-    if (!strcmp(col, "path"))
+    if (rpmvtColIs(col, "path"))
 	sqlite3_result_text(pContext, path, -1, SQLITE_STATIC);
     else if (!strcmp(col, "st_dev") && !ret)
 	sqlite3_result_int64(pContext, st->st_dev);
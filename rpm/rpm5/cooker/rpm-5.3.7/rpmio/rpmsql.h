@@ -158,6 +158,9 @@ struct rpmvt_s {
     void * _gi;
     void * _h;
 
+    void * _mire;		/*!< Compiled vd->regex (lazy). */
+    void ** _idx;		/*!< Sorted rows, per column (lazy). */
+
     rpmvd vd;		/* Data object. */
 };
 struct rpmVT_s {
@@ -188,6 +191,9 @@ struct rpmvc_s {
     rpmvt vt;			/*!< Linkage to virtual table. */
     int ix;			/*!< Current row index. */
     int nrows;			/*!< No. of row items. */
+    int * sel;			/*!< Selected rows, in order (NULL scans all). */
+    int nsel;			/*!< No. of selected rows. */
+    int sx;			/*!< Current selected row index. */
     int debug;
     rpmvd vd;			/*!< Data object. */
 };
@@ -385,6 +391,8 @@ int rpmvtConnect(void * _db, void * pAux,
 
 /**
  * Optimize a virtual table query.
+ * Equality and range constraints (and ORDER BY) on the path column, and on
+ * columns parsed from the path, are satisfied from a sorted index.
  * @param vt		virtual table
  * @retval pInfo	query to optimize 
  * @return		0 on success
@@ -533,10 +541,10 @@ int rpmvcClose(rpmvc vc)
 /**
  * Start a virtual table search.
  * @param vc		virtual cursor
- * @param idxNum
+ * @param idxNum	index plan from rpmvtBestIndex()
  * @param idxStr
- * @param argc
- * @param argv
+ * @param argc		no. of constraint values
+ * @param argv		constraint values
  * @return		0 on success
  */
 int rpmvcFilter(rpmvc vc, int idxNum, const char * idxStr,
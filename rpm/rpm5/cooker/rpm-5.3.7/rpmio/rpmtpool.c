@@ -0,0 +1,221 @@
+/** \ingroup rpmio
+ * \file rpmio/rpmtpool.c
+ * Persistent worker thread pool.
+ */
+
+#include "system.h"
+
+#include <rpmiotypes.h>
+#include <rpmio.h>		/* XXX _free */
+#include <rpmsq.h>
+#include <yarn.h>
+
+#include <rpmtpool.h>
+
+#include "debug.h"
+
+/*@unchecked@*/
+int _rpmtpool_debug = 0;
+
+/**
+ * A queued job.
+ */
+typedef struct rpmtpoolJob_s * rpmtpoolJob;
+struct rpmtpoolJob_s {
+/*@null@*/
+    rpmtpoolJob next;		/*!< next job in queue */
+/*@null@*/
+    void (*fn) (void * arg);	/*!< job function (NULL stops a worker) */
+/*@null@*/
+    void * (*call) (void * arg);/*!< called function */
+/*@shared@*/ /*@null@*/
+    void * arg;			/*!< job function argument */
+/*@shared@*/ /*@null@*/
+    void * ret;			/*!< called function return */
+/*@null@*/
+    yarnLock done;		/*!< (called functions) 1 when done */
+};
+
+/**
+ * Worker thread pool.
+ */
+struct rpmtpool_s {
+    yarnLock have;		/*!< no. of queued jobs, lock for queue */
+/*@null@*/
+    rpmtpoolJob head;		/*!< queued jobs */
+/*@dependent@*/
+    rpmtpoolJob * tail;		/*!< end of job queue */
+    yarnLock busy;		/*!< no. of unfinished jobs */
+    int nthreads;		/*!< no. of worker threads */
+/*@only@*/ /*@null@*/
+    void ** threads;		/*!< worker threads */
+};
+
+/**
+ * Append a job to the queue.
+ * @param tp		worker thread pool
+ * @param job		job
+ */
+static void rpmtpoolPush(rpmtpool tp, /*@only@*/ rpmtpoolJob job)
+	/*@modifies tp, job @*/
+{
+    job->next = NULL;
+    yarnPossess(tp->busy);
+    yarnTwist(tp->busy, BY, 1);
+    yarnPossess(tp->have);
+    *tp->tail = job;
+    tp->tail = &job->next;
+    yarnTwist(tp->have, BY, 1);
+}
+
+/**
+ * Run queued jobs until a stop job is found.
+ * @param _tp		worker thread pool
+ * @return		NULL always
+ */
+/*@null@*/
+static void * rpmtpoolWorker(void * _tp)
+	/*@modifies _tp @*/
+{
+    rpmtpool tp = _tp;
+    rpmtpoolJob job;
+
+    for (;;) {
+	yarnPossess(tp->have);
+	yarnWaitFor(tp->have, NOT_TO_BE, 0);
+	job = tp->head;
+assert(job != NULL);
+	if ((tp->head = job->next) == NULL)
+	    tp->tail = &tp->head;
+	yarnTwist(tp->have, BY, -1);
+
+	if (job->fn == NULL && job->call == NULL) {
+	    job = _free(job);
+	    break;
+	}
+
+	if (job->call != NULL) {
+	    yarnLock done = job->done;
+	    job->ret = (*job->call) (job->arg);
+	    /* XXX the caller owns (and will free) the job. */
+	    yarnPossess(done);
+	    yarnTwist(done, TO, 1);
+	} else {
+	    (*job->fn) (job->arg);
+	    job = _free(job);
+	}
+
+	yarnPossess(tp->busy);
+	yarnTwist(tp->busy, BY, -1);
+    }
+    return NULL;
+}
+
+rpmtpool rpmtpoolNew(int nthreads)
+{
+    rpmtpool tp = xcalloc(1, sizeof(*tp));
+    int i;
+
+    if (nthreads <= 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (cpus > 0 ? (int) cpus : 1);
+    }
+
+    tp->have = yarnNewLock(0);
+    tp->head = NULL;
+    tp->tail = &tp->head;
+    tp->busy = yarnNewLock(0);
+    tp->threads = xcalloc(nthreads, sizeof(*tp->threads));
+    for (i = 0; i < nthreads; i++) {
+	if ((tp->threads[i] = rpmsqThread(rpmtpoolWorker, tp)) == NULL)
+	    break;
+    }
+    tp->nthreads = i;
+    if (tp->nthreads == 0)
+	tp->threads = _free(tp->threads);
+
+if (_rpmtpool_debug)
+fprintf(stderr, "<-- %s(%d) tp %p threads %d\n", __FUNCTION__, nthreads, tp, tp->nthreads);
+    return tp;
+}
+
+rpmtpool rpmtpoolFree(rpmtpool tp)
+{
+    int i;
+
+    if (tp == NULL)
+	return NULL;
+
+if (_rpmtpool_debug)
+fprintf(stderr, "--> %s(%p) threads %d\n", __FUNCTION__, tp, tp->nthreads);
+
+    /* Queue a stop job for each worker, then join them all. */
+    for (i = 0; i < tp->nthreads; i++)
+	rpmtpoolPush(tp, xcalloc(1, sizeof(struct rpmtpoolJob_s)));
+    for (i = 0; i < tp->nthreads; i++)
+	(void) rpmsqJoin(tp->threads[i]);
+    tp->threads = _free(tp->threads);
+
+    tp->have = yarnFreeLock(tp->have);
+    tp->busy = yarnFreeLock(tp->busy);
+    tp = _free(tp);
+    return NULL;
+}
+
+int rpmtpoolThreads(rpmtpool tp)
+{
+    return (tp != NULL ? tp->nthreads : 0);
+}
+
+int rpmtpoolSubmit(rpmtpool tp, void (*fn) (void * arg), void * arg)
+{
+    rpmtpoolJob job;
+
+    if (tp == NULL || tp->nthreads == 0) {
+	(*fn) (arg);
+	return 0;
+    }
+
+    job = xcalloc(1, sizeof(*job));
+    job->fn = fn;
+    job->arg = arg;
+    rpmtpoolPush(tp, job);
+    return 0;
+}
+
+void * rpmtpoolCall(rpmtpool tp, void * (*fn) (void * arg), void * arg)
+{
+    struct rpmtpoolJob_s job;
+    int i;
+
+    if (tp == NULL || tp->nthreads == 0)
+	return (*fn) (arg);
+
+    /* Recursive calls from a worker are run immediately. */
+    for (i = 0; i < tp->nthreads; i++) {
+	if (rpmsqThreadEqual(tp->threads[i]))
+	    return (*fn) (arg);
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.call = fn;
+    job.arg = arg;
+    job.done = yarnNewLock(0);
+    rpmtpoolPush(tp, &job);
+
+    yarnPossess(job.done);
+    yarnWaitFor(job.done, TO_BE, 1);
+    yarnRelease(job.done);
+    job.done = yarnFreeLock(job.done);
+
+    return job.ret;
+}
+
+void rpmtpoolWait(rpmtpool tp)
+{
+    if (tp == NULL || tp->nthreads == 0)
+	return;
+    yarnPossess(tp->busy);
+    yarnWaitFor(tp->busy, TO_BE, 0);
+    yarnRelease(tp->busy);
+}
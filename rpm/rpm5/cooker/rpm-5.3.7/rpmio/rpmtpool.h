@@ -0,0 +1,90 @@
+#ifndef	H_RPMTPOOL
+#define	H_RPMTPOOL
+
+/** \ingroup rpmio
+ * \file rpmio/rpmtpool.h
+ * Persistent worker thread pool.
+ */
+
+/**
+ */
+typedef /*@abstract@*/ struct rpmtpool_s * rpmtpool;
+
+/**
+ */
+/*@-redecl@*/
+/*@unchecked@*/
+extern int _rpmtpool_debug;
+/*@=redecl@*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Create a pool of worker threads.
+ * Without threads, jobs are run by the caller when submitted.
+ * @param nthreads	no. of worker threads (<= 0 uses no. of cpus)
+ * @return		new worker thread pool
+ */
+/*@only@*/
+rpmtpool rpmtpoolNew(int nthreads)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/;
+
+/**
+ * Destroy a pool of worker threads, after running all submitted jobs.
+ * @param tp		worker thread pool
+ * @return		NULL always
+ */
+/*@null@*/
+rpmtpool rpmtpoolFree(/*@only@*/ /*@null@*/ rpmtpool tp)
+	/*@globals internalState @*/
+	/*@modifies tp, internalState @*/;
+
+/**
+ * Return no. of worker threads in a pool.
+ * @param tp		worker thread pool
+ * @return		no. of worker threads (0 if not threaded)
+ */
+int rpmtpoolThreads(/*@null@*/ rpmtpool tp)
+	/*@*/;
+
+/**
+ * Queue a job to be run (asynchronously) by a worker thread.
+ * @param tp		worker thread pool (NULL runs the job immediately)
+ * @param fn		job function
+ * @param arg		job function argument
+ * @return		0 on success
+ */
+int rpmtpoolSubmit(/*@null@*/ rpmtpool tp, void (*fn) (void * arg), void * arg)
+	/*@globals internalState @*/
+	/*@modifies tp, internalState @*/;
+
+/**
+ * Run a function on a worker thread, waiting for the result.
+ * Calls from a worker thread of the same pool are run immediately, so
+ * that a job can (recursively) call into the same pool w/o deadlock.
+ * @param tp		worker thread pool (NULL runs the function immediately)
+ * @param fn		function
+ * @param arg		function argument
+ * @return		function return
+ */
+/*@null@*/
+void * rpmtpoolCall(/*@null@*/ rpmtpool tp, void * (*fn) (void * arg), void * arg)
+	/*@globals internalState @*/
+	/*@modifies tp, internalState @*/;
+
+/**
+ * Wait until all submitted jobs have been run.
+ * @param tp		worker thread pool
+ */
+void rpmtpoolWait(/*@null@*/ rpmtpool tp)
+	/*@globals internalState @*/
+	/*@modifies tp, internalState @*/;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* H_RPMTPOOL */
@@ -38,17 +38,18 @@
 
 #include "system.h"
 
-#if defined(WITH_BZIP2)
-
 #include <rpmiotypes.h>
 #include <rpmlog.h>
 
+#if defined(WITH_BZIP2)
 #define	_RPMBZ_INTERNAL
 #include "rpmbz.h"
 
 /*@access rpmbz @*/
+#endif
 
 #include "yarn.h"
+#include "rpmtpool.h"
 
 #define	_RPMZLOG_INTERNAL
 #include "rpmzlog.h"
@@ -294,6 +295,7 @@ struct poptOption rpmzqOptionsPoptTable[] = {
 
 /*==============================================================*/
 
+#if defined(WITH_BZIP2)
 /*@-mustmod@*/
 int rpmbzCompressBlock(void * _bz, rpmzJob job)
 {
@@ -324,6 +326,7 @@ static int rpmbzDecompressBlock(rpmbz bz, rpmzJob job)
     return rc;
 }
 /*@=mustmod@*/
+#endif	/* WITH_BZIP2 */
 
 /*==============================================================*/
 
@@ -865,6 +868,7 @@ void rpmzqAddWJob(rpmzQueue zq, rpmzJob job)
     yarnTwist(zq->_zw.q->first, TO, zq->_zw.q->head->seq);
 }
 
+#if defined(WITH_BZIP2)
 static rpmzJob rpmzqFillOut(rpmzQueue zq, /*@returned@*/rpmzJob job, rpmbz bz)
 	/*@globals fileSystem, internalState @*/
 	/*@modifies zq, job, fileSystem, internalState @*/
@@ -987,6 +991,8 @@ void rpmzqLaunch(rpmzQueue zq, long seq, unsigned int threads)
     }
 }
 
+#endif	/* WITH_BZIP2 */
+
 /* verify no more jobs, prepare for next use */
 void rpmzqVerify(rpmzQueue zq)
 {
@@ -994,4 +1000,222 @@ void rpmzqVerify(rpmzQueue zq)
     rpmzqVerifySEQ(zq->_zw.q);
 }
 
-#endif /* WITH_BZIP2 */
+/*==============================================================*/
+
+/* -- block-parallel (de)compression pipe -- */
+
+/* A pipe splits a stream into blocks, (de)compresses the blocks on worker
+   threads, and outputs the results in order from the thread that writes
+   into the pipe (so that the underlying FILE/fd is used by one thread).
+   With dictionary chaining (as pigz does), the previous input block is
+   passed to the coder, so that deflate can prime its window with it. */
+
+/**
+ */
+struct rpmzPipe_s {
+    unsigned int threads;	/*!< no. of worker threads */
+    size_t blocksize;		/*!< input block size */
+    int dict;			/*!< pass previous input as dictionary? */
+    int (*code) (void * arg, rpmzJob job, /*@null@*/ rpmzSpace dict);
+    int (*output) (void * arg, rpmzJob job);
+/*@shared@*/
+    void * arg;			/*!< coder/output argument */
+/*@only@*/ /*@null@*/
+    rpmtpool tp;		/*!< worker threads (created as needed) */
+/*@only@*/
+    rpmzPool pool;		/*!< input buffer pool */
+/*@only@*/ /*@null@*/
+    rpmzJob job;		/*!< block being filled */
+/*@only@*/ /*@null@*/
+    rpmzSpace prev;		/*!< previous input block (dictionary) */
+/*@only@*/ /*@null@*/
+    rpmzJob head;		/*!< submitted blocks, in order */
+/*@dependent@*/
+    rpmzJob * tail;
+    int njobs;			/*!< no. of submitted blocks */
+    long seq;			/*!< next block sequence number */
+    int rc;			/*!< first coder/output failure */
+};
+
+rpmzPipe rpmzqNewPipe(unsigned int threads, size_t blocksize, int dict,
+		int (*code) (void * arg, rpmzJob job, rpmzSpace dict),
+		int (*output) (void * arg, rpmzJob job), void * arg)
+{
+    rpmzPipe zp = xcalloc(1, sizeof(*zp));
+
+    if (threads == 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = (cpus > 0 ? (unsigned int) cpus : 1);
+    }
+    zp->threads = threads;
+    zp->blocksize = blocksize;
+    zp->dict = dict;
+    zp->code = code;
+    zp->output = output;
+    zp->arg = arg;
+    zp->pool = rpmzqNewPool(blocksize, -1);
+    zp->head = NULL;
+    zp->tail = &zp->head;
+zqFprintf(stderr, "<-- %s(%u,%u,%d) zp %p\n", __FUNCTION__, threads, (unsigned)blocksize, dict, zp);
+    return zp;
+}
+
+/**
+ * Code a block, on a worker thread.
+ * @param _job		block (job->calc is set to 1 when done)
+ */
+static void rpmzqPipeCode(void * _job)
+	/*@modifies _job @*/
+{
+    rpmzJob job = _job;
+    rpmzPipe zp = job->owner;
+    rpmzSpace dict = job->out;
+
+    job->out = NULL;
+    job->rc = (*zp->code) (zp->arg, job, dict);
+    dict = rpmzqDropSpace(dict);
+
+    yarnPossess(job->calc);
+    yarnTwist(job->calc, TO, 1);
+}
+
+/**
+ * Output coded blocks, in order.
+ * @param zp		pipe
+ * @param max		max. no. of blocks left unfinished (0 waits for all)
+ * @return		0 on success
+ */
+static int rpmzqPipeDrain(rpmzPipe zp, int max)
+	/*@modifies zp @*/
+{
+    rpmzJob job;
+
+    while ((job = zp->head) != NULL) {
+	/* Stop at an unfinished block, unless too far ahead. */
+	if (zp->njobs <= max && yarnPeekLock(job->calc) == 0)
+	    break;
+	yarnPossess(job->calc);
+	yarnWaitFor(job->calc, TO_BE, 1);
+	yarnRelease(job->calc);
+
+	if ((zp->head = job->next) == NULL)
+	    zp->tail = &zp->head;
+	zp->njobs--;
+
+	if (zp->rc == 0)
+	    zp->rc = (job->rc ? job->rc : (*zp->output) (zp->arg, job));
+
+	job->in = rpmzqDropSpace(job->in);
+	job->out = rpmzqDropSpace(job->out);
+	job = rpmzqDropJob(job);
+    }
+    return zp->rc;
+}
+
+/**
+ * Submit the block being filled to the worker threads.
+ * @param zp		pipe
+ * @param more		0 if this is the last block
+ * @return		0 on success
+ */
+static int rpmzqPipeSubmit(rpmzPipe zp, int more)
+	/*@modifies zp @*/
+{
+    rpmzJob job = zp->job;
+
+    if (job == NULL) {
+	job = rpmzqNewJob(zp->seq++);
+	job->in = rpmzqNewSpace(zp->pool, zp->pool->size);
+	job->in->len = 0;
+    }
+    zp->job = NULL;
+
+    job->more = more;
+    job->owner = zp;
+    if (zp->dict) {
+	job->out = zp->prev;
+	zp->prev = NULL;
+	if (more) {
+	    rpmzqUseSpace(job->in);
+	    zp->prev = job->in;
+	}
+    }
+
+    job->next = NULL;
+    *zp->tail = job;
+    zp->tail = &job->next;
+    zp->njobs++;
+
+    /* A stream that fits in one block is coded w/o threads. */
+    if (zp->tp == NULL && (more || job->seq > 0))
+	zp->tp = rpmtpoolNew(zp->threads);
+    (void) rpmtpoolSubmit(zp->tp, rpmzqPipeCode, job);
+
+    return rpmzqPipeDrain(zp, (more ? 2 * (int)zp->threads : 0));
+}
+
+ssize_t rpmzqPipeWrite(rpmzPipe zp, const void * buf, size_t nb)
+{
+    const unsigned char * b = buf;
+    size_t left = nb;
+
+    while (left > 0) {
+	rpmzSpace in;
+	size_t n;
+
+	if (zp->rc)
+	    return -1;
+	if (zp->job == NULL) {
+	    zp->job = rpmzqNewJob(zp->seq++);
+	    zp->job->in = rpmzqNewSpace(zp->pool, zp->pool->size);
+	    zp->job->in->len = 0;
+	}
+	in = zp->job->in;
+	n = zp->blocksize - in->len;
+	if (n > left)
+	    n = left;
+	memcpy(in->buf + in->len, b, n);
+	in->len += n;
+	b += n;
+	left -= n;
+	if (in->len == zp->blocksize && rpmzqPipeSubmit(zp, 1))
+	    return -1;
+    }
+    return (zp->rc ? -1 : (ssize_t)nb);
+}
+
+int rpmzqPipeCut(rpmzPipe zp, size_t minlen)
+{
+    if (zp->rc)
+	return zp->rc;
+    if (zp->job == NULL || zp->job->in->len == 0 || zp->job->in->len < minlen)
+	return 0;
+    return rpmzqPipeSubmit(zp, 1);
+}
+
+int rpmzqPipeFinish(rpmzPipe zp)
+{
+    if (zp->rc == 0)
+	(void) rpmzqPipeSubmit(zp, 0);
+    return rpmzqPipeDrain(zp, 0);
+}
+
+rpmzPipe rpmzqFreePipe(rpmzPipe zp)
+{
+    if (zp == NULL)
+	return NULL;
+
+    /* Wait for (and discard) anything unfinished. */
+    zp->tp = rpmtpoolFree(zp->tp);
+    if (zp->rc == 0)
+	zp->rc = -1;
+    (void) rpmzqPipeDrain(zp, 0);
+    if (zp->job != NULL) {
+	zp->job->in = rpmzqDropSpace(zp->job->in);
+	zp->job = rpmzqDropJob(zp->job);
+    }
+    zp->prev = rpmzqDropSpace(zp->prev);
+    zp->pool = rpmzqFreePool(zp->pool, NULL);
+    zp = _free(zp);
+    return NULL;
+}
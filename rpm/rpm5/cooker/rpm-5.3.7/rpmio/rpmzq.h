@@ -26,6 +26,10 @@ typedef /*@abstract@*/ struct rpmzQueue_s * rpmzQueue;
  */
 typedef /*@abstract@*/ /*@refcounted@*/ struct rpmzJob_s * rpmzJob;
 
+/**
+ */
+typedef /*@abstract@*/ struct rpmzPipe_s * rpmzPipe;
+
 /**
  */
 /*@-redecl@*/
@@ -151,6 +155,9 @@ struct rpmzJob_s {
     yarnLock calc;		/*!< released when check calculation complete */
 /*@null@*/
     rpmzJob next;		/*!< for job linked list */
+/*@dependent@*/ /*@null@*/
+    void * owner;		/*!< pipe (or reader) the job belongs to */
+    int rc;			/*!< coder return (0 on success) */
 };
 
 /**
@@ -539,6 +546,68 @@ void rpmzqVerify(rpmzQueue zq)
 	/*@globals fileSystem, internalState @*/
 	/*@modifies zq, fileSystem, internalState @*/;
 
+/**
+ * Create a pipe that (de)compresses blocks on worker threads.
+ *
+ * Blocks are coded by calling code(arg, job, dict) on a worker thread,
+ * which sets job->out (and job->check, if needed) from job->in. The coded
+ * blocks are then passed, in order, to output(arg, job) from the thread
+ * calling rpmzqPipeWrite()/rpmzqPipeCut()/rpmzqPipeFinish().
+ * A stream that fits in one block is coded without any threads.
+ * @param threads	no. of worker threads (0 uses no. of cpus)
+ * @param blocksize	input block size
+ * @param dict		pass the previous input block to the coder?
+ * @param code		block coder
+ * @param output	coded block output
+ * @param arg		coder/output argument
+ * @return		new pipe
+ */
+/*@only@*/
+rpmzPipe rpmzqNewPipe(unsigned int threads, size_t blocksize, int dict,
+		int (*code) (void * arg, rpmzJob job, /*@null@*/ rpmzSpace dict),
+		int (*output) (void * arg, rpmzJob job), void * arg)
+	/*@*/;
+
+/**
+ * Write data into a pipe, submitting each block as it is filled.
+ * @param zp		pipe
+ * @param buf		data
+ * @param nb		no. of bytes
+ * @return		nb on success, -1 on failure
+ */
+ssize_t rpmzqPipeWrite(rpmzPipe zp, const void * buf, size_t nb)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies zp, fileSystem, internalState @*/;
+
+/**
+ * End the current block early (e.g. at an rsync(1) friendly boundary).
+ * @param zp		pipe
+ * @param minlen	min. no. of bytes in the block to end it
+ * @return		0 on success
+ */
+int rpmzqPipeCut(rpmzPipe zp, size_t minlen)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies zp, fileSystem, internalState @*/;
+
+/**
+ * Submit the last block, and wait for all blocks to be output.
+ * @param zp		pipe
+ * @return		0 on success
+ */
+int rpmzqPipeFinish(rpmzPipe zp)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies zp, fileSystem, internalState @*/;
+
+/**
+ * Destroy a pipe, discarding anything not yet output.
+ * @param zp		pipe
+ * @return		NULL always
+ */
+/*@null@*/
+rpmzPipe rpmzqFreePipe(/*@only@*/ /*@null@*/ rpmzPipe zp)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies zp, fileSystem, internalState @*/;
+
 #ifdef __cplusplus
 }
 #endif
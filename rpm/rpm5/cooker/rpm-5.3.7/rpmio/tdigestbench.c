@@ -0,0 +1,170 @@
+/** \ingroup rpmio
+ * \file rpmio/tdigestbench.c
+ * Time MD5/SHA1/SHA256 throughput on many small buffers (as rpm -V and
+ * rpmmtree digest files), one buffer at a time with rpmDigestInit() et al,
+ * and batched with rpmDigestBatch(), for each kernel the cpu supports.
+ *
+ * The batched digests are compared with the one at a time digests.
+ */
+
+#include "system.h"
+
+#include <rpmio.h>
+#include <rpmsw.h>
+#include <poptIO.h>
+
+#include "mbdigest.h"
+
+#include "debug.h"
+
+static int nloops = 1;
+static int nbufs = 4096;
+static int sizekb = 4;
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each digest N times"), N_("N") },
+ { "count", 'c', POPT_ARG_INT,		&nbufs, 0,
+	N_("digest N buffers"), N_("N") },
+ { "size", 's', POPT_ARG_INT,		&sizekb, 0,
+	N_("buffers of N KiB"), N_("N") },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
+	N_("Common options for all rpmio executables:"),
+	NULL },
+
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+/**
+ * Digest buffers one at a time.
+ * @param algo		digest algorithm
+ * @param bufs		buffers
+ * @param lens		buffer lengths
+ * @retval digests	binary digests
+ * @param op		timing
+ */
+static void runSerial(pgpHashAlgo algo, const void ** bufs,
+		const size_t * lens, unsigned char ** digests, rpmop op)
+	/*@modifies *digests, op @*/
+{
+    size_t nb = 0;
+    int i;
+    int xx;
+
+    xx = rpmswEnter(op, 0);
+    for (i = 0; i < nbufs; i++) {
+	DIGEST_CTX ctx = rpmDigestInit(algo, RPMDIGEST_NONE);
+	unsigned char * digest = NULL;
+	size_t digestlen = 0;
+
+	xx = rpmDigestUpdate(ctx, bufs[i], lens[i]);
+	xx = rpmDigestFinal(ctx, &digest, &digestlen, 0);
+	memcpy(digests[i], digest, digestlen);
+	digest = _free(digest);
+	nb += lens[i];
+    }
+    xx = rpmswExit(op, nb);
+}
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmioInit(argc, argv, optionsTable);
+    static const pgpHashAlgo algos[] = {
+	PGPHASHALGO_MD5, PGPHASHALGO_SHA1, PGPHASHALGO_SHA256
+    };
+    static const char * names[] = { "MD5", "SHA1", "SHA256" };
+    /* Kernels, best first: drop one extension at a time. */
+    static const int masks[] = {
+	~0,
+	~MBD_ISA_SHANI,
+	~(MBD_ISA_SHANI | MBD_ISA_AVX2),
+	0
+    };
+    size_t len = (size_t) sizekb << 10;
+    const void ** bufs = xcalloc(nbufs, sizeof(*bufs));
+    size_t * lens = xcalloc(nbufs, sizeof(*lens));
+    unsigned char ** digests = xcalloc(nbufs, sizeof(*digests));
+    unsigned char ** bdigests = xcalloc(nbufs, sizeof(*bdigests));
+    unsigned char * b = xmalloc(len * nbufs);
+    int isa = mbdISA();
+    int ec = 0;
+    int i, j, k;
+
+    /* Pseudo-random contents, sizes from len/2 to len. */
+    for (i = 0; i < (int)(len * nbufs); i++)
+	b[i] = (unsigned char)((i * 2654435761U) >> 24);
+    for (i = 0; i < nbufs; i++) {
+	bufs[i] = b + i * len;
+	lens[i] = len / 2 + (len / 2 * (unsigned) i) / nbufs;
+	digests[i] = xmalloc(64);
+	bdigests[i] = xmalloc(64);
+    }
+
+    fprintf(stderr, "===== %d buffers of %u-%u bytes, %d loops, isa 0x%x\n",
+		nbufs, (unsigned) (len / 2), (unsigned) len, nloops, isa);
+
+    for (i = 0; i < (int)(sizeof(algos) / sizeof(algos[0])); i++) {
+	const char * lastkernel = NULL;
+	size_t dlen = (algos[i] == PGPHASHALGO_MD5 ? 16
+		: algos[i] == PGPHASHALGO_SHA1 ? 20 : 32);
+
+	for (k = 0; k < (int)(sizeof(masks) / sizeof(masks[0])); k++) {
+	    rpmop serial = memset(alloca(sizeof(*serial)), 0, sizeof(*serial));
+	    rpmop batch = memset(alloca(sizeof(*batch)), 0, sizeof(*batch));
+	    const char * kernel;
+	    size_t nb = 0;
+	    int xx;
+
+	    _mbd_isa = isa & masks[k];
+	    kernel = mbdKernel(algos[i]);
+	    if (lastkernel != NULL && !strcmp(kernel, lastkernel))
+		continue;
+	    lastkernel = kernel;
+
+	    for (j = 0; j < nbufs; j++)
+		nb += lens[j];
+	    for (j = 0; j < nloops; j++) {
+		runSerial(algos[i], bufs, lens, digests, serial);
+		xx = rpmswEnter(batch, 0);
+		xx = rpmDigestBatch(algos[i], nbufs, bufs, lens, bdigests);
+		xx = rpmswExit(batch, nb);
+	    }
+
+	    for (j = 0; j < nbufs; j++) {
+		if (memcmp(digests[j], bdigests[j], dlen)) {
+		    fprintf(stderr, "FAIL: %s %s buffer %d\n",
+				names[i], kernel, j);
+		    ec = 1;
+		    break;
+		}
+	    }
+
+	    fprintf(stderr, "%s (%s):\n", names[i], kernel);
+	    rpmswPrint("    serial:", serial, NULL);
+	    rpmswPrint("   batched:", batch, NULL);
+	    if (serial->usecs > 0 && batch->usecs > 0)
+		fprintf(stderr, "    %.1f MB/s => %.1f MB/s\n",
+			(double) serial->bytes / serial->usecs,
+			(double) batch->bytes / batch->usecs);
+	}
+    }
+    _mbd_isa = isa;
+
+    for (i = 0; i < nbufs; i++) {
+	digests[i] = _free(digests[i]);
+	bdigests[i] = _free(bdigests[i]);
+    }
+    digests = _free(digests);
+    bdigests = _free(bdigests);
+    bufs = _free(bufs);
+    lens = _free(lens);
+    b = _free(b);
+
+    optCon = rpmioFini(optCon);
+
+    return ec;
+}
@@ -0,0 +1,193 @@
+/** \ingroup rpmio
+ * \file rpmio/thashbench.c
+ * Time hashTable insert/lookup on a file fingerprint workload.
+ *
+ * Every file found walking the argument directories (default /usr) is
+ * keyed by (dev, ino) of its directory and its basename, as rpmtsPrepare
+ * keys files (in rpmdb/fprint.c) in the ts->ht hash table.
+ */
+
+#include "system.h"
+
+#include <fts.h>
+#include <rpmio.h>
+#include <rpmhash.h>
+#include <rpmsw.h>
+#include <poptIO.h>
+
+#include "debug.h"
+
+static int nloops = 5;
+static int sizehint = 1;
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each phase N times"), N_("N") },
+ { "nohint", '\0', POPT_ARG_VAL,	&sizehint, 0,
+	N_("create tables w/o a size hint (i.e. grow the tables)"), NULL },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
+	N_("Common options for all rpmio executables:"),
+	NULL },
+
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+/**
+ * A file fingerprint (cf. rpmdb/fprint.h).
+ */
+typedef struct fp_s {
+    dev_t dev;			/*!< directory device */
+    ino_t ino;			/*!< directory inode */
+    const char * baseName;	/*!< file base name */
+} * FP_t;
+
+static rpmuint32_t fpHash(rpmuint32_t h, const void * data,
+		/*@unused@*/ size_t size)
+	/*@*/
+{
+    const struct fp_s * fp = data;
+
+    h = hashFunctionString(h, fp->baseName, 0);
+    h ^= (rpmuint32_t)fp->dev * 0x9e3779b1U;
+    h ^= (rpmuint32_t)fp->ino;
+    return h;
+}
+
+static int fpCmp(const void * a, const void * b)
+	/*@*/
+{
+    const struct fp_s * A = a;
+    const struct fp_s * B = b;
+    return !(A->dev == B->dev && A->ino == B->ino
+		&& !strcmp(A->baseName, B->baseName));
+}
+
+/**
+ * Collect fingerprints of all files below a set of directories.
+ * @param paths		directories to walk
+ * @retval *nfpp	no. of fingerprints
+ * @return		array of fingerprints
+ */
+static FP_t fpLoad(char *const * paths, int * nfpp)
+	/*@modifies *nfpp @*/
+{
+    FTS * t = Fts_open(paths, FTS_PHYSICAL, NULL);
+    FTSENT * p;
+    FP_t fps = NULL;
+    int nfps = 0;
+    int nalloced = 0;
+
+    while (t != NULL && (p = Fts_read(t)) != NULL) {
+	FP_t fp;
+	/* XXX the (directory) fingerprint is in the parent's stat(2) */
+	if (p->fts_info == FTS_DP || p->fts_level < 1)
+	    continue;
+	if (nfps == nalloced) {
+	    nalloced = (nalloced ? 2 * nalloced : 1024);
+	    fps = xrealloc(fps, nalloced * sizeof(*fps));
+	}
+	fp = fps + nfps++;
+	fp->dev = p->fts_parent->fts_statp->st_dev;
+	fp->ino = p->fts_parent->fts_statp->st_ino;
+	fp->baseName = xstrdup(p->fts_name);
+    }
+    if (t != NULL)
+	(void) Fts_close(t);
+    *nfpp = nfps;
+    return fps;
+}
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmioInit(argc, argv, optionsTable);
+    rpmop load = memset(alloca(sizeof(*load)), 0, sizeof(*load));
+    rpmop add = memset(alloca(sizeof(*add)), 0, sizeof(*add));
+    rpmop bulk = memset(alloca(sizeof(*bulk)), 0, sizeof(*bulk));
+    rpmop lookup = memset(alloca(sizeof(*lookup)), 0, sizeof(*lookup));
+    rpmop keys = memset(alloca(sizeof(*keys)), 0, sizeof(*keys));
+    static const char * defaultPaths[] = { "/usr", NULL };
+    ARGV_t av = poptGetArgs(optCon);
+    char *const * paths = (char *const *) (av != NULL && av[0] != NULL
+		? (const char **) av : defaultPaths);
+    const void ** fpkeys;
+    const void ** fpdata;
+    FP_t fps;
+    int nfps = 0;
+    int nkeys = 0;
+    int nmissed = 0;
+    int xx;
+    int i, j;
+
+    xx = rpmswEnter(load, 0);
+    fps = fpLoad(paths, &nfps);
+    xx = rpmswExit(load, nfps);
+
+    fpkeys = xmalloc(nfps * sizeof(*fpkeys));
+    fpdata = xmalloc(nfps * sizeof(*fpdata));
+    for (j = 0; j < nfps; j++) {
+	fpkeys[j] = fps + j;
+	fpdata[j] = fps + j;
+    }
+
+    for (i = 0; i < nloops; i++) {
+	hashTable ht;
+	const void ** htkeys;
+
+	/* Add fingerprints one at a time (as rpmtsAddFingerprints does). */
+	xx = rpmswEnter(add, 0);
+	ht = htCreate((sizehint ? nfps : 1), 0, 0, fpHash, fpCmp);
+	for (j = 0; j < nfps; j++)
+	    htAddEntry(ht, fpkeys[j], fpdata[j]);
+	xx = rpmswExit(add, nfps);
+
+	/* Look up every fingerprint (as rpmtsCheckInstalledFiles does). */
+	xx = rpmswEnter(lookup, 0);
+	for (j = 0; j < nfps; j++) {
+	    const void ** data = NULL;
+	    int ndata = 0;
+	    if (htGetEntry(ht, fpkeys[j], &data, &ndata, NULL) || ndata < 1)
+		nmissed++;
+	}
+	xx = rpmswExit(lookup, nfps);
+
+	xx = rpmswEnter(keys, 0);
+	htkeys = htGetKeys(ht);
+	nkeys = 0;
+	while (htkeys[nkeys] != NULL)
+	    nkeys++;
+	htkeys = _free(htkeys);
+	xx = rpmswExit(keys, nkeys);
+
+	ht = htFree(ht);
+
+	/* Add all fingerprints at once. */
+	xx = rpmswEnter(bulk, 0);
+	ht = htCreate((sizehint ? nfps : 1), 0, 0, fpHash, fpCmp);
+	htAddEntries(ht, fpkeys, fpdata, nfps);
+	xx = rpmswExit(bulk, nfps);
+
+	ht = htFree(ht);
+    }
+
+    fprintf(stderr, "===== %d loops, %d files, %d keys, %d missed%s\n",
+		nloops, nfps, nkeys, nmissed, (sizehint ? "" : " (no size hint)"));
+    rpmswPrint("     load:", load, NULL);
+    rpmswPrint("      add:", add, NULL);
+    rpmswPrint("     bulk:", bulk, NULL);
+    rpmswPrint("   lookup:", lookup, NULL);
+    rpmswPrint("  getkeys:", keys, NULL);
+
+    for (j = 0; j < nfps; j++)
+	fps[j].baseName = _free(fps[j].baseName);
+    fps = _free(fps);
+    fpkeys = _free(fpkeys);
+    fpdata = _free(fpdata);
+
+    optCon = rpmioFini(optCon);
+
+    return (nmissed ? 1 : 0);
+}
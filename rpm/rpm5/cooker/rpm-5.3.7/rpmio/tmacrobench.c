@@ -0,0 +1,114 @@
+/** \ingroup rpmio
+ * \file rpmio/tmacrobench.c
+ * Time macro file loading, definition and expansion (rpm --eval startup).
+ */
+
+#include "system.h"
+
+#include <rpmio.h>
+#include <rpmmacro.h>
+#include <rpmsw.h>
+#include <poptIO.h>
+
+#include "debug.h"
+
+static int nloops = 10;
+static int ndefines = 10000;
+static const char * macrofiles = NULL;
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each phase N times"), N_("N") },
+ { "defines", 'd', POPT_ARG_INT,	&ndefines, 0,
+	N_("define (and undefine) N synthetic macros"), N_("N") },
+ { "macrofiles", '\0', POPT_ARG_STRING,	&macrofiles, 0,
+	N_("read <FILE:...> instead of default macro file(s)"), N_("<FILE:...>") },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
+	N_("Common options for all rpmio executables:"),
+	NULL },
+
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+static const char * defaultExprs[] = {
+    "%{_bindir}", "%{_libdir}", "%{_target_platform}",
+    "%{?_with_foo:foo}%{!?_with_foo:nofoo}", "%{__find_requires}",
+    NULL
+};
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmioInit(argc, argv, optionsTable);
+    rpmop load = memset(alloca(sizeof(*load)), 0, sizeof(*load));
+    rpmop define = memset(alloca(sizeof(*define)), 0, sizeof(*define));
+    rpmop lookup = memset(alloca(sizeof(*lookup)), 0, sizeof(*lookup));
+    rpmop expand = memset(alloca(sizeof(*expand)), 0, sizeof(*expand));
+    rpmop undefine = memset(alloca(sizeof(*undefine)), 0, sizeof(*undefine));
+    ARGV_t av = poptGetArgs(optCon);
+    const char ** exprs = (av != NULL && av[0] != NULL
+		? (const char **) av : defaultExprs);
+    char name[64];
+    int nmacros = 0;
+    int xx;
+    int i, j;
+
+    if (macrofiles == NULL)
+	macrofiles = rpmMacrofiles;
+
+    for (i = 0; i < nloops; i++) {
+	rpmFreeMacros(NULL);
+
+	xx = rpmswEnter(load, 0);
+	rpmInitMacros(NULL, macrofiles);
+	nmacros = rpmGetMacroEntries(NULL, NULL, -1, NULL);
+	xx = rpmswExit(load, nmacros);
+
+	xx = rpmswEnter(define, 0);
+	for (j = 0; j < ndefines; j++) {
+	    (void) snprintf(name, sizeof(name), "_tmacrobench_%d", j);
+	    addMacro(NULL, name, NULL, "%{_bindir}/bench", RMIL_GLOBAL);
+	}
+	xx = rpmswExit(define, ndefines);
+
+	xx = rpmswEnter(lookup, 0);
+	for (j = 0; j < ndefines; j++) {
+	    const char * t;
+	    (void) snprintf(name, sizeof(name), "%%{?_tmacrobench_%d}", j);
+	    t = rpmExpand(name, NULL);
+	    t = _free(t);
+	}
+	xx = rpmswExit(lookup, ndefines);
+
+	xx = rpmswEnter(expand, 0);
+	for (j = 0; exprs[j] != NULL; j++) {
+	    const char * t = rpmExpand(exprs[j], NULL);
+	    if (i == 0 && rpmIsVerbose())
+		fprintf(stdout, "%s:\t%s\n", exprs[j], t);
+	    t = _free(t);
+	}
+	xx = rpmswExit(expand, j);
+
+	xx = rpmswEnter(undefine, 0);
+	for (j = 0; j < ndefines; j++) {
+	    (void) snprintf(name, sizeof(name), "_tmacrobench_%d", j);
+	    delMacro(NULL, name);
+	}
+	xx = rpmswExit(undefine, ndefines);
+    }
+
+    fprintf(stderr, "===== %d loops, %d macros loaded, %d defined\n",
+		nloops, nmacros, ndefines);
+    rpmswPrint("   load:", load, NULL);
+    rpmswPrint(" define:", define, NULL);
+    rpmswPrint(" lookup:", lookup, NULL);
+    rpmswPrint(" expand:", expand, NULL);
+    rpmswPrint("  undef:", undefine, NULL);
+
+    optCon = rpmioFini(optCon);
+
+    return 0;
+}
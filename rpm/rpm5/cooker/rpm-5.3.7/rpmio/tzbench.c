@@ -0,0 +1,185 @@
+/** \ingroup rpmio
+ * \file rpmio/tzbench.c
+ * Time xz/gzip compression throughput (as writeRPM() writes a payload)
+ * on a single thread, and with %_compress_threads worker threads.
+ *
+ * The input is the argument files (default: files below /usr/bin, up to
+ * --size MiB), compressed from memory into a temporary file, which is then
+ * decompressed and compared with the input.
+ */
+
+#include "system.h"
+
+#include <fts.h>
+#include <rpmio.h>
+#include <rpmmacro.h>
+#include <rpmsw.h>
+#include <poptIO.h>
+
+#include "debug.h"
+
+static int nloops = 1;
+static int nthreads = 0;
+static int sizemb = 64;
+static const char * tmpfn = "/tmp/tzbench.out";
+
+static struct poptOption optionsTable[] = {
+
+ { "loops", 'n', POPT_ARG_INT,		&nloops, 0,
+	N_("repeat each compression N times"), N_("N") },
+ { "threads", 'j', POPT_ARG_INT,	&nthreads, 0,
+	N_("compress with N threads (0 uses no. of cpus)"), N_("N") },
+ { "size", 's', POPT_ARG_INT,		&sizemb, 0,
+	N_("read at most N MiB of input"), N_("N") },
+ { "output", 'o', POPT_ARG_STRING,	&tmpfn, 0,
+	N_("write compressed output to FILE"), N_("FILE") },
+
+ { NULL, '\0', POPT_ARG_INCLUDE_TABLE, rpmioAllPoptTable, 0,
+	N_("Common options for all rpmio executables:"),
+	NULL },
+
+  POPT_AUTOHELP
+  POPT_TABLEEND
+};
+
+/**
+ * Read (regular) files below a set of paths into memory.
+ * @param paths		files/directories to read
+ * @param max		max. no. of bytes to read
+ * @retval *nbp		no. of bytes read
+ * @return		file contents
+ */
+static char * loadInput(char *const * paths, size_t max, size_t * nbp)
+	/*@modifies *nbp @*/
+{
+    FTS * t = Fts_open(paths, FTS_PHYSICAL, NULL);
+    FTSENT * p;
+    char * b = xmalloc(max);
+    size_t nb = 0;
+
+    while (t != NULL && nb < max && (p = Fts_read(t)) != NULL) {
+	FD_t fd;
+	size_t nr;
+	if (p->fts_info != FTS_F)
+	    continue;
+	fd = Fopen(p->fts_accpath, "r.ufdio");
+	if (fd == NULL || Ferror(fd)) {
+	    if (fd != NULL)
+		(void) Fclose(fd);
+	    continue;
+	}
+	while (nb < max && (nr = Fread(b + nb, 1, max - nb, fd)) > 0)
+	    nb += nr;
+	(void) Fclose(fd);
+    }
+    if (t != NULL)
+	(void) Fts_close(t);
+    *nbp = nb;
+    return b;
+}
+
+/**
+ * Compress a buffer into a file, then decompress and compare.
+ * @param fmode		compression mode (e.g. "w6.xzdio")
+ * @param threads	%_compress_threads value
+ * @param b		input
+ * @param nb		no. of bytes of input
+ * @param op		compression timing
+ * @retval *nzp		compressed size
+ * @return		0 on success
+ */
+static int runCompress(const char * fmode, int threads, const char * b,
+		size_t nb, rpmop op, size_t * nzp)
+	/*@modifies op, *nzp @*/
+{
+    const char * rmode = strchr(fmode, '.');
+    char * rb = xmalloc(nb + 1);
+    char t[32];
+    struct stat sb;
+    size_t nr = 0;
+    size_t n;
+    FD_t fd;
+    int rc = 1;
+    int xx;
+
+    (void) snprintf(t, sizeof(t), "%d", threads);
+    addMacro(NULL, "_compress_threads", NULL, t, RMIL_CMDLINE);
+
+    xx = rpmswEnter(op, 0);
+    fd = Fopen(tmpfn, fmode);
+    if (fd == NULL || Ferror(fd))
+	goto exit;
+    if (Fwrite(b, 1, nb, fd) != nb || Ferror(fd)) {
+	(void) Fclose(fd);
+	goto exit;
+    }
+    if (Fclose(fd))
+	goto exit;
+    xx = rpmswExit(op, nb);
+
+    *nzp = (Stat(tmpfn, &sb) == 0 ? (size_t) sb.st_size : 0);
+
+    /* Verify the round trip. */
+    (void) snprintf(t, sizeof(t), "r%s", rmode);
+    fd = Fopen(tmpfn, t);
+    if (fd == NULL || Ferror(fd))
+	goto exit;
+    while (nr <= nb && (n = Fread(rb + nr, 1, nb + 1 - nr, fd)) > 0)
+	nr += n;
+    (void) Fclose(fd);
+    if (nr == nb && !memcmp(b, rb, nb))
+	rc = 0;
+
+exit:
+    delMacro(NULL, "_compress_threads");
+    if (rc)
+	fprintf(stderr, "FAIL: %s with %d thread(s)\n", fmode, threads);
+    rb = _free(rb);
+    return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+    poptContext optCon = rpmioInit(argc, argv, optionsTable);
+    static const char * defaultPaths[] = { "/usr/bin", NULL };
+    static const char * fmodes[] = { "w6.xzdio", "w9.gzdio", NULL };
+    ARGV_t av = poptGetArgs(optCon);
+    char *const * paths = (char *const *) (av != NULL && av[0] != NULL
+		? (const char **) av : defaultPaths);
+    size_t nb = 0;
+    char * b = loadInput(paths, (size_t) sizemb << 20, &nb);
+    int ec = 0;
+    int i, j;
+
+    fprintf(stderr, "===== %u bytes, %d loops, %d thread(s)\n",
+		(unsigned) nb, nloops, nthreads);
+
+    for (i = 0; fmodes[i] != NULL; i++) {
+	rpmop serial = memset(alloca(sizeof(*serial)), 0, sizeof(*serial));
+	rpmop threaded = memset(alloca(sizeof(*threaded)), 0, sizeof(*threaded));
+	size_t nz1 = 0;
+	size_t nzN = 0;
+
+	for (j = 0; j < nloops; j++) {
+	    ec |= runCompress(fmodes[i], 1, b, nb, serial, &nz1);
+	    ec |= runCompress(fmodes[i], nthreads, b, nb, threaded, &nzN);
+	}
+
+	fprintf(stderr, "%s: 1 thread %u bytes, %d thread(s) %u bytes\n",
+		fmodes[i], (unsigned) nz1, nthreads, (unsigned) nzN);
+	rpmswPrint("   1 thread:", serial, NULL);
+	rpmswPrint(" N threads:", threaded, NULL);
+	if (serial->usecs > 0 && threaded->usecs > 0)
+	    fprintf(stderr, "    %.1f MB/s => %.1f MB/s\n",
+		(double) serial->bytes / serial->usecs,
+		(double) threaded->bytes / threaded->usecs);
+    }
+
+    (void) Unlink(tmpfn);
+    b = _free(b);
+
+    optCon = rpmioFini(optCon);
+
+    return ec;
+}
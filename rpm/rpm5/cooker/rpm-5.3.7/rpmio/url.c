@@ -191,13 +191,11 @@ void urlFreeCache(void)
 	    _url_cache[i] = urlFree(_url_cache[i], "_url_cache");
 	    if (_url_cache[i] == NULL)
 		continue;
-	    yarnPossess(_url_cache[i]->_item.use);
 	    fprintf(stderr,
 		_("warning: _url_cache[%d] %p nrefs(%ld) != 1 (%s %s)\n"),
-		i, _url_cache[i], yarnPeekLock(_url_cache[i]->_item.use),
+		i, _url_cache[i], _url_cache[i]->_item.refs,
 		(_url_cache[i]->host ? _url_cache[i]->host : ""),
 		(_url_cache[i]->scheme ? _url_cache[i]->scheme : ""));
-	    yarnRelease(_url_cache[i]->_item.use);
 	}
     }
     _url_cache = _free(_url_cache);
@@ -38,13 +38,22 @@
 #define LZMA_PRESET_DEFAULT     UINT32_C(6)
 #endif
 
+#include "rpmtpool.h"
+#include "rpmzlog.h"
+#define	_RPMZQ_INTERNAL
+#include "rpmzq.h"
+
 #include "debug.h"
 
 /*@access FD_t @*/
+/*@access rpmzJob @*/
+/*@access rpmzSpace @*/
+/*@access rpmzSEQ @*/
 
 #define	XZDONLY(fd)	assert(fdGetIo(fd) == xzdio)
 
 #define kBufferSize (1 << 15)
+#define kMemLimit (100 << 20)
 
 typedef struct xzfile {
 /*@only@*/
@@ -54,8 +63,577 @@ typedef struct xzfile {
     FILE * fp;
     int encoding;
     int eof;
+/*@only@*/ /*@null@*/
+    rpmzPipe zp;		/*!< block-parallel encoder (if threaded) */
+/*@only@*/ /*@null@*/
+    lzma_index * index;		/*!< (threaded) block index */
+    lzma_options_lzma options;	/*!< (threaded) LZMA2 options */
+    unsigned int threads;	/*!< (threaded read) no. of threads (1 if not) */
+    lzma_stream_flags flags;	/*!< (threaded read) stream header flags */
+/*@only@*/ /*@null@*/
+    lzma_index_hash * ihash;	/*!< (threaded read) block index hash */
+/*@only@*/ /*@null@*/
+    rpmtpool tp;		/*!< (threaded read) block decoders */
+/*@only@*/ /*@null@*/
+    rpmzSEQ seq;		/*!< (threaded read) decoded blocks, in order */
+/*@only@*/ /*@null@*/
+    rpmzJob job;		/*!< (threaded read) block being returned */
+    long nread;			/*!< (threaded read) no. of blocks read */
+    long nused;			/*!< (threaded read) no. of blocks returned */
+    uint64_t mem;		/*!< (threaded read) memory of queued blocks */
+    uint64_t memmax;		/*!< (threaded read) queued block memory limit */
+    rpmuint8_t hdr[LZMA_BLOCK_HEADER_SIZE_MAX];	/*!< (threaded read) next block header */
+    lzma_block block;		/*!< (threaded read) next block (sizes) */
+    int pending;		/*!< (threaded read) next block not yet queued? */
+    int ateof;			/*!< (threaded read) index (and footer) read */
+    int bad;			/*!< (threaded read) stream is corrupt */
 } XZFILE;
 
+/* =============================================================== */
+/* Multi-block .xz streams, with blocks compressed by rpmzq threads. */
+
+/**
+ * Return no. of threads to compress with (%_compress_threads).
+ * @return		no. of threads (0 uses no. of cpus)
+ */
+static unsigned int xzThreads(void)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    int threads = rpmExpandNumeric(
+		"%{?_compress_threads}%{!?_compress_threads:1}");
+    return (threads < 0 ? 1 : (unsigned int) threads);
+}
+
+/**
+ * Compress a block (on a worker thread).
+ * @param _xzfile	xz file
+ * @param job		block to compress
+ * @param dict		(unused) dictionary
+ * @return		0 on success
+ */
+static int xzEncodeBlock(void * _xzfile, rpmzJob job,
+		/*@unused@*/ /*@null@*/ rpmzSpace dict)
+	/*@modifies job @*/
+{
+    XZFILE * xzfile = _xzfile;
+    lzma_options_lzma options = xzfile->options;
+    lzma_filter filters[2];
+    lzma_block block;
+    size_t outlen;
+    size_t outpos = 0;
+    lzma_ret ret;
+
+    if (job->in->len == 0)
+	return 0;
+
+    filters[0].id = LZMA_FILTER_LZMA2;
+    filters[0].options = &options;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = NULL;
+    memset(&block, 0, sizeof(block));
+    block.version = 0;
+    block.check = LZMA_CHECK_CRC32;
+    block.filters = filters;
+
+    outlen = lzma_block_buffer_bound(job->in->len);
+    job->out = rpmzqNewSpace(NULL, outlen);
+    ret = lzma_block_buffer_encode(&block, NULL, job->in->buf, job->in->len,
+		job->out->buf, &outpos, outlen);
+    job->out->len = outpos;
+    /* XXX the index needs the unpadded size, not a check value. */
+    job->check = (unsigned long) lzma_block_unpadded_size(&block);
+    return (ret == LZMA_OK ? 0 : -1);
+}
+
+/**
+ * Write a compressed block, and add it to the index (in order).
+ * @param _xzfile	xz file
+ * @param job		compressed block
+ * @return		0 on success
+ */
+static int xzWriteBlock(void * _xzfile, rpmzJob job)
+	/*@globals fileSystem @*/
+	/*@modifies _xzfile, fileSystem @*/
+{
+    XZFILE * xzfile = _xzfile;
+
+    if (job->out == NULL || job->out->len == 0)
+	return 0;
+    if (fwrite(job->out->buf, 1, job->out->len, xzfile->fp) != job->out->len)
+	return -1;
+    if (lzma_index_append(xzfile->index, NULL, (lzma_vli) job->check,
+		(lzma_vli) job->in->len) != LZMA_OK)
+	return -1;
+    return 0;
+}
+
+/**
+ * Start a multi-block .xz stream.
+ * @param xzfile	xz file
+ * @param level		compression level (and flags)
+ * @param threads	no. of threads (0 uses no. of cpus)
+ * @return		LZMA_OK on success
+ */
+static lzma_ret xzPipeOpen(XZFILE * xzfile, rpmuint32_t level,
+		unsigned int threads)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    rpmuint8_t hdr[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags flags;
+    lzma_filter filters[2];
+    size_t blocksize;
+    uint64_t mem;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    if (lzma_lzma_preset(&xzfile->options, level))
+	return LZMA_OPTIONS_ERROR;
+
+    /* Use the xz(1) default block size: 3 * dictionary size (>= 1MiB). */
+    blocksize = 3 * (size_t) xzfile->options.dict_size;
+    if (blocksize < (1 << 20))
+	blocksize = (1 << 20);
+
+    if (threads == 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = (cpus > 0 ? (unsigned int) cpus : 1);
+    }
+
+    /* Use no more than half of physical memory (incl. queued blocks). */
+    filters[0].id = LZMA_FILTER_LZMA2;
+    filters[0].options = &xzfile->options;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = NULL;
+    mem = lzma_raw_encoder_memusage(filters) + 4 * (uint64_t) blocksize;
+    if (pages > 0 && pagesize > 0) {
+	uint64_t avail = ((uint64_t) pages * (uint64_t) pagesize) / 2;
+	while (threads > 1 && threads * mem > avail)
+	    threads--;
+    }
+
+    memset(&flags, 0, sizeof(flags));
+    flags.version = 0;
+    flags.check = LZMA_CHECK_CRC32;
+    if (lzma_stream_header_encode(&flags, hdr) != LZMA_OK)
+	return LZMA_PROG_ERROR;
+    if (fwrite(hdr, 1, sizeof(hdr), xzfile->fp) != sizeof(hdr))
+	return LZMA_PROG_ERROR;
+
+    if ((xzfile->index = lzma_index_init(NULL)) == NULL)
+	return LZMA_MEM_ERROR;
+    xzfile->zp = rpmzqNewPipe(threads, blocksize, 0,
+		xzEncodeBlock, xzWriteBlock, xzfile);
+    return LZMA_OK;
+}
+
+/**
+ * Finish a multi-block .xz stream (remaining blocks, index and footer).
+ * @param xzfile	xz file
+ * @return		0 on success
+ */
+static int xzPipeClose(XZFILE * xzfile)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    rpmuint8_t ftr[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags flags;
+    rpmuint8_t * b = NULL;
+    size_t nb;
+    size_t pos = 0;
+    int rc;
+
+    rc = rpmzqPipeFinish(xzfile->zp);
+    xzfile->zp = rpmzqFreePipe(xzfile->zp);
+    if (rc)
+	goto exit;
+
+    rc = -1;
+    nb = (size_t) lzma_index_size(xzfile->index);
+    b = xmalloc(nb);
+    if (lzma_index_buffer_encode(xzfile->index, b, &pos, nb) != LZMA_OK)
+	goto exit;
+    if (fwrite(b, 1, pos, xzfile->fp) != pos)
+	goto exit;
+
+    memset(&flags, 0, sizeof(flags));
+    flags.version = 0;
+    flags.check = LZMA_CHECK_CRC32;
+    flags.backward_size = lzma_index_size(xzfile->index);
+    if (lzma_stream_footer_encode(&flags, ftr) != LZMA_OK)
+	goto exit;
+    if (fwrite(ftr, 1, sizeof(ftr), xzfile->fp) != sizeof(ftr))
+	goto exit;
+    rc = 0;
+
+exit:
+    b = _free(b);
+    lzma_index_end(xzfile->index, NULL);
+    xzfile->index = NULL;
+    return rc;
+}
+
+/**
+ * Read and decode a block header.
+ * @param xzfile	xz file
+ * @param hdr		block header buffer (LZMA_BLOCK_HEADER_SIZE_MAX)
+ * @retval block	block header (sizes)
+ * @return		1 on block, 0 on index, -1 on error
+ */
+static int xzReadBlockHeader(XZFILE * xzfile, rpmuint8_t * hdr,
+		lzma_block * block)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, *hdr, *block, fileSystem @*/
+{
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    size_t nb;
+    int i;
+
+    /* XXX header_size is the no. of bytes read, even on error. */
+    memset(block, 0, sizeof(*block));
+    if (fread(hdr, 1, 1, xzfile->fp) != 1)
+	return -1;
+    block->header_size = 1;
+    if (hdr[0] == 0x00)
+	return 0;
+    nb = lzma_block_header_size_decode(hdr[0]);
+    block->header_size += fread(hdr + 1, 1, nb - 1, xzfile->fp);
+    if (block->header_size != nb)
+	return -1;
+    block->version = 0;
+    block->check = xzfile->flags.check;
+    block->filters = filters;
+    if (lzma_block_header_decode(block, NULL, hdr) != LZMA_OK)
+	return -1;
+    for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+	free(filters[i].options);
+    block->filters = NULL;
+    return 1;
+}
+
+/**
+ * Can a block be decoded in memory, on a worker thread?
+ * The sizes are from the (untrusted) block header, and are held to the
+ * same memory limit as the serial decoder.
+ * @param block		block header (sizes)
+ * @return		1 if sizes are known, and within limits
+ */
+static int xzBlockFits(const lzma_block * block)
+	/*@*/
+{
+    return (block->compressed_size != LZMA_VLI_UNKNOWN
+	 && block->uncompressed_size != LZMA_VLI_UNKNOWN
+	 && block->compressed_size <= kMemLimit
+	 && block->uncompressed_size <= kMemLimit);
+}
+
+/**
+ * Return the memory needed to queue (and decode) a block.
+ * @param block		block header (sizes)
+ * @return		no. of bytes
+ */
+static uint64_t xzBlockMem(const lzma_block * block)
+	/*@*/
+{
+    return (uint64_t) (block->compressed_size + block->uncompressed_size);
+}
+
+/**
+ * Decode a block (on a worker thread), then queue it in order.
+ * @param _job		block to decode
+ */
+static void xzDecodeBlock(void * _job)
+	/*@modifies _job @*/
+{
+    rpmzJob job = _job;
+    XZFILE * xzfile = job->owner;
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block block;
+    size_t inpos;
+    size_t outpos = 0;
+    lzma_ret ret;
+    int i;
+
+    memset(&block, 0, sizeof(block));
+    block.version = 0;
+    block.check = xzfile->flags.check;
+    block.filters = filters;
+    block.header_size = lzma_block_header_size_decode(job->in->buf[0]);
+    ret = lzma_block_header_decode(&block, NULL, job->in->buf);
+    if (ret == LZMA_OK) {
+	job->out = rpmzqNewSpace(NULL, (size_t) block.uncompressed_size);
+	inpos = block.header_size;
+	ret = lzma_block_buffer_decode(&block, NULL, job->in->buf, &inpos,
+		job->in->len, job->out->buf, &outpos, job->out->len);
+	job->out->len = outpos;
+	job->out->ix = 0;
+	for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+	    free(filters[i].options);
+    }
+    job->rc = (ret == LZMA_OK ? 0 : -1);
+    job->in = rpmzqDropSpace(job->in);
+
+    rpmzqAddSEQ(xzfile->seq, job);
+}
+
+/**
+ * Read the rest of a block, and queue it to be decoded.
+ * @param xzfile	xz file
+ * @param hdr		block header
+ * @param block		block header (sizes)
+ * @return		0 on success
+ */
+static int xzSubmitBlock(XZFILE * xzfile, const rpmuint8_t * hdr,
+		lzma_block * block)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    size_t nb = (size_t) lzma_block_total_size(block);
+    rpmzJob job;
+
+    if (nb == 0 || lzma_index_hash_append(xzfile->ihash,
+		lzma_block_unpadded_size(block), block->uncompressed_size)
+		!= LZMA_OK)
+	return -1;
+
+    job = rpmzqNewJob(xzfile->nread++);
+    job->in = rpmzqNewSpace(NULL, nb);
+    memcpy(job->in->buf, hdr, block->header_size);
+    if (fread(job->in->buf + block->header_size, 1, nb - block->header_size,
+		xzfile->fp) != nb - block->header_size)
+    {
+	job->in = rpmzqDropSpace(job->in);
+	job = rpmzqDropJob(job);
+	return -1;
+    }
+    job->owner = xzfile;
+    /* XXX job->check (unused when decoding) holds the block's memory. */
+    job->check = (unsigned long) xzBlockMem(block);
+    xzfile->mem += job->check;
+
+    /* A stream with a single block is decoded w/o threads. */
+    if (xzfile->tp == NULL && job->seq > 0)
+	xzfile->tp = rpmtpoolNew(xzfile->threads);
+    return rpmtpoolSubmit(xzfile->tp, xzDecodeBlock, job);
+}
+
+/**
+ * Verify the index (against the blocks read) and the stream footer.
+ * @param xzfile	xz file (after the index indicator)
+ * @return		0 on success
+ */
+static int xzReadIndex(XZFILE * xzfile)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    rpmuint8_t ftr[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags flags;
+    rpmuint8_t c = 0x00;
+    size_t pos = 0;
+    lzma_ret ret;
+
+    /* XXX one byte at a time, so that the footer isn't read. */
+    ret = lzma_index_hash_decode(xzfile->ihash, &c, &pos, 1);
+    while (ret == LZMA_OK) {
+	if (fread(&c, 1, 1, xzfile->fp) != 1)
+	    return -1;
+	pos = 0;
+	ret = lzma_index_hash_decode(xzfile->ihash, &c, &pos, 1);
+    }
+    if (ret != LZMA_STREAM_END)
+	return -1;
+
+    if (fread(ftr, 1, sizeof(ftr), xzfile->fp) != sizeof(ftr)
+     || lzma_stream_footer_decode(&flags, ftr) != LZMA_OK
+     || lzma_stream_flags_compare(&xzfile->flags, &flags) != LZMA_OK
+     || flags.backward_size != lzma_index_hash_size(xzfile->ihash))
+	return -1;
+    return 0;
+}
+
+/**
+ * Read ahead (and queue for decoding) blocks, until enough are queued.
+ * Every block is held to kMemLimit, and the blocks queued at once to the
+ * memory budget that sized the no. of threads. A block that doesn't fit
+ * in the budget waits (as the next block) until queued blocks are read.
+ * @param xzfile	xz file
+ * @return		0 on success
+ */
+static int xzReadAhead(XZFILE * xzfile)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    while (!xzfile->bad && !xzfile->ateof
+     && xzfile->nread - xzfile->nused < 2 * (long) xzfile->threads)
+    {
+	if (!xzfile->pending) {
+	    switch (xzReadBlockHeader(xzfile, xzfile->hdr, &xzfile->block)) {
+	    case 1:
+		if (!xzBlockFits(&xzfile->block))
+		    xzfile->bad = 1;
+		else
+		    xzfile->pending = 1;
+		break;
+	    case 0:
+		if (xzReadIndex(xzfile))
+		    xzfile->bad = 1;
+		xzfile->ateof = 1;
+		break;
+	    default:
+		xzfile->bad = 1;
+		break;
+	    }
+	    if (!xzfile->pending)
+		continue;
+	}
+
+	/* Queue at least one block, otherwise stay within the budget. */
+	if (xzfile->nread > xzfile->nused
+	 && xzfile->mem + xzBlockMem(&xzfile->block) > xzfile->memmax)
+	    break;
+	xzfile->pending = 0;
+	if (xzSubmitBlock(xzfile, xzfile->hdr, &xzfile->block))
+	    xzfile->bad = 1;
+    }
+    return (xzfile->bad ? -1 : 0);
+}
+
+/**
+ * Decide how to decode a stream, on the first read.
+ * Streams whose (first) block header has compressed and uncompressed sizes
+ * (i.e. multi-block streams, as written by threaded xz encoders) have
+ * their blocks decoded in parallel. Anything else (including blocks too
+ * large to decode in memory) is decoded serially, starting with the bytes
+ * read here. A later block that is too large is a decode error.
+ * @param xzfile	xz file
+ */
+static void xzProbe(XZFILE * xzfile)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, fileSystem @*/
+{
+    rpmuint8_t * hdr = xzfile->buf + LZMA_STREAM_HEADER_SIZE;
+    lzma_block block;
+    size_t nb;
+    uint64_t mem;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int xx;
+
+    nb = fread(xzfile->buf, 1, LZMA_STREAM_HEADER_SIZE, xzfile->fp);
+    if (nb != LZMA_STREAM_HEADER_SIZE
+     || lzma_stream_header_decode(&xzfile->flags, xzfile->buf) != LZMA_OK)
+	goto serial;
+    xx = xzReadBlockHeader(xzfile, hdr, &block);
+    nb += block.header_size;
+    if (xx != 1 || !xzBlockFits(&block))
+	goto serial;
+
+    if (xzfile->threads == 0) {
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	xzfile->threads = (cpus > 0 ? (unsigned int) cpus : 1);
+    }
+    /* Queue no more than half of physical memory of blocks. */
+    mem = 2 * xzBlockMem(&block) + (1 << 20);
+    xzfile->memmax = (uint64_t) 2 * xzfile->threads * 2 * kMemLimit;
+    if (pages > 0 && pagesize > 0) {
+	uint64_t avail = ((uint64_t) pages * (uint64_t) pagesize) / 2;
+	while (xzfile->threads > 1 && xzfile->threads * mem > avail)
+	    xzfile->threads--;
+	xzfile->memmax = avail;
+    }
+
+    xzfile->ihash = lzma_index_hash_init(NULL, NULL);
+    xzfile->seq = rpmzqInitSEQ(-1L);
+    if (xzfile->ihash == NULL || xzSubmitBlock(xzfile, hdr, &block))
+	xzfile->bad = 1;
+    return;
+
+serial:
+    if (xzfile->ihash != NULL)
+	lzma_index_hash_end(xzfile->ihash, NULL);
+    xzfile->ihash = NULL;
+    xzfile->threads = 1;
+    xzfile->strm.next_in = (uint8_t *)xzfile->buf;
+    xzfile->strm.avail_in = (nb > 0 && nb <= kBufferSize ? nb : 0);
+}
+
+/**
+ * Read from a stream whose blocks are decoded in parallel.
+ * @param xzfile	xz file
+ * @param buf		output buffer
+ * @param len		no. of bytes to read
+ * @return		no. of bytes read, -1 on error
+ */
+static ssize_t xzReadBlocks(XZFILE * xzfile, void * buf, size_t len)
+	/*@globals fileSystem @*/
+	/*@modifies xzfile, *buf, fileSystem @*/
+{
+    rpmuint8_t * b = buf;
+    size_t nb = 0;
+
+    while (nb < len) {
+	rpmzJob job = xzfile->job;
+	size_t n;
+
+	if (job == NULL) {
+	    if (xzReadAhead(xzfile))
+		return -1;
+	    if (xzfile->nused == xzfile->nread) {
+		xzfile->eof = 1;
+		break;
+	    }
+	    job = xzfile->job = rpmzqDelSEQ(xzfile->seq, xzfile->nused++);
+	    xzfile->mem -= job->check;
+	    if (job->rc) {
+		xzfile->bad = 1;
+		return -1;
+	    }
+	}
+
+	n = job->out->len - job->out->ix;
+	if (n > len - nb)
+	    n = len - nb;
+	memcpy(b + nb, job->out->buf + job->out->ix, n);
+	job->out->ix += n;
+	nb += n;
+
+	if (job->out->ix == job->out->len) {
+	    job->out = rpmzqDropSpace(job->out);
+	    xzfile->job = rpmzqDropJob(job);
+	}
+    }
+    return nb;
+}
+
+/**
+ * Stop decoding blocks, discarding anything not yet read.
+ * @param xzfile	xz file
+ */
+static void xzReadBlocksEnd(XZFILE * xzfile)
+	/*@modifies xzfile @*/
+{
+    rpmzJob job;
+
+    xzfile->tp = rpmtpoolFree(xzfile->tp);
+    if (xzfile->job != NULL) {
+	xzfile->job->out = rpmzqDropSpace(xzfile->job->out);
+	xzfile->job = rpmzqDropJob(xzfile->job);
+    }
+    if (xzfile->seq != NULL) {
+	while ((job = xzfile->seq->head) != NULL) {
+	    xzfile->seq->head = job->next;
+	    job->in = rpmzqDropSpace(job->in);
+	    job->out = rpmzqDropSpace(job->out);
+	    job = rpmzqDropJob(job);
+	}
+	xzfile->seq = rpmzqFiniSEQ(xzfile->seq);
+    }
+    if (xzfile->ihash != NULL)
+	lzma_index_hash_end(xzfile->ihash, NULL);
+    xzfile->ihash = NULL;
+}
+
 /*@-globstate@*/
 /*@null@*/
 static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int xz)
@@ -94,6 +672,10 @@ static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int
     tmp = (lzma_stream)LZMA_STREAM_INIT;
     xzfile->strm = tmp;
     if (encoding) {
+	unsigned int threads = (xz ? xzThreads() : 1);
+	if (threads != 1) {
+	    ret = xzPipeOpen(xzfile, level, threads);
+	} else
 	if (xz) {
 	    ret = lzma_easy_encoder(&xzfile->strm, level, LZMA_CHECK_CRC32);
 	} else {
@@ -102,12 +684,17 @@ static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int
 	    ret = lzma_alone_encoder(&xzfile->strm, &options);
 	}
     } else {
+	/* Multi-block xz streams may be decoded in parallel (on 1st read). */
+	xzfile->threads = (xz ? xzThreads() : 1);
 	/* We set the memlimit for decompression to 100MiB which should be
 	 * more than enough to be sufficient for level 9 which requires 65 MiB.
 	 */
-	ret = lzma_auto_decoder(&xzfile->strm, 100<<20, 0);
+	ret = lzma_auto_decoder(&xzfile->strm, kMemLimit, 0);
     }
     if (ret != LZMA_OK) {
+	xzfile->zp = rpmzqFreePipe(xzfile->zp);
+	if (xzfile->index != NULL)
+	    lzma_index_end(xzfile->index, NULL);
 	(void) fclose(fp);
 	memset(xzfile, 0, sizeof(*xzfile));
 	free(xzfile);
@@ -170,6 +757,10 @@ static int xzclose(/*@only@*/ XZFILE *xzfile)
 
     if (!xzfile)
 	return -1;
+    if (xzfile->zp != NULL) {
+	if (xzPipeClose(xzfile))
+	    return -1;
+    } else
     if (xzfile->encoding) {
 	for (;;) {
 	    xzfile->strm.avail_out = kBufferSize;
@@ -183,7 +774,8 @@ static int xzclose(/*@only@*/ XZFILE *xzfile)
 	    if (ret == LZMA_STREAM_END)
 		break;
 	}
-    }
+    } else
+	xzReadBlocksEnd(xzfile);
     lzma_end(&xzfile->strm);
     rc = fclose(xzfile->fp);
     memset(xzfile, 0, sizeof(*xzfile));
@@ -203,6 +795,10 @@ static ssize_t xzread(XZFILE *xzfile, void *buf, size_t len)
       return -1;
     if (xzfile->eof)
       return 0;
+    if (xzfile->seq == NULL && xzfile->threads != 1)
+	xzProbe(xzfile);
+    if (xzfile->seq != NULL)
+	return xzReadBlocks(xzfile, buf, len);
 /*@-temptrans@*/
     xzfile->strm.next_out = buf;
 /*@=temptrans@*/
@@ -241,6 +837,8 @@ static ssize_t xzwrite(XZFILE *xzfile, void *buf, size_t len)
 	return -1;
     if (!len)
 	return 0;
+    if (xzfile->zp != NULL)
+	return rpmzqPipeWrite(xzfile->zp, buf, len);
 /*@-temptrans@*/
     xzfile->strm.next_in = buf;
 /*@=temptrans@*/
@@ -0,0 +1,36 @@
+Summary:   fsync policy benchmark
+Name:      fsync-bench
+Version:   1.0
+Release:   1
+License:   Public Domain
+Group:     Development/Tools
+URL:       http://rpm5.org/
+Prefix:    /fsync-bench
+BuildArch: noarch
+
+%description
+5000 small files in 50 directories, to time installing with each
+%%_transaction_fsync_policy.
+
+%prep
+
+%build
+
+%install
+for D in `seq 1 50`; do
+    mkdir -p %{buildroot}/fsync-bench/d$D
+    for F in `seq 1 100`; do
+	echo "fsync-bench d$D/f$F" > %{buildroot}/fsync-bench/d$D/f$F
+    done
+done
+
+%clean
+rm -rf %{buildroot}
+
+%files
+%defattr(-,root,root)
+/fsync-bench
+
+%changelog
+* Fri Oct 16 2026 rpm5 <rpm-devel@rpm5.org> - 1.0-1
+- time per-file, per-package and per-transaction fsync.